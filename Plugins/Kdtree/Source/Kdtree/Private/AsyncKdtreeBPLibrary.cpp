@@ -9,149 +9,383 @@
 
 #include "AsyncKdtreeBPLibrary.h"
 
-#include "Async/AsyncWork.h"
 #include "Engine/Engine.h"
 #include "KdtreeBPLibrary.h"
 #include "KdtreeInternal.h"
+#include "KdtreeQuerySubsystem.h"
 #include "Kismet/BlueprintAsyncActionBase.h"
+#include "Tasks/Task.h"
 
-struct FBuildKdtreeTaskParams
+// Shared by a build action and the worker building for it. The worker owns its reference, so destroying the action
+// never waits for the build.
+template <typename StructType>
+struct TBuildState
 {
-	FKdtree* Tree;
-	TArray<FVector> Data;
+	using FSnapshotPtr = TSharedPtr<typename StructType::FSnapshotRef::ElementType, ESPMode::ThreadSafe>;
+
+	// The new tree or hash. Written by the worker before bDone is set, and only read after that.
+	FSnapshotPtr Built;
+	std::atomic<bool> bDone = false;
+	// Set when the action is destroyed, so a build that has not started yet is skipped.
+	std::atomic<bool> bUnwanted = false;
 };
 
-class FBuildKdtreeTask : public FNonAbandonableTask
+// Builds a kd-tree or a spatial hash. StructType is FKdtree or FSpatialHash, SettingsType the settings its build takes.
+template <typename StructType, typename SettingsType>
+class TBuildAction : public FPendingLatentAction
 {
 public:
-	FBuildKdtreeTask(const FBuildKdtreeTaskParams& InParams) : Params(InParams)
+	using FState = TBuildState<StructType>;
+
+	FLatentActionInfo LatentInfo;
+	StructType* Target;
+	TSharedRef<FState, ESPMode::ThreadSafe> State;
+
+	TBuildAction(const FLatentActionInfo& InLatentInfo, StructType* InTarget, TArray<FVector>&& Data, const SettingsType& Settings)
+		: LatentInfo(InLatentInfo), Target(InTarget), State(MakeShared<FState, ESPMode::ThreadSafe>())
 	{
+		UE::Tasks::Launch(UE_SOURCE_LOCATION, [State = State, Data = MoveTemp(Data), Settings]() mutable {
+			if (State->bUnwanted)
+			{
+				return;
+			}
+			// Built is a back buffer nothing else reads yet, so queries on the live tree go on undisturbed.
+			typename FState::FSnapshotPtr Built = MakeShared<typename FState::FSnapshotPtr::ElementType, ESPMode::ThreadSafe>();
+			if constexpr (std::is_same_v<StructType, FKdtree>)
+			{
+				KdtreeInternal::BuildKdtree(Built.Get(), MoveTemp(Data), Settings);
+			}
+			else
+			{
+				KdtreeInternal::BuildSpatialHash(Built.Get(), MoveTemp(Data), Settings);
+			}
+			State->Built = MoveTemp(Built);
+			State->bDone = true;
+		});
 	}
 
-	void DoWork()
+	virtual ~TBuildAction()
 	{
-		KdtreeInternal::BuildKdtree(&Params.Tree->Internal, Params.Data);
+		// The action goes away with its owner, e.g. when the level is unloaded mid-build. A running build is left to
+		// finish on its worker, which frees the result, and a finished one is freed on a worker thread as well.
+		State->bUnwanted = true;
+		if (State->bDone && State->Built.IsValid())
+		{
+			UE::Tasks::Launch(UE_SOURCE_LOCATION, [Retired = State]() {});
+		}
 	}
 
-	FORCEINLINE TStatId GetStatId() const
+	void UpdateOperation(FLatentResponse& Response) override
 	{
-		RETURN_QUICK_DECLARE_CYCLE_STAT(FBuildKdtreeTask, STATGROUP_ThreadPoolAsyncTasks);
+		const bool bDone = State->bDone;
+		if (bDone)
+		{
+			// Latent actions are updated on the game thread, so every query started from now on sees the new tree.
+			// Async queries started before keep the previous tree alive until they finish.
+			typename StructType::FSnapshotRef Retired = Target->SwapSnapshot(State->Built.ToSharedRef());
+			State->Built.Reset();
+			// Freeing a large tree takes a while, so the last reference is dropped on a worker thread.
+			UE::Tasks::Launch(UE_SOURCE_LOCATION, [Retired]() {});
+		}
+		Response.FinishAndTriggerIf(bDone, LatentInfo.ExecutionFunction, LatentInfo.Linkage, LatentInfo.CallbackTarget);
 	}
-
-private:
-	FBuildKdtreeTaskParams Params;
 };
 
-class FBuildKdtreeAction : public FPendingLatentAction
+using FBuildKdtreeAction = TBuildAction<FKdtree, FKdtreeBuildSettings>;
+using FBuildSpatialHashAction = TBuildAction<FSpatialHash, FSpatialHashBuildSettings>;
+
+template <typename ActionType, typename StructType, typename SettingsType>
+static void StartBuildAction(const UObject* WorldContextObject, StructType& Target, TArray<FVector>&& Data,
+	const SettingsType& Settings, const FLatentActionInfo& LatentInfo)
+{
+	if (UWorld* World = GEngine->GetWorldFromContextObject(WorldContextObject, EGetWorldErrorMode::LogAndReturnNull))
+	{
+		FLatentActionManager& LatentManager = World->GetLatentActionManager();
+		if (LatentManager.FindExistingAction<ActionType>(LatentInfo.CallbackTarget, LatentInfo.UUID) == nullptr)
+		{
+			ActionType* NewAction = new ActionType(LatentInfo, &Target, MoveTemp(Data), Settings);
+			LatentManager.AddNewAction(LatentInfo.CallbackTarget, LatentInfo.UUID, NewAction);
+		}
+	}
+}
+
+UAsyncKdtreeBPLibrary::UAsyncKdtreeBPLibrary(const FObjectInitializer& ObjectInitializer) : Super(ObjectInitializer)
+{
+}
+
+void UAsyncKdtreeBPLibrary::BuildKdtreeAsync(
+	const UObject* WorldContextObject, FKdtree& Tree, const TArray<FVector>& Data, FLatentActionInfo LatentInfo)
+{
+	BuildKdtreeWithSettingsAsync(WorldContextObject, Tree, Data, FKdtreeBuildSettings(), LatentInfo);
+}
+
+void UAsyncKdtreeBPLibrary::BuildKdtreeWithSettingsAsync(const UObject* WorldContextObject, FKdtree& Tree,
+	const TArray<FVector>& Data, const FKdtreeBuildSettings& Settings, FLatentActionInfo LatentInfo)
+{
+	BuildKdtreeWithSettingsAsync(WorldContextObject, Tree, TArray<FVector>(Data), Settings, LatentInfo);
+}
+
+void UAsyncKdtreeBPLibrary::BuildKdtreeWithSettingsAsync(const UObject* WorldContextObject, FKdtree& Tree,
+	TArray<FVector>&& Data, const FKdtreeBuildSettings& Settings, FLatentActionInfo LatentInfo)
+{
+	StartBuildAction<FBuildKdtreeAction>(WorldContextObject, Tree, MoveTemp(Data), Settings, LatentInfo);
+}
+
+void UAsyncKdtreeBPLibrary::BuildSpatialHashAsync(const UObject* WorldContextObject, FSpatialHash& Hash,
+	const TArray<FVector>& Data, const FSpatialHashBuildSettings& Settings, FLatentActionInfo LatentInfo)
+{
+	BuildSpatialHashAsync(WorldContextObject, Hash, TArray<FVector>(Data), Settings, LatentInfo);
+}
+
+void UAsyncKdtreeBPLibrary::BuildSpatialHashAsync(const UObject* WorldContextObject, FSpatialHash& Hash, TArray<FVector>&& Data,
+	const FSpatialHashBuildSettings& Settings, FLatentActionInfo LatentInfo)
+{
+	StartBuildAction<FBuildSpatialHashAction>(WorldContextObject, Hash, MoveTemp(Data), Settings, LatentInfo);
+}
+
+// Waits for a query run by UKdtreeQuerySubsystem. The outputs are written when the subsystem delivers the result on
+// the game thread, so worker threads never touch the Blueprint-owned arrays.
+class FKdtreeQueryAction : public FPendingLatentAction
 {
 public:
 	FLatentActionInfo LatentInfo;
-	FAsyncTask<FBuildKdtreeTask>* Task;
+	TWeakObjectPtr<UKdtreeQuerySubsystem> Subsystem;
+	FKdtreeQueryHandle Handle;
+	bool bDone;
 
-	FBuildKdtreeAction(const FLatentActionInfo& InLatentInfo, FKdtree* Tree, const TArray<FVector>& Data)
-		: LatentInfo(InLatentInfo), Task(nullptr)
+	FKdtreeQueryAction(const FLatentActionInfo& InLatentInfo, UKdtreeQuerySubsystem* InSubsystem)
+		: LatentInfo(InLatentInfo), Subsystem(InSubsystem), bDone(false)
 	{
-		FBuildKdtreeTaskParams Params;
-		Params.Tree = Tree;
-		Params.Data = Data;
-		Task = new FAsyncTask<FBuildKdtreeTask>(Params);
-		Task->StartBackgroundTask();
+	}
+
+	virtual ~FKdtreeQueryAction()
+	{
+		// The outputs may be gone along with the action, e.g. when the calling object was destroyed.
+		if (!bDone && Subsystem.IsValid())
+		{
+			Subsystem->CancelQuery(Handle);
+		}
 	}
 
 	void UpdateOperation(FLatentResponse& Response) override
 	{
-		Response.FinishAndTriggerIf(Task->IsDone(), LatentInfo.ExecutionFunction, LatentInfo.Linkage, LatentInfo.CallbackTarget);
+		Response.FinishAndTriggerIf(bDone, LatentInfo.ExecutionFunction, LatentInfo.Linkage, LatentInfo.CallbackTarget);
 	}
 };
 
-UAsyncKdtreeBPLibrary::UAsyncKdtreeBPLibrary(const FObjectInitializer& ObjectInitializer) : Super(ObjectInitializer)
-{
-}
-
-void UAsyncKdtreeBPLibrary::BuildKdtreeAsync(
-	const UObject* WorldContextObject, FKdtree& Tree, const TArray<FVector>& Data, FLatentActionInfo LatentInfo)
+// Returns the query subsystem of the world, or nullptr if the query cannot be started.
+static UKdtreeQuerySubsystem* GetQuerySubsystemForAction(const UObject* WorldContextObject, const FLatentActionInfo& LatentInfo)
 {
 	if (UWorld* World = GEngine->GetWorldFromContextObject(WorldContextObject, EGetWorldErrorMode::LogAndReturnNull))
 	{
 		FLatentActionManager& LatentManager = World->GetLatentActionManager();
-		if (LatentManager.FindExistingAction<FBuildKdtreeAction>(LatentInfo.CallbackTarget, LatentInfo.UUID) == nullptr)
+		if (LatentManager.FindExistingAction<FKdtreeQueryAction>(LatentInfo.CallbackTarget, LatentInfo.UUID) == nullptr)
 		{
-			FBuildKdtreeAction* NewAction = new FBuildKdtreeAction(LatentInfo, &Tree, Data);
-			LatentManager.AddNewAction(LatentInfo.CallbackTarget, LatentInfo.UUID, NewAction);
+			return World->GetSubsystem<UKdtreeQuerySubsystem>();
 		}
 	}
+	return nullptr;
 }
 
-struct FCollectFromKdtreeTaskParams
+static void AddQueryAction(UKdtreeQuerySubsystem* Subsystem, FKdtreeQueryAction* Action)
 {
-	const FKdtree* Tree;
-	FVector Center;
-	float Radius;
-	TArray<int>* Indices;
-	TArray<FVector>* Data;
-};
+	Subsystem->GetWorld()->GetLatentActionManager().AddNewAction(
+		Action->LatentInfo.CallbackTarget, Action->LatentInfo.UUID, Action);
+}
 
-class FCollectFromKdtreeTask : public FNonAbandonableTask
+void UAsyncKdtreeBPLibrary::CollectFromKdtreeAsync(const UObject* WorldContextObject, const FKdtree& Tree, const FVector Center,
+	float Radius, TArray<int>& Indices, TArray<FVector>& Data, FLatentActionInfo LatentInfo)
 {
-public:
-	FCollectFromKdtreeTask(const FCollectFromKdtreeTaskParams& InParams) : Params(InParams)
+	if (UKdtreeQuerySubsystem* Subsystem = GetQuerySubsystemForAction(WorldContextObject, LatentInfo))
 	{
+		FKdtreeQueryAction* NewAction = new FKdtreeQueryAction(LatentInfo, Subsystem);
+		NewAction->Handle = Subsystem->CollectFromKdtree(Tree, Center, Radius,
+			FOnKdtreeQueryDone::CreateLambda([NewAction, &Indices, &Data](const FKdtreeQueryResult& Result) {
+				Indices.Append(Result.Indices);
+				Data.Append(Result.Data);
+				NewAction->bDone = true;
+			}));
+		AddQueryAction(Subsystem, NewAction);
 	}
+}
 
-	void DoWork()
+static void CollectInShapeAsync(const UObject* WorldContextObject, const FKdtree& Tree, FKdtreeQueryShape&& Shape,
+	TArray<int>& Indices, TArray<FVector>& Data, const FLatentActionInfo& LatentInfo)
+{
+	if (UKdtreeQuerySubsystem* Subsystem = GetQuerySubsystemForAction(WorldContextObject, LatentInfo))
 	{
-		KdtreeInternal::CollectFromKdtree(Params.Tree->Internal, Params.Center, Params.Radius, Params.Indices);
-		for (int Index = 0; Index < Params.Indices->Num(); ++Index)
-		{
-			Params.Data->Add(Params.Tree->Internal.Data[(*Params.Indices)[Index]]);
-		}
+		FKdtreeQueryAction* NewAction = new FKdtreeQueryAction(LatentInfo, Subsystem);
+		NewAction->Handle = Subsystem->CollectInShapeFromKdtree(Tree, MoveTemp(Shape),
+			FOnKdtreeQueryDone::CreateLambda([NewAction, &Indices, &Data](const FKdtreeQueryResult& Result) {
+				Indices.Append(Result.Indices);
+				Data.Append(Result.Data);
+				NewAction->bDone = true;
+			}));
+		AddQueryAction(Subsystem, NewAction);
 	}
+}
+
+void UAsyncKdtreeBPLibrary::CollectInBoxFromKdtreeAsync(const UObject* WorldContextObject, const FKdtree& Tree, const FBox& Box,
+	TArray<int>& Indices, TArray<FVector>& Data, FLatentActionInfo LatentInfo)
+{
+	CollectInShapeAsync(WorldContextObject, Tree, FKdtreeQueryShape(TInPlaceType<FKdtreeBoxShape>(), FKdtreeBoxShape{Box.Min, Box.Max}),
+		Indices, Data, LatentInfo);
+}
+
+void UAsyncKdtreeBPLibrary::CollectInOrientedBoxFromKdtreeAsync(const UObject* WorldContextObject, const FKdtree& Tree,
+	const FVector Center, const FRotator Rotation, const FVector Extent, TArray<int>& Indices, TArray<FVector>& Data,
+	FLatentActionInfo LatentInfo)
+{
+	CollectInShapeAsync(WorldContextObject, Tree,
+		FKdtreeQueryShape(TInPlaceType<FKdtreeOrientedBoxShape>(), FKdtreeOrientedBoxShape(Center, Rotation.Quaternion(), Extent)),
+		Indices, Data, LatentInfo);
+}
+
+void UAsyncKdtreeBPLibrary::CollectInCapsuleFromKdtreeAsync(const UObject* WorldContextObject, const FKdtree& Tree,
+	const FVector Start, const FVector End, float Radius, TArray<int>& Indices, TArray<FVector>& Data, FLatentActionInfo LatentInfo)
+{
+	CollectInShapeAsync(WorldContextObject, Tree,
+		FKdtreeQueryShape(TInPlaceType<FKdtreeCapsuleShape>(), FKdtreeCapsuleShape{Start, End, Radius}), Indices, Data, LatentInfo);
+}
+
+void UAsyncKdtreeBPLibrary::CollectInConvexVolumeFromKdtreeAsync(const UObject* WorldContextObject, const FKdtree& Tree,
+	const TArray<FPlane>& Planes, TArray<int>& Indices, TArray<FVector>& Data, FLatentActionInfo LatentInfo)
+{
+	FKdtreeConvexShape Shape;
+	Shape.Planes.Append(Planes);
+	CollectInShapeAsync(WorldContextObject, Tree, FKdtreeQueryShape(TInPlaceType<FKdtreeConvexShape>(), MoveTemp(Shape)), Indices,
+		Data, LatentInfo);
+}
 
-	FORCEINLINE TStatId GetStatId() const
+void UAsyncKdtreeBPLibrary::CollectInFrustumFromKdtreeAsync(const UObject* WorldContextObject, const FKdtree& Tree,
+	const FVector Origin, const FRotator Rotation, float FOVDegrees, float AspectRatio, float NearDistance, float FarDistance,
+	TArray<int>& Indices, TArray<FVector>& Data, FLatentActionInfo LatentInfo)
+{
+	CollectInShapeAsync(WorldContextObject, Tree,
+		FKdtreeQueryShape(TInPlaceType<FKdtreeConvexShape>(),
+			FKdtreeConvexShape::MakeFrustum(
+				Origin, Rotation.Quaternion(), FMath::DegreesToRadians(FOVDegrees * 0.5), AspectRatio, NearDistance, FarDistance)),
+		Indices, Data, LatentInfo);
+}
+
+static void FindFirstAlongPathAsync(const UObject* WorldContextObject, const FKdtree& Tree, TArray<FVector>&& Path, float Radius,
+	bool& bFound, int& Index, FVector& Data, float& Distance, const FLatentActionInfo& LatentInfo)
+{
+	if (UKdtreeQuerySubsystem* Subsystem = GetQuerySubsystemForAction(WorldContextObject, LatentInfo))
 	{
-		RETURN_QUICK_DECLARE_CYCLE_STAT(FCollectFromKdtreeTask, STATGROUP_ThreadPoolAsyncTasks);
+		FKdtreeQueryAction* NewAction = new FKdtreeQueryAction(LatentInfo, Subsystem);
+		NewAction->Handle = Subsystem->FindFirstAlongPathFromKdtree(Tree, MoveTemp(Path), Radius,
+			FOnKdtreeQueryDone::CreateLambda([NewAction, &bFound, &Index, &Data, &Distance](const FKdtreeQueryResult& Result) {
+				bFound = Result.Indices.Num() > 0;
+				Index = bFound ? Result.Indices[0] : INDEX_NONE;
+				if (bFound)
+				{
+					Data = Result.Data[0];
+					Distance = Result.Distance;
+				}
+				NewAction->bDone = true;
+			}));
+		AddQueryAction(Subsystem, NewAction);
 	}
+}
 
-private:
-	FCollectFromKdtreeTaskParams Params;
-};
+void UAsyncKdtreeBPLibrary::FindFirstAlongSegmentFromKdtreeAsync(const UObject* WorldContextObject, const FKdtree& Tree,
+	const FVector Start, const FVector End, float Radius, bool& bFound, int& Index, FVector& Data, float& Distance,
+	FLatentActionInfo LatentInfo)
+{
+	FindFirstAlongPathAsync(WorldContextObject, Tree, TArray<FVector>{Start, End}, Radius, bFound, Index, Data, Distance, LatentInfo);
+}
 
-class FCollectFromKdtreeAction : public FPendingLatentAction
+void UAsyncKdtreeBPLibrary::FindFirstAlongPathFromKdtreeAsync(const UObject* WorldContextObject, const FKdtree& Tree,
+	const TArray<FVector>& Path, float Radius, bool& bFound, int& Index, FVector& Data, float& Distance, FLatentActionInfo LatentInfo)
 {
-public:
-	FLatentActionInfo LatentInfo;
-	FAsyncTask<FCollectFromKdtreeTask>* Task;
+	FindFirstAlongPathAsync(WorldContextObject, Tree, TArray<FVector>(Path), Radius, bFound, Index, Data, Distance, LatentInfo);
+}
 
-	FCollectFromKdtreeAction(const FLatentActionInfo& InLatentInfo, const FKdtree* Tree, const FVector Center, float Radius,
-		TArray<int>* Indices, TArray<FVector>* Data)
-		: LatentInfo(InLatentInfo), Task(nullptr)
+void UAsyncKdtreeBPLibrary::FindKNearestFromKdtreeAsync(const UObject* WorldContextObject, const FKdtree& Tree,
+	const FVector Center, int K, float MaxDistance, TArray<int>& Indices, TArray<FVector>& Data, FLatentActionInfo LatentInfo)
+{
+	if (UKdtreeQuerySubsystem* Subsystem = GetQuerySubsystemForAction(WorldContextObject, LatentInfo))
 	{
-		FCollectFromKdtreeTaskParams Params;
-		Params.Tree = Tree;
-		Params.Center = Center;
-		Params.Radius = Radius;
-		Params.Indices = Indices;
-		Params.Data = Data;
-		Task = new FAsyncTask<FCollectFromKdtreeTask>(Params);
-		Task->StartBackgroundTask();
+		FKdtreeQueryAction* NewAction = new FKdtreeQueryAction(LatentInfo, Subsystem);
+		NewAction->Handle = Subsystem->FindKNearestFromKdtree(Tree, Center, K, MaxDistance,
+			FOnKdtreeQueryDone::CreateLambda([NewAction, &Indices, &Data](const FKdtreeQueryResult& Result) {
+				Indices.Append(Result.Indices);
+				Data.Append(Result.Data);
+				NewAction->bDone = true;
+			}));
+		AddQueryAction(Subsystem, NewAction);
 	}
+}
 
-	void UpdateOperation(FLatentResponse& Response) override
+void UAsyncKdtreeBPLibrary::FindNearestFromKdtreeAsync(const UObject* WorldContextObject, const FKdtree& Tree,
+	const FVector Center, float MaxDistance, bool& bFound, int& Index, FVector& Data, FLatentActionInfo LatentInfo)
+{
+	if (UKdtreeQuerySubsystem* Subsystem = GetQuerySubsystemForAction(WorldContextObject, LatentInfo))
 	{
-		Response.FinishAndTriggerIf(Task->IsDone(), LatentInfo.ExecutionFunction, LatentInfo.Linkage, LatentInfo.CallbackTarget);
+		FKdtreeQueryAction* NewAction = new FKdtreeQueryAction(LatentInfo, Subsystem);
+		NewAction->Handle = Subsystem->FindNearestFromKdtree(Tree, Center, MaxDistance,
+			FOnKdtreeQueryDone::CreateLambda([NewAction, &bFound, &Index, &Data](const FKdtreeQueryResult& Result) {
+				bFound = Result.Indices.Num() > 0;
+				Index = bFound ? Result.Indices[0] : INDEX_NONE;
+				if (bFound)
+				{
+					Data = Result.Data[0];
+				}
+				NewAction->bDone = true;
+			}));
+		AddQueryAction(Subsystem, NewAction);
 	}
-};
+}
 
-void UAsyncKdtreeBPLibrary::CollectFromKdtreeAsync(const UObject* WorldContextObject, const FKdtree& Tree, const FVector Center,
-	float Radius, TArray<int>& Indices, TArray<FVector>& Data, FLatentActionInfo LatentInfo)
+void UAsyncKdtreeBPLibrary::CollectFromSpatialHashAsync(const UObject* WorldContextObject, const FSpatialHash& Hash,
+	const FVector Center, float Radius, TArray<int>& Indices, TArray<FVector>& Data, FLatentActionInfo LatentInfo)
 {
-	if (UWorld* World = GEngine->GetWorldFromContextObject(WorldContextObject, EGetWorldErrorMode::LogAndReturnNull))
+	if (UKdtreeQuerySubsystem* Subsystem = GetQuerySubsystemForAction(WorldContextObject, LatentInfo))
 	{
-		FLatentActionManager& LatentManager = World->GetLatentActionManager();
-		if (LatentManager.FindExistingAction<FCollectFromKdtreeAction>(LatentInfo.CallbackTarget, LatentInfo.UUID) == nullptr)
-		{
-			FCollectFromKdtreeAction* NewAction = new FCollectFromKdtreeAction(LatentInfo, &Tree, Center, Radius, &Indices, &Data);
-			LatentManager.AddNewAction(LatentInfo.CallbackTarget, LatentInfo.UUID, NewAction);
-		}
+		FKdtreeQueryAction* NewAction = new FKdtreeQueryAction(LatentInfo, Subsystem);
+		NewAction->Handle = Subsystem->CollectFromSpatialHash(Hash, Center, Radius,
+			FOnKdtreeQueryDone::CreateLambda([NewAction, &Indices, &Data](const FKdtreeQueryResult& Result) {
+				Indices.Append(Result.Indices);
+				Data.Append(Result.Data);
+				NewAction->bDone = true;
+			}));
+		AddQueryAction(Subsystem, NewAction);
+	}
+}
+
+void UAsyncKdtreeBPLibrary::FindKNearestFromSpatialHashAsync(const UObject* WorldContextObject, const FSpatialHash& Hash,
+	const FVector Center, int K, float MaxDistance, TArray<int>& Indices, TArray<FVector>& Data, FLatentActionInfo LatentInfo)
+{
+	if (UKdtreeQuerySubsystem* Subsystem = GetQuerySubsystemForAction(WorldContextObject, LatentInfo))
+	{
+		FKdtreeQueryAction* NewAction = new FKdtreeQueryAction(LatentInfo, Subsystem);
+		NewAction->Handle = Subsystem->FindKNearestFromSpatialHash(Hash, Center, K, MaxDistance,
+			FOnKdtreeQueryDone::CreateLambda([NewAction, &Indices, &Data](const FKdtreeQueryResult& Result) {
+				Indices.Append(Result.Indices);
+				Data.Append(Result.Data);
+				NewAction->bDone = true;
+			}));
+		AddQueryAction(Subsystem, NewAction);
+	}
+}
+
+void UAsyncKdtreeBPLibrary::FindNearestFromSpatialHashAsync(const UObject* WorldContextObject, const FSpatialHash& Hash,
+	const FVector Center, float MaxDistance, bool& bFound, int& Index, FVector& Data, FLatentActionInfo LatentInfo)
+{
+	if (UKdtreeQuerySubsystem* Subsystem = GetQuerySubsystemForAction(WorldContextObject, LatentInfo))
+	{
+		FKdtreeQueryAction* NewAction = new FKdtreeQueryAction(LatentInfo, Subsystem);
+		NewAction->Handle = Subsystem->FindNearestFromSpatialHash(Hash, Center, MaxDistance,
+			FOnKdtreeQueryDone::CreateLambda([NewAction, &bFound, &Index, &Data](const FKdtreeQueryResult& Result) {
+				bFound = Result.Indices.Num() > 0;
+				Index = bFound ? Result.Indices[0] : INDEX_NONE;
+				if (bFound)
+				{
+					Data = Result.Data[0];
+				}
+				NewAction->bDone = true;
+			}));
+		AddQueryAction(Subsystem, NewAction);
 	}
 }
@@ -0,0 +1,131 @@
+/*!
+ * Kdtree
+ *
+ * Copyright (c) 2019-2023 nutti
+ *
+ * This software is released under the MIT License.
+ * https://opensource.org/licenses/MIT
+ */
+
+#include "KdtreeAsset.h"
+
+#include "HAL/IConsoleManager.h"
+#include "KdtreeInternal.h"
+#include "Serialization/CustomVersion.h"
+#include "UObject/UObjectIterator.h"
+
+namespace
+{
+// Versions of the asset layout, recorded in the package summary so that mismatches are reported when it is loaded.
+// Every new layout of SerializeKdtree needs a new entry here, mapped to that layout in GetTreeVersion.
+struct FKdtreeAssetCustomVersion
+{
+	enum Type
+	{
+		// The tree is written in the InputIndices layout.
+		Initial = 1,
+
+		VersionPlusOne,
+		LatestVersion = VersionPlusOne - 1
+	};
+
+	static const FGuid GUID;
+};
+
+const FGuid FKdtreeAssetCustomVersion::GUID(0x57744E80, 0x70BA467D, 0x95CE1D2B, 0x9164124D);
+FCustomVersionRegistration GRegisterKdtreeAssetCustomVersion(
+	FKdtreeAssetCustomVersion::GUID, FKdtreeAssetCustomVersion::LatestVersion, TEXT("KdtreeAssetVer"));
+
+// Returns the layout the tree of an asset saved with Version is written in.
+KdtreeInternal::EKdtreeSerializeVersion GetTreeVersion(int32 Version)
+{
+	switch (Version)
+	{
+		case FKdtreeAssetCustomVersion::Initial:
+			return KdtreeInternal::EKdtreeSerializeVersion::InputIndices;
+		default:
+			// Archives that do not carry custom versions, such as in-memory copies, use the latest layout.
+			return KdtreeInternal::EKdtreeSerializeVersion::Latest;
+	}
+}
+
+FAutoConsoleCommand LogKdtreeAssetSummariesCommand(TEXT("Kdtree.Summary"),
+	TEXT("Logs the shape and memory use of the tree of every loaded kd-tree asset."), FConsoleCommandDelegate::CreateLambda([]() {
+		int64 TotalBytes = 0;
+		for (TObjectIterator<UKdtreeAsset> It; It; ++It)
+		{
+			const FKdtreeSummary Summary = KdtreeInternal::GetKdtreeSummary(It->GetKdtree().Get());
+			UE_LOG(LogTemp, Display, TEXT("%s: %s"), *It->GetPathName(), *Summary.ToString());
+			TotalBytes += Summary.AllocatedBytes;
+		}
+		UE_LOG(LogTemp, Display, TEXT("Kdtree assets use %lld bytes in total"), TotalBytes);
+	}));
+}	 // namespace
+
+UKdtreeAsset::UKdtreeAsset()
+{
+}
+
+FKdtree UKdtreeAsset::GetKdtreeCopy() const
+{
+	return Tree;
+}
+
+#if WITH_EDITOR
+void UKdtreeAsset::SetSourcePoints(const TArray<FVector>& Points)
+{
+	Modify();
+	SourcePoints = Points;
+	RebuildKdtree();
+}
+
+void UKdtreeAsset::PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent)
+{
+	Super::PostEditChangeProperty(PropertyChangedEvent);
+
+	RebuildKdtree();
+}
+
+void UKdtreeAsset::RebuildKdtree()
+{
+	// Users that got the previous tree keep it until they ask for the tree again.
+	FKdtree::FSnapshotRef Built = MakeShared<FKdtreeInternal, ESPMode::ThreadSafe>();
+	KdtreeInternal::BuildKdtree(&Built.Get(), SourcePoints, Settings);
+	Tree.SwapSnapshot(Built);
+}
+#endif
+
+void UKdtreeAsset::Serialize(FArchive& Ar)
+{
+	Super::Serialize(Ar);
+
+	// Reference collectors and memory counters would walk the whole tree without finding anything, as it holds no
+	// objects and GetResourceSizeEx reports its size.
+	if (Ar.IsObjectReferenceCollector() || Ar.IsCountingMemory())
+	{
+		return;
+	}
+
+	Ar.UsingCustomVersion(FKdtreeAssetCustomVersion::GUID);
+	const KdtreeInternal::EKdtreeSerializeVersion TreeVersion = GetTreeVersion(Ar.CustomVer(FKdtreeAssetCustomVersion::GUID));
+
+	if (Ar.IsLoading())
+	{
+		// Loaded into a new tree, so users of the current one are not affected.
+		FKdtree::FSnapshotRef Loaded = MakeShared<FKdtreeInternal, ESPMode::ThreadSafe>();
+		KdtreeInternal::SerializeKdtree(Ar, Loaded.Get(), TreeVersion);
+		Tree.SwapSnapshot(Loaded);
+	}
+	else
+	{
+		// Saving only reads the tree, so it is not copied even if users still share it.
+		KdtreeInternal::SerializeKdtree(Ar, const_cast<FKdtreeInternal&>(Tree.Get()), TreeVersion);
+	}
+}
+
+void UKdtreeAsset::GetResourceSizeEx(FResourceSizeEx& CumulativeResourceSize)
+{
+	Super::GetResourceSizeEx(CumulativeResourceSize);
+
+	CumulativeResourceSize.AddDedicatedSystemMemoryBytes(Tree.GetAllocatedSize());
+}
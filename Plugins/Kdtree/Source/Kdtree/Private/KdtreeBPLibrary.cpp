@@ -12,36 +12,436 @@
 #include "./KdtreeInternal.h"
 #include "Kdtree.h"
 
+namespace
+{
+template <typename ShapeType>
+void CollectInShape(const FKdtree& Tree, const ShapeType& Shape, TArray<int>& Indices, TArray<FVector>& Data)
+{
+	const int NumBefore = Indices.Num();
+	KdtreeInternal::CollectInShape(Tree.Get(), Shape, &Indices);
+	Data.Reserve(Data.Num() + Indices.Num() - NumBefore);
+	for (int Offset = NumBefore; Offset < Indices.Num(); ++Offset)
+	{
+		Data.Add(Tree.Get().Data[Indices[Offset]]);
+	}
+}
+
+bool SetHitOutputs(const FKdtree& Tree, int HitIndex, FVector::FReal HitDistance, int& Index, FVector& Data, float& Distance)
+{
+	Index = HitIndex;
+	if (HitIndex == INDEX_NONE)
+	{
+		return false;
+	}
+
+	Data = Tree.Get().Data[HitIndex];
+	Distance = static_cast<float>(HitDistance);
+	return true;
+}
+}	 // namespace
+
 UKdtreeBPLibrary::UKdtreeBPLibrary(const FObjectInitializer& ObjectInitializer) : Super(ObjectInitializer)
 {
 }
 
 void UKdtreeBPLibrary::BuildKdtree(FKdtree& Tree, const TArray<FVector>& Data)
 {
-	KdtreeInternal::BuildKdtree(&Tree.Internal, Data);
+	BuildKdtreeWithSettings(Tree, Data, FKdtreeBuildSettings());
+}
+
+void UKdtreeBPLibrary::BuildKdtreeWithSettings(FKdtree& Tree, const TArray<FVector>& Data, const FKdtreeBuildSettings& Settings)
+{
+	// Nothing of the current tree is kept, so a new one is built instead of editing one async queries may still read.
+	FKdtree::FSnapshotRef Built = MakeShared<FKdtreeInternal, ESPMode::ThreadSafe>();
+	KdtreeInternal::BuildKdtree(&Built.Get(), Data, Settings);
+	Tree.SwapSnapshot(Built);
+}
+
+void UKdtreeBPLibrary::BuildKdtreeWithMasks(
+	FKdtree& Tree, const TArray<FVector>& Data, const TArray<int64>& Masks, const FKdtreeBuildSettings& Settings)
+{
+	if (Masks.Num() != Data.Num())
+	{
+		UE_LOG(LogTemp, Error, TEXT("BuildKdtreeWithMasks: got %d points but %d masks"), Data.Num(), Masks.Num());
+		return;
+	}
+
+	TArray<uint64> PointMasks;
+	PointMasks.Reserve(Masks.Num());
+	for (const int64 Mask : Masks)
+	{
+		PointMasks.Add(static_cast<uint64>(Mask));
+	}
+	FKdtree::FSnapshotRef Built = MakeShared<FKdtreeInternal, ESPMode::ThreadSafe>();
+	KdtreeInternal::BuildKdtreeWithMasks(&Built.Get(), Data, PointMasks, Settings);
+	Tree.SwapSnapshot(Built);
 }
 
 void UKdtreeBPLibrary::ClearKdtree(FKdtree& Tree)
 {
-	KdtreeInternal::ClearKdtree(&Tree.Internal);
+	if (!Tree.IsShared())
+	{
+		KdtreeInternal::ClearKdtree(&Tree.Edit());
+		return;
+	}
+
+	// Copying a shared tree just to clear it would be wasted, so an empty one built the same way replaces it.
+	FKdtree::FSnapshotRef Cleared = MakeShared<FKdtreeInternal, ESPMode::ThreadSafe>();
+	KdtreeInternal::BuildKdtree(&Cleared.Get(), TArray<FVector>(), KdtreeInternal::GetBuildSettings(Tree.Get()));
+	Tree.SwapSnapshot(Cleared);
+}
+
+int UKdtreeBPLibrary::InsertPointToKdtree(FKdtree& Tree, const FVector Point)
+{
+	return KdtreeInternal::InsertPoint(&Tree.Edit(), Point);
+}
+
+int UKdtreeBPLibrary::InsertPointWithMaskToKdtree(FKdtree& Tree, const FVector Point, int64 Mask)
+{
+	return KdtreeInternal::InsertPointWithMask(&Tree.Edit(), Point, static_cast<uint64>(Mask));
+}
+
+bool UKdtreeBPLibrary::SetPointMaskInKdtree(FKdtree& Tree, int Index, int64 Mask)
+{
+	return KdtreeInternal::SetPointMask(&Tree.Edit(), Index, static_cast<uint64>(Mask));
+}
+
+int64 UKdtreeBPLibrary::GetPointMaskFromKdtree(const FKdtree& Tree, int Index)
+{
+	return static_cast<int64>(KdtreeInternal::GetPointMask(Tree.Get(), Index));
+}
+
+bool UKdtreeBPLibrary::RemovePointFromKdtree(FKdtree& Tree, int Index)
+{
+	return KdtreeInternal::RemovePoint(&Tree.Edit(), Index);
+}
+
+void UKdtreeBPLibrary::UpdatePositionsInKdtree(
+	FKdtree& Tree, const TArray<int>& Indices, const TArray<FVector>& Positions, FKdtreeUpdateStats& Stats)
+{
+	if (Indices.Num() != Positions.Num())
+	{
+		UE_LOG(LogTemp, Error, TEXT("UpdatePositionsInKdtree: got %d indices but %d positions"), Indices.Num(), Positions.Num());
+		return;
+	}
+
+	KdtreeInternal::UpdatePositions(&Tree.Edit(), Indices, Positions, &Stats);
 }
 
 void UKdtreeBPLibrary::CollectFromKdtree(
 	const FKdtree& Tree, const FVector Center, float Radius, TArray<int>& Indices, TArray<FVector>& Data)
 {
-	KdtreeInternal::CollectFromKdtree(Tree.Internal, Center, Radius, &Indices);
+	KdtreeInternal::CollectFromKdtree(Tree.Get(), Center, Radius, &Indices);
+	for (int Index = 0; Index < Indices.Num(); ++Index)
+	{
+		Data.Add(Tree.Get().Data[Indices[Index]]);
+	}
+}
+
+void UKdtreeBPLibrary::CollectFromKdtreeWithMask(const FKdtree& Tree, const FVector Center, float Radius,
+	const FKdtreeMaskFilter& Filter, TArray<int>& Indices, TArray<FVector>& Data)
+{
+	KdtreeInternal::CollectFromKdtreeFiltered(Tree.Get(), Center, Radius, Filter, &Indices);
 	for (int Index = 0; Index < Indices.Num(); ++Index)
 	{
-		Data.Add(Tree.Internal.Data[Indices[Index]]);
+		Data.Add(Tree.Get().Data[Indices[Index]]);
+	}
+}
+
+bool UKdtreeBPLibrary::CollectFromKdtreeApproximate(const FKdtree& Tree, const FVector Center, float Radius,
+	const FKdtreeApproximation& Approximation, TArray<int>& Indices, TArray<FVector>& Data)
+{
+	const bool bCompleted = KdtreeInternal::CollectFromKdtreeApproximate(Tree.Get(), Center, Radius, Approximation, &Indices);
+	for (int Index = 0; Index < Indices.Num(); ++Index)
+	{
+		Data.Add(Tree.Get().Data[Indices[Index]]);
+	}
+	return bCompleted;
+}
+
+void UKdtreeBPLibrary::CollectInBoxFromKdtree(const FKdtree& Tree, const FBox& Box, TArray<int>& Indices, TArray<FVector>& Data)
+{
+	CollectInShape(Tree, FKdtreeBoxShape{Box.Min, Box.Max}, Indices, Data);
+}
+
+void UKdtreeBPLibrary::CollectInOrientedBoxFromKdtree(const FKdtree& Tree, const FVector Center, const FRotator Rotation,
+	const FVector Extent, TArray<int>& Indices, TArray<FVector>& Data)
+{
+	CollectInShape(Tree, FKdtreeOrientedBoxShape(Center, Rotation.Quaternion(), Extent), Indices, Data);
+}
+
+void UKdtreeBPLibrary::CollectInCapsuleFromKdtree(
+	const FKdtree& Tree, const FVector Start, const FVector End, float Radius, TArray<int>& Indices, TArray<FVector>& Data)
+{
+	CollectInShape(Tree, FKdtreeCapsuleShape{Start, End, Radius}, Indices, Data);
+}
+
+void UKdtreeBPLibrary::CollectInConvexVolumeFromKdtree(
+	const FKdtree& Tree, const TArray<FPlane>& Planes, TArray<int>& Indices, TArray<FVector>& Data)
+{
+	FKdtreeConvexShape Shape;
+	Shape.Planes.Append(Planes);
+	CollectInShape(Tree, Shape, Indices, Data);
+}
+
+void UKdtreeBPLibrary::CollectInFrustumFromKdtree(const FKdtree& Tree, const FVector Origin, const FRotator Rotation,
+	float FOVDegrees, float AspectRatio, float NearDistance, float FarDistance, TArray<int>& Indices, TArray<FVector>& Data)
+{
+	CollectInShape(Tree,
+		FKdtreeConvexShape::MakeFrustum(
+			Origin, Rotation.Quaternion(), FMath::DegreesToRadians(FOVDegrees * 0.5), AspectRatio, NearDistance, FarDistance),
+		Indices, Data);
+}
+
+int UKdtreeBPLibrary::CountInRadiusFromKdtree(const FKdtree& Tree, const FVector Center, float Radius)
+{
+	return KdtreeInternal::CountInRadius(Tree.Get(), Center, Radius);
+}
+
+bool UKdtreeBPLibrary::AnyInRadiusFromKdtree(const FKdtree& Tree, const FVector Center, float Radius)
+{
+	return KdtreeInternal::AnyInRadius(Tree.Get(), Center, Radius);
+}
+
+bool UKdtreeBPLibrary::FindFirstAlongSegmentFromKdtree(
+	const FKdtree& Tree, const FVector Start, const FVector End, float Radius, int& Index, FVector& Data, float& Distance)
+{
+	FVector::FReal HitDistance = 0.0;
+	const int HitIndex = KdtreeInternal::FindFirstAlongSegment(Tree.Get(), Start, End, Radius, &HitDistance);
+	return SetHitOutputs(Tree, HitIndex, HitDistance, Index, Data, Distance);
+}
+
+bool UKdtreeBPLibrary::FindFirstAlongRayFromKdtree(const FKdtree& Tree, const FVector Origin, const FVector Direction,
+	float MaxDistance, float Radius, int& Index, FVector& Data, float& Distance)
+{
+	FVector::FReal HitDistance = 0.0;
+	const int HitIndex = KdtreeInternal::FindFirstAlongRay(Tree.Get(), Origin, Direction, MaxDistance, Radius, &HitDistance);
+	return SetHitOutputs(Tree, HitIndex, HitDistance, Index, Data, Distance);
+}
+
+bool UKdtreeBPLibrary::FindFirstAlongPathFromKdtree(
+	const FKdtree& Tree, const TArray<FVector>& Path, float Radius, int& Index, FVector& Data, float& Distance)
+{
+	FVector::FReal HitDistance = 0.0;
+	const int HitIndex = KdtreeInternal::FindFirstAlongPath(Tree.Get(), MakeArrayView(Path), Radius, &HitDistance);
+	return SetHitOutputs(Tree, HitIndex, HitDistance, Index, Data, Distance);
+}
+
+void UKdtreeBPLibrary::CollectFromKdtreeBatch(const FKdtree& Tree, const TArray<FVector>& Centers, const TArray<float>& Radii,
+	TArray<int>& Indices, TArray<int>& Offsets)
+{
+	if (Radii.Num() != 1 && Radii.Num() != Centers.Num())
+	{
+		UE_LOG(LogTemp, Error, TEXT("CollectFromKdtreeBatch: expected 1 or %d radii, got %d"), Centers.Num(), Radii.Num());
+		return;
+	}
+
+	KdtreeInternal::CollectFromKdtreeBatch(Tree.Get(), Centers, Radii, &Indices, &Offsets);
+}
+
+void UKdtreeBPLibrary::BuildRadiusNeighborGraphFromKdtree(const FKdtree& Tree, float Radius, FKdtreeNeighborGraph& Graph)
+{
+	KdtreeInternal::BuildRadiusNeighborGraph(Tree.Get(), Radius, &Graph);
+}
+
+void UKdtreeBPLibrary::BuildKNearestNeighborGraphFromKdtree(const FKdtree& Tree, int K, float MaxDistance, FKdtreeNeighborGraph& Graph)
+{
+	KdtreeInternal::BuildKNearestNeighborGraph(Tree.Get(), K, MaxDistance, &Graph);
+}
+
+void UKdtreeBPLibrary::FindKNearestFromKdtree(
+	const FKdtree& Tree, const FVector Center, int K, float MaxDistance, TArray<int>& Indices, TArray<FVector>& Data)
+{
+	KdtreeInternal::FindKNearest(Tree.Get(), Center, K, MaxDistance, &Indices);
+	for (int Index = 0; Index < Indices.Num(); ++Index)
+	{
+		Data.Add(Tree.Get().Data[Indices[Index]]);
+	}
+}
+
+bool UKdtreeBPLibrary::FindNearestFromKdtree(
+	const FKdtree& Tree, const FVector Center, float MaxDistance, int& Index, FVector& Data)
+{
+	Index = KdtreeInternal::FindNearest(Tree.Get(), Center, MaxDistance);
+	if (Index == INDEX_NONE)
+	{
+		return false;
+	}
+
+	Data = Tree.Get().Data[Index];
+	return true;
+}
+
+void UKdtreeBPLibrary::FindKNearestFromKdtreeWithMask(const FKdtree& Tree, const FVector Center, int K, float MaxDistance,
+	const FKdtreeMaskFilter& Filter, TArray<int>& Indices, TArray<FVector>& Data)
+{
+	KdtreeInternal::FindKNearestFiltered(Tree.Get(), Center, K, MaxDistance, Filter, &Indices);
+	for (int Index = 0; Index < Indices.Num(); ++Index)
+	{
+		Data.Add(Tree.Get().Data[Indices[Index]]);
+	}
+}
+
+bool UKdtreeBPLibrary::FindNearestFromKdtreeWithMask(
+	const FKdtree& Tree, const FVector Center, float MaxDistance, const FKdtreeMaskFilter& Filter, int& Index, FVector& Data)
+{
+	Index = KdtreeInternal::FindNearestFiltered(Tree.Get(), Center, MaxDistance, Filter);
+	if (Index == INDEX_NONE)
+	{
+		return false;
+	}
+
+	Data = Tree.Get().Data[Index];
+	return true;
+}
+
+bool UKdtreeBPLibrary::FindKNearestFromKdtreeApproximate(const FKdtree& Tree, const FVector Center, int K, float MaxDistance,
+	const FKdtreeApproximation& Approximation, TArray<int>& Indices, TArray<FVector>& Data)
+{
+	const bool bCompleted = KdtreeInternal::FindKNearestApproximate(Tree.Get(), Center, K, MaxDistance, Approximation, &Indices);
+	for (int Index = 0; Index < Indices.Num(); ++Index)
+	{
+		Data.Add(Tree.Get().Data[Indices[Index]]);
+	}
+	return bCompleted;
+}
+
+bool UKdtreeBPLibrary::FindNearestFromKdtreeApproximate(const FKdtree& Tree, const FVector Center, float MaxDistance,
+	const FKdtreeApproximation& Approximation, int& Index, FVector& Data, bool& bCompleted)
+{
+	Index = KdtreeInternal::FindNearestApproximate(Tree.Get(), Center, MaxDistance, Approximation, &bCompleted);
+	if (Index == INDEX_NONE)
+	{
+		return false;
+	}
+
+	Data = Tree.Get().Data[Index];
+	return true;
+}
+
+void UKdtreeBPLibrary::GetInputIndicesFromKdtree(const FKdtree& Tree, const TArray<int>& Indices, TArray<int>& InputIndices)
+{
+	InputIndices.Reserve(InputIndices.Num() + Indices.Num());
+	for (const int Index : Indices)
+	{
+		InputIndices.Add(Tree.Get().Data.IsValidIndex(Index) ? KdtreeInternal::GetInputIndex(Tree.Get(), Index) : INDEX_NONE);
 	}
 }
 
 void UKdtreeBPLibrary::ValidateKdtree(const FKdtree& Tree)
 {
-	KdtreeInternal::ValidateKdtree(Tree.Internal);
+	KdtreeInternal::ValidateKdtree(Tree.Get());
+}
+
+FKdtreeSummary UKdtreeBPLibrary::GetKdtreeSummary(const FKdtree& Tree)
+{
+	return KdtreeInternal::GetKdtreeSummary(Tree.Get());
+}
+
+void UKdtreeBPLibrary::LogKdtreeSummary(const FKdtree& Tree)
+{
+	UE_LOG(LogTemp, Display, TEXT("Kdtree: %s"), *GetKdtreeSummary(Tree).ToString());
 }
 
 void UKdtreeBPLibrary::DumpKdtreeToConsole(const FKdtree& Tree)
 {
-	KdtreeInternal::DumpKdTree(Tree.Internal);
+	KdtreeInternal::DumpKdTree(Tree.Get());
+}
+
+void UKdtreeBPLibrary::BuildSpatialHash(FSpatialHash& Hash, const TArray<FVector>& Data, const FSpatialHashBuildSettings& Settings)
+{
+	// Built aside and swapped in like BuildKdtreeWithSettings, so async queries keep reading the grid they started on.
+	FSpatialHash::FSnapshotRef Built = MakeShared<FSpatialHashInternal, ESPMode::ThreadSafe>();
+	KdtreeInternal::BuildSpatialHash(&Built.Get(), Data, Settings);
+	Hash.SwapSnapshot(Built);
+}
+
+void UKdtreeBPLibrary::ClearSpatialHash(FSpatialHash& Hash)
+{
+	if (!Hash.IsShared())
+	{
+		KdtreeInternal::ClearSpatialHash(&Hash.Edit());
+		return;
+	}
+
+	FSpatialHash::FSnapshotRef Cleared = MakeShared<FSpatialHashInternal, ESPMode::ThreadSafe>();
+	Cleared->RequestedCellSize = Hash.Get().RequestedCellSize;
+	Hash.SwapSnapshot(Cleared);
+}
+
+int UKdtreeBPLibrary::InsertPointToSpatialHash(FSpatialHash& Hash, const FVector Point)
+{
+	return KdtreeInternal::InsertIntoSpatialHash(&Hash.Edit(), Point);
+}
+
+bool UKdtreeBPLibrary::RemovePointFromSpatialHash(FSpatialHash& Hash, int Index)
+{
+	return KdtreeInternal::RemoveFromSpatialHash(&Hash.Edit(), Index);
+}
+
+void UKdtreeBPLibrary::UpdatePositionsInSpatialHash(FSpatialHash& Hash, const TArray<int>& Indices, const TArray<FVector>& Positions)
+{
+	if (Indices.Num() != Positions.Num())
+	{
+		UE_LOG(
+			LogTemp, Error, TEXT("UpdatePositionsInSpatialHash: got %d indices but %d positions"), Indices.Num(), Positions.Num());
+		return;
+	}
+
+	KdtreeInternal::UpdateSpatialHashPositions(&Hash.Edit(), Indices, Positions);
+}
+
+void UKdtreeBPLibrary::CollectFromSpatialHash(
+	const FSpatialHash& Hash, const FVector Center, float Radius, TArray<int>& Indices, TArray<FVector>& Data)
+{
+	KdtreeInternal::CollectFromSpatialHash(Hash.Get(), Center, Radius, &Indices);
+	for (int Index = 0; Index < Indices.Num(); ++Index)
+	{
+		Data.Add(Hash.Get().Data[Indices[Index]]);
+	}
+}
+
+void UKdtreeBPLibrary::CollectFromSpatialHashBatch(const FSpatialHash& Hash, const TArray<FVector>& Centers,
+	const TArray<float>& Radii, TArray<int>& Indices, TArray<int>& Offsets)
+{
+	if (Radii.Num() != 1 && Radii.Num() != Centers.Num())
+	{
+		UE_LOG(LogTemp, Error, TEXT("CollectFromSpatialHashBatch: expected 1 or %d radii, got %d"), Centers.Num(), Radii.Num());
+		return;
+	}
+
+	KdtreeInternal::CollectFromSpatialHashBatch(Hash.Get(), Centers, Radii, &Indices, &Offsets);
+}
+
+void UKdtreeBPLibrary::FindKNearestFromSpatialHash(
+	const FSpatialHash& Hash, const FVector Center, int K, float MaxDistance, TArray<int>& Indices, TArray<FVector>& Data)
+{
+	KdtreeInternal::FindKNearestInSpatialHash(Hash.Get(), Center, K, MaxDistance, &Indices);
+	for (int Index = 0; Index < Indices.Num(); ++Index)
+	{
+		Data.Add(Hash.Get().Data[Indices[Index]]);
+	}
+}
+
+bool UKdtreeBPLibrary::FindNearestFromSpatialHash(
+	const FSpatialHash& Hash, const FVector Center, float MaxDistance, int& Index, FVector& Data)
+{
+	Index = KdtreeInternal::FindNearestInSpatialHash(Hash.Get(), Center, MaxDistance);
+	if (Index == INDEX_NONE)
+	{
+		return false;
+	}
+
+	Data = Hash.Get().Data[Index];
+	return true;
+}
+
+void UKdtreeBPLibrary::ValidateSpatialHash(const FSpatialHash& Hash)
+{
+	KdtreeInternal::ValidateSpatialHash(Hash.Get());
+}
+
+EKdtreeSpatialBackend UKdtreeBPLibrary::RecommendSpatialBackend(int NumPoints, int NumMovedPerFrame, int NumQueriesPerFrame)
+{
+	return KdtreeInternal::RecommendSpatialBackend(NumPoints, NumMovedPerFrame, NumQueriesPerFrame);
 }
@@ -9,268 +9,72 @@
 
 #include "KdtreeInternal.h"
 
-#include "KdtreeBPLibrary.h"
-
 namespace KdtreeInternal
 {
-namespace
-{
-template <typename T>
-void Swap(T* Var1, T* Var2)
-{
-	T Tmp = *Var1;
-	*Var1 = *Var2;
-	*Var2 = Tmp;
-}
-
-template <typename T>
-void QuickSort(T* First, T* Last, TFunctionRef<int(T, T)> Comparator)
-{
-	T* Left = First;
-	T* Right = Last;
-	T Pivot = *First;
-
-	while (true)
-	{
-		while (Left <= Last && Comparator(*Left, Pivot) == 1)
-		{
-			Left++;
-		}
-		while (Right >= First && Comparator(*Right, Pivot) == -1)
-		{
-			Right--;
-		}
-		if (Left > Right)
-		{
-			break;
-		}
-		Swap(Left, Right);
-		Left++;
-		Right--;
-	}
-
-	if (First < Left - 1)
-	{
-		QuickSort(First, Left - 1, Comparator);
-	}
-	if (Left < Last)
-	{
-		QuickSort(Left, Last, Comparator);
-	}
-}
-
-template <typename T>
-void NthElement(T* First, T* Nth, T* Last, TFunctionRef<int(T, T)> Comparator)
-{
-	// TODO: Use faster algorithm such as introselect.
-	QuickSort(First, Last - 1, Comparator);
-}
-
-FKdtreeNode* BuildNode(const FKdtreeInternal& Tree, int* Indices, int NumData, int Depth)
-{
-	if (NumData <= 0)
-	{
-		return nullptr;
-	}
-
-	const int Axis = Depth % 3;
-	const int Middle = (NumData - 1) / 2;
-
-	NthElement<int>(Indices, Indices + Middle, Indices + NumData, [&](int Lhs, int Rhs) {
-		if (Tree.Data[Lhs][Axis] < Tree.Data[Rhs][Axis])
-		{
-			return 1;
-		}
-		else if (Tree.Data[Lhs][Axis] > Tree.Data[Rhs][Axis])
-		{
-			return -1;
-		}
-
-		return 0;
-	});
-
-	FKdtreeNode* NewNode = new FKdtreeNode();
-	NewNode->Index = Indices[Middle];
-	NewNode->Axis = Axis;
-	NewNode->ChildLeft = BuildNode(Tree, Indices, Middle, Depth + 1);
-	NewNode->ChildRight = BuildNode(Tree, Indices + Middle + 1, NumData - Middle - 1, Depth + 1);
-
-	return NewNode;
-}
-
-void ClearNode(FKdtreeNode* Node)
-{
-	if (Node == nullptr)
-	{
-		return;
-	}
-
-	if (Node->ChildLeft)
-	{
-		ClearNode(Node->ChildLeft);
-	}
-	if (Node->ChildRight)
-	{
-		ClearNode(Node->ChildRight);
-	}
-
-	delete Node;
-}
-
-void ValidateKdtree(const FKdtreeInternal& Tree, const FKdtreeNode* Node, int Depth)
-{
-	if (Node == nullptr)
-	{
-		return;
-	}
-
-	int Axis = Node->Axis;
-	const FKdtreeNode* NodeLeft = Node->ChildLeft;
-	const FKdtreeNode* NodeRight = Node->ChildRight;
-	if (NodeLeft)
-	{
-		if (Tree.Data[Node->Index][Axis] < Tree.Data[NodeLeft->Index][Axis])
-		{
-			UE_LOG(LogTemp, Error, TEXT("Kdtree is invalid: tree.Data[%d][%d](%f) < tree.Data[%d][%d](%f)"), Node->Index, Axis,
-				Tree.Data[Node->Index][Axis], NodeLeft->Index, Axis, Tree.Data[NodeLeft->Index][Axis]);
-		}
-	}
-	if (NodeRight)
-	{
-		if (Tree.Data[Node->Index][Axis] > Tree.Data[NodeRight->Index][Axis])
-		{
-			UE_LOG(LogTemp, Error, TEXT("Kdtree is invalid: tree.Data[%d][%d](%f) > tree.Data[%d][%d](%f)"), Node->Index, Axis,
-				Tree.Data[Node->Index][Axis], NodeRight->Index, Axis, Tree.Data[NodeRight->Index][Axis]);
-		}
-	}
-
-	if (NodeLeft)
-	{
-		ValidateKdtree(Tree, NodeLeft, Depth + 1);
-	}
-	if (NodeRight)
-	{
-		ValidateKdtree(Tree, NodeRight, Depth + 1);
-	}
-}
-
-void DumpNode(const FKdtreeInternal& Tree, const FKdtreeNode* Node)
-{
-	if (Node == nullptr)
-	{
-		return;
-	}
-
-	FString Left = "null";
-	FString Right = "null";
-
-	if (Node->ChildLeft)
-	{
-		Left = FString::FromInt(Node->ChildLeft->Index);
-	}
-	if (Node->ChildRight)
-	{
-		Right = FString::FromInt(Node->ChildRight->Index);
-	}
-
-	UE_LOG(LogTemp, Display, TEXT("[%d] value=(%f, %f, %f), axis=%d, child_left=%s, child_right=%s"), Node->Index,
-		Tree.Data[Node->Index][0], Tree.Data[Node->Index][1], Tree.Data[Node->Index][2], Node->Axis, *Left, *Right);
-}
-
-void DumpKdTree(const FKdtreeInternal& Tree, const FKdtreeNode* Node)
-{
-	if (Node == nullptr)
-	{
-		return;
-	}
-
-	DumpNode(Tree, Node);
-
-	if (Node->ChildLeft)
-	{
-		DumpKdTree(Tree, Node->ChildLeft);
-	}
-	if (Node->ChildRight)
-	{
-		DumpKdTree(Tree, Node->ChildRight);
-	}
-}
-
-void CollectFromKdtree(
-	const FKdtreeInternal& Tree, const FKdtreeNode* Node, const FVector& Center, float Radius, TArray<int>* Result)
-{
-	if (Node == nullptr)
-	{
-		return;
-	}
-
-	const FVector& Current = Tree.Data[Node->Index];
-	if (FVector::DistSquared(Center, Current) < Radius * Radius)
-	{
-		Result->Add(Node->Index);
-	}
-
-	int Axis = Node->Axis;
-	if (Center[Axis] < Current[Axis])
-	{
-		CollectFromKdtree(Tree, Node->ChildLeft, Center, Radius, Result);
-	}
-	else
-	{
-		CollectFromKdtree(Tree, Node->ChildRight, Center, Radius, Result);
-	}
-
-	float Diff = FMath::Abs(Center[Axis] - Current[Axis]);
-	if (Diff < Radius)
-	{
-		if (Center[Axis] < Current[Axis])
-		{
-			CollectFromKdtree(Tree, Node->ChildRight, Center, Radius, Result);
-		}
-		else
-		{
-			CollectFromKdtree(Tree, Node->ChildLeft, Center, Radius, Result);
-		}
-	}
-}
-}	 // namespace
-
-void BuildKdtree(FKdtreeInternal* Tree, const TArray<FVector>& Data)
-{
-	ClearKdtree(Tree);
-
-	Tree->Data = Data;
-
-	TArray<int> Indices;
-	for (int Index = 0; Index < Data.Num(); ++Index)
-	{
-		Indices.Add(Index);
-	}
-
-	Tree->Root = BuildNode(*Tree, Indices.GetData(), Indices.Num(), 0);
-}
-
-void ClearKdtree(FKdtreeInternal* Tree)
-{
-	ClearNode(Tree->Root);
-	Tree->Data.Empty();
-}
-
-void CollectFromKdtree(const FKdtreeInternal& Tree, const FVector& Center, float Radius, TArray<int>* Result)
-{
-	CollectFromKdtree(Tree, Tree.Root, Center, Radius, Result);
-}
-
-void ValidateKdtree(const FKdtreeInternal& Tree)
-{
-	ValidateKdtree(Tree, Tree.Root, 0);
-}
-
-void DumpKdTree(const FKdtreeInternal& Tree)
-{
-	UE_LOG(LogTemp, Display, TEXT("========== DUMP FKdtree =========="));
-	DumpKdTree(Tree, Tree.Root);
-	UE_LOG(LogTemp, Display, TEXT("=================================="));
-}
-
+template void BuildKdtree(FKdtreeInternal* Tree, const TArray<FVector>& Data, const FKdtreeBuildSettings& Settings);
+template void BuildKdtree(FKdtreeInternal* Tree, TArray<FVector>&& Data, const FKdtreeBuildSettings& Settings);
+template FKdtreeBuildSettings GetBuildSettings(const FKdtreeInternal& Tree);
+template void BuildKdtreeWithMasks(
+	FKdtreeInternal* Tree, const TArray<FVector>& Data, const TArray<uint64>& Masks, const FKdtreeBuildSettings& Settings);
+template bool SetPointMask(FKdtreeInternal* Tree, int Index, uint64 Mask);
+template int GetInputIndex(const FKdtreeInternal& Tree, int Index);
+template uint64 GetPointMask(const FKdtreeInternal& Tree, int Index);
+template void ClearKdtree(FKdtreeInternal* Tree);
+template int InsertPoint(FKdtreeInternal* Tree, const FVector& Point);
+template int InsertPointWithMask(FKdtreeInternal* Tree, const FVector& Point, uint64 Mask);
+template bool RemovePoint(FKdtreeInternal* Tree, int Index);
+template void UpdatePositions(
+	FKdtreeInternal* Tree, const TArray<int>& Indices, const TArray<FVector>& Positions, FKdtreeUpdateStats* Stats);
+template void CollectFromKdtree(const FKdtreeInternal& Tree, const FVector& Center, float Radius, TArray<int>* Result);
+template void CollectFromKdtreeFiltered(
+	const FKdtreeInternal& Tree, const FVector& Center, float Radius, const FKdtreeMaskFilter& Filter, TArray<int>* Result);
+template bool CollectFromKdtreeApproximate(const FKdtreeInternal& Tree, const FVector& Center, float Radius,
+	const FKdtreeApproximation& Approximation, TArray<int>* Result);
+template int32 CollectFromKdtreeToBuffer(const FKdtreeInternal& Tree, const FVector& Center, float Radius, TArrayView<int> Buffer);
+template bool ForEachInRadius(
+	const FKdtreeInternal& Tree, const FVector& Center, float Radius, const TFunctionRef<bool(int)>& Visitor);
+template int32 CountInRadius(const FKdtreeInternal& Tree, const FVector& Center, float Radius);
+template bool AnyInRadius(const FKdtreeInternal& Tree, const FVector& Center, float Radius);
+template void CollectInShape(const FKdtreeInternal& Tree, const FKdtreeBoxShape& Shape, TArray<int>* Result);
+template void CollectInShape(const FKdtreeInternal& Tree, const FKdtreeOrientedBoxShape& Shape, TArray<int>* Result);
+template void CollectInShape(const FKdtreeInternal& Tree, const FKdtreeCapsuleShape& Shape, TArray<int>* Result);
+template void CollectInShape(const FKdtreeInternal& Tree, const FKdtreeConvexShape& Shape, TArray<int>* Result);
+template int FindFirstAlongSegment(
+	const FKdtreeInternal& Tree, const FVector& Start, const FVector& End, float Radius, FVector::FReal* OutDistance);
+template int FindFirstAlongRay(const FKdtreeInternal& Tree, const FVector& Origin, const FVector& Direction, float MaxDistance,
+	float Radius, FVector::FReal* OutDistance);
+template int FindFirstAlongPath(const FKdtreeInternal& Tree, TArrayView<const FVector> Path, float Radius, FVector::FReal* OutDistance);
+template void CollectFromKdtreeBatch(const FKdtreeInternal& Tree, const TArray<FVector>& Centers, const TArray<float>& Radii,
+	TArray<int>* ResultIndices, TArray<int>* ResultOffsets);
+template void BuildRadiusNeighborGraph(const FKdtreeInternal& Tree, float Radius, FKdtreeNeighborGraph* Graph);
+template void BuildKNearestNeighborGraph(const FKdtreeInternal& Tree, int K, float MaxDistance, FKdtreeNeighborGraph* Graph);
+template void FindKNearest(const FKdtreeInternal& Tree, const FVector& Center, int K, float MaxDistance, TArray<int>* Result);
+template void FindKNearestFiltered(const FKdtreeInternal& Tree, const FVector& Center, int K, float MaxDistance,
+	const FKdtreeMaskFilter& Filter, TArray<int>* Result);
+template int FindNearest(const FKdtreeInternal& Tree, const FVector& Center, float MaxDistance);
+template bool FindKNearestApproximate(const FKdtreeInternal& Tree, const FVector& Center, int K, float MaxDistance,
+	const FKdtreeApproximation& Approximation, TArray<int>* Result);
+template int FindNearestApproximate(const FKdtreeInternal& Tree, const FVector& Center, float MaxDistance,
+	const FKdtreeApproximation& Approximation, bool* bOutCompleted);
+template int FindNearestFiltered(const FKdtreeInternal& Tree, const FVector& Center, float MaxDistance, const FKdtreeMaskFilter& Filter);
+template void SerializeKdtree(FArchive& Ar, FKdtreeInternal& Tree, EKdtreeSerializeVersion Version);
+template void ValidateKdtree(const FKdtreeInternal& Tree);
+template FKdtreeSummary GetKdtreeSummary(const FKdtreeInternal& Tree);
+template void DumpKdTree(const FKdtreeInternal& Tree);
+template void BuildSpatialHash(
+	FSpatialHashInternal* Hash, const TArray<FVector>& Data, const FSpatialHashBuildSettings& Settings);
+template void BuildSpatialHash(FSpatialHashInternal* Hash, TArray<FVector>&& Data, const FSpatialHashBuildSettings& Settings);
+template void ClearSpatialHash(FSpatialHashInternal* Hash);
+template int InsertIntoSpatialHash(FSpatialHashInternal* Hash, const FVector& Point);
+template bool RemoveFromSpatialHash(FSpatialHashInternal* Hash, int Index);
+template void UpdateSpatialHashPositions(
+	FSpatialHashInternal* Hash, const TArray<int>& Indices, const TArray<FVector>& Positions);
+template void CollectFromSpatialHash(
+	const FSpatialHashInternal& Hash, const FVector& Center, float Radius, TArray<int>* Result);
+template void CollectFromSpatialHashBatch(const FSpatialHashInternal& Hash, const TArray<FVector>& Centers,
+	const TArray<float>& Radii, TArray<int>* ResultIndices, TArray<int>* ResultOffsets);
+template void FindKNearestInSpatialHash(
+	const FSpatialHashInternal& Hash, const FVector& Center, int K, float MaxDistance, TArray<int>* Result);
+template int FindNearestInSpatialHash(const FSpatialHashInternal& Hash, const FVector& Center, float MaxDistance);
+template void ValidateSpatialHash(const FSpatialHashInternal& Hash);
 }	 // namespace KdtreeInternal
@@ -10,20 +10,77 @@
 #pragma once
 
 #include "KdtreeBPLibrary.h"
+#include "KdtreeOperations.h"
+#include "SpatialHashOperations.h"
 
+// The operations on FKdtreeInternal and FSpatialHashInternal are compiled once in KdtreeInternal.cpp instead of in
+// every user.
 namespace KdtreeInternal
 {
-struct FKdtreeNode
-{
-	int Index = -1;
-	int Axis = -1;
-	FKdtreeNode* ChildLeft = nullptr;
-	FKdtreeNode* ChildRight = nullptr;
-};
-
-void BuildKdtree(FKdtreeInternal* Tree, const TArray<FVector>& Data);
-void ClearKdtree(FKdtreeInternal* Tree);
-void CollectFromKdtree(const FKdtreeInternal& Tree, const FVector& Center, float Radius, TArray<int>* Result);
-void ValidateKdtree(const FKdtreeInternal& Tree);
-void DumpKdTree(const FKdtreeInternal& Tree);
+extern template void BuildKdtree(FKdtreeInternal* Tree, const TArray<FVector>& Data, const FKdtreeBuildSettings& Settings);
+extern template void BuildKdtree(FKdtreeInternal* Tree, TArray<FVector>&& Data, const FKdtreeBuildSettings& Settings);
+extern template FKdtreeBuildSettings GetBuildSettings(const FKdtreeInternal& Tree);
+extern template void BuildKdtreeWithMasks(
+	FKdtreeInternal* Tree, const TArray<FVector>& Data, const TArray<uint64>& Masks, const FKdtreeBuildSettings& Settings);
+extern template bool SetPointMask(FKdtreeInternal* Tree, int Index, uint64 Mask);
+extern template int GetInputIndex(const FKdtreeInternal& Tree, int Index);
+extern template uint64 GetPointMask(const FKdtreeInternal& Tree, int Index);
+extern template void ClearKdtree(FKdtreeInternal* Tree);
+extern template int InsertPoint(FKdtreeInternal* Tree, const FVector& Point);
+extern template int InsertPointWithMask(FKdtreeInternal* Tree, const FVector& Point, uint64 Mask);
+extern template bool RemovePoint(FKdtreeInternal* Tree, int Index);
+extern template void UpdatePositions(
+	FKdtreeInternal* Tree, const TArray<int>& Indices, const TArray<FVector>& Positions, FKdtreeUpdateStats* Stats);
+extern template void CollectFromKdtree(const FKdtreeInternal& Tree, const FVector& Center, float Radius, TArray<int>* Result);
+extern template void CollectFromKdtreeFiltered(
+	const FKdtreeInternal& Tree, const FVector& Center, float Radius, const FKdtreeMaskFilter& Filter, TArray<int>* Result);
+extern template bool CollectFromKdtreeApproximate(const FKdtreeInternal& Tree, const FVector& Center, float Radius,
+	const FKdtreeApproximation& Approximation, TArray<int>* Result);
+extern template int32 CollectFromKdtreeToBuffer(const FKdtreeInternal& Tree, const FVector& Center, float Radius, TArrayView<int> Buffer);
+extern template bool ForEachInRadius(
+	const FKdtreeInternal& Tree, const FVector& Center, float Radius, const TFunctionRef<bool(int)>& Visitor);
+extern template int32 CountInRadius(const FKdtreeInternal& Tree, const FVector& Center, float Radius);
+extern template bool AnyInRadius(const FKdtreeInternal& Tree, const FVector& Center, float Radius);
+extern template void CollectInShape(const FKdtreeInternal& Tree, const FKdtreeBoxShape& Shape, TArray<int>* Result);
+extern template void CollectInShape(const FKdtreeInternal& Tree, const FKdtreeOrientedBoxShape& Shape, TArray<int>* Result);
+extern template void CollectInShape(const FKdtreeInternal& Tree, const FKdtreeCapsuleShape& Shape, TArray<int>* Result);
+extern template void CollectInShape(const FKdtreeInternal& Tree, const FKdtreeConvexShape& Shape, TArray<int>* Result);
+extern template int FindFirstAlongSegment(
+	const FKdtreeInternal& Tree, const FVector& Start, const FVector& End, float Radius, FVector::FReal* OutDistance);
+extern template int FindFirstAlongRay(const FKdtreeInternal& Tree, const FVector& Origin, const FVector& Direction, float MaxDistance,
+	float Radius, FVector::FReal* OutDistance);
+extern template int FindFirstAlongPath(const FKdtreeInternal& Tree, TArrayView<const FVector> Path, float Radius, FVector::FReal* OutDistance);
+extern template void CollectFromKdtreeBatch(const FKdtreeInternal& Tree, const TArray<FVector>& Centers, const TArray<float>& Radii,
+	TArray<int>* ResultIndices, TArray<int>* ResultOffsets);
+extern template void BuildRadiusNeighborGraph(const FKdtreeInternal& Tree, float Radius, FKdtreeNeighborGraph* Graph);
+extern template void BuildKNearestNeighborGraph(const FKdtreeInternal& Tree, int K, float MaxDistance, FKdtreeNeighborGraph* Graph);
+extern template void FindKNearest(const FKdtreeInternal& Tree, const FVector& Center, int K, float MaxDistance, TArray<int>* Result);
+extern template void FindKNearestFiltered(const FKdtreeInternal& Tree, const FVector& Center, int K, float MaxDistance,
+	const FKdtreeMaskFilter& Filter, TArray<int>* Result);
+extern template int FindNearest(const FKdtreeInternal& Tree, const FVector& Center, float MaxDistance);
+extern template bool FindKNearestApproximate(const FKdtreeInternal& Tree, const FVector& Center, int K, float MaxDistance,
+	const FKdtreeApproximation& Approximation, TArray<int>* Result);
+extern template int FindNearestApproximate(const FKdtreeInternal& Tree, const FVector& Center, float MaxDistance,
+	const FKdtreeApproximation& Approximation, bool* bOutCompleted);
+extern template int FindNearestFiltered(const FKdtreeInternal& Tree, const FVector& Center, float MaxDistance, const FKdtreeMaskFilter& Filter);
+extern template void SerializeKdtree(FArchive& Ar, FKdtreeInternal& Tree, EKdtreeSerializeVersion Version);
+extern template void ValidateKdtree(const FKdtreeInternal& Tree);
+extern template FKdtreeSummary GetKdtreeSummary(const FKdtreeInternal& Tree);
+extern template void DumpKdTree(const FKdtreeInternal& Tree);
+extern template void BuildSpatialHash(
+	FSpatialHashInternal* Hash, const TArray<FVector>& Data, const FSpatialHashBuildSettings& Settings);
+extern template void BuildSpatialHash(FSpatialHashInternal* Hash, TArray<FVector>&& Data, const FSpatialHashBuildSettings& Settings);
+extern template void ClearSpatialHash(FSpatialHashInternal* Hash);
+extern template int InsertIntoSpatialHash(FSpatialHashInternal* Hash, const FVector& Point);
+extern template bool RemoveFromSpatialHash(FSpatialHashInternal* Hash, int Index);
+extern template void UpdateSpatialHashPositions(
+	FSpatialHashInternal* Hash, const TArray<int>& Indices, const TArray<FVector>& Positions);
+extern template void CollectFromSpatialHash(
+	const FSpatialHashInternal& Hash, const FVector& Center, float Radius, TArray<int>* Result);
+extern template void CollectFromSpatialHashBatch(const FSpatialHashInternal& Hash, const TArray<FVector>& Centers,
+	const TArray<float>& Radii, TArray<int>* ResultIndices, TArray<int>* ResultOffsets);
+extern template void FindKNearestInSpatialHash(
+	const FSpatialHashInternal& Hash, const FVector& Center, int K, float MaxDistance, TArray<int>* Result);
+extern template int FindNearestInSpatialHash(const FSpatialHashInternal& Hash, const FVector& Center, float MaxDistance);
+extern template void ValidateSpatialHash(const FSpatialHashInternal& Hash);
 }	 // namespace KdtreeInternal
@@ -0,0 +1,329 @@
+/*!
+ * Kdtree
+ *
+ * Copyright (c) 2019-2023 nutti
+ *
+ * This software is released under the MIT License.
+ * https://opensource.org/licenses/MIT
+ */
+
+#include "KdtreeQuerySubsystem.h"
+
+#include "Async/ParallelFor.h"
+#include "HAL/PlatformTime.h"
+#include "KdtreeInternal.h"
+
+namespace
+{
+FKdtreeQueryHandle MakeHandle(int64 Id)
+{
+	FKdtreeQueryHandle Handle;
+	Handle.Id = Id;
+	return Handle;
+}
+}	 // namespace
+
+FKdtreeQueryHandle UKdtreeQuerySubsystem::CollectFromKdtree(
+	const FKdtree& Tree, const FVector& Center, float Radius, FOnKdtreeQueryDone OnDone)
+{
+	FQuery& Query = Submit(Tree, EQueryType::Collect, MoveTemp(OnDone));
+	Query.Center = Center;
+	Query.Radius = Radius;
+	return MakeHandle(Query.Id);
+}
+
+FKdtreeQueryHandle UKdtreeQuerySubsystem::FindKNearestFromKdtree(
+	const FKdtree& Tree, const FVector& Center, int K, float MaxDistance, FOnKdtreeQueryDone OnDone)
+{
+	FQuery& Query = Submit(Tree, EQueryType::KNearest, MoveTemp(OnDone));
+	Query.Center = Center;
+	Query.Radius = MaxDistance;
+	Query.K = K;
+	return MakeHandle(Query.Id);
+}
+
+FKdtreeQueryHandle UKdtreeQuerySubsystem::FindNearestFromKdtree(
+	const FKdtree& Tree, const FVector& Center, float MaxDistance, FOnKdtreeQueryDone OnDone)
+{
+	FQuery& Query = Submit(Tree, EQueryType::Nearest, MoveTemp(OnDone));
+	Query.Center = Center;
+	Query.Radius = MaxDistance;
+	return MakeHandle(Query.Id);
+}
+
+FKdtreeQueryHandle UKdtreeQuerySubsystem::CollectInShapeFromKdtree(
+	const FKdtree& Tree, FKdtreeQueryShape Shape, FOnKdtreeQueryDone OnDone)
+{
+	FQuery& Query = Submit(Tree, EQueryType::Shape, MoveTemp(OnDone));
+	Query.Shape = MoveTemp(Shape);
+	return MakeHandle(Query.Id);
+}
+
+FKdtreeQueryHandle UKdtreeQuerySubsystem::FindFirstAlongPathFromKdtree(
+	const FKdtree& Tree, TArray<FVector> Path, float Radius, FOnKdtreeQueryDone OnDone)
+{
+	FQuery& Query = Submit(Tree, EQueryType::Path, MoveTemp(OnDone));
+	Query.Path = MoveTemp(Path);
+	Query.Radius = Radius;
+	return MakeHandle(Query.Id);
+}
+
+FKdtreeQueryHandle UKdtreeQuerySubsystem::CollectFromSpatialHash(
+	const FSpatialHash& Hash, const FVector& Center, float Radius, FOnKdtreeQueryDone OnDone)
+{
+	FQuery& Query = Submit(Hash, EQueryType::Collect, MoveTemp(OnDone));
+	Query.Center = Center;
+	Query.Radius = Radius;
+	return MakeHandle(Query.Id);
+}
+
+FKdtreeQueryHandle UKdtreeQuerySubsystem::FindKNearestFromSpatialHash(
+	const FSpatialHash& Hash, const FVector& Center, int K, float MaxDistance, FOnKdtreeQueryDone OnDone)
+{
+	FQuery& Query = Submit(Hash, EQueryType::KNearest, MoveTemp(OnDone));
+	Query.Center = Center;
+	Query.Radius = MaxDistance;
+	Query.K = K;
+	return MakeHandle(Query.Id);
+}
+
+FKdtreeQueryHandle UKdtreeQuerySubsystem::FindNearestFromSpatialHash(
+	const FSpatialHash& Hash, const FVector& Center, float MaxDistance, FOnKdtreeQueryDone OnDone)
+{
+	FQuery& Query = Submit(Hash, EQueryType::Nearest, MoveTemp(OnDone));
+	Query.Center = Center;
+	Query.Radius = MaxDistance;
+	return MakeHandle(Query.Id);
+}
+
+UKdtreeQuerySubsystem::FQuery& UKdtreeQuerySubsystem::Submit(const FKdtree& Tree, EQueryType Type, FOnKdtreeQueryDone&& OnDone)
+{
+	FQuery& Query = AddPendingQuery(Type, MoveTemp(OnDone));
+	Query.Tree = Tree.GetSnapshot();
+	return Query;
+}
+
+UKdtreeQuerySubsystem::FQuery& UKdtreeQuerySubsystem::Submit(const FSpatialHash& Hash, EQueryType Type, FOnKdtreeQueryDone&& OnDone)
+{
+	FQuery& Query = AddPendingQuery(Type, MoveTemp(OnDone));
+	Query.SpatialHash = Hash.GetSnapshot();
+	return Query;
+}
+
+UKdtreeQuerySubsystem::FQuery& UKdtreeQuerySubsystem::AddPendingQuery(EQueryType Type, FOnKdtreeQueryDone&& OnDone)
+{
+	FKdtreeQueryResult* Result;
+	if (FreeResults.Num() > 0)
+	{
+		Result = FreeResults.Pop(EAllowShrinking::No);
+	}
+	else
+	{
+		Result = ResultPool.Add_GetRef(MakeUnique<FKdtreeQueryResult>()).Get();
+	}
+
+	FQuery& Query = PendingQueries.AddDefaulted_GetRef();
+	Query.Id = NextId++;
+	Query.Type = Type;
+	Query.bCancelled = false;
+	Query.Center = FVector::ZeroVector;
+	Query.Radius = 0.0f;
+	Query.K = 0;
+	Query.OnDone = MoveTemp(OnDone);
+	Query.Result = Result;
+	return Query;
+}
+
+bool UKdtreeQuerySubsystem::CancelQuery(FKdtreeQueryHandle Handle)
+{
+	// Pending queries are simply dropped. Running and completed ones stay in place, as the batch may still read them.
+	for (int Index = 0; Index < PendingQueries.Num(); ++Index)
+	{
+		if (PendingQueries[Index].Id == Handle.Id)
+		{
+			FreeResults.Add(PendingQueries[Index].Result);
+			PendingQueries.RemoveAt(Index, 1, EAllowShrinking::No);
+			return true;
+		}
+	}
+	for (TArray<FQuery>* Queries : {&BatchQueries, &CompletedQueries})
+	{
+		for (FQuery& Query : *Queries)
+		{
+			if (Query.Id == Handle.Id)
+			{
+				const bool bWasCancelled = Query.bCancelled;
+				Query.bCancelled = true;
+				return !bWasCancelled;
+			}
+		}
+	}
+	return false;
+}
+
+void UKdtreeQuerySubsystem::Deinitialize()
+{
+	BatchTask.Wait();
+	PendingQueries.Empty();
+	BatchQueries.Empty();
+	CompletedQueries.Empty();
+	FreeResults.Empty();
+	ResultPool.Empty();
+
+	Super::Deinitialize();
+}
+
+void UKdtreeQuerySubsystem::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	if (BatchTask.IsValid() && BatchTask.IsCompleted())
+	{
+		FinishBatch();
+	}
+
+	// A batch launched while the previous one still runs would have to wait for its workers anyway, so new queries
+	// keep gathering until it finished.
+	if (!BatchTask.IsValid() && PendingQueries.Num() > 0)
+	{
+		Swap(PendingQueries, BatchQueries);
+		BatchTask = UE::Tasks::Launch(UE_SOURCE_LOCATION, [this]() {
+			ParallelFor(
+				BatchQueries.Num(), [this](int32 Index) { RunQuery(BatchQueries[Index]); }, EParallelForFlags::Unbalanced);
+		});
+	}
+
+	DeliverResults();
+}
+
+TStatId UKdtreeQuerySubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UKdtreeQuerySubsystem, STATGROUP_Tickables);
+}
+
+void UKdtreeQuerySubsystem::RunQuery(FQuery& Query)
+{
+	FKdtreeQueryResult& Result = *Query.Result;
+	Result.Indices.Reset();
+	Result.Data.Reset();
+	Result.Distance = 0.0f;
+	if (Query.SpatialHash.IsValid())
+	{
+		RunSpatialHashQuery(Query);
+		return;
+	}
+
+	const FKdtreeInternal& Tree = *Query.Tree;
+	switch (Query.Type)
+	{
+		case EQueryType::Collect:
+			KdtreeInternal::CollectFromKdtree(Tree, Query.Center, Query.Radius, &Result.Indices);
+			break;
+		case EQueryType::KNearest:
+			KdtreeInternal::FindKNearest(Tree, Query.Center, Query.K, Query.Radius, &Result.Indices);
+			break;
+		case EQueryType::Nearest:
+		{
+			const int Index = KdtreeInternal::FindNearest(Tree, Query.Center, Query.Radius);
+			if (Index != INDEX_NONE)
+			{
+				Result.Indices.Add(Index);
+			}
+			break;
+		}
+		case EQueryType::Shape:
+			Visit([&Tree, &Result](const auto& Shape) { KdtreeInternal::CollectInShape(Tree, Shape, &Result.Indices); }, Query.Shape);
+			break;
+		case EQueryType::Path:
+		{
+			FVector::FReal Distance = 0.0;
+			const int Index = KdtreeInternal::FindFirstAlongPath(Tree, MakeArrayView(Query.Path), Query.Radius, &Distance);
+			if (Index != INDEX_NONE)
+			{
+				Result.Indices.Add(Index);
+				Result.Distance = static_cast<float>(Distance);
+			}
+			break;
+		}
+	}
+
+	Result.Data.Reserve(Result.Indices.Num());
+	for (const int Index : Result.Indices)
+	{
+		Result.Data.Add(Tree.Data[Index]);
+	}
+}
+
+void UKdtreeQuerySubsystem::RunSpatialHashQuery(FQuery& Query)
+{
+	FKdtreeQueryResult& Result = *Query.Result;
+	const FSpatialHashInternal& Hash = *Query.SpatialHash;
+	switch (Query.Type)
+	{
+		case EQueryType::Collect:
+			KdtreeInternal::CollectFromSpatialHash(Hash, Query.Center, Query.Radius, &Result.Indices);
+			break;
+		case EQueryType::KNearest:
+			KdtreeInternal::FindKNearestInSpatialHash(Hash, Query.Center, Query.K, Query.Radius, &Result.Indices);
+			break;
+		case EQueryType::Nearest:
+		{
+			const int Index = KdtreeInternal::FindNearestInSpatialHash(Hash, Query.Center, Query.Radius);
+			if (Index != INDEX_NONE)
+			{
+				Result.Indices.Add(Index);
+			}
+			break;
+		}
+		case EQueryType::Shape:
+		case EQueryType::Path:
+			// Only submitted for kd-trees.
+			checkNoEntry();
+			break;
+	}
+
+	Result.Data.Reserve(Result.Indices.Num());
+	for (const int Index : Result.Indices)
+	{
+		Result.Data.Add(Hash.Data[Index]);
+	}
+}
+
+void UKdtreeQuerySubsystem::FinishBatch()
+{
+	BatchTask = UE::Tasks::FTask();
+	for (FQuery& Query : BatchQueries)
+	{
+		// The snapshot is released here instead of at delivery, so a replaced tree is not kept alive any longer.
+		Query.Tree.Reset();
+		Query.SpatialHash.Reset();
+		CompletedQueries.Add(MoveTemp(Query));
+	}
+	BatchQueries.Reset();
+}
+
+void UKdtreeQuerySubsystem::DeliverResults()
+{
+	const double EndTime = FPlatformTime::Seconds() + DeliveryBudgetMs / 1000.0;
+	int NumDelivered = 0;
+	while (NumDelivered < CompletedQueries.Num())
+	{
+		// Marked as cancelled before the callback runs, which may submit new queries or cancel this one.
+		FQuery& Query = CompletedQueries[NumDelivered++];
+		FKdtreeQueryResult* Result = Query.Result;
+		const bool bCancelled = Query.bCancelled;
+		FOnKdtreeQueryDone OnDone = MoveTemp(Query.OnDone);
+		Query.bCancelled = true;
+		if (!bCancelled)
+		{
+			OnDone.ExecuteIfBound(*Result);
+		}
+		FreeResults.Add(Result);
+
+		if (FPlatformTime::Seconds() >= EndTime)
+		{
+			break;
+		}
+	}
+	CompletedQueries.RemoveAt(0, NumDelivered, EAllowShrinking::No);
+}
@@ -0,0 +1,32 @@
+/*!
+ * Kdtree
+ *
+ * Copyright (c) 2019-2023 nutti
+ *
+ * This software is released under the MIT License.
+ * https://opensource.org/licenses/MIT
+ */
+
+#include "KdtreeStats.h"
+
+DEFINE_STAT(STAT_KdtreeBuild);
+DEFINE_STAT(STAT_KdtreeEdit);
+DEFINE_STAT(STAT_KdtreeSerialize);
+DEFINE_STAT(STAT_KdtreeCollect);
+DEFINE_STAT(STAT_KdtreeCollectBatch);
+DEFINE_STAT(STAT_KdtreeCollectInShape);
+DEFINE_STAT(STAT_KdtreeFindKNearest);
+DEFINE_STAT(STAT_KdtreeFindNearest);
+DEFINE_STAT(STAT_KdtreeFindAlongPath);
+DEFINE_STAT(STAT_KdtreeNeighborGraph);
+DEFINE_STAT(STAT_SpatialHashBuild);
+DEFINE_STAT(STAT_SpatialHashEdit);
+DEFINE_STAT(STAT_SpatialHashCollect);
+DEFINE_STAT(STAT_SpatialHashCollectBatch);
+DEFINE_STAT(STAT_SpatialHashFindKNearest);
+DEFINE_STAT(STAT_SpatialHashFindNearest);
+
+DEFINE_STAT(STAT_KdtreeQueries);
+DEFINE_STAT(STAT_KdtreeNodesVisited);
+DEFINE_STAT(STAT_KdtreePointsTested);
+DEFINE_STAT(STAT_KdtreeResultsReturned);
@@ -0,0 +1,424 @@
+/*!
+ * Kdtree
+ *
+ * Copyright (c) 2019-2023 nutti
+ *
+ * This software is released under the MIT License.
+ * https://opensource.org/licenses/MIT
+ */
+
+#include "HAL/PlatformTime.h"
+#include "KdtreeTestUtils.h"
+#include "Misc/AutomationTest.h"
+#include "Misc/CommandLine.h"
+#include "Misc/DateTime.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+using namespace KdtreeTests;
+
+namespace
+{
+// One line of the report: named values in a fixed order, written as a CSV row and as a JSON object.
+struct FBenchmarkRow
+{
+	struct FField
+	{
+		FString Name;
+		FString Value;
+		bool bIsNumber;
+	};
+
+	TArray<FField> Fields;
+
+	void Add(const TCHAR* Name, const FString& Value)
+	{
+		Fields.Add(FField{Name, Value, false});
+	}
+
+	void Add(const TCHAR* Name, double Value)
+	{
+		Fields.Add(FField{Name, FString::Printf(TEXT("%.6g"), Value), true});
+	}
+};
+
+void SaveReport(const TArray<FBenchmarkRow>& Rows, const FString& BaseName)
+{
+	TArray<FString> Columns;
+	for (const FBenchmarkRow& Row : Rows)
+	{
+		for (const FBenchmarkRow::FField& Field : Row.Fields)
+		{
+			Columns.AddUnique(Field.Name);
+		}
+	}
+
+	FString Csv = FString::Join(Columns, TEXT(",")) + TEXT("\n");
+	FString Json = TEXT("[\n");
+	for (int RowIndex = 0; RowIndex < Rows.Num(); ++RowIndex)
+	{
+		TArray<FString> Values;
+		TArray<FString> Members;
+		for (const FString& Column : Columns)
+		{
+			const FBenchmarkRow::FField* Field =
+				Rows[RowIndex].Fields.FindByPredicate([&Column](const FBenchmarkRow::FField& Field) { return Field.Name == Column; });
+			Values.Add(Field != nullptr ? Field->Value : FString());
+			if (Field != nullptr)
+			{
+				Members.Add(FString::Printf(
+					Field->bIsNumber ? TEXT("\"%s\": %s") : TEXT("\"%s\": \"%s\""), *Field->Name, *Field->Value));
+			}
+		}
+		Csv += FString::Join(Values, TEXT(",")) + TEXT("\n");
+		Json += TEXT("  {") + FString::Join(Members, TEXT(", ")) + (RowIndex + 1 < Rows.Num() ? TEXT("},\n") : TEXT("}\n"));
+	}
+	Json += TEXT("]\n");
+
+	FFileHelper::SaveStringToFile(Csv, *(BaseName + TEXT(".csv")));
+	FFileHelper::SaveStringToFile(Json, *(BaseName + TEXT(".json")));
+	UE_LOG(LogTemp, Display, TEXT("Kdtree benchmark results written to %s.csv/.json"), *BaseName);
+}
+
+// Runs Body repeatedly for at least MinSeconds (and at least once) and returns the average seconds per run.
+template <typename BodyType>
+double TimeAverage(double MinSeconds, const BodyType& Body)
+{
+	int NumRuns = 0;
+	const double StartTime = FPlatformTime::Seconds();
+	double Elapsed;
+	do
+	{
+		Body();
+		++NumRuns;
+		Elapsed = FPlatformTime::Seconds() - StartTime;
+	} while (Elapsed < MinSeconds);
+	return Elapsed / NumRuns;
+}
+
+// Compares a sample of the benchmark's queries with brute force. Collect(Center, Result) and FindKNearest(Center, Result)
+// run the radius and 8-nearest queries on Index, a tree or a spatial hash.
+template <typename IndexType, typename CollectType, typename KNearestType>
+bool VerifyAgainstBruteForce(const IndexType& Index, const TArray<FVector>& Centers, float Radius, const CollectType& Collect,
+	const KNearestType& FindKNearest)
+{
+	const int NumChecked = FMath::Min(Centers.Num(), 16);
+	for (int Query = 0; Query < NumChecked; ++Query)
+	{
+		TArray<int> Collected;
+		Collect(Centers[Query], Collected);
+		if (Sorted(Collected) != BruteForceCollect(Index.Data, Index.RemovedPoints, Centers[Query], Radius))
+		{
+			return false;
+		}
+
+		TArray<int> Nearest;
+		FindKNearest(Centers[Query], Nearest);
+		if (!AreDistancesNearlyEqual(GetDistances(Index.Data, Nearest, Centers[Query]),
+				BruteForceKNearestDistances(Index.Data, Index.RemovedPoints, Centers[Query], 8, 0.0f)))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool VerifyAgainstBruteForce(const FKdtreeInternal& Tree, const TArray<FVector>& Centers, float Radius)
+{
+	return VerifyAgainstBruteForce(
+		Tree, Centers, Radius,
+		[&](const FVector& Center, TArray<int>& Result) { KdtreeInternal::CollectFromKdtree(Tree, Center, Radius, &Result); },
+		[&](const FVector& Center, TArray<int>& Result) { KdtreeInternal::FindKNearest(Tree, Center, 8, 0.0f, &Result); });
+}
+
+bool VerifyAgainstBruteForce(const FSpatialHashInternal& Hash, const TArray<FVector>& Centers, float Radius)
+{
+	return VerifyAgainstBruteForce(
+		Hash, Centers, Radius,
+		[&](const FVector& Center, TArray<int>& Result) { KdtreeInternal::CollectFromSpatialHash(Hash, Center, Radius, &Result); },
+		[&](const FVector& Center, TArray<int>& Result) { KdtreeInternal::FindKNearestInSpatialHash(Hash, Center, 8, 0.0f, &Result); });
+}
+// Fraction of the exact results of all queries that are among the approximate ones.
+double GetRecall(const TArray<TArray<int>>& Exact, const TArray<TArray<int>>& Approximate)
+{
+	int64 NumExact = 0;
+	int64 NumFound = 0;
+	for (int Query = 0; Query < Exact.Num(); ++Query)
+	{
+		NumExact += Exact[Query].Num();
+		for (const int Index : Exact[Query])
+		{
+			NumFound += Approximate[Query].Contains(Index) ? 1 : 0;
+		}
+	}
+	return NumExact > 0 ? static_cast<double>(NumFound) / NumExact : 1.0;
+}
+}	 // namespace
+
+// Times build, radius, batch and k-nearest queries and moving a tenth of the points over 1k points up to
+// -KdtreeBenchmarkMaxPoints= (1M by default, 10M at most) for every point distribution, for kd-trees of every split
+// policy, with and without reordering the points, and for the spatial hash. Also measures the speed against recall of
+// approximate queries over a range of tolerances and node budgets. Headless run:
+//   UnrealEditor-Cmd <Project>.uproject -nullrhi -unattended -ExecCmds="Automation RunTests Plugins.Kdtree.Benchmark; Quit"
+// Results go to Saved/Kdtree/Benchmark-<time>.csv and .json.
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FKdtreeBenchmark, "Plugins.Kdtree.Benchmark",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::PerfFilter)
+
+bool FKdtreeBenchmark::RunTest(const FString& Parameters)
+{
+	int MaxPoints = 1000 * 1000;
+	FParse::Value(FCommandLine::Get(), TEXT("KdtreeBenchmarkMaxPoints="), MaxPoints);
+	int NumQueries = 10000;
+	FParse::Value(FCommandLine::Get(), TEXT("KdtreeBenchmarkQueries="), NumQueries);
+
+	TArray<FBenchmarkRow> Rows;
+	for (const EPointDistribution Distribution : AllDistributions)
+	{
+		for (int NumPoints = 1000; NumPoints <= FMath::Min(MaxPoints, 10 * 1000 * 1000); NumPoints *= 10)
+		{
+			const TArray<FVector> Points = MakePoints(Distribution, NumPoints, 1);
+			const TArray<FVector> Centers = MakeQueryCenters(Points, NumQueries, 2);
+			const float Radius = GetRadiusForHits(NumPoints, 32.0, Distribution);
+			const double MinSeconds = 0.2;
+			// One of 16 categories per point, of which the masked queries select one.
+			TArray<uint64> Masks;
+			FRandomStream Random(3);
+			for (int Index = 0; Index < NumPoints; ++Index)
+			{
+				Masks.Add(uint64(1) << Random.RandHelper(16));
+			}
+			FKdtreeMaskFilter Filter;
+			Filter.IncludeMask = 1;
+			// Every tenth point, moved by up to a quarter of the query radius and back again on alternate runs, like a
+			// crowd walking about between frames.
+			TArray<int> MovedIndices;
+			TArray<FVector> MovedPositions[2];
+			for (int Index = 0; Index < NumPoints; Index += 10)
+			{
+				MovedIndices.Add(Index);
+				MovedPositions[0].Add(Points[Index] + Random.GetUnitVector() * Random.FRandRange(0.0, Radius * 0.25));
+				MovedPositions[1].Add(Points[Index]);
+			}
+
+			// Split policies and point reordering are compared at the default leaf size.
+			struct FVariant
+			{
+				int LeafSize;
+				EKdtreeSplitPolicy SplitPolicy;
+				bool bReorderPoints;
+			};
+			const FVariant Variants[] = {{0, EKdtreeSplitPolicy::RoundRobin, false}, {0, EKdtreeSplitPolicy::RoundRobin, true},
+				{16, EKdtreeSplitPolicy::RoundRobin, false}, {16, EKdtreeSplitPolicy::RoundRobin, true},
+				{16, EKdtreeSplitPolicy::MaxSpread, false}, {16, EKdtreeSplitPolicy::SlidingMidpoint, false},
+				{16, EKdtreeSplitPolicy::SurfaceAreaHeuristic, false}};
+			for (const FVariant& Variant : Variants)
+			{
+				const int LeafSize = Variant.LeafSize;
+				FKdtreeBuildSettings Settings;
+				Settings.LeafSize = LeafSize;
+				Settings.SplitPolicy = Variant.SplitPolicy;
+				Settings.ExpectedQueryRadius = Radius;
+				Settings.bReorderPoints = Variant.bReorderPoints;
+				FKdtreeInternal Tree;
+				const double BuildSeconds = TimeAverage(MinSeconds, [&]() { KdtreeInternal::BuildKdtree(&Tree, Points, Settings); });
+
+				int64 NumHits = 0;
+				TArray<int> Result;
+				const double RadiusSeconds = TimeAverage(MinSeconds, [&]() {
+					NumHits = 0;
+					for (const FVector& Center : Centers)
+					{
+						Result.Reset();
+						KdtreeInternal::CollectFromKdtree(Tree, Center, Radius, &Result);
+						NumHits += Result.Num();
+					}
+				});
+
+				TArray<int> BatchIndices;
+				TArray<int> BatchOffsets;
+				const double BatchSeconds = TimeAverage(
+					MinSeconds, [&]() { KdtreeInternal::CollectFromKdtreeBatch(Tree, Centers, {Radius}, &BatchIndices, &BatchOffsets); });
+
+				const double KNearestSeconds = TimeAverage(MinSeconds, [&]() {
+					for (const FVector& Center : Centers)
+					{
+						Result.Reset();
+						KdtreeInternal::FindKNearest(Tree, Center, 8, 0.0f, &Result);
+					}
+				});
+
+				FKdtreeInternal MaskedTree;
+				KdtreeInternal::BuildKdtreeWithMasks(&MaskedTree, Points, Masks, Settings);
+				const double MaskedRadiusSeconds = TimeAverage(MinSeconds, [&]() {
+					for (const FVector& Center : Centers)
+					{
+						Result.Reset();
+						KdtreeInternal::CollectFromKdtreeFiltered(MaskedTree, Center, Radius, Filter, &Result);
+					}
+				});
+
+				// The graph holds every pair within Radius, so it is skipped where it would not fit comfortably in memory.
+				double GraphSeconds = 0.0;
+				if (static_cast<double>(NumHits) / NumQueries * NumPoints <= 64.0 * 1000 * 1000)
+				{
+					FKdtreeNeighborGraph Graph;
+					GraphSeconds = TimeAverage(MinSeconds, [&]() { KdtreeInternal::BuildRadiusNeighborGraph(Tree, Radius, &Graph); });
+				}
+
+				int NumMoveRuns = 0;
+				const double MoveSeconds = TimeAverage(MinSeconds, [&]() {
+					KdtreeInternal::UpdatePositions(&Tree, MovedIndices, MovedPositions[NumMoveRuns++ % 2]);
+				});
+
+				const bool bVerified = VerifyAgainstBruteForce(Tree, Centers, Radius);
+				if (!bVerified)
+				{
+					AddError(FString::Printf(TEXT("%s, %d points, leaf size %d, %s: results differ from brute force"),
+						GetDistributionName(Distribution), NumPoints, LeafSize, LexToString(Variant.SplitPolicy)));
+				}
+
+				FBenchmarkRow& Row = Rows.AddDefaulted_GetRef();
+				Row.Add(TEXT("distribution"), GetDistributionName(Distribution));
+				Row.Add(TEXT("variant"),
+					FString::Printf(TEXT("kdtree_leaf%d%s"), LeafSize, Variant.bReorderPoints ? TEXT("_reordered") : TEXT("")));
+				Row.Add(TEXT("split_policy"), LexToString(Variant.SplitPolicy));
+				Row.Add(TEXT("points"), NumPoints);
+				Row.Add(TEXT("queries"), NumQueries);
+				Row.Add(TEXT("build_ms"), BuildSeconds * 1000.0);
+				Row.Add(TEXT("radius_us_per_query"), RadiusSeconds * 1e6 / NumQueries);
+				Row.Add(TEXT("radius_hits_per_query"), static_cast<double>(NumHits) / NumQueries);
+				Row.Add(TEXT("radius_masked_us_per_query"), MaskedRadiusSeconds * 1e6 / NumQueries);
+				Row.Add(TEXT("batch_us_per_query"), BatchSeconds * 1e6 / NumQueries);
+				Row.Add(TEXT("knn8_us_per_query"), KNearestSeconds * 1e6 / NumQueries);
+				Row.Add(TEXT("radius_graph_us_per_point"), GraphSeconds * 1e6 / NumPoints);
+				Row.Add(TEXT("move_us_per_point"), MoveSeconds * 1e6 / MovedIndices.Num());
+				Row.Add(TEXT("memory_bytes"), static_cast<double>(sizeof(FKdtreeInternal) + Tree.GetAllocatedSize()));
+				Row.Add(TEXT("verified"), bVerified ? TEXT("true") : TEXT("false"));
+			}
+
+			// The spatial hash with cells of the query radius and with cells derived from the density of the points.
+			for (const float CellSize : {Radius, 0.0f})
+			{
+				FSpatialHashBuildSettings Settings;
+				Settings.CellSize = CellSize;
+				FSpatialHashInternal Hash;
+				const double BuildSeconds = TimeAverage(MinSeconds, [&]() { KdtreeInternal::BuildSpatialHash(&Hash, Points, Settings); });
+
+				int64 NumHits = 0;
+				TArray<int> Result;
+				const double RadiusSeconds = TimeAverage(MinSeconds, [&]() {
+					NumHits = 0;
+					for (const FVector& Center : Centers)
+					{
+						Result.Reset();
+						KdtreeInternal::CollectFromSpatialHash(Hash, Center, Radius, &Result);
+						NumHits += Result.Num();
+					}
+				});
+
+				TArray<int> BatchIndices;
+				TArray<int> BatchOffsets;
+				const double BatchSeconds = TimeAverage(MinSeconds,
+					[&]() { KdtreeInternal::CollectFromSpatialHashBatch(Hash, Centers, {Radius}, &BatchIndices, &BatchOffsets); });
+
+				const double KNearestSeconds = TimeAverage(MinSeconds, [&]() {
+					for (const FVector& Center : Centers)
+					{
+						Result.Reset();
+						KdtreeInternal::FindKNearestInSpatialHash(Hash, Center, 8, 0.0f, &Result);
+					}
+				});
+
+				int NumMoveRuns = 0;
+				const double MoveSeconds = TimeAverage(MinSeconds, [&]() {
+					KdtreeInternal::UpdateSpatialHashPositions(&Hash, MovedIndices, MovedPositions[NumMoveRuns++ % 2]);
+				});
+
+				const bool bVerified = VerifyAgainstBruteForce(Hash, Centers, Radius);
+				if (!bVerified)
+				{
+					AddError(FString::Printf(TEXT("%s, %d points, spatial hash with cell size %f: results differ from brute force"),
+						GetDistributionName(Distribution), NumPoints, CellSize));
+				}
+
+				FBenchmarkRow& Row = Rows.AddDefaulted_GetRef();
+				Row.Add(TEXT("distribution"), GetDistributionName(Distribution));
+				Row.Add(TEXT("variant"), CellSize > 0.0f ? TEXT("spatial_hash_radius_cells") : TEXT("spatial_hash_auto_cells"));
+				Row.Add(TEXT("points"), NumPoints);
+				Row.Add(TEXT("queries"), NumQueries);
+				Row.Add(TEXT("cell_size"), Hash.CellSize);
+				Row.Add(TEXT("build_ms"), BuildSeconds * 1000.0);
+				Row.Add(TEXT("radius_us_per_query"), RadiusSeconds * 1e6 / NumQueries);
+				Row.Add(TEXT("radius_hits_per_query"), static_cast<double>(NumHits) / NumQueries);
+				Row.Add(TEXT("batch_us_per_query"), BatchSeconds * 1e6 / NumQueries);
+				Row.Add(TEXT("knn8_us_per_query"), KNearestSeconds * 1e6 / NumQueries);
+				Row.Add(TEXT("move_us_per_point"), MoveSeconds * 1e6 / MovedIndices.Num());
+				Row.Add(TEXT("memory_bytes"), static_cast<double>(sizeof(FSpatialHashInternal) + Hash.GetAllocatedSize()));
+				Row.Add(TEXT("verified"), bVerified ? TEXT("true") : TEXT("false"));
+			}
+
+			// Approximate queries on the default tree, with recall measured against its exact results.
+			FKdtreeInternal Tree;
+			KdtreeInternal::BuildKdtree(&Tree, Points);
+			TArray<TArray<int>> ExactRadius;
+			TArray<TArray<int>> ExactNearest;
+			for (const FVector& Center : Centers)
+			{
+				KdtreeInternal::CollectFromKdtree(Tree, Center, Radius, &ExactRadius.AddDefaulted_GetRef());
+				KdtreeInternal::FindKNearest(Tree, Center, 8, 0.0f, &ExactNearest.AddDefaulted_GetRef());
+			}
+
+			const TPair<float, int32> Approximations[] = {{0.25f, 0}, {0.5f, 0}, {1.0f, 0}, {2.0f, 0}, {0.0f, 16}, {0.0f, 32},
+				{0.0f, 64}, {0.0f, 128}, {0.5f, 32}};
+			for (const TPair<float, int32>& Limits : Approximations)
+			{
+				FKdtreeApproximation Approximation;
+				Approximation.Epsilon = Limits.Key;
+				Approximation.MaxVisitedNodes = Limits.Value;
+
+				TArray<TArray<int>> ApproximateRadius;
+				ApproximateRadius.SetNum(Centers.Num());
+				const double RadiusSeconds = TimeAverage(MinSeconds, [&]() {
+					for (int Query = 0; Query < Centers.Num(); ++Query)
+					{
+						ApproximateRadius[Query].Reset();
+						KdtreeInternal::CollectFromKdtreeApproximate(
+							Tree, Centers[Query], Radius, Approximation, &ApproximateRadius[Query]);
+					}
+				});
+
+				TArray<TArray<int>> ApproximateNearest;
+				ApproximateNearest.SetNum(Centers.Num());
+				const double KNearestSeconds = TimeAverage(MinSeconds, [&]() {
+					for (int Query = 0; Query < Centers.Num(); ++Query)
+					{
+						ApproximateNearest[Query].Reset();
+						KdtreeInternal::FindKNearestApproximate(
+							Tree, Centers[Query], 8, 0.0f, Approximation, &ApproximateNearest[Query]);
+					}
+				});
+
+				FBenchmarkRow& Row = Rows.AddDefaulted_GetRef();
+				Row.Add(TEXT("distribution"), GetDistributionName(Distribution));
+				Row.Add(TEXT("variant"), TEXT("kdtree_leaf16_approximate"));
+				Row.Add(TEXT("split_policy"), LexToString(Tree.SplitPolicy));
+				Row.Add(TEXT("points"), NumPoints);
+				Row.Add(TEXT("queries"), NumQueries);
+				Row.Add(TEXT("epsilon"), Approximation.Epsilon);
+				Row.Add(TEXT("max_visited_nodes"), Approximation.MaxVisitedNodes);
+				Row.Add(TEXT("radius_us_per_query"), RadiusSeconds * 1e6 / NumQueries);
+				Row.Add(TEXT("radius_recall"), GetRecall(ExactRadius, ApproximateRadius));
+				Row.Add(TEXT("knn8_us_per_query"), KNearestSeconds * 1e6 / NumQueries);
+				Row.Add(TEXT("knn8_recall"), GetRecall(ExactNearest, ApproximateNearest));
+				Row.Add(TEXT("memory_bytes"), static_cast<double>(sizeof(FKdtreeInternal) + Tree.GetAllocatedSize()));
+			}
+		}
+	}
+
+	SaveReport(Rows, FPaths::ProjectSavedDir() / TEXT("Kdtree") / TEXT("Benchmark-") + FDateTime::Now().ToString());
+	return !HasAnyErrors();
+}
+
+#endif	  // WITH_DEV_AUTOMATION_TESTS
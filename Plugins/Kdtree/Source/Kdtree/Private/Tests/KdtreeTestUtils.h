@@ -0,0 +1,268 @@
+/*!
+ * Kdtree
+ *
+ * Copyright (c) 2019-2023 nutti
+ *
+ * This software is released under the MIT License.
+ * https://opensource.org/licenses/MIT
+ */
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "../KdtreeInternal.h"
+#include "Math/RandomStream.h"
+
+namespace KdtreeTests
+{
+enum class EPointDistribution : uint8
+{
+	Uniform,
+	// Gaussian blobs around a few centers.
+	Clustered,
+	// Uniform points in ascending X order, the worst case for naive median picks and for incremental insertion.
+	Sorted,
+	// Few distinct positions, each repeated many times.
+	Duplicates,
+	// Uniform over the cube in X and Y but within 1% of it in Z, like scatter on terrain.
+	Flat,
+};
+
+inline const TCHAR* GetDistributionName(EPointDistribution Distribution)
+{
+	switch (Distribution)
+	{
+		case EPointDistribution::Uniform:
+			return TEXT("uniform");
+		case EPointDistribution::Clustered:
+			return TEXT("clustered");
+		case EPointDistribution::Sorted:
+			return TEXT("sorted");
+		case EPointDistribution::Duplicates:
+			return TEXT("duplicates");
+		case EPointDistribution::Flat:
+			return TEXT("flat");
+	}
+	return TEXT("unknown");
+}
+
+constexpr EPointDistribution AllDistributions[] = {EPointDistribution::Uniform, EPointDistribution::Clustered,
+	EPointDistribution::Sorted, EPointDistribution::Duplicates, EPointDistribution::Flat};
+
+// Extent of the cube the generated points lie in.
+constexpr double WorldSize = 10000.0;
+// Extent in Z of the flat distribution relative to WorldSize.
+constexpr double FlatThickness = 0.01;
+
+inline TArray<FVector> MakePoints(EPointDistribution Distribution, int NumPoints, int32 Seed)
+{
+	FRandomStream Random(Seed);
+	TArray<FVector> Points;
+	Points.Reserve(NumPoints);
+	switch (Distribution)
+	{
+		case EPointDistribution::Uniform:
+		case EPointDistribution::Sorted:
+			for (int Index = 0; Index < NumPoints; ++Index)
+			{
+				Points.Add(FVector(Random.FRand(), Random.FRand(), Random.FRand()) * WorldSize);
+			}
+			if (Distribution == EPointDistribution::Sorted)
+			{
+				Points.Sort([](const FVector& Lhs, const FVector& Rhs) { return Lhs.X < Rhs.X; });
+			}
+			break;
+		case EPointDistribution::Clustered:
+		{
+			TArray<FVector> Centers;
+			for (int Cluster = 0; Cluster < 16; ++Cluster)
+			{
+				Centers.Add(FVector(Random.FRand(), Random.FRand(), Random.FRand()) * WorldSize);
+			}
+			for (int Index = 0; Index < NumPoints; ++Index)
+			{
+				// Sum of uniforms as a cheap approximation of a normal distribution.
+				const FVector Offset(Random.FRand() + Random.FRand() + Random.FRand() - 1.5,
+					Random.FRand() + Random.FRand() + Random.FRand() - 1.5, Random.FRand() + Random.FRand() + Random.FRand() - 1.5);
+				Points.Add(Centers[Random.RandHelper(Centers.Num())] + Offset * WorldSize * 0.02);
+			}
+			break;
+		}
+		case EPointDistribution::Duplicates:
+		{
+			const int NumDistinct = FMath::Max(1, NumPoints / 64);
+			TArray<FVector> Distinct;
+			for (int Index = 0; Index < NumDistinct; ++Index)
+			{
+				Distinct.Add(FVector(Random.FRand(), Random.FRand(), Random.FRand()) * WorldSize);
+			}
+			for (int Index = 0; Index < NumPoints; ++Index)
+			{
+				Points.Add(Distinct[Random.RandHelper(NumDistinct)]);
+			}
+			break;
+		}
+		case EPointDistribution::Flat:
+			for (int Index = 0; Index < NumPoints; ++Index)
+			{
+				Points.Add(FVector(Random.FRand(), Random.FRand(), Random.FRand() * FlatThickness) * WorldSize);
+			}
+			break;
+	}
+	return Points;
+}
+
+// Query centers: half of them on data points, half anywhere in the bounding box of the points.
+inline TArray<FVector> MakeQueryCenters(const TArray<FVector>& Points, int NumQueries, int32 Seed)
+{
+	FVector Min = Points.Num() > 0 ? Points[0] : FVector(0.0);
+	FVector Max = Points.Num() > 0 ? Points[0] : FVector(WorldSize);
+	for (const FVector& Point : Points)
+	{
+		for (int32 Axis = 0; Axis < 3; ++Axis)
+		{
+			Min[Axis] = FMath::Min(Min[Axis], Point[Axis]);
+			Max[Axis] = FMath::Max(Max[Axis], Point[Axis]);
+		}
+	}
+
+	FRandomStream Random(Seed);
+	TArray<FVector> Centers;
+	Centers.Reserve(NumQueries);
+	for (int Query = 0; Query < NumQueries; ++Query)
+	{
+		if (Query % 2 == 0 && Points.Num() > 0)
+		{
+			Centers.Add(Points[Random.RandHelper(Points.Num())]);
+		}
+		else
+		{
+			Centers.Add(Min + FVector(Random.FRand(), Random.FRand(), Random.FRand()) * (Max - Min));
+		}
+	}
+	return Centers;
+}
+
+// Radius that catches about ExpectedHits of NumPoints points of the distribution, assuming they are spread uniformly.
+inline float GetRadiusForHits(int NumPoints, double ExpectedHits, EPointDistribution Distribution = EPointDistribution::Uniform)
+{
+	const double Thickness = Distribution == EPointDistribution::Flat ? WorldSize * FlatThickness : WorldSize;
+	const double Volume = WorldSize * WorldSize * Thickness * ExpectedHits / FMath::Max(NumPoints, 1);
+	const double Radius = FMath::Pow(Volume * 3.0 / (4.0 * PI), 1.0 / 3.0);
+	// Spheres thicker than the slab of flat points catch the points of a disk.
+	if (Distribution == EPointDistribution::Flat && 2.0 * Radius > Thickness)
+	{
+		return static_cast<float>(FMath::Sqrt(Volume / (PI * Thickness)));
+	}
+	return static_cast<float>(Radius);
+}
+
+// Tree over Points with leaves of LeafSize points, of which the ones at 0, RemoveStride, 2 * RemoveStride and so on are
+// removed again, at most NumRemoved of them, so queries also run past removed points. Nothing is removed for a
+// RemoveStride of 0.
+inline FKdtreeInternal MakeTestTreeWithHoles(
+	const TArray<FVector>& Points, int32 LeafSize, int32 RemoveStride = 0, int32 NumRemoved = MAX_int32)
+{
+	FKdtreeBuildSettings Settings;
+	Settings.LeafSize = LeafSize;
+	FKdtreeInternal Tree;
+	KdtreeInternal::BuildKdtree(&Tree, Points, Settings);
+	for (int32 Step = 0; RemoveStride > 0 && Step < NumRemoved && Step * RemoveStride < Points.Num(); ++Step)
+	{
+		KdtreeInternal::RemovePoint(&Tree, Step * RemoveStride);
+	}
+	return Tree;
+}
+
+// Inserts NumSteps points picked from Extra and removes as many random indices, some of them removed already.
+inline void ChurnPoints(FKdtreeInternal* Tree, const TArray<FVector>& Extra, int32 NumSteps, FRandomStream& Random)
+{
+	for (int32 Step = 0; Step < NumSteps; ++Step)
+	{
+		KdtreeInternal::InsertPoint(Tree, Extra[Random.RandHelper(Extra.Num())]);
+		KdtreeInternal::RemovePoint(Tree, Random.RandHelper(Tree->Data.Num()));
+	}
+}
+
+inline void ChurnPoints(FSpatialHashInternal* Hash, const TArray<FVector>& Extra, int32 NumSteps, FRandomStream& Random)
+{
+	for (int32 Step = 0; Step < NumSteps; ++Step)
+	{
+		KdtreeInternal::InsertIntoSpatialHash(Hash, Extra[Random.RandHelper(Extra.Num())]);
+		KdtreeInternal::RemoveFromSpatialHash(Hash, Random.RandHelper(Hash->Data.Num()));
+	}
+}
+
+// Brute-force reference for the queries. Points flagged in Removed are skipped.
+
+inline TArray<int> BruteForceCollect(const TArray<FVector>& Points, const TBitArray<>& Removed, const FVector& Center, float Radius)
+{
+	TArray<int> Result;
+	const double RadiusSquared = FMath::Square(static_cast<double>(Radius));
+	for (int Index = 0; Index < Points.Num(); ++Index)
+	{
+		if (!Removed[Index] && FVector::DistSquared(Points[Index], Center) < RadiusSquared)
+		{
+			Result.Add(Index);
+		}
+	}
+	return Result;
+}
+
+// Squared distances of the K nearest points, nearest first. Ties make the indices ambiguous, the distances are not.
+inline TArray<double> BruteForceKNearestDistances(
+	const TArray<FVector>& Points, const TBitArray<>& Removed, const FVector& Center, int K, float MaxDistance)
+{
+	const double MaxDistSquared = MaxDistance > 0.0f ? FMath::Square(static_cast<double>(MaxDistance)) : TNumericLimits<double>::Max();
+	TArray<double> Distances;
+	for (int Index = 0; Index < Points.Num(); ++Index)
+	{
+		const double DistSquared = FVector::DistSquared(Points[Index], Center);
+		if (!Removed[Index] && DistSquared < MaxDistSquared)
+		{
+			Distances.Add(DistSquared);
+		}
+	}
+	Distances.Sort();
+	Distances.SetNum(FMath::Min(K, Distances.Num()));
+	return Distances;
+}
+
+inline TArray<double> GetDistances(const TArray<FVector>& Points, const TArray<int>& Indices, const FVector& Center)
+{
+	TArray<double> Distances;
+	for (const int Index : Indices)
+	{
+		Distances.Add(FVector::DistSquared(Points[Index], Center));
+	}
+	return Distances;
+}
+
+// Distances computed along different code paths can differ in the last bits, e.g. where one of them uses FMA.
+inline bool AreDistancesNearlyEqual(const TArray<double>& Lhs, const TArray<double>& Rhs)
+{
+	if (Lhs.Num() != Rhs.Num())
+	{
+		return false;
+	}
+	for (int Index = 0; Index < Lhs.Num(); ++Index)
+	{
+		if (!FMath::IsNearlyEqual(Lhs[Index], Rhs[Index], 1e-9 * FMath::Max(1.0, Rhs[Index])))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+inline TArray<int> Sorted(TArray<int> Indices)
+{
+	Indices.Sort();
+	return Indices;
+}
+}	 // namespace KdtreeTests
+
+#endif	  // WITH_DEV_AUTOMATION_TESTS
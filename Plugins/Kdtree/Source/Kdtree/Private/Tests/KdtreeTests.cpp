@@ -0,0 +1,1124 @@
+/*!
+ * Kdtree
+ *
+ * Copyright (c) 2019-2023 nutti
+ *
+ * This software is released under the MIT License.
+ * https://opensource.org/licenses/MIT
+ */
+
+#include "KdtreeTestUtils.h"
+#include "Misc/AutomationTest.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+using namespace KdtreeTests;
+
+namespace
+{
+// Checks every query type at the given centers against brute force. Returns false after the first mismatch.
+bool CheckQueries(FAutomationTestBase& Test, const FString& Context, const FKdtreeInternal& Tree, const TArray<FVector>& Centers,
+	float Radius)
+{
+	const TBitArray<>& Removed = Tree.RemovedPoints;
+	for (int Query = 0; Query < Centers.Num(); ++Query)
+	{
+		const FVector& Center = Centers[Query];
+
+		TArray<int> Collected;
+		KdtreeInternal::CollectFromKdtree(Tree, Center, Radius, &Collected);
+		const TArray<int> Expected = BruteForceCollect(Tree.Data, Removed, Center, Radius);
+		if (Sorted(Collected) != Expected)
+		{
+			Test.AddError(FString::Printf(TEXT("%s: radius query %d differs from brute force"), *Context, Query));
+			return false;
+		}
+
+		TArray<int> Visited;
+		KdtreeInternal::ForEachInRadius(Tree, Center, Radius, [&Visited](int Index) { Visited.Add(Index); });
+		if (Sorted(Visited) != Expected || KdtreeInternal::CountInRadius(Tree, Center, Radius) != Expected.Num() ||
+			KdtreeInternal::AnyInRadius(Tree, Center, Radius) != (Expected.Num() > 0))
+		{
+			Test.AddError(FString::Printf(TEXT("%s: visitor, count or any query %d differs from brute force"), *Context, Query));
+			return false;
+		}
+
+		// Queries stopped early must return only points in range, and exactly as many as asked for.
+		int Buffer[5];
+		const int32 NumInBuffer = KdtreeInternal::CollectFromKdtreeToBuffer(Tree, Center, Radius, MakeArrayView(Buffer));
+		int32 NumVisited = 0;
+		const bool bCompleted = KdtreeInternal::ForEachInRadius(Tree, Center, Radius, [&NumVisited](int) { return ++NumVisited < 3; });
+		bool bBufferInRange = true;
+		for (int32 Offset = 0; Offset < NumInBuffer; ++Offset)
+		{
+			bBufferInRange &= Expected.Contains(Buffer[Offset]);
+		}
+		if (NumInBuffer != FMath::Min(Expected.Num(), 5) || !bBufferInRange || NumVisited != FMath::Min(Expected.Num(), 3) ||
+			bCompleted != (Expected.Num() < 3))
+		{
+			Test.AddError(FString::Printf(TEXT("%s: early stopping radius query %d is wrong"), *Context, Query));
+			return false;
+		}
+
+		for (const float MaxDistance : {0.0f, Radius})
+		{
+			TArray<int> Nearest;
+			KdtreeInternal::FindKNearest(Tree, Center, 8, MaxDistance, &Nearest);
+			if (!AreDistancesNearlyEqual(
+					GetDistances(Tree.Data, Nearest, Center), BruteForceKNearestDistances(Tree.Data, Removed, Center, 8, MaxDistance)))
+			{
+				Test.AddError(FString::Printf(TEXT("%s: k-nearest query %d differs from brute force"), *Context, Query));
+				return false;
+			}
+
+			const int Index = KdtreeInternal::FindNearest(Tree, Center, MaxDistance);
+			const TArray<double> ExpectedNearest = BruteForceKNearestDistances(Tree.Data, Removed, Center, 1, MaxDistance);
+			const TArray<double> Found = Index != INDEX_NONE ? TArray<double>{FVector::DistSquared(Tree.Data[Index], Center)} : TArray<double>();
+			if (!AreDistancesNearlyEqual(Found, ExpectedNearest))
+			{
+				Test.AddError(FString::Printf(TEXT("%s: nearest query %d differs from brute force"), *Context, Query));
+				return false;
+			}
+		}
+	}
+
+	TArray<int> BatchIndices;
+	TArray<int> BatchOffsets;
+	KdtreeInternal::CollectFromKdtreeBatch(Tree, Centers, {Radius}, &BatchIndices, &BatchOffsets);
+	for (int Query = 0; Query < Centers.Num(); ++Query)
+	{
+		TArray<int> Collected;
+		KdtreeInternal::CollectFromKdtree(Tree, Centers[Query], Radius, &Collected);
+		const TArray<int> FromBatch(BatchIndices.GetData() + BatchOffsets[Query], BatchOffsets[Query + 1] - BatchOffsets[Query]);
+		if (Sorted(FromBatch) != Sorted(Collected))
+		{
+			Test.AddError(FString::Printf(TEXT("%s: batch query %d differs from the single query"), *Context, Query));
+			return false;
+		}
+	}
+	return true;
+}
+
+// A freshly built tree split at medians is as deep as a perfectly balanced one up to rounding.
+void CheckSummary(FAutomationTestBase& Test, const FString& Context, const FKdtreeInternal& Tree)
+{
+	const FKdtreeSummary Summary = KdtreeInternal::GetKdtreeSummary(Tree);
+	int32 NumNodes = 0;
+	for (const int32 NumAtDepth : Summary.NodesPerDepth)
+	{
+		NumNodes += NumAtDepth;
+	}
+	Test.TestEqual(*FString::Printf(TEXT("%s: summary points"), *Context), Summary.NumPoints, Tree.Data.Num());
+	Test.TestEqual(*FString::Printf(TEXT("%s: summary nodes"), *Context), NumNodes, Summary.NumNodes);
+	Test.TestEqual(*FString::Printf(TEXT("%s: summary bytes"), *Context), Summary.AllocatedBytes,
+		static_cast<int64>(sizeof(FKdtreeInternal) + Tree.GetAllocatedSize()));
+	Test.TestEqual(*FString::Printf(TEXT("%s: summary split policy"), *Context), Summary.SplitPolicy, Tree.SplitPolicy);
+	if (Summary.NumNodes > 0 && KdtreeInternal::Private::IsBalancedSplitPolicy(Tree.SplitPolicy))
+	{
+		Test.TestTrue(*FString::Printf(TEXT("%s: balance factor %f"), *Context, Summary.BalanceFactor), Summary.BalanceFactor <= 1.25f);
+	}
+}
+}	 // namespace
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FKdtreeQueryTest, "Plugins.Kdtree.Queries",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FKdtreeQueryTest::RunTest(const FString& Parameters)
+{
+	for (const EPointDistribution Distribution : AllDistributions)
+	{
+		for (const int NumPoints : {0, 1, 7, 1000, 20000})
+		{
+			for (const int LeafSize : {0, 1, 16})
+			{
+				const FString Context =
+					FString::Printf(TEXT("%s, %d points, leaf size %d"), GetDistributionName(Distribution), NumPoints, LeafSize);
+				const TArray<FVector> Points = MakePoints(Distribution, NumPoints, 1);
+				const FKdtreeInternal Tree = MakeTestTreeWithHoles(Points, LeafSize);
+				CheckQueries(*this, Context, Tree, MakeQueryCenters(Points, 50, 2), GetRadiusForHits(NumPoints, 20.0, Distribution));
+				CheckSummary(*this, Context, Tree);
+			}
+		}
+	}
+
+	// K is bounded by the live points instead of sizing anything after it.
+	const TArray<FVector> Points = MakePoints(EPointDistribution::Uniform, 1000, 1);
+	const FKdtreeInternal Tree = MakeTestTreeWithHoles(Points, 16, 4);
+	TArray<int> All;
+	TArray<int> AllFiltered;
+	TArray<int> AllApproximate;
+	KdtreeInternal::FindKNearest(Tree, Points[1], MAX_int32, 0.0f, &All);
+	KdtreeInternal::FindKNearestFiltered(Tree, Points[1], MAX_int32, 0.0f, [](int) { return true; }, &AllFiltered);
+	KdtreeInternal::FindKNearestApproximate(Tree, Points[1], MAX_int32, 0.0f, FKdtreeApproximation(), &AllApproximate);
+	TestEqual(TEXT("Huge K finds every live point"), All.Num(), 750);
+	TestEqual(TEXT("Huge K finds every live point through a filter"), AllFiltered.Num(), 750);
+	TestEqual(TEXT("Huge K finds every live point approximately"), AllApproximate.Num(), 750);
+
+	// A far point makes the squared distances to the boxes near the root much larger than the radius.
+	TArray<FVector> Spread = MakePoints(EPointDistribution::Uniform, 1000, 2);
+	Spread.Add(FVector(1e12, 0.0, 0.0));
+	const FKdtreeInternal SpreadTree = MakeTestTreeWithHoles(Spread, 0);
+	CheckQueries(*this, TEXT("Far point"), SpreadTree, MakeQueryCenters(Points, 30, 3),
+		GetRadiusForHits(1000, 20.0, EPointDistribution::Uniform));
+	return !HasAnyErrors();
+}
+
+namespace
+{
+template <typename ShapeType>
+bool CheckShape(FAutomationTestBase& Test, const FString& Context, const FKdtreeInternal& Tree, const ShapeType& Shape)
+{
+	TArray<int> Expected;
+	for (int Index = 0; Index < Tree.Data.Num(); ++Index)
+	{
+		if (!Tree.RemovedPoints[Index] && Shape.Contains(Tree.Data[Index]))
+		{
+			Expected.Add(Index);
+		}
+	}
+
+	TArray<int> Collected;
+	KdtreeInternal::CollectInShape(Tree, Shape, &Collected);
+	if (Sorted(Collected) != Expected || KdtreeInternal::CountInShape(Tree, Shape) != Expected.Num() ||
+		KdtreeInternal::AnyInShape(Tree, Shape) != (Expected.Num() > 0))
+	{
+		Test.AddError(FString::Printf(TEXT("%s: found %d points, brute force %d"), *Context, Collected.Num(), Expected.Num()));
+		return false;
+	}
+	return true;
+}
+}	 // namespace
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FKdtreeShapeTest, "Plugins.Kdtree.Shapes",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FKdtreeShapeTest::RunTest(const FString& Parameters)
+{
+	for (const EPointDistribution Distribution : AllDistributions)
+	{
+		for (const int LeafSize : {0, 16})
+		{
+			const TArray<FVector> Points = MakePoints(Distribution, 20000, 6);
+			const FKdtreeInternal Tree = MakeTestTreeWithHoles(Points, LeafSize, 37, 200);
+
+			FRandomStream Random(7);
+			const TArray<FVector> Centers = MakeQueryCenters(Points, 20, 8);
+			for (int Query = 0; Query < Centers.Num(); ++Query)
+			{
+				const FString Context =
+					FString::Printf(TEXT("%s, leaf size %d, query %d"), GetDistributionName(Distribution), LeafSize, Query);
+				const FVector& Center = Centers[Query];
+				const FVector Extent(Random.FRandRange(10.0, 1500.0), Random.FRandRange(10.0, 1500.0), Random.FRandRange(10.0, 1500.0));
+				const FQuat Rotation = FRotator(Random.FRandRange(-180.0, 180.0), Random.FRandRange(-180.0, 180.0),
+					Random.FRandRange(-180.0, 180.0)).Quaternion();
+
+				const bool bPassed =
+					CheckShape(*this, Context + TEXT(", box"), Tree, FKdtreeBoxShape{Center - Extent, Center + Extent}) &&
+					CheckShape(*this, Context + TEXT(", oriented box"), Tree, FKdtreeOrientedBoxShape(Center, Rotation, Extent)) &&
+					CheckShape(*this, Context + TEXT(", capsule"), Tree,
+						FKdtreeCapsuleShape{Center - Rotation.GetAxisX() * Extent.X, Center + Rotation.GetAxisX() * Extent.X, Extent.Y}) &&
+					CheckShape(*this, Context + TEXT(", point capsule"), Tree, FKdtreeCapsuleShape{Center, Center, Extent.Z}) &&
+					CheckShape(*this, Context + TEXT(", frustum"), Tree,
+						FKdtreeConvexShape::MakeFrustum(Center - Rotation.GetAxisX() * Extent.X, Rotation,
+							FMath::DegreesToRadians(Random.FRandRange(20.0, 60.0)), Random.FRandRange(0.5, 2.0), 10.0, Extent.Y * 2.0));
+				if (!bPassed)
+				{
+					break;
+				}
+			}
+		}
+	}
+	return !HasAnyErrors();
+}
+
+namespace
+{
+// Distance along Path to the first point closer than Radius to it, or -1 if there is none.
+double BruteForceFirstAlongPath(const FKdtreeInternal& Tree, const TArray<FVector>& Path, float Radius)
+{
+	double PathLength = 0.0;
+	for (int Segment = 0; Segment + 1 < Path.Num(); ++Segment)
+	{
+		const FVector Direction = Path[Segment + 1] - Path[Segment];
+		double FirstTime = TNumericLimits<double>::Max();
+		for (int Index = 0; Index < Tree.Data.Num(); ++Index)
+		{
+			const FVector Offset = Tree.Data[Index] - Path[Segment];
+			const double Time = Direction.IsZero() ? 0.0 : FMath::Clamp((Offset | Direction) / Direction.SizeSquared(), 0.0, 1.0);
+			if (!Tree.RemovedPoints[Index] && (Offset - Direction * Time).SizeSquared() < FMath::Square(Radius))
+			{
+				FirstTime = FMath::Min(FirstTime, Time);
+			}
+		}
+		if (FirstTime != TNumericLimits<double>::Max())
+		{
+			return PathLength + FirstTime * Direction.Size();
+		}
+		PathLength += Direction.Size();
+	}
+	return -1.0;
+}
+
+bool CheckPath(FAutomationTestBase& Test, const FString& Context, const FKdtreeInternal& Tree, const TArray<FVector>& Path, float Radius)
+{
+	const double Expected = BruteForceFirstAlongPath(Tree, Path, Radius);
+	FVector::FReal Distance = -1.0;
+	const int Index = KdtreeInternal::FindFirstAlongPath(Tree, MakeArrayView(Path), Radius, &Distance);
+	// Ties along the path make the index ambiguous, the distance is not.
+	const bool bPassed = Index == INDEX_NONE ? Expected < 0.0
+											 : !Tree.RemovedPoints[Index] && FMath::IsNearlyEqual(Distance, Expected, 1e-6);
+	if (!bPassed)
+	{
+		Test.AddError(FString::Printf(TEXT("%s: found %d at %f, brute force %f"), *Context, Index, Distance, Expected));
+	}
+	return bPassed;
+}
+}	 // namespace
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FKdtreePathTest, "Plugins.Kdtree.Paths",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FKdtreePathTest::RunTest(const FString& Parameters)
+{
+	for (const EPointDistribution Distribution : AllDistributions)
+	{
+		for (const int LeafSize : {0, 16})
+		{
+			const TArray<FVector> Points = MakePoints(Distribution, 20000, 9);
+			const FKdtreeInternal Tree = MakeTestTreeWithHoles(Points, LeafSize, 37, 200);
+
+			FRandomStream Random(10);
+			const TArray<FVector> Starts = MakeQueryCenters(Points, 20, 11);
+			for (int Query = 0; Query < Starts.Num(); ++Query)
+			{
+				const FString Context =
+					FString::Printf(TEXT("%s, leaf size %d, query %d"), GetDistributionName(Distribution), LeafSize, Query);
+				const float Radius = Random.FRandRange(1.0, 100.0);
+
+				// A thrown arc sampled like a predicted projectile path.
+				TArray<FVector> Path;
+				const FVector Velocity = Random.GetUnitVector() * 2000.0;
+				for (int Sample = 0; Sample < 30; ++Sample)
+				{
+					const double Time = Sample * 0.1;
+					Path.Add(Starts[Query] + Velocity * Time + FVector(0.0, 0.0, -490.0) * Time * Time);
+				}
+
+				const FVector Direction = Random.GetUnitVector();
+				FVector::FReal RayDistance = -1.0;
+				const int RayIndex = KdtreeInternal::FindFirstAlongRay(Tree, Starts[Query], Direction, 0.0f, Radius, &RayDistance);
+				const double ExpectedRay =
+					BruteForceFirstAlongPath(Tree, {Starts[Query], Starts[Query] + Direction * WorldSize * 2.0}, Radius);
+				if (RayIndex == INDEX_NONE ? ExpectedRay >= 0.0 : !FMath::IsNearlyEqual(RayDistance, ExpectedRay, 1e-6))
+				{
+					AddError(FString::Printf(TEXT("%s, ray: found %d at %f, brute force %f"), *Context, RayIndex, RayDistance, ExpectedRay));
+					break;
+				}
+
+				const bool bPassed = CheckPath(*this, Context + TEXT(", segment"), Tree, {Path[0], Path[5]}, Radius) &&
+									 CheckPath(*this, Context + TEXT(", path"), Tree, Path, Radius) &&
+									 CheckPath(*this, Context + TEXT(", point"), Tree, {Path[0], Path[0]}, Radius * 10.0f);
+				if (!bPassed)
+				{
+					break;
+				}
+			}
+		}
+	}
+	return !HasAnyErrors();
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FKdtreeNeighborGraphTest, "Plugins.Kdtree.NeighborGraph",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FKdtreeNeighborGraphTest::RunTest(const FString& Parameters)
+{
+	for (const EPointDistribution Distribution : AllDistributions)
+	{
+		for (const int LeafSize : {0, 1, 16})
+		{
+			const FString Context = FString::Printf(TEXT("%s, leaf size %d"), GetDistributionName(Distribution), LeafSize);
+			const TArray<FVector> Points = MakePoints(Distribution, 2000, 12);
+			FKdtreeInternal Tree = MakeTestTreeWithHoles(Points, LeafSize, 29, 100);
+			for (int Step = 0; Step < 100; ++Step)
+			{
+				KdtreeInternal::InsertPoint(&Tree, Points[Step * 13] + FVector(1.0));
+			}
+
+			const float Radius = GetRadiusForHits(Points.Num(), 10.0, Distribution);
+			FKdtreeNeighborGraph RadiusGraph;
+			KdtreeInternal::BuildRadiusNeighborGraph(Tree, Radius, &RadiusGraph);
+			FKdtreeNeighborGraph KNearestGraph;
+			KdtreeInternal::BuildKNearestNeighborGraph(Tree, 6, 0.0f, &KNearestGraph);
+			if (RadiusGraph.Offsets.Num() != Tree.Data.Num() + 1 || KNearestGraph.Offsets.Num() != Tree.Data.Num() + 1)
+			{
+				AddError(FString::Printf(TEXT("%s: graphs have %d and %d rows for %d points"), *Context, RadiusGraph.Offsets.Num() - 1,
+					KNearestGraph.Offsets.Num() - 1, Tree.Data.Num()));
+				continue;
+			}
+
+			for (int Index = 0; Index < Tree.Data.Num(); ++Index)
+			{
+				const bool bRemoved = Tree.RemovedPoints[Index];
+				TArray<int> Expected = bRemoved ? TArray<int>() : BruteForceCollect(Tree.Data, Tree.RemovedPoints, Tree.Data[Index], Radius);
+				Expected.Remove(Index);
+				if (Sorted(TArray<int>(RadiusGraph.GetNeighbors(Index))) != Expected)
+				{
+					AddError(FString::Printf(TEXT("%s: radius neighbors of point %d differ from brute force"), *Context, Index));
+					break;
+				}
+
+				// The point itself is one of the nearest at distance 0.
+				TArray<double> ExpectedNearest =
+					bRemoved ? TArray<double>() : BruteForceKNearestDistances(Tree.Data, Tree.RemovedPoints, Tree.Data[Index], 7, 0.0f);
+				if (ExpectedNearest.Num() > 0)
+				{
+					ExpectedNearest.RemoveAt(0);
+				}
+				const TArrayView<const int32> Nearest = KNearestGraph.GetNeighbors(Index);
+				if (Nearest.Contains(Index) ||
+					!AreDistancesNearlyEqual(GetDistances(Tree.Data, TArray<int>(Nearest), Tree.Data[Index]), ExpectedNearest))
+				{
+					AddError(FString::Printf(TEXT("%s: k-nearest neighbors of point %d differ from brute force"), *Context, Index));
+					break;
+				}
+			}
+		}
+	}
+
+	// A K beyond the number of points links every point to all others.
+	FKdtreeInternal Tree;
+	KdtreeInternal::BuildKdtree(&Tree, MakePoints(EPointDistribution::Uniform, 50, 13));
+	FKdtreeNeighborGraph Graph;
+	KdtreeInternal::BuildKNearestNeighborGraph(Tree, MAX_int32, 0.0f, &Graph);
+	TestEqual(TEXT("Huge K links every pair"), Graph.Neighbors.Num(), 50 * 49);
+	return !HasAnyErrors();
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FKdtreeSplitPolicyTest, "Plugins.Kdtree.SplitPolicies",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FKdtreeSplitPolicyTest::RunTest(const FString& Parameters)
+{
+	for (const EKdtreeSplitPolicy Policy : {EKdtreeSplitPolicy::MaxSpread, EKdtreeSplitPolicy::SlidingMidpoint,
+			 EKdtreeSplitPolicy::SurfaceAreaHeuristic})
+	{
+		for (const EPointDistribution Distribution : AllDistributions)
+		{
+			// 20000 points are built in parallel, which leaves gaps to compact in unbalanced trees.
+			for (const int NumPoints : {1, 1000, 20000})
+			{
+				for (const int LeafSize : {0, 16})
+				{
+					const FString Context = FString::Printf(TEXT("%s, %s, %d points, leaf size %d"), LexToString(Policy),
+						GetDistributionName(Distribution), NumPoints, LeafSize);
+					const TArray<FVector> Points = MakePoints(Distribution, NumPoints, 13);
+					const float Radius = GetRadiusForHits(NumPoints, 20.0, Distribution);
+					FKdtreeBuildSettings Settings;
+					Settings.LeafSize = LeafSize;
+					Settings.SplitPolicy = Policy;
+					Settings.ExpectedQueryRadius = Radius;
+					FKdtreeInternal Tree;
+					KdtreeInternal::BuildKdtree(&Tree, Points, Settings);
+					CheckSummary(*this, Context, Tree);
+					if (!CheckQueries(*this, Context, Tree, MakeQueryCenters(Points, 30, 14), Radius))
+					{
+						continue;
+					}
+
+					// Edits rebuild subtrees with balanced splits, mixing them with the ones of the policy.
+					FRandomStream Random(15);
+					for (int Step = 0; Step < NumPoints / 4; ++Step)
+					{
+						KdtreeInternal::RemovePoint(&Tree, Random.RandHelper(Tree.Data.Num()));
+						KdtreeInternal::InsertPoint(&Tree, Points[Random.RandHelper(NumPoints)] + FVector(Random.FRandRange(-1.0, 1.0)));
+					}
+					CheckQueries(*this, Context + TEXT(", edited"), Tree, MakeQueryCenters(Points, 30, 16), Radius);
+				}
+			}
+		}
+	}
+
+	// Geometrically spaced points make unbalanced policies peel off one point per level, until the depth limit falls
+	// back to median splits.
+	TArray<FVector> Spaced;
+	TArray<FVector> SpacedCenters;
+	FRandomStream Random(17);
+	for (int32 Exponent = 0; Exponent < 40; ++Exponent)
+	{
+		Spaced.Add(FVector(FMath::Pow(2.0, Exponent), Random.FRand(), Random.FRand()));
+		SpacedCenters.Add(FVector(FMath::Pow(2.0, Exponent) + 0.5, 0.5, 0.5));
+	}
+	for (const EKdtreeSplitPolicy Policy : {EKdtreeSplitPolicy::SlidingMidpoint, EKdtreeSplitPolicy::SurfaceAreaHeuristic})
+	{
+		const FString Context = FString::Printf(TEXT("%s, geometrically spaced points"), LexToString(Policy));
+		FKdtreeBuildSettings Settings;
+		Settings.LeafSize = 0;
+		Settings.SplitPolicy = Policy;
+		FKdtreeInternal Tree;
+		KdtreeInternal::BuildKdtree(&Tree, Spaced, Settings);
+		CheckSummary(*this, Context, Tree);
+		const int32 MaxDepth = KdtreeInternal::Private::GetMaxUnbalancedDepth(Spaced.Num()) +
+							   static_cast<int32>(FMath::CeilLogTwo(static_cast<uint32>(Spaced.Num()))) + 1;
+		const int32 Depth = KdtreeInternal::GetKdtreeSummary(Tree).NodesPerDepth.Num();
+		TestTrue(*FString::Printf(TEXT("%s: depth %d is at most %d"), *Context, Depth, MaxDepth), Depth <= MaxDepth);
+		CheckQueries(*this, Context, Tree, SpacedCenters, 1.0f);
+	}
+	return !HasAnyErrors();
+}
+
+namespace
+{
+// Brute-force references filter by treating the points that fail the filter as removed.
+template <typename FilterType>
+TBitArray<> GetRejectedPoints(const FKdtreeInternal& Tree, const FilterType& Filter)
+{
+	TBitArray<> Rejected = Tree.RemovedPoints;
+	for (int Index = 0; Index < Tree.Data.Num(); ++Index)
+	{
+		Rejected[Index] = Rejected[Index] || !Filter(Index);
+	}
+	return Rejected;
+}
+
+bool CheckFilteredQueries(FAutomationTestBase& Test, const FString& Context, const FKdtreeInternal& Tree,
+	const TArray<FVector>& Centers, float Radius, const FKdtreeMaskFilter& MaskFilter)
+{
+	const TFunction<bool(int)> Predicate = [](int Index) { return Index % 3 == 0; };
+	const TBitArray<> MaskRejected =
+		GetRejectedPoints(Tree, [&](int Index) { return MaskFilter.Matches(KdtreeInternal::GetPointMask(Tree, Index)); });
+	const TBitArray<> PredicateRejected = GetRejectedPoints(Tree, Predicate);
+	for (int Query = 0; Query < Centers.Num(); ++Query)
+	{
+		const FVector& Center = Centers[Query];
+		TArray<int> Masked;
+		KdtreeInternal::CollectFromKdtreeFiltered(Tree, Center, Radius, MaskFilter, &Masked);
+		TArray<int> Predicated;
+		KdtreeInternal::CollectFromKdtreeFiltered(Tree, Center, Radius, Predicate, &Predicated);
+		if (Sorted(Masked) != BruteForceCollect(Tree.Data, MaskRejected, Center, Radius) ||
+			Sorted(Predicated) != BruteForceCollect(Tree.Data, PredicateRejected, Center, Radius))
+		{
+			Test.AddError(FString::Printf(TEXT("%s: filtered radius query %d differs from brute force"), *Context, Query));
+			return false;
+		}
+
+		TArray<int> Nearest;
+		KdtreeInternal::FindKNearestFiltered(Tree, Center, 8, 0.0f, MaskFilter, &Nearest);
+		const TArray<double> Expected = BruteForceKNearestDistances(Tree.Data, MaskRejected, Center, 8, 0.0f);
+		const int Single = KdtreeInternal::FindNearestFiltered(Tree, Center, 0.0f, Predicate);
+		const TArray<double> ExpectedSingle = BruteForceKNearestDistances(Tree.Data, PredicateRejected, Center, 1, 0.0f);
+		if (!AreDistancesNearlyEqual(GetDistances(Tree.Data, Nearest, Center), Expected) ||
+			(Single == INDEX_NONE ? ExpectedSingle.Num() != 0
+								  : !AreDistancesNearlyEqual(GetDistances(Tree.Data, {Single}, Center), ExpectedSingle)))
+		{
+			Test.AddError(FString::Printf(TEXT("%s: filtered nearest query %d differs from brute force"), *Context, Query));
+			return false;
+		}
+	}
+	return true;
+}
+}	 // namespace
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FKdtreeMaskTest, "Plugins.Kdtree.Masks",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FKdtreeMaskTest::RunTest(const FString& Parameters)
+{
+	// Bit 0 for every point, bits 1 to 4 for a quarter of them each and bit 5 only for the points in one corner.
+	FKdtreeMaskFilter CategoryFilter;
+	CategoryFilter.IncludeMask = 1 << 2;
+	FKdtreeMaskFilter CornerFilter;
+	CornerFilter.IncludeMask = 1 << 5;
+	CornerFilter.ExcludeMask = 1 << 1;
+	const auto MakeMask = [](const FVector& Point, FRandomStream& Random)
+	{
+		const bool bInCorner = Point.X < WorldSize * 0.2 && Point.Y < WorldSize * 0.2;
+		return uint64(1) | uint64(2) << Random.RandHelper(4) | (bInCorner ? uint64(1) << 5 : 0);
+	};
+
+	for (const EPointDistribution Distribution : AllDistributions)
+	{
+		for (const int LeafSize : {0, 16})
+		{
+			const FString Context = FString::Printf(TEXT("%s, leaf size %d"), GetDistributionName(Distribution), LeafSize);
+			const TArray<FVector> Points = MakePoints(Distribution, 3000, 17);
+			FRandomStream Random(18);
+			TArray<uint64> Masks;
+			for (const FVector& Point : Points)
+			{
+				Masks.Add(MakeMask(Point, Random));
+			}
+			FKdtreeBuildSettings Settings;
+			Settings.LeafSize = LeafSize;
+			FKdtreeInternal Tree;
+			KdtreeInternal::BuildKdtreeWithMasks(&Tree, Points, Masks, Settings);
+
+			const float Radius = GetRadiusForHits(Points.Num(), 40.0, Distribution);
+			const TArray<FVector> Centers = MakeQueryCenters(Points, 30, 19);
+			if (!CheckFilteredQueries(*this, Context, Tree, Centers, Radius, CategoryFilter) ||
+				!CheckFilteredQueries(*this, Context, Tree, Centers, Radius, CornerFilter))
+			{
+				continue;
+			}
+
+			// Edits keep the subtree masks covering the points below them.
+			for (int Step = 0; Step < 600; ++Step)
+			{
+				const FVector Point = Points[Random.RandHelper(Points.Num())] + FVector(Random.FRandRange(-5.0, 5.0));
+				KdtreeInternal::InsertPointWithMask(&Tree, Point, MakeMask(Point, Random));
+				KdtreeInternal::RemovePoint(&Tree, Random.RandHelper(Tree.Data.Num()));
+				const int Changed = Random.RandHelper(Tree.Data.Num());
+				KdtreeInternal::SetPointMask(&Tree, Changed, MakeMask(Tree.Data[Changed], Random));
+				if (Step % 100 == 0)
+				{
+					const int Index = Random.RandHelper(Tree.Data.Num());
+					KdtreeInternal::UpdatePositions(&Tree, {Index}, {Points[Random.RandHelper(Points.Num())]});
+				}
+			}
+
+			// A bit no point had before must be found on the few points it is given.
+			FKdtreeMaskFilter TagFilter;
+			TagFilter.IncludeMask = 1 << 6;
+			TArray<FVector> TagCenters;
+			for (int Tag = 0; Tag < 10; ++Tag)
+			{
+				const int Index = Random.RandHelper(Tree.Data.Num());
+				KdtreeInternal::SetPointMask(&Tree, Index, KdtreeInternal::GetPointMask(Tree, Index) | TagFilter.IncludeMask);
+				TagCenters.Add(Tree.Data[Index]);
+			}
+			KdtreeInternal::ValidateKdtree(Tree);
+			if (!CheckFilteredQueries(*this, Context + TEXT(", edited"), Tree, Centers, Radius, CategoryFilter) ||
+				!CheckFilteredQueries(*this, Context + TEXT(", edited"), Tree, Centers, Radius, CornerFilter))
+			{
+				continue;
+			}
+			CheckFilteredQueries(*this, Context + TEXT(", tagged"), Tree, TagCenters, Radius, TagFilter);
+		}
+	}
+
+	// Masks given to single points turn them on for the whole tree.
+	FKdtreeInternal Tree;
+	KdtreeInternal::BuildKdtree(&Tree, MakePoints(EPointDistribution::Uniform, 100, 20));
+	TArray<int> Found;
+	KdtreeInternal::CollectFromKdtreeFiltered(Tree, FVector(WorldSize * 0.5), WorldSize, FKdtreeMaskFilter(), &Found);
+	TestEqual(TEXT("Points without masks pass no mask filter"), Found.Num(), 0);
+	KdtreeInternal::SetPointMask(&Tree, 42, 1);
+	KdtreeInternal::CollectFromKdtreeFiltered(Tree, FVector(WorldSize * 0.5), WorldSize, FKdtreeMaskFilter(), &Found);
+	TestTrue(TEXT("Only the point with a mask passes"), Found.Num() == 1 && Found[0] == 42);
+	return !HasAnyErrors();
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FKdtreeReorderTest, "Plugins.Kdtree.Reorder",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FKdtreeReorderTest::RunTest(const FString& Parameters)
+{
+	for (const EPointDistribution Distribution : AllDistributions)
+	{
+		for (const EKdtreeSplitPolicy SplitPolicy : {EKdtreeSplitPolicy::RoundRobin, EKdtreeSplitPolicy::SlidingMidpoint})
+		{
+			for (const int LeafSize : {0, 16})
+			{
+				const FString Context = FString::Printf(
+					TEXT("%s, %s, leaf size %d"), GetDistributionName(Distribution), LexToString(SplitPolicy), LeafSize);
+				const TArray<FVector> Points = MakePoints(Distribution, 3000, 21);
+				TArray<uint64> Masks;
+				for (int Index = 0; Index < Points.Num(); ++Index)
+				{
+					Masks.Add(uint64(1) << (Index % 8));
+				}
+				FKdtreeBuildSettings Settings;
+				Settings.LeafSize = LeafSize;
+				Settings.SplitPolicy = SplitPolicy;
+				Settings.bReorderPoints = true;
+				FKdtreeInternal Tree;
+				KdtreeInternal::BuildKdtreeWithMasks(&Tree, Points, Masks, Settings);
+				KdtreeInternal::ValidateKdtree(Tree);
+
+				// Every input point is moved exactly once, together with its mask.
+				TBitArray<> Seen(false, Points.Num());
+				bool bMatchesInput = Tree.InputIndices.Num() == Points.Num();
+				for (int Index = 0; bMatchesInput && Index < Tree.Data.Num(); ++Index)
+				{
+					const int InputIndex = KdtreeInternal::GetInputIndex(Tree, Index);
+					bMatchesInput = !Seen[InputIndex] && Tree.Data[Index] == Points[InputIndex] &&
+									KdtreeInternal::GetPointMask(Tree, Index) == Masks[InputIndex];
+					Seen[InputIndex] = true;
+				}
+				if (!TestTrue(Context + TEXT(": points are a permutation of the input"), bMatchesInput))
+				{
+					continue;
+				}
+
+				// Results map back to the input indices brute force finds.
+				const float Radius = GetRadiusForHits(Points.Num(), 30.0, Distribution);
+				const TArray<FVector> Centers = MakeQueryCenters(Points, 30, 22);
+				for (int Query = 0; Query < Centers.Num(); ++Query)
+				{
+					TArray<int> Collected;
+					KdtreeInternal::CollectFromKdtree(Tree, Centers[Query], Radius, &Collected);
+					for (int& Index : Collected)
+					{
+						Index = KdtreeInternal::GetInputIndex(Tree, Index);
+					}
+					if (Sorted(Collected) != BruteForceCollect(Points, TBitArray<>(false, Points.Num()), Centers[Query], Radius))
+					{
+						AddError(FString::Printf(TEXT("%s: radius query %d differs from brute force"), *Context, Query));
+						break;
+					}
+				}
+
+				// Edits keep the indices they are given; inserted points have no input index.
+				FRandomStream Random(23);
+				for (int Step = 0; Step < 300; ++Step)
+				{
+					const int Inserted = KdtreeInternal::InsertPoint(&Tree, Points[Random.RandHelper(Points.Num())] + FVector(1.0));
+					TestEqual(Context + TEXT(": input index of an inserted point"), KdtreeInternal::GetInputIndex(Tree, Inserted), INDEX_NONE);
+					KdtreeInternal::RemovePoint(&Tree, Random.RandHelper(Tree.Data.Num()));
+				}
+				KdtreeInternal::ValidateKdtree(Tree);
+				CheckQueries(*this, Context + TEXT(", edited"), Tree, Centers, Radius);
+			}
+		}
+	}
+
+	FKdtreeInternal Tree;
+	KdtreeInternal::BuildKdtree(&Tree, MakePoints(EPointDistribution::Uniform, 100, 24));
+	TestTrue(TEXT("Input order is kept by default"), Tree.InputIndices.Num() == 0 && KdtreeInternal::GetInputIndex(Tree, 42) == 42);
+	return !HasAnyErrors();
+}
+
+namespace
+{
+// Checks the guarantees of the approximate queries against brute force: results within 1 + Epsilon of the exact ones
+// while the queries complete, and distinct points in range when the node budget cuts them short.
+bool CheckApproximateQueries(FAutomationTestBase& Test, const FString& Context, const FKdtreeInternal& Tree,
+	const TArray<FVector>& Centers, float Radius, const FKdtreeApproximation& Approximation)
+{
+	const double Factor = FMath::Square(1.0 + Approximation.Epsilon) * (1.0 + 1e-9);
+	for (int Query = 0; Query < Centers.Num(); ++Query)
+	{
+		const FVector& Center = Centers[Query];
+		TArray<int> Nearest;
+		const bool bNearestCompleted = KdtreeInternal::FindKNearestApproximate(Tree, Center, 8, 0.0f, Approximation, &Nearest);
+		const TArray<double> Distances = GetDistances(Tree.Data, Nearest, Center);
+		const TArray<double> Expected = BruteForceKNearestDistances(Tree.Data, Tree.RemovedPoints, Center, 8, 0.0f);
+		TBitArray<> Found(false, Tree.Data.Num());
+		bool bNearestValid = Nearest.Num() <= Expected.Num();
+		for (int Rank = 0; bNearestValid && Rank < Nearest.Num(); ++Rank)
+		{
+			bNearestValid = !Found[Nearest[Rank]] && !Tree.RemovedPoints[Nearest[Rank]] &&
+							(!bNearestCompleted || Distances[Rank] <= Expected[Rank] * Factor);
+			Found[Nearest[Rank]] = true;
+		}
+		if (!bNearestValid || (bNearestCompleted && Nearest.Num() != Expected.Num()))
+		{
+			Test.AddError(FString::Printf(TEXT("%s: approximate k-nearest query %d is off"), *Context, Query));
+			return false;
+		}
+
+		bool bSingleCompleted;
+		const int Single = KdtreeInternal::FindNearestApproximate(Tree, Center, 0.0f, Approximation, &bSingleCompleted);
+		if (bSingleCompleted && (Single == INDEX_NONE || FVector::DistSquared(Tree.Data[Single], Center) > Expected[0] * Factor))
+		{
+			Test.AddError(FString::Printf(TEXT("%s: approximate nearest query %d is off"), *Context, Query));
+			return false;
+		}
+
+		TArray<int> Collected;
+		const bool bCollectCompleted =
+			KdtreeInternal::CollectFromKdtreeApproximate(Tree, Center, Radius, Approximation, &Collected);
+		// Slightly inside the guaranteed radius, as the query compares squared distances.
+		const TArray<int> Guaranteed =
+			BruteForceCollect(Tree.Data, Tree.RemovedPoints, Center, Radius / (1.0f + Approximation.Epsilon) * 0.9999f);
+		Found.Init(false, Tree.Data.Num());
+		bool bCollectValid = true;
+		for (const int Index : Collected)
+		{
+			bCollectValid &= !Found[Index] && !Tree.RemovedPoints[Index] &&
+							 FVector::DistSquared(Tree.Data[Index], Center) < FMath::Square(static_cast<double>(Radius));
+			Found[Index] = true;
+		}
+		for (const int Index : Guaranteed)
+		{
+			bCollectValid &= !bCollectCompleted || Found[Index];
+		}
+		if (!bCollectValid)
+		{
+			Test.AddError(FString::Printf(TEXT("%s: approximate radius query %d is off"), *Context, Query));
+			return false;
+		}
+	}
+	return true;
+}
+}	 // namespace
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FKdtreeApproximateTest, "Plugins.Kdtree.Approximate",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FKdtreeApproximateTest::RunTest(const FString& Parameters)
+{
+	for (const EPointDistribution Distribution : AllDistributions)
+	{
+		for (const int LeafSize : {0, 16})
+		{
+			const FString Context = FString::Printf(TEXT("%s, leaf size %d"), GetDistributionName(Distribution), LeafSize);
+			const TArray<FVector> Points = MakePoints(Distribution, 4000, 25);
+			const FKdtreeInternal Tree = MakeTestTreeWithHoles(Points, LeafSize, 7);
+
+			const float Radius = GetRadiusForHits(Points.Num(), 30.0, Distribution);
+			const TArray<FVector> Centers = MakeQueryCenters(Points, 40, 26);
+			for (const float Epsilon : {0.0f, 0.5f, 2.0f})
+			{
+				for (const int32 MaxVisitedNodes : {0, 4, 40})
+				{
+					FKdtreeApproximation Approximation;
+					Approximation.Epsilon = Epsilon;
+					Approximation.MaxVisitedNodes = MaxVisitedNodes;
+					CheckApproximateQueries(*this,
+						FString::Printf(TEXT("%s, epsilon %.1f, %d nodes"), *Context, Epsilon, MaxVisitedNodes), Tree, Centers,
+						Radius, Approximation);
+				}
+			}
+		}
+	}
+
+	// Without limits the approximate queries find exactly what the exact ones do; a budget of one node only gets the root.
+	FKdtreeInternal Tree;
+	const TArray<FVector> Points = MakePoints(EPointDistribution::Uniform, 1000, 27);
+	KdtreeInternal::BuildKdtree(&Tree, Points);
+	const float Radius = GetRadiusForHits(Points.Num(), 50.0);
+	TArray<int> Exact;
+	TArray<int> Approximate;
+	KdtreeInternal::CollectFromKdtree(Tree, Points[0], Radius, &Exact);
+	TestTrue(TEXT("Unlimited radius query completes"),
+		KdtreeInternal::CollectFromKdtreeApproximate(Tree, Points[0], Radius, FKdtreeApproximation(), &Approximate));
+	TestTrue(TEXT("Unlimited radius query is exact"), Sorted(Exact) == Sorted(Approximate));
+	FKdtreeApproximation OneNode;
+	OneNode.MaxVisitedNodes = 1;
+	Approximate.Reset();
+	TestFalse(TEXT("Budget of one node runs out"),
+		KdtreeInternal::FindKNearestApproximate(Tree, Points[0], 8, 0.0f, OneNode, &Approximate));
+	TestTrue(TEXT("Budget of one node finds the root point"), Approximate.Num() == 1 && Approximate[0] == Tree.Nodes[0].Index);
+
+	// A radius holding the whole tree hands the point of every visited node to the result, so with one point per node
+	// the result counts the nodes visited, which must stay within the budget even inside fully contained subtrees.
+	const FKdtreeInternal NodeTree = MakeTestTreeWithHoles(Points, 0);
+	for (const int32 MaxVisitedNodes : {1, 2, 10, 100})
+	{
+		FKdtreeApproximation Budget;
+		Budget.MaxVisitedNodes = MaxVisitedNodes;
+		Approximate.Reset();
+		const bool bCompleted = KdtreeInternal::CollectFromKdtreeApproximate(NodeTree, Points[0], 1e7f, Budget, &Approximate);
+		TestFalse(*FString::Printf(TEXT("Budget of %d nodes runs out on a huge radius"), MaxVisitedNodes), bCompleted);
+		TestTrue(*FString::Printf(TEXT("Budget of %d nodes visits %d nodes"), MaxVisitedNodes, Approximate.Num()),
+			Approximate.Num() <= MaxVisitedNodes);
+	}
+	return !HasAnyErrors();
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FKdtreeDynamicTest, "Plugins.Kdtree.Dynamic",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FKdtreeDynamicTest::RunTest(const FString& Parameters)
+{
+	for (const EPointDistribution Distribution : AllDistributions)
+	{
+		for (const int LeafSize : {0, 16})
+		{
+			const FString Context = FString::Printf(TEXT("%s, leaf size %d"), GetDistributionName(Distribution), LeafSize);
+			const TArray<FVector> Points = MakePoints(Distribution, 4000, 3);
+			const TArray<FVector> Extra = MakePoints(Distribution, 4000, 4);
+			FKdtreeInternal Tree = MakeTestTreeWithHoles(TArray<FVector>(Points.GetData(), 2000), LeafSize);
+
+			FRandomStream Random(5);
+			for (int Round = 0; Round < 8; ++Round)
+			{
+				ChurnPoints(&Tree, Extra, 250, Random);
+
+				TArray<int> Indices;
+				TArray<FVector> Positions;
+				for (int Step = 0; Step < 300; ++Step)
+				{
+					const int Index = Random.RandHelper(Tree.Data.Num());
+					if (!Tree.RemovedPoints[Index] && !Indices.Contains(Index))
+					{
+						Indices.Add(Index);
+						// Mostly small moves that stay in their node, some jumps across the tree.
+						Positions.Add(Step % 4 == 0 ? Points[Random.RandHelper(Points.Num())]
+													: Tree.Data[Index] + FVector(Random.FRandRange(-20.0, 20.0), 0.0, 0.0));
+					}
+				}
+				KdtreeInternal::UpdatePositions(&Tree, Indices, Positions);
+				for (int Offset = 0; Offset < Indices.Num(); ++Offset)
+				{
+					if (Tree.Data[Indices[Offset]] != Positions[Offset])
+					{
+						AddError(FString::Printf(TEXT("%s: point %d was not moved"), *Context, Indices[Offset]));
+					}
+				}
+
+				if (!CheckQueries(*this, FString::Printf(TEXT("%s, round %d"), *Context, Round), Tree,
+						MakeQueryCenters(Points, 40, Round), GetRadiusForHits(Points.Num(), 20.0, Distribution)))
+				{
+					break;
+				}
+			}
+		}
+	}
+	return !HasAnyErrors();
+}
+
+namespace
+{
+// Checks the queries of the spatial hash at the given centers against brute force. Returns false after the first
+// mismatch.
+bool CheckSpatialHashQueries(FAutomationTestBase& Test, const FString& Context, const FSpatialHashInternal& Hash,
+	const TArray<FVector>& Centers, float Radius)
+{
+	KdtreeInternal::ValidateSpatialHash(Hash);
+	const TBitArray<>& Removed = Hash.RemovedPoints;
+	for (int Query = 0; Query < Centers.Num(); ++Query)
+	{
+		const FVector& Center = Centers[Query];
+
+		TArray<int> Collected;
+		KdtreeInternal::CollectFromSpatialHash(Hash, Center, Radius, &Collected);
+		if (Sorted(Collected) != BruteForceCollect(Hash.Data, Removed, Center, Radius))
+		{
+			Test.AddError(FString::Printf(TEXT("%s: radius query %d differs from brute force"), *Context, Query));
+			return false;
+		}
+
+		for (const float MaxDistance : {0.0f, Radius})
+		{
+			TArray<int> Nearest;
+			KdtreeInternal::FindKNearestInSpatialHash(Hash, Center, 8, MaxDistance, &Nearest);
+			if (!AreDistancesNearlyEqual(
+					GetDistances(Hash.Data, Nearest, Center), BruteForceKNearestDistances(Hash.Data, Removed, Center, 8, MaxDistance)))
+			{
+				Test.AddError(FString::Printf(TEXT("%s: k-nearest query %d differs from brute force"), *Context, Query));
+				return false;
+			}
+
+			const int Index = KdtreeInternal::FindNearestInSpatialHash(Hash, Center, MaxDistance);
+			const TArray<double> Found = Index != INDEX_NONE ? TArray<double>{FVector::DistSquared(Hash.Data[Index], Center)} : TArray<double>();
+			if (!AreDistancesNearlyEqual(Found, BruteForceKNearestDistances(Hash.Data, Removed, Center, 1, MaxDistance)))
+			{
+				Test.AddError(FString::Printf(TEXT("%s: nearest query %d differs from brute force"), *Context, Query));
+				return false;
+			}
+		}
+	}
+
+	TArray<int> BatchIndices;
+	TArray<int> BatchOffsets;
+	KdtreeInternal::CollectFromSpatialHashBatch(Hash, Centers, {Radius}, &BatchIndices, &BatchOffsets);
+	for (int Query = 0; Query < Centers.Num(); ++Query)
+	{
+		const TArray<int> FromBatch(BatchIndices.GetData() + BatchOffsets[Query], BatchOffsets[Query + 1] - BatchOffsets[Query]);
+		if (Sorted(FromBatch) != BruteForceCollect(Hash.Data, Removed, Centers[Query], Radius))
+		{
+			Test.AddError(FString::Printf(TEXT("%s: batch query %d differs from brute force"), *Context, Query));
+			return false;
+		}
+	}
+	return true;
+}
+}	 // namespace
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FKdtreeSpatialHashTest, "Plugins.Kdtree.SpatialHash",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FKdtreeSpatialHashTest::RunTest(const FString& Parameters)
+{
+	for (const EPointDistribution Distribution : AllDistributions)
+	{
+		const float Radius = GetRadiusForHits(4000, 20.0, Distribution);
+		// Derived cells, cells of the query radius, and cells so small that queries fall back to scanning all points.
+		for (const float CellSize : {0.0f, Radius, Radius / 64.0f})
+		{
+			const FString Context = FString::Printf(TEXT("%s, cell size %f"), GetDistributionName(Distribution), CellSize);
+			const TArray<FVector> Points = MakePoints(Distribution, 4000, 3);
+			const TArray<FVector> Extra = MakePoints(Distribution, 4000, 4);
+			FSpatialHashBuildSettings Settings;
+			Settings.CellSize = CellSize;
+			FSpatialHashInternal Hash;
+			KdtreeInternal::BuildSpatialHash(&Hash, TArray<FVector>(Points.GetData(), 2000), Settings);
+			TArray<FVector> Centers = MakeQueryCenters(Points, 40, 1);
+			// Far outside the points, where nearest queries have to cross many empty cells.
+			Centers.Add(FVector(-4.0 * WorldSize));
+			if (!CheckSpatialHashQueries(*this, Context + TEXT(", built"), Hash, Centers, Radius))
+			{
+				continue;
+			}
+
+			FRandomStream Random(5);
+			for (int Round = 0; Round < 6; ++Round)
+			{
+				ChurnPoints(&Hash, Extra, 250, Random);
+
+				TArray<int> Indices;
+				TArray<FVector> Positions;
+				for (int Step = 0; Step < 600; ++Step)
+				{
+					const int Index = Random.RandHelper(Hash.Data.Num());
+					if (!Hash.RemovedPoints[Index])
+					{
+						// Mostly small moves within or into neighboring cells, some jumps across the grid. Points may
+						// move several times in one update.
+						Indices.Add(Index);
+						Positions.Add(Step % 4 == 0 ? Points[Random.RandHelper(Points.Num())]
+													: Hash.Data[Index] + Random.GetUnitVector() * Random.FRandRange(0.0, Radius));
+					}
+				}
+				KdtreeInternal::UpdateSpatialHashPositions(&Hash, Indices, Positions);
+				if (!CheckSpatialHashQueries(
+						*this, FString::Printf(TEXT("%s, round %d"), *Context, Round), Hash, MakeQueryCenters(Points, 40, Round), Radius))
+				{
+					break;
+				}
+			}
+		}
+	}
+
+	// A cleared grid takes new points, one at a time, rebuilding as it grows.
+	FSpatialHashInternal Hash;
+	KdtreeInternal::BuildSpatialHash(&Hash, MakePoints(EPointDistribution::Uniform, 1000, 6));
+	KdtreeInternal::ClearSpatialHash(&Hash);
+	TestEqual(TEXT("Points after clearing"), Hash.NumPoints, 0);
+	TestEqual(TEXT("Nearest after clearing"), KdtreeInternal::FindNearestInSpatialHash(Hash, FVector(0.0), 0.0f), INDEX_NONE);
+	const TArray<FVector> Points = MakePoints(EPointDistribution::Clustered, 3000, 7);
+	for (const FVector& Point : Points)
+	{
+		KdtreeInternal::InsertIntoSpatialHash(&Hash, Point);
+	}
+	TestTrue(TEXT("Buckets grow with the points"), Hash.GetNumBuckets() >= Points.Num() / 8);
+	CheckSpatialHashQueries(*this, TEXT("Inserted one by one"), Hash, MakeQueryCenters(Points, 40, 8), GetRadiusForHits(3000, 20.0));
+	TArray<int> All;
+	KdtreeInternal::FindKNearestInSpatialHash(Hash, Points[0], MAX_int32, 0.0f, &All);
+	TestEqual(TEXT("Huge K finds every point"), All.Num(), Hash.NumPoints);
+
+	// Many moving points favor the grid, static points queried a lot the tree.
+	TestEqual(TEXT("Backend for moving points"), KdtreeInternal::RecommendSpatialBackend(100000, 100000, 100),
+		EKdtreeSpatialBackend::SpatialHash);
+	TestEqual(TEXT("Backend for static points"), KdtreeInternal::RecommendSpatialBackend(100000, 0, 10000),
+		EKdtreeSpatialBackend::Kdtree);
+	return !HasAnyErrors();
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FKdtreeSerializationTest, "Plugins.Kdtree.Serialization",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FKdtreeSerializationTest::RunTest(const FString& Parameters)
+{
+	const TArray<FVector> Points = MakePoints(EPointDistribution::Clustered, 20000, 6);
+	FKdtreeBuildSettings Settings;
+	Settings.SplitPolicy = EKdtreeSplitPolicy::SlidingMidpoint;
+	Settings.bReorderPoints = true;
+	FKdtreeInternal Tree;
+	KdtreeInternal::BuildKdtree(&Tree, Points, Settings);
+	for (int Index = 0; Index < 500; ++Index)
+	{
+		KdtreeInternal::RemovePoint(&Tree, Index * 3);
+		KdtreeInternal::SetPointMask(&Tree, Index * 3 + 1, Index);
+	}
+
+	TArray<uint8> Bytes;
+	FMemoryWriter Writer(Bytes);
+	KdtreeInternal::SerializeKdtree(Writer, Tree);
+	FMemoryReader Reader(Bytes);
+	FKdtreeInternal Loaded;
+	KdtreeInternal::SerializeKdtree(Reader, Loaded);
+
+	TestEqual(TEXT("Bytes read"), Reader.Tell(), static_cast<int64>(Bytes.Num()));
+	TestEqual(TEXT("Split policy"), Loaded.SplitPolicy, Tree.SplitPolicy);
+	TestTrue(TEXT("Masks"), Loaded.PointMasks == Tree.PointMasks && Loaded.SubtreeMasks == Tree.SubtreeMasks);
+	TestTrue(TEXT("Input indices"), Loaded.InputIndices.Num() == Points.Num() && Loaded.InputIndices == Tree.InputIndices);
+	CheckQueries(*this, TEXT("Loaded tree"), Loaded, MakeQueryCenters(Points, 100, 7), GetRadiusForHits(Points.Num(), 20.0));
+	return !HasAnyErrors();
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FKdtreeSharingTest, "Plugins.Kdtree.Sharing",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FKdtreeSharingTest::RunTest(const FString& Parameters)
+{
+	const TArray<FVector> Points = MakePoints(EPointDistribution::Uniform, 1000, 17);
+	TWeakPtr<const FKdtreeInternal, ESPMode::ThreadSafe> Released;
+	{
+		FKdtree Original;
+		KdtreeInternal::BuildKdtree(&Original.Edit(), Points);
+		FKdtree Copy = Original;
+		TestTrue(TEXT("Copies share the tree"), &Copy.Get() == &Original.Get() && Original.IsShared());
+
+		// Editing a copy gives it its own tree and leaves the other copies as they were.
+		KdtreeInternal::InsertPoint(&Copy.Edit(), FVector(1.0));
+		TestTrue(TEXT("Edited copy has its own tree"), &Copy.Get() != &Original.Get() && !Original.IsShared() && !Copy.IsShared());
+		TestEqual(TEXT("Points of the original"), KdtreeInternal::GetKdtreeSummary(Original.Get()).NumPoints, Points.Num());
+		TestEqual(TEXT("Points of the copy"), KdtreeInternal::GetKdtreeSummary(Copy.Get()).NumPoints, Points.Num() + 1);
+
+		FKdtree Assigned;
+		Assigned = Original;
+		Released = Original.GetSnapshot();
+		Original = FKdtree();
+		TestTrue(TEXT("Tree kept while a copy holds it"), Released.IsValid() && &Assigned.Get() == Released.Pin().Get());
+	}
+	TestFalse(TEXT("Tree freed with its last holder"), Released.IsValid());
+	return !HasAnyErrors();
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FKdtreeTemplateTest, "Plugins.Kdtree.Templates",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FKdtreeTemplateTest::RunTest(const FString& Parameters)
+{
+	// A 2D float tree with payloads against brute force, to cover a non-default instantiation.
+	using FTree2f = TKdtree<2, float, int32>;
+	FRandomStream Random(8);
+	TArray<FVector2f> Points;
+	TArray<int32> Payloads;
+	for (int Index = 0; Index < 5000; ++Index)
+	{
+		Points.Add(FVector2f(Random.FRand(), Random.FRand()) * 1000.0f);
+		Payloads.Add(Index * 10);
+	}
+	FTree2f Tree;
+	KdtreeInternal::BuildKdtreeWithPayloads(&Tree, Points, Payloads);
+	const int Inserted = KdtreeInternal::InsertPointWithPayload(&Tree, FVector2f(500.0f, 500.0f), -1);
+	TestEqual(TEXT("Payload of inserted point"), Tree.Payloads[Inserted], -1);
+
+	for (int Query = 0; Query < 100; ++Query)
+	{
+		const FVector2f Center(Random.FRand() * 1000.0f, Random.FRand() * 1000.0f);
+		TArray<int> Collected;
+		KdtreeInternal::CollectFromKdtree(Tree, Center, 40.0f, &Collected);
+		TArray<int> Expected;
+		for (int Index = 0; Index < Tree.Data.Num(); ++Index)
+		{
+			if (FVector2f::DistSquared(Tree.Data[Index], Center) < 1600.0f)
+			{
+				Expected.Add(Index);
+			}
+		}
+		if (Sorted(Collected) != Expected)
+		{
+			AddError(FString::Printf(TEXT("2D radius query %d differs from brute force"), Query));
+			break;
+		}
+	}
+
+	// Points inserted without a payload into the index of a removed one do not inherit its payload.
+	for (int Index = 1; Index < 100; ++Index)
+	{
+		KdtreeInternal::RemovePoint(&Tree, Index);
+	}
+	const int Reused = KdtreeInternal::InsertPoint(&Tree, FVector2f(250.0f, 250.0f));
+	TestTrue(TEXT("Index of removed point reused"), Reused < 100);
+	TestEqual(TEXT("Payload of point inserted into a reused index"), Tree.Payloads[Reused], 0);
+	return !HasAnyErrors();
+}
+
+#endif	  // WITH_DEV_AUTOMATION_TESTS
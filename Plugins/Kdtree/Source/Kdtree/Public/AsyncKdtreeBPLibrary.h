@@ -29,10 +29,118 @@ public:
 	static void BuildKdtreeAsync(
 		const UObject* WorldContextObject, FKdtree& Tree, const TArray<FVector>& Data, FLatentActionInfo LatentInfo);
 
+	UFUNCTION(BlueprintCallable,
+		meta = (WorldContextObject = "WorldContextObject", Latent, LatentInfo = "LatentInfo", HidePin = "WorldContextObject",
+			DefaultToSelf = "WorldContextObject", AutoCreateRefTerm = "Settings"),
+		Category = "SpacialDataStructure|kd-tree")
+	static void BuildKdtreeWithSettingsAsync(const UObject* WorldContextObject, FKdtree& Tree, const TArray<FVector>& Data,
+		const FKdtreeBuildSettings& Settings, FLatentActionInfo LatentInfo);
+
+	// Takes ownership of Data instead of copying it. The tree is built into a separate buffer and replaces the current
+	// one on the game thread once done, so queries on the current tree keep running during the build.
+	static void BuildKdtreeWithSettingsAsync(const UObject* WorldContextObject, FKdtree& Tree, TArray<FVector>&& Data,
+		const FKdtreeBuildSettings& Settings, FLatentActionInfo LatentInfo);
+
 	UFUNCTION(BlueprintCallable,
 		meta = (WorldContextObject = "WorldContextObject", Latent, LatentInfo = "LatentInfo", HidePin = "WorldContextObject",
 			DefaultToSelf = "WorldContextObject"),
 		Category = "SpacialDataStructure|kd-tree")
 	static void CollectFromKdtreeAsync(const UObject* WorldContextObject, const FKdtree& Tree, const FVector Center, float Radius,
 		TArray<int>& Indices, TArray<FVector>& Data, FLatentActionInfo LatentInfo);
+
+	UFUNCTION(BlueprintCallable,
+		meta = (WorldContextObject = "WorldContextObject", Latent, LatentInfo = "LatentInfo", HidePin = "WorldContextObject",
+			DefaultToSelf = "WorldContextObject"),
+		Category = "SpacialDataStructure|kd-tree")
+	static void CollectInBoxFromKdtreeAsync(const UObject* WorldContextObject, const FKdtree& Tree, const FBox& Box,
+		TArray<int>& Indices, TArray<FVector>& Data, FLatentActionInfo LatentInfo);
+
+	UFUNCTION(BlueprintCallable,
+		meta = (WorldContextObject = "WorldContextObject", Latent, LatentInfo = "LatentInfo", HidePin = "WorldContextObject",
+			DefaultToSelf = "WorldContextObject"),
+		Category = "SpacialDataStructure|kd-tree")
+	static void CollectInOrientedBoxFromKdtreeAsync(const UObject* WorldContextObject, const FKdtree& Tree, const FVector Center,
+		const FRotator Rotation, const FVector Extent, TArray<int>& Indices, TArray<FVector>& Data, FLatentActionInfo LatentInfo);
+
+	UFUNCTION(BlueprintCallable,
+		meta = (WorldContextObject = "WorldContextObject", Latent, LatentInfo = "LatentInfo", HidePin = "WorldContextObject",
+			DefaultToSelf = "WorldContextObject"),
+		Category = "SpacialDataStructure|kd-tree")
+	static void CollectInCapsuleFromKdtreeAsync(const UObject* WorldContextObject, const FKdtree& Tree, const FVector Start,
+		const FVector End, float Radius, TArray<int>& Indices, TArray<FVector>& Data, FLatentActionInfo LatentInfo);
+
+	UFUNCTION(BlueprintCallable,
+		meta = (WorldContextObject = "WorldContextObject", Latent, LatentInfo = "LatentInfo", HidePin = "WorldContextObject",
+			DefaultToSelf = "WorldContextObject"),
+		Category = "SpacialDataStructure|kd-tree")
+	static void CollectInConvexVolumeFromKdtreeAsync(const UObject* WorldContextObject, const FKdtree& Tree,
+		const TArray<FPlane>& Planes, TArray<int>& Indices, TArray<FVector>& Data, FLatentActionInfo LatentInfo);
+
+	UFUNCTION(BlueprintCallable,
+		meta = (WorldContextObject = "WorldContextObject", Latent, LatentInfo = "LatentInfo", HidePin = "WorldContextObject",
+			DefaultToSelf = "WorldContextObject"),
+		Category = "SpacialDataStructure|kd-tree")
+	static void CollectInFrustumFromKdtreeAsync(const UObject* WorldContextObject, const FKdtree& Tree, const FVector Origin,
+		const FRotator Rotation, float FOVDegrees, float AspectRatio, float NearDistance, float FarDistance, TArray<int>& Indices,
+		TArray<FVector>& Data, FLatentActionInfo LatentInfo);
+
+	UFUNCTION(BlueprintCallable,
+		meta = (WorldContextObject = "WorldContextObject", Latent, LatentInfo = "LatentInfo", HidePin = "WorldContextObject",
+			DefaultToSelf = "WorldContextObject"),
+		Category = "SpacialDataStructure|kd-tree")
+	static void FindFirstAlongSegmentFromKdtreeAsync(const UObject* WorldContextObject, const FKdtree& Tree, const FVector Start,
+		const FVector End, float Radius, bool& bFound, int& Index, FVector& Data, float& Distance, FLatentActionInfo LatentInfo);
+
+	UFUNCTION(BlueprintCallable,
+		meta = (WorldContextObject = "WorldContextObject", Latent, LatentInfo = "LatentInfo", HidePin = "WorldContextObject",
+			DefaultToSelf = "WorldContextObject"),
+		Category = "SpacialDataStructure|kd-tree")
+	static void FindFirstAlongPathFromKdtreeAsync(const UObject* WorldContextObject, const FKdtree& Tree, const TArray<FVector>& Path,
+		float Radius, bool& bFound, int& Index, FVector& Data, float& Distance, FLatentActionInfo LatentInfo);
+
+	UFUNCTION(BlueprintCallable,
+		meta = (WorldContextObject = "WorldContextObject", Latent, LatentInfo = "LatentInfo", HidePin = "WorldContextObject",
+			DefaultToSelf = "WorldContextObject"),
+		Category = "SpacialDataStructure|kd-tree")
+	static void FindKNearestFromKdtreeAsync(const UObject* WorldContextObject, const FKdtree& Tree, const FVector Center, int K,
+		float MaxDistance, TArray<int>& Indices, TArray<FVector>& Data, FLatentActionInfo LatentInfo);
+
+	UFUNCTION(BlueprintCallable,
+		meta = (WorldContextObject = "WorldContextObject", Latent, LatentInfo = "LatentInfo", HidePin = "WorldContextObject",
+			DefaultToSelf = "WorldContextObject"),
+		Category = "SpacialDataStructure|kd-tree")
+	static void FindNearestFromKdtreeAsync(const UObject* WorldContextObject, const FKdtree& Tree, const FVector Center,
+		float MaxDistance, bool& bFound, int& Index, FVector& Data, FLatentActionInfo LatentInfo);
+
+	UFUNCTION(BlueprintCallable,
+		meta = (WorldContextObject = "WorldContextObject", Latent, LatentInfo = "LatentInfo", HidePin = "WorldContextObject",
+			DefaultToSelf = "WorldContextObject", AutoCreateRefTerm = "Settings"),
+		Category = "SpacialDataStructure|spatial-hash")
+	static void BuildSpatialHashAsync(const UObject* WorldContextObject, FSpatialHash& Hash, const TArray<FVector>& Data,
+		const FSpatialHashBuildSettings& Settings, FLatentActionInfo LatentInfo);
+
+	// Takes ownership of Data, and swaps the new grid in once built like BuildKdtreeWithSettingsAsync.
+	static void BuildSpatialHashAsync(const UObject* WorldContextObject, FSpatialHash& Hash, TArray<FVector>&& Data,
+		const FSpatialHashBuildSettings& Settings, FLatentActionInfo LatentInfo);
+
+	UFUNCTION(BlueprintCallable,
+		meta = (WorldContextObject = "WorldContextObject", Latent, LatentInfo = "LatentInfo", HidePin = "WorldContextObject",
+			DefaultToSelf = "WorldContextObject"),
+		Category = "SpacialDataStructure|spatial-hash")
+	static void CollectFromSpatialHashAsync(const UObject* WorldContextObject, const FSpatialHash& Hash, const FVector Center,
+		float Radius, TArray<int>& Indices, TArray<FVector>& Data, FLatentActionInfo LatentInfo);
+
+	UFUNCTION(BlueprintCallable,
+		meta = (WorldContextObject = "WorldContextObject", Latent, LatentInfo = "LatentInfo", HidePin = "WorldContextObject",
+			DefaultToSelf = "WorldContextObject"),
+		Category = "SpacialDataStructure|spatial-hash")
+	static void FindKNearestFromSpatialHashAsync(const UObject* WorldContextObject, const FSpatialHash& Hash, const FVector Center,
+		int K, float MaxDistance, TArray<int>& Indices, TArray<FVector>& Data, FLatentActionInfo LatentInfo);
+
+	UFUNCTION(BlueprintCallable,
+		meta = (WorldContextObject = "WorldContextObject", Latent, LatentInfo = "LatentInfo", HidePin = "WorldContextObject",
+			DefaultToSelf = "WorldContextObject"),
+		Category = "SpacialDataStructure|spatial-hash")
+	static void FindNearestFromSpatialHashAsync(const UObject* WorldContextObject, const FSpatialHash& Hash, const FVector Center,
+		float MaxDistance, bool& bFound, int& Index, FVector& Data, FLatentActionInfo LatentInfo);
 };
@@ -0,0 +1,63 @@
+/*!
+ * Kdtree
+ *
+ * Copyright (c) 2019-2023 nutti
+ *
+ * This software is released under the MIT License.
+ * https://opensource.org/licenses/MIT
+ */
+
+#pragma once
+
+#include "Engine/DataAsset.h"
+#include "KdtreeCommon.h"
+
+#include "KdtreeAsset.generated.h"
+
+// A kd-tree over a fixed set of points, built in the editor and saved with the asset. Loading reads the tree back as
+// flat arrays instead of building it, and every user of the asset shares the same read-only tree.
+UCLASS(BlueprintType)
+class KDTREE_API UKdtreeAsset : public UDataAsset
+{
+	GENERATED_BODY()
+
+public:
+	UKdtreeAsset();
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "SpacialDataStructure|kd-tree")
+	FKdtreeBuildSettings Settings;
+
+#if WITH_EDITORONLY_DATA
+	// Points the tree is built from. Not included in cooked builds, which only need the tree.
+	UPROPERTY(EditAnywhere, Category = "SpacialDataStructure|kd-tree")
+	TArray<FVector> SourcePoints;
+#endif
+
+	// The tree of this asset, shared by all its native users. Copies of it can be edited without affecting the asset.
+	const FKdtree& GetKdtree() const
+	{
+		return Tree;
+	}
+
+	// Returns a copy of the tree for Blueprint use. It shares the tree of the asset until it is edited.
+	UFUNCTION(BlueprintPure, Category = "SpacialDataStructure|kd-tree")
+	FKdtree GetKdtreeCopy() const;
+
+#if WITH_EDITOR
+	// Replaces the source points and rebuilds the tree, e.g. from an editor utility.
+	UFUNCTION(BlueprintCallable, Category = "SpacialDataStructure|kd-tree")
+	void SetSourcePoints(const TArray<FVector>& Points);
+
+	virtual void PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent) override;
+#endif
+
+	virtual void Serialize(FArchive& Ar) override;
+	virtual void GetResourceSizeEx(FResourceSizeEx& CumulativeResourceSize) override;
+
+private:
+#if WITH_EDITOR
+	void RebuildKdtree();
+#endif
+
+	FKdtree Tree;
+};
@@ -25,16 +25,214 @@ public:
 	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|kd-tree")
 	static void BuildKdtree(FKdtree& Tree, const TArray<FVector>& Data);
 
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|kd-tree", meta = (AutoCreateRefTerm = "Settings"))
+	static void BuildKdtreeWithSettings(FKdtree& Tree, const TArray<FVector>& Data, const FKdtreeBuildSettings& Settings);
+
+	// Builds the tree with the user bits Masks[i] assigned to Data[i], for the queries taking an FKdtreeMaskFilter.
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|kd-tree", meta = (AutoCreateRefTerm = "Settings"))
+	static void BuildKdtreeWithMasks(
+		FKdtree& Tree, const TArray<FVector>& Data, const TArray<int64>& Masks, const FKdtreeBuildSettings& Settings);
+
 	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|kd-tree")
 	static void ClearKdtree(UPARAM(ref) FKdtree& Tree);
 
+	// Adds a point without rebuilding the whole tree and returns its index. Indices of removed points are reused.
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|kd-tree")
+	static int InsertPointToKdtree(UPARAM(ref) FKdtree& Tree, const FVector Point);
+
+	// Same as InsertPointToKdtree, assigning the user bits in Mask to the point.
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|kd-tree")
+	static int InsertPointWithMaskToKdtree(UPARAM(ref) FKdtree& Tree, const FVector Point, int64 Mask);
+
+	// Assigns the user bits in Mask to the point at Index. Returns false if there is no such point.
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|kd-tree")
+	static bool SetPointMaskInKdtree(UPARAM(ref) FKdtree& Tree, int Index, int64 Mask);
+
+	// The user bits of the point at Index, 0 if it has none.
+	UFUNCTION(BlueprintPure, Category = "SpacialDataStructure|kd-tree")
+	static int64 GetPointMaskFromKdtree(const FKdtree& Tree, int Index);
+
+	// Removes the point at Index. The indices of all other points stay valid.
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|kd-tree")
+	static bool RemovePointFromKdtree(UPARAM(ref) FKdtree& Tree, int Index);
+
+	// Moves the points at Indices to Positions, updating the tree in place where the points stay inside their node.
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|kd-tree")
+	static void UpdatePositionsInKdtree(UPARAM(ref) FKdtree& Tree, const TArray<int>& Indices,
+		const TArray<FVector>& Positions, FKdtreeUpdateStats& Stats);
+
 	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|kd-tree")
 	static void CollectFromKdtree(
 		const FKdtree& Tree, const FVector Center, float Radius, TArray<int>& Indices, TArray<FVector>& Data);
 
+	// Collects the points closer to Center than Radius whose masks pass Filter. Parts of the tree without any of the
+	// included bits are skipped.
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|kd-tree")
+	static void CollectFromKdtreeWithMask(const FKdtree& Tree, const FVector Center, float Radius, const FKdtreeMaskFilter& Filter,
+		TArray<int>& Indices, TArray<FVector>& Data);
+
+	// Same as CollectFromKdtree within the limits of Approximation: may miss points farther than Radius / (1 + Epsilon),
+	// and returns false if the node budget ran out before every point in range was found.
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|kd-tree")
+	static bool CollectFromKdtreeApproximate(const FKdtree& Tree, const FVector Center, float Radius,
+		const FKdtreeApproximation& Approximation, TArray<int>& Indices, TArray<FVector>& Data);
+
+	// Number of points closer to Center than Radius, without returning them.
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|kd-tree")
+	static int CountInRadiusFromKdtree(const FKdtree& Tree, const FVector Center, float Radius);
+
+	// Whether any point is closer to Center than Radius. Stops at the first one found.
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|kd-tree")
+	static bool AnyInRadiusFromKdtree(const FKdtree& Tree, const FVector Center, float Radius);
+
+	// Collects the points inside Box, including points on its faces.
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|kd-tree")
+	static void CollectInBoxFromKdtree(const FKdtree& Tree, const FBox& Box, TArray<int>& Indices, TArray<FVector>& Data);
+
+	// Collects the points inside the box reaching Extent from Center along each of its axes, rotated by Rotation.
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|kd-tree")
+	static void CollectInOrientedBoxFromKdtree(const FKdtree& Tree, const FVector Center, const FRotator Rotation,
+		const FVector Extent, TArray<int>& Indices, TArray<FVector>& Data);
+
+	// Collects the points closer than Radius to the segment from Start to End.
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|kd-tree")
+	static void CollectInCapsuleFromKdtree(const FKdtree& Tree, const FVector Start, const FVector End, float Radius,
+		TArray<int>& Indices, TArray<FVector>& Data);
+
+	// Collects the points behind all Planes, whose normals point out of the volume as in FConvexVolume.
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|kd-tree")
+	static void CollectInConvexVolumeFromKdtree(
+		const FKdtree& Tree, const TArray<FPlane>& Planes, TArray<int>& Indices, TArray<FVector>& Data);
+
+	// Collects the points inside the perspective view frustum seen from Origin with the given rotation, horizontal
+	// field of view and width to height ratio.
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|kd-tree")
+	static void CollectInFrustumFromKdtree(const FKdtree& Tree, const FVector Origin, const FRotator Rotation, float FOVDegrees,
+		float AspectRatio, float NearDistance, float FarDistance, TArray<int>& Indices, TArray<FVector>& Data);
+
+	// Finds the first point closer than Radius to the segment from Start to End. Distance is how far along the segment
+	// the point comes closest to it.
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|kd-tree")
+	static bool FindFirstAlongSegmentFromKdtree(
+		const FKdtree& Tree, const FVector Start, const FVector End, float Radius, int& Index, FVector& Data, float& Distance);
+
+	// Same as FindFirstAlongSegmentFromKdtree for a ray, which ends after MaxDistance or past the tree if it is 0.
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|kd-tree")
+	static bool FindFirstAlongRayFromKdtree(const FKdtree& Tree, const FVector Origin, const FVector Direction, float MaxDistance,
+		float Radius, int& Index, FVector& Data, float& Distance);
+
+	// Same as FindFirstAlongSegmentFromKdtree for the polyline through Path, e.g. the points of a predicted projectile
+	// path. Distance is measured along the polyline.
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|kd-tree")
+	static bool FindFirstAlongPathFromKdtree(
+		const FKdtree& Tree, const TArray<FVector>& Path, float Radius, int& Index, FVector& Data, float& Distance);
+
+	// Radius query for many centers at once. Radii holds one radius per center or a single shared radius. The indices
+	// found for Centers[i] are Indices[Offsets[i]] to Indices[Offsets[i + 1] - 1].
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|kd-tree")
+	static void CollectFromKdtreeBatch(const FKdtree& Tree, const TArray<FVector>& Centers, const TArray<float>& Radii,
+		TArray<int>& Indices, TArray<int>& Offsets);
+
+	// Finds the points closer than Radius to every point at once, using all cores. The neighbors of the point at index
+	// i are Graph.Neighbors[Graph.Offsets[i]] to Graph.Neighbors[Graph.Offsets[i + 1] - 1].
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|kd-tree")
+	static void BuildRadiusNeighborGraphFromKdtree(const FKdtree& Tree, float Radius, FKdtreeNeighborGraph& Graph);
+
+	// Finds the K nearest other points of every point at once, nearest first, laid out as in
+	// BuildRadiusNeighborGraphFromKdtree.
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|kd-tree")
+	static void BuildKNearestNeighborGraphFromKdtree(const FKdtree& Tree, int K, float MaxDistance, FKdtreeNeighborGraph& Graph);
+
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|kd-tree")
+	static void FindKNearestFromKdtree(
+		const FKdtree& Tree, const FVector Center, int K, float MaxDistance, TArray<int>& Indices, TArray<FVector>& Data);
+
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|kd-tree")
+	static bool FindNearestFromKdtree(const FKdtree& Tree, const FVector Center, float MaxDistance, int& Index, FVector& Data);
+
+	// Same as FindKNearestFromKdtree among the points whose masks pass Filter.
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|kd-tree")
+	static void FindKNearestFromKdtreeWithMask(const FKdtree& Tree, const FVector Center, int K, float MaxDistance,
+		const FKdtreeMaskFilter& Filter, TArray<int>& Indices, TArray<FVector>& Data);
+
+	// Same as FindNearestFromKdtree among the points whose masks pass Filter.
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|kd-tree")
+	static bool FindNearestFromKdtreeWithMask(
+		const FKdtree& Tree, const FVector Center, float MaxDistance, const FKdtreeMaskFilter& Filter, int& Index, FVector& Data);
+
+	// Same as FindKNearestFromKdtree within the limits of Approximation: each result is at most 1 + Epsilon times farther
+	// than the exact one of the same rank. Returns false if the node budget ran out, leaving the nearest points found.
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|kd-tree")
+	static bool FindKNearestFromKdtreeApproximate(const FKdtree& Tree, const FVector Center, int K, float MaxDistance,
+		const FKdtreeApproximation& Approximation, TArray<int>& Indices, TArray<FVector>& Data);
+
+	// Same as FindNearestFromKdtree within the limits of Approximation. bCompleted is false if the node budget ran out.
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|kd-tree")
+	static bool FindNearestFromKdtreeApproximate(const FKdtree& Tree, const FVector Center, float MaxDistance,
+		const FKdtreeApproximation& Approximation, int& Index, FVector& Data, bool& bCompleted);
+
+	// Maps indices returned by the tree to positions in the array it was built from. They differ only for trees built
+	// with bReorderPoints, where points inserted since the build map to -1.
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|kd-tree")
+	static void GetInputIndicesFromKdtree(const FKdtree& Tree, const TArray<int>& Indices, TArray<int>& InputIndices);
+
 	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|kd-tree")
 	static void ValidateKdtree(const FKdtree& Tree);
 
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|kd-tree")
+	static FKdtreeSummary GetKdtreeSummary(const FKdtree& Tree);
+
+	// Logs the summary of the tree in one line.
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|kd-tree")
+	static void LogKdtreeSummary(const FKdtree& Tree);
+
+	// Logs every node of the tree. Use LogKdtreeSummary for large trees.
 	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|kd-tree")
 	static void DumpKdtreeToConsole(const FKdtree& Tree);
+
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|spatial-hash", meta = (AutoCreateRefTerm = "Settings"))
+	static void BuildSpatialHash(FSpatialHash& Hash, const TArray<FVector>& Data, const FSpatialHashBuildSettings& Settings);
+
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|spatial-hash")
+	static void ClearSpatialHash(UPARAM(ref) FSpatialHash& Hash);
+
+	// Adds a point and returns its index. Indices of removed points are reused.
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|spatial-hash")
+	static int InsertPointToSpatialHash(UPARAM(ref) FSpatialHash& Hash, const FVector Point);
+
+	// Removes the point at Index. Returns false if there is no such point.
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|spatial-hash")
+	static bool RemovePointFromSpatialHash(UPARAM(ref) FSpatialHash& Hash, int Index);
+
+	// Moves the points at Indices to Positions, at a constant cost per point however far it moves. While async queries
+	// still read the grid, the whole grid is copied first; see FSpatialHash.
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|spatial-hash")
+	static void UpdatePositionsInSpatialHash(
+		UPARAM(ref) FSpatialHash& Hash, const TArray<int>& Indices, const TArray<FVector>& Positions);
+
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|spatial-hash")
+	static void CollectFromSpatialHash(
+		const FSpatialHash& Hash, const FVector Center, float Radius, TArray<int>& Indices, TArray<FVector>& Data);
+
+	// Same output layout as CollectFromKdtreeBatch.
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|spatial-hash")
+	static void CollectFromSpatialHashBatch(const FSpatialHash& Hash, const TArray<FVector>& Centers, const TArray<float>& Radii,
+		TArray<int>& Indices, TArray<int>& Offsets);
+
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|spatial-hash")
+	static void FindKNearestFromSpatialHash(
+		const FSpatialHash& Hash, const FVector Center, int K, float MaxDistance, TArray<int>& Indices, TArray<FVector>& Data);
+
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|spatial-hash")
+	static bool FindNearestFromSpatialHash(
+		const FSpatialHash& Hash, const FVector Center, float MaxDistance, int& Index, FVector& Data);
+
+	UFUNCTION(BluePrintCallable, Category = "SpacialDataStructure|spatial-hash")
+	static void ValidateSpatialHash(const FSpatialHash& Hash);
+
+	// Picks between FKdtree and FSpatialHash for NumPoints points of which NumMovedPerFrame move every frame while
+	// NumQueriesPerFrame queries run, from the costs measured by the benchmark. Assumes the points are moved while no
+	// async query reads the structure, as either one is copied whole otherwise.
+	UFUNCTION(BlueprintPure, Category = "SpacialDataStructure|spatial-hash")
+	static EKdtreeSpatialBackend RecommendSpatialBackend(int NumPoints, int NumMovedPerFrame, int NumQueriesPerFrame);
 };
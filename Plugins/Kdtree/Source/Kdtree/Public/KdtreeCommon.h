@@ -9,25 +9,382 @@
 
 #pragma once
 
+#include "KdtreeCore.h"
+#include "SpatialHashCore.h"
+#include "Templates/SharedPointer.h"
 #include "UObject/ObjectMacros.h"
 
 #include "KdtreeCommon.generated.h"
 
-namespace KdtreeInternal
+// The tree behind FKdtree: three dimensions in the precision of FVector, no payload.
+using FKdtreeInternal = TKdtree<3, FVector::FReal>;
+
+// The grid behind FSpatialHash, in the same precision.
+using FSpatialHashInternal = TSpatialHash<3, FVector::FReal>;
+
+// How the build picks the axis and position at which a node splits its points. The point at the split position is
+// stored in the node, so every policy cuts through a point.
+UENUM(BlueprintType)
+enum class EKdtreeSplitPolicy : uint8
 {
-struct FKdtreeNode;
+	// Cycles through the axes by depth and splits at the median. Fastest to build, best for points spread evenly
+	// along every axis.
+	RoundRobin,
+	// Splits at the median along the axis over which the points of the node spread the most. Keeps the tree balanced
+	// while not wasting levels on flat axes, e.g. for scatter on terrain.
+	MaxSpread,
+	// Cuts the axis of largest spread in its middle and slides the cut to the nearest point when all points lie on one
+	// side. Gives cells with bounded aspect ratio at the cost of an unbalanced tree, which suits clustered points.
+	SlidingMidpoint,
+	// Picks the axis and cut that minimize the expected number of points visited by queries of ExpectedQueryRadius:
+	// the number of points on each side weighted by the volume of its cell grown by the radius.
+	SurfaceAreaHeuristic,
+	// SlidingMidpoint and SurfaceAreaHeuristic split at the median below about twice the depth of a balanced tree, so
+	// the depth stays logarithmic in the number of points.
+};
+
+inline const TCHAR* LexToString(EKdtreeSplitPolicy Policy)
+{
+	switch (Policy)
+	{
+		case EKdtreeSplitPolicy::RoundRobin:
+			return TEXT("RoundRobin");
+		case EKdtreeSplitPolicy::MaxSpread:
+			return TEXT("MaxSpread");
+		case EKdtreeSplitPolicy::SlidingMidpoint:
+			return TEXT("SlidingMidpoint");
+		case EKdtreeSplitPolicy::SurfaceAreaHeuristic:
+			return TEXT("SurfaceAreaHeuristic");
+	}
+	return TEXT("Unknown");
 }
 
-struct FKdtreeInternal
+USTRUCT(BlueprintType)
+struct KDTREE_API FKdtreeBuildSettings
+{
+	GENERATED_USTRUCT_BODY()
+
+	// Subtrees with at most this many points are stored as a single leaf bucket whose points are tested with SIMD
+	// instructions during queries. 0 stores one point per node.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "SpacialDataStructure|kd-tree", meta = (ClampMin = "0", ClampMax = "256"))
+	int32 LeafSize = 16;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "SpacialDataStructure|kd-tree")
+	EKdtreeSplitPolicy SplitPolicy = EKdtreeSplitPolicy::RoundRobin;
+
+	// Typical radius of the queries run on the tree, used by the surface area heuristic. 0 optimizes for nearest
+	// neighbor queries, whose search radius shrinks to the distance between neighboring points.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "SpacialDataStructure|kd-tree",
+		meta = (ClampMin = "0", EditCondition = "SplitPolicy == EKdtreeSplitPolicy::SurfaceAreaHeuristic"))
+	float ExpectedQueryRadius = 0.0f;
+
+	// Stores the points in the order the tree visits them instead of the input order, so that points near each other
+	// are near each other in memory, which saves cache misses on large trees. Indices then refer to the reordered
+	// points; the input index of each is kept alongside, see GetInputIndex.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "SpacialDataStructure|kd-tree")
+	bool bReorderPoints = false;
+};
+
+USTRUCT(BlueprintType)
+struct KDTREE_API FKdtreeUpdateStats
+{
+	GENERATED_USTRUCT_BODY()
+
+	// Points that stayed inside the region of their node and were updated in place.
+	UPROPERTY(BlueprintReadOnly, Category = "SpacialDataStructure|kd-tree")
+	int32 NumMovedInPlace = 0;
+
+	// Points that left the region of their node and were reinserted.
+	UPROPERTY(BlueprintReadOnly, Category = "SpacialDataStructure|kd-tree")
+	int32 NumReinserted = 0;
+
+	// Subtrees rebuilt while reinserting points, either because a leaf bucket overflowed or to restore balance.
+	UPROPERTY(BlueprintReadOnly, Category = "SpacialDataStructure|kd-tree")
+	int32 NumSubtreesRebuilt = 0;
+
+	// Whether the whole tree was rebuilt afterwards to reclaim the nodes left behind.
+	UPROPERTY(BlueprintReadOnly, Category = "SpacialDataStructure|kd-tree")
+	bool bRebuiltAll = false;
+};
+
+// Selects points by the user bits assigned to them: a point passes if its mask shares a bit with IncludeMask and none
+// with ExcludeMask. Points without a mask have no bits set and never pass.
+USTRUCT(BlueprintType)
+struct KDTREE_API FKdtreeMaskFilter
+{
+	GENERATED_USTRUCT_BODY()
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "SpacialDataStructure|kd-tree")
+	int64 IncludeMask = -1;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "SpacialDataStructure|kd-tree")
+	int64 ExcludeMask = 0;
+
+	bool Matches(uint64 Mask) const
+	{
+		return (Mask & static_cast<uint64>(IncludeMask)) != 0 && (Mask & static_cast<uint64>(ExcludeMask)) == 0;
+	}
+};
+
+// Trades accuracy of nearest and radius queries for speed, e.g. for effects on huge point clouds that can do with
+// nearly the right neighbors but must stay within a fixed time per query.
+USTRUCT(BlueprintType)
+struct KDTREE_API FKdtreeApproximation
+{
+	GENERATED_USTRUCT_BODY()
+
+	// Relative error allowed in distances: nearest queries may return a point up to 1 + Epsilon times farther than the
+	// exact one, and radius queries may miss points farther than the radius divided by 1 + Epsilon, though they never
+	// return points outside the radius. 0 keeps results exact.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "SpacialDataStructure|kd-tree", meta = (ClampMin = "0"))
+	float Epsilon = 0.0f;
+
+	// Nodes a query may visit, counting each leaf bucket as one node. Queries visit the nodes closest to the center
+	// first and return the best answer found when the budget runs out. 0 means no limit.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "SpacialDataStructure|kd-tree", meta = (ClampMin = "0"))
+	int32 MaxVisitedNodes = 0;
+};
+
+USTRUCT(BlueprintType)
+struct KDTREE_API FSpatialHashBuildSettings
+{
+	GENERATED_USTRUCT_BODY()
+
+	// Edge length of the grid cells. Radius queries are fastest with cells about as large as their radius. 0 picks a
+	// size holding a few points per cell, which suits nearest neighbor queries, and adapts it to the points at every
+	// rebuild.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "SpacialDataStructure|spatial-hash", meta = (ClampMin = "0"))
+	float CellSize = 0.0f;
+};
+
+// The structures the plugin can index points with.
+UENUM(BlueprintType)
+enum class EKdtreeSpatialBackend : uint8
+{
+	// Adapts to any distribution of points and answers nearest queries at any distance, but moving points costs a walk
+	// down the tree and the odd subtree rebuild.
+	Kdtree,
+	// Uniform grid. Moving a point costs a few array writes, and radius queries of about the cell size are cheap, but
+	// clustered points crowd into few cells and faraway neighbors take many cells to reach.
+	SpatialHash,
+};
+
+// Shape and memory use of a tree, for spotting degenerate trees without dumping every node.
+USTRUCT(BlueprintType)
+struct KDTREE_API FKdtreeSummary
+{
+	GENERATED_USTRUCT_BODY()
+
+	UPROPERTY(BlueprintReadOnly, Category = "SpacialDataStructure|kd-tree")
+	int32 NumPoints = 0;
+
+	// Nodes reachable from the root, counting each leaf bucket as one node.
+	UPROPERTY(BlueprintReadOnly, Category = "SpacialDataStructure|kd-tree")
+	int32 NumNodes = 0;
+
+	UPROPERTY(BlueprintReadOnly, Category = "SpacialDataStructure|kd-tree")
+	int32 NumLeafBuckets = 0;
+
+	// Removed points whose nodes still split space.
+	UPROPERTY(BlueprintReadOnly, Category = "SpacialDataStructure|kd-tree")
+	int32 NumTombstones = 0;
+
+	// Number of nodes at each depth, starting with the root.
+	UPROPERTY(BlueprintReadOnly, Category = "SpacialDataStructure|kd-tree")
+	TArray<int32> NodesPerDepth;
+
+	// Depth of the tree divided by the depth of a perfectly balanced tree with as many nodes. 1 is perfectly
+	// balanced; edits that leave the tree lopsided raise it until a rebuild.
+	UPROPERTY(BlueprintReadOnly, Category = "SpacialDataStructure|kd-tree")
+	float BalanceFactor = 0.0f;
+
+	UPROPERTY(BlueprintReadOnly, Category = "SpacialDataStructure|kd-tree")
+	int64 AllocatedBytes = 0;
+
+	UPROPERTY(BlueprintReadOnly, Category = "SpacialDataStructure|kd-tree")
+	EKdtreeSplitPolicy SplitPolicy = EKdtreeSplitPolicy::RoundRobin;
+
+	// One line per summary, e.g. for logging many trees at once.
+	FString ToString() const
+	{
+		FString Histogram;
+		for (int32 Depth = 0; Depth < NodesPerDepth.Num(); ++Depth)
+		{
+			Histogram += FString::Printf(TEXT("%s%d"), Depth > 0 ? TEXT(" ") : TEXT(""), NodesPerDepth[Depth]);
+		}
+		return FString::Printf(
+			TEXT("points=%d nodes=%d leaves=%d tombstones=%d depth=%d balance=%.2f bytes=%lld split=%s nodes_per_depth=[%s]"), NumPoints,
+			NumNodes, NumLeafBuckets, NumTombstones, NodesPerDepth.Num(), BalanceFactor, AllocatedBytes, LexToString(SplitPolicy), *Histogram);
+	}
+};
+
+// Neighbors of every point in compressed sparse row form: the neighbors of the point at index i are Neighbors[Offsets[i]]
+// to Neighbors[Offsets[i + 1] - 1]. Offsets has one entry per point index plus one, and removed points have no neighbors.
+USTRUCT(BlueprintType)
+struct KDTREE_API FKdtreeNeighborGraph
 {
-	TArray<FVector> Data;
-	KdtreeInternal::FKdtreeNode* Root;
+	GENERATED_USTRUCT_BODY()
+
+	UPROPERTY(BlueprintReadOnly, Category = "SpacialDataStructure|kd-tree")
+	TArray<int32> Offsets;
+
+	UPROPERTY(BlueprintReadOnly, Category = "SpacialDataStructure|kd-tree")
+	TArray<int32> Neighbors;
+
+	int32 GetNumNeighbors(int32 Index) const
+	{
+		return Offsets[Index + 1] - Offsets[Index];
+	}
+
+	TArrayView<const int32> GetNeighbors(int32 Index) const
+	{
+		return MakeArrayView(Neighbors.GetData() + Offsets[Index], GetNumNeighbors(Index));
+	}
 };
 
+// Holds InternalType, a tree or a grid, for FKdtree and FSpatialHash. Copies share it and only bump its thread-safe
+// reference count. The first Edit() of a copy gives it one of its own, so copies still behave as if they held it by
+// value. It is freed with the last copy or async task holding it.
+template <typename InternalType>
+class TKdtreeSharedSnapshot
+{
+public:
+	using FSnapshotRef = TSharedRef<InternalType, ESPMode::ThreadSafe>;
+	using FConstSnapshotRef = TSharedRef<const InternalType, ESPMode::ThreadSafe>;
+
+	TKdtreeSharedSnapshot() : Snapshot(MakeShared<InternalType, ESPMode::ThreadSafe>())
+	{
+	}
+
+	const InternalType& Get() const
+	{
+		return *Snapshot;
+	}
+
+	// The current snapshot, for async work that has to keep reading it after a later rebuild replaced it.
+	FConstSnapshotRef GetSnapshot() const
+	{
+		return Snapshot;
+	}
+
+	// Whether other copies or async work also hold the current snapshot, so that Edit() has to copy it.
+	bool IsShared() const
+	{
+		return !Snapshot.IsUnique();
+	}
+
+	// The current snapshot for editing in place. It is copied first if other copies or async work still hold it.
+	InternalType& Edit()
+	{
+		if (!Snapshot.IsUnique())
+		{
+			Snapshot = MakeShared<InternalType, ESPMode::ThreadSafe>(*Snapshot);
+		}
+		return *Snapshot;
+	}
+
+	// Memory held by the current snapshot, including the snapshot itself. A shared snapshot is counted by every copy.
+	SIZE_T GetAllocatedSize() const
+	{
+		return sizeof(InternalType) + Snapshot->GetAllocatedSize();
+	}
+
+	// Replaces the snapshot by one built elsewhere and returns the previous one. Must be called on the thread that owns
+	// the holder; work started on the previous snapshot keeps running on it.
+	FSnapshotRef SwapSnapshot(FSnapshotRef NewSnapshot)
+	{
+		Swap(Snapshot, NewSnapshot);
+		return NewSnapshot;
+	}
+
+private:
+	FSnapshotRef Snapshot;
+};
+
+// Copies, including Blueprint pass-by-value, share the tree until one of them is edited. See TKdtreeSharedSnapshot.
 USTRUCT(BlueprintType)
 struct KDTREE_API FKdtree
 {
 	GENERATED_USTRUCT_BODY()
 
-	FKdtreeInternal Internal;
+	using FSnapshotRef = TKdtreeSharedSnapshot<FKdtreeInternal>::FSnapshotRef;
+	using FConstSnapshotRef = TKdtreeSharedSnapshot<FKdtreeInternal>::FConstSnapshotRef;
+
+	const FKdtreeInternal& Get() const
+	{
+		return Shared.Get();
+	}
+
+	FConstSnapshotRef GetSnapshot() const
+	{
+		return Shared.GetSnapshot();
+	}
+
+	bool IsShared() const
+	{
+		return Shared.IsShared();
+	}
+
+	FKdtreeInternal& Edit()
+	{
+		return Shared.Edit();
+	}
+
+	SIZE_T GetAllocatedSize() const
+	{
+		return Shared.GetAllocatedSize();
+	}
+
+	FSnapshotRef SwapSnapshot(FSnapshotRef NewSnapshot)
+	{
+		return Shared.SwapSnapshot(MoveTemp(NewSnapshot));
+	}
+
+private:
+	TKdtreeSharedSnapshot<FKdtreeInternal> Shared;
+};
+
+// The points of FSpatialHash are shared between copies exactly like the tree of FKdtree. Editing a grid that an async
+// query or a copy still reads copies the whole grid first, so moving points costs O(number of points) instead of a few
+// writes per moved point in every frame that async queries are in flight.
+USTRUCT(BlueprintType)
+struct KDTREE_API FSpatialHash
+{
+	GENERATED_USTRUCT_BODY()
+
+	using FSnapshotRef = TKdtreeSharedSnapshot<FSpatialHashInternal>::FSnapshotRef;
+	using FConstSnapshotRef = TKdtreeSharedSnapshot<FSpatialHashInternal>::FConstSnapshotRef;
+
+	const FSpatialHashInternal& Get() const
+	{
+		return Shared.Get();
+	}
+
+	FConstSnapshotRef GetSnapshot() const
+	{
+		return Shared.GetSnapshot();
+	}
+
+	bool IsShared() const
+	{
+		return Shared.IsShared();
+	}
+
+	FSpatialHashInternal& Edit()
+	{
+		return Shared.Edit();
+	}
+
+	SIZE_T GetAllocatedSize() const
+	{
+		return Shared.GetAllocatedSize();
+	}
+
+	FSnapshotRef SwapSnapshot(FSnapshotRef NewSnapshot)
+	{
+		return Shared.SwapSnapshot(MoveTemp(NewSnapshot));
+	}
+
+private:
+	TKdtreeSharedSnapshot<FSpatialHashInternal> Shared;
 };
@@ -0,0 +1,215 @@
+/*!
+ * Kdtree
+ *
+ * Copyright (c) 2019-2023 nutti
+ *
+ * This software is released under the MIT License.
+ * https://opensource.org/licenses/MIT
+ */
+
+#pragma once
+
+#include "Containers/BitArray.h"
+#include "Containers/StaticArray.h"
+#include "CoreMinimal.h"
+#include "Templates/IntegerSequence.h"
+
+#include <type_traits>
+
+// Declared in KdtreeCommon.h, where it is exposed to Blueprint.
+enum class EKdtreeSplitPolicy : uint8;
+
+namespace KdtreeInternal
+{
+// Node of a tree stored contiguously in TKdtree::Nodes. Children are addressed by their position in that array;
+// the root always lives at position 0, so 0 doubles as "no child".
+struct FKdtreeNode
+{
+	static constexpr uint32 NoChild = 0;
+	static constexpr uint32 AxisBits = 3;
+	static constexpr uint32 AxisMask = (1u << AxisBits) - 1;
+
+	int32 Index = INDEX_NONE;
+	uint32 ChildLeft = NoChild;
+	// Right child in the upper 29 bits, split axis in the lower 3 bits.
+	uint32 ChildRightAndAxis = NoChild;
+
+	int32 GetAxis() const
+	{
+		return ChildRightAndAxis & AxisMask;
+	}
+
+	uint32 GetChildRight() const
+	{
+		return ChildRightAndAxis >> AxisBits;
+	}
+
+	void SetChildRightAndAxis(uint32 ChildRight, int32 Axis)
+	{
+		ChildRightAndAxis = (ChildRight << AxisBits) | static_cast<uint32>(Axis);
+	}
+
+	// Leaf buckets are marked by an axis value no split can have. They reuse Index as the first slot in
+	// TKdtree::LeafIndices/LeafCoords, ChildLeft as the number of points in the bucket and the right child
+	// bits as the number of slots reserved for it, which can exceed the number of points once the tree is edited.
+	static constexpr int32 LeafAxis = AxisMask;
+
+	bool IsLeaf() const
+	{
+		return GetAxis() == LeafAxis;
+	}
+
+	int32 GetLeafFirstSlot() const
+	{
+		return Index;
+	}
+
+	int32 GetLeafNumPoints() const
+	{
+		return static_cast<int32>(ChildLeft);
+	}
+
+	int32 GetLeafCapacity() const
+	{
+		return static_cast<int32>(GetChildRight());
+	}
+
+	void SetLeaf(int32 FirstSlot, int32 NumPoints, int32 Capacity)
+	{
+		Index = FirstSlot;
+		ChildLeft = static_cast<uint32>(NumPoints);
+		SetChildRightAndAxis(static_cast<uint32>(Capacity), LeafAxis);
+	}
+
+	void SetLeafNumPoints(int32 NumPoints)
+	{
+		ChildLeft = static_cast<uint32>(NumPoints);
+	}
+
+	friend FArchive& operator<<(FArchive& Ar, FKdtreeNode& Node)
+	{
+		return Ar << Node.Index << Node.ChildLeft << Node.ChildRightAndAxis;
+	}
+};
+
+// Point type of a tree: the engine vector types in 2D and 3D, a plain array of coordinates otherwise.
+template <int32 Dim, typename ScalarType>
+struct TKdtreePoint
+{
+	using Type = TStaticArray<ScalarType, Dim>;
+};
+
+template <typename ScalarType>
+struct TKdtreePoint<2, ScalarType>
+{
+	using Type = UE::Math::TVector2<ScalarType>;
+};
+
+template <typename ScalarType>
+struct TKdtreePoint<3, ScalarType>
+{
+	using Type = UE::Math::TVector<ScalarType>;
+};
+
+// Values attached to the points, indexed like TKdtree::Data. Takes no space when there is no payload.
+template <typename PayloadType>
+struct TKdtreePayloads
+{
+	TArray<PayloadType> Payloads;
+};
+
+template <>
+struct TKdtreePayloads<void>
+{
+};
+
+template <typename BodyType, int32... Axes>
+FORCEINLINE void ForEachAxisImpl(BodyType& Body, TIntegerSequence<int32, Axes...>)
+{
+	(Body(Axes), ...);
+}
+
+// Calls Body(Axis) for every axis below Dim. The calls are expanded at compile time instead of looping.
+template <int32 Dim, typename BodyType>
+FORCEINLINE void ForEachAxis(BodyType&& Body)
+{
+	ForEachAxisImpl(Body, TMakeIntegerSequence<int32, Dim>());
+}
+}	 // namespace KdtreeInternal
+
+// Kd-tree over points with Dim coordinates of type ScalarType, each optionally carrying a PayloadType value.
+// The operations working on it live in KdtreeOperations.h. FKdtreeInternal, the tree behind the Blueprint-facing
+// FKdtree, is the 3D double precision instantiation.
+template <int32 InDim, typename InScalarType, typename InPayloadType = void>
+struct TKdtree : public KdtreeInternal::TKdtreePayloads<InPayloadType>
+{
+	static_assert(InDim >= 1 && InDim < KdtreeInternal::FKdtreeNode::LeafAxis, "Unsupported number of dimensions");
+	static_assert(std::is_floating_point_v<InScalarType>, "Coordinates must be float or double");
+
+	static constexpr int32 Dim = InDim;
+	using ScalarType = InScalarType;
+	using PayloadType = InPayloadType;
+	using PointType = typename KdtreeInternal::TKdtreePoint<Dim, ScalarType>::Type;
+
+	static PointType MakeUniformPoint(ScalarType Value)
+	{
+		PointType Point;
+		KdtreeInternal::ForEachAxis<Dim>([&Point, Value](int32 Axis) { Point[Axis] = Value; });
+		return Point;
+	}
+
+	TArray<PointType> Data;
+	TArray<KdtreeInternal::FKdtreeNode> Nodes;
+	// Bounding box of all points, the region covered by the root node. Empty while BoundsMin lies above BoundsMax.
+	PointType BoundsMin = MakeUniformPoint(TNumericLimits<ScalarType>::Max());
+	PointType BoundsMax = MakeUniformPoint(TNumericLimits<ScalarType>::Lowest());
+
+	// Maximum number of points per leaf bucket the tree was built with, 0 if it has no buckets.
+	int32 LeafSize = 0;
+	// Split policy and expected query radius the tree was built with. Subtrees rebuilt after edits are always split
+	// at the median, along the axis of largest spread unless the policy is round robin, to stay balanced.
+	EKdtreeSplitPolicy SplitPolicy{};
+	float SplitQueryRadius = 0.0f;
+	// Points stored in leaf buckets, grouped by leaf: the index into Data and the coordinates as one array per axis.
+	// Each coordinate array is padded so that a full SIMD register can be loaded at the last slot.
+	TArray<int32> LeafIndices;
+	TArray<ScalarType> LeafCoords[Dim];
+
+	// Set for every index into Data that holds no point of the tree. Indices of live points never change.
+	TBitArray<> RemovedPoints;
+	// Removed indices no node refers to anymore. Insertions reuse them before growing Data.
+	TArray<int32> FreeIndices;
+	// Number of nodes whose point was removed. They keep splitting space until their subtree is rebuilt.
+	int32 NumTombstones = 0;
+	// Nodes and leaf slots left unreachable by partial rebuilds, reclaimed when the whole tree is rebuilt.
+	int32 NumGarbageNodes = 0;
+	int32 NumGarbageLeafSlots = 0;
+	// Largest number of points the tree held since it was last built from scratch.
+	int32 MaxNumPoints = 0;
+
+	// Optional user bits per point, indexed like Data, and for every node the OR of the bits of the points below it,
+	// indexed like Nodes. Both stay empty until masks are assigned. The subtree masks may keep bits of points that were
+	// removed or changed since the last rebuild, which only costs filtered queries a visit to the subtree.
+	TArray<uint64> PointMasks;
+	TArray<uint64> SubtreeMasks;
+	// For trees built with FKdtreeBuildSettings::bReorderPoints, the position of every point in the array it was built
+	// from, indexed like Data, and INDEX_NONE for points inserted since. Empty when the points keep their input order.
+	TArray<int32> InputIndices;
+
+	// Heap memory held by the arrays of the tree, not counting the tree itself.
+	SIZE_T GetAllocatedSize() const
+	{
+		SIZE_T Size = Data.GetAllocatedSize() + Nodes.GetAllocatedSize() + LeafIndices.GetAllocatedSize() +
+					  RemovedPoints.GetAllocatedSize() + FreeIndices.GetAllocatedSize() + PointMasks.GetAllocatedSize() +
+					  SubtreeMasks.GetAllocatedSize() + InputIndices.GetAllocatedSize();
+		for (const TArray<ScalarType>& Coords : LeafCoords)
+		{
+			Size += Coords.GetAllocatedSize();
+		}
+		if constexpr (!std::is_void_v<PayloadType>)
+		{
+			Size += this->Payloads.GetAllocatedSize();
+		}
+		return Size;
+	}
+};
@@ -0,0 +1,3752 @@
+/*!
+ * Kdtree
+ *
+ * Copyright (c) 2019-2023 nutti
+ *
+ * This software is released under the MIT License.
+ * https://opensource.org/licenses/MIT
+ */
+
+#pragma once
+
+#include "Async/ParallelFor.h"
+#include "Async/TaskGraphInterfaces.h"
+#include "KdtreeCommon.h"
+#include "KdtreeShapes.h"
+#include "KdtreeStats.h"
+#include "Math/VectorRegister.h"
+#include "Misc/App.h"
+#include "Serialization/Archive.h"
+#include "Tasks/Task.h"
+
+namespace KdtreeInternal
+{
+// Subtrees with at least this many points are split across task graph workers during BuildKdtree.
+constexpr int ParallelBuildMinPoints = 16 * 1024;
+
+namespace Private
+{
+// Ranges at or below this size are finished with an insertion sort.
+constexpr int64 InsertionSortThreshold = 16;
+
+template <typename T, typename PredicateType>
+void InsertionSort(T* First, T* Last, const PredicateType& Less)
+{
+	for (T* Current = First + 1; Current < Last; ++Current)
+	{
+		T Value = *Current;
+		T* Hole = Current;
+		for (; Hole > First && Less(Value, *(Hole - 1)); --Hole)
+		{
+			*Hole = *(Hole - 1);
+		}
+		*Hole = Value;
+	}
+}
+
+template <typename T, typename PredicateType>
+T MedianOfThree(T A, T B, T C, const PredicateType& Less)
+{
+	if (Less(B, A))
+	{
+		Swap(A, B);
+	}
+	if (Less(C, B))
+	{
+		Swap(B, C);
+		if (Less(B, A))
+		{
+			Swap(A, B);
+		}
+	}
+	return B;
+}
+
+// Three-way partition of [First, Last) around Pivot.
+// On return, [First, OutEqualFirst) < Pivot, [OutEqualFirst, OutEqualLast) == Pivot and [OutEqualLast, Last) > Pivot.
+// Grouping the elements equal to the pivot keeps duplicate-heavy inputs linear.
+template <typename T, typename PredicateType>
+void PartitionThreeWay(T* First, T* Last, T Pivot, const PredicateType& Less, T*& OutEqualFirst, T*& OutEqualLast)
+{
+	T* Lower = First;
+	T* Current = First;
+	T* Upper = Last;
+	while (Current < Upper)
+	{
+		if (Less(*Current, Pivot))
+		{
+			Swap(*Lower++, *Current++);
+		}
+		else if (Less(Pivot, *Current))
+		{
+			Swap(*Current, *--Upper);
+		}
+		else
+		{
+			++Current;
+		}
+	}
+	OutEqualFirst = Lower;
+	OutEqualLast = Upper;
+}
+
+template <typename T, typename PredicateType>
+void NthElement(T* First, T* Nth, T* Last, const PredicateType& Less);
+
+// Pivot with a guaranteed split ratio (median of the medians of groups of five).
+// Reorders [First, Last) so that the group medians are moved to the front.
+template <typename T, typename PredicateType>
+T MedianOfMedians(T* First, T* Last, const PredicateType& Less)
+{
+	T* Medians = First;
+	for (T* Group = First; Group < Last; Group += 5)
+	{
+		T* GroupLast = FMath::Min(Group + 5, Last);
+		InsertionSort(Group, GroupLast, Less);
+		Swap(*Medians++, Group[(GroupLast - Group - 1) / 2]);
+	}
+
+	T* Middle = First + (Medians - First - 1) / 2;
+	NthElement(First, Middle, Medians, Less);
+	return *Middle;
+}
+
+// Introselect: quickselect with a median-of-three pivot, falling back to median-of-medians pivots once the
+// partitioning depth exceeds 2*log2(N). Linear time on average and in the worst case.
+template <typename T, typename PredicateType>
+void NthElement(T* First, T* Nth, T* Last, const PredicateType& Less)
+{
+	int32 DepthLimit = 2 * FMath::FloorLog2(static_cast<uint32>(Last - First) | 1);
+	while (Last - First > InsertionSortThreshold)
+	{
+		const T Pivot = DepthLimit-- > 0 ? MedianOfThree(*First, First[(Last - First) / 2], *(Last - 1), Less)
+										 : MedianOfMedians(First, Last, Less);
+
+		T* EqualFirst;
+		T* EqualLast;
+		PartitionThreeWay(First, Last, Pivot, Less, EqualFirst, EqualLast);
+		if (Nth < EqualFirst)
+		{
+			Last = EqualFirst;
+		}
+		else if (Nth >= EqualLast)
+		{
+			First = EqualLast;
+		}
+		else
+		{
+			return;
+		}
+	}
+
+	InsertionSort(First, Last, Less);
+}
+
+// Reorders Indices so that the median point along Axis ends up at the returned position,
+// with no larger value before it and no smaller value after it.
+template <typename TreeType>
+int SplitAtMedian(const TreeType& Tree, int* Indices, int NumData, int Axis)
+{
+	const int Middle = (NumData - 1) / 2;
+
+	const typename TreeType::PointType* Data = Tree.Data.GetData();
+	NthElement(Indices, Indices + Middle, Indices + NumData,
+		[Data, Axis](int Lhs, int Rhs) { return Data[Lhs][Axis] < Data[Rhs][Axis]; });
+
+	return Middle;
+}
+
+// Reorders Indices so that the points below Cut along Axis come first, directly followed by the smallest point not
+// below it, whose position is returned. If every point lies below Cut, the largest one is moved to the end instead.
+template <typename TreeType>
+int SplitAtValue(const TreeType& Tree, int* Indices, int NumData, int Axis, typename TreeType::ScalarType Cut)
+{
+	const typename TreeType::PointType* Data = Tree.Data.GetData();
+	int NumBelow = 0;
+	for (int Offset = 0; Offset < NumData; ++Offset)
+	{
+		if (Data[Indices[Offset]][Axis] < Cut)
+		{
+			Swap(Indices[Offset], Indices[NumBelow++]);
+		}
+	}
+
+	// The point stored in the node has to bound both sides, so it is the extreme one of the side it is taken from.
+	const int Middle = FMath::Min(NumBelow, NumData - 1);
+	int Best = Middle;
+	if (NumBelow < NumData)
+	{
+		for (int Offset = Middle + 1; Offset < NumData; ++Offset)
+		{
+			if (Data[Indices[Offset]][Axis] < Data[Indices[Best]][Axis])
+			{
+				Best = Offset;
+			}
+		}
+	}
+	else
+	{
+		for (int Offset = 0; Offset < Middle; ++Offset)
+		{
+			if (Data[Indices[Offset]][Axis] > Data[Indices[Best]][Axis])
+			{
+				Best = Offset;
+			}
+		}
+	}
+	Swap(Indices[Middle], Indices[Best]);
+	return Middle;
+}
+
+// Number of bins the surface area heuristic sorts the points of a node into along each axis. The cuts it evaluates
+// are the bin boundaries.
+constexpr int32 SurfaceAreaNumBins = 32;
+
+struct FNodeSplit
+{
+	int Axis;
+	// Position in the reordered indices of the point stored in the node.
+	int Middle;
+};
+
+// Binned surface area heuristic. A query of radius R visits a side when its center lies within the cell of the side
+// grown by R, so each cut is rated by the number of points on either side weighted by the volume of that grown cell.
+template <typename TreeType>
+FNodeSplit SplitBySurfaceArea(const TreeType& Tree, int* Indices, int NumData, const typename TreeType::PointType& Min,
+	const typename TreeType::PointType& Max, int FallbackAxis)
+{
+	using ScalarType = typename TreeType::ScalarType;
+	constexpr int32 Dim = TreeType::Dim;
+
+	const double GrowBy = 2.0 * Tree.SplitQueryRadius;
+	double GrownVolume = 1.0;
+	ForEachAxis<Dim>([&](int32 Axis) { GrownVolume *= static_cast<double>(Max[Axis] - Min[Axis]) + GrowBy; });
+
+	double BestCost = TNumericLimits<double>::Max();
+	FNodeSplit Best{FallbackAxis, INDEX_NONE};
+	ScalarType BestCut = 0;
+	const typename TreeType::PointType* Data = Tree.Data.GetData();
+	for (int32 Axis = 0; Axis < Dim; ++Axis)
+	{
+		const double Extent = static_cast<double>(Max[Axis] - Min[Axis]);
+		if (Extent <= 0.0)
+		{
+			continue;
+		}
+
+		int32 Counts[SurfaceAreaNumBins] = {};
+		const double Scale = SurfaceAreaNumBins / Extent;
+		for (int Offset = 0; Offset < NumData; ++Offset)
+		{
+			const int32 Bin = static_cast<int32>((Data[Indices[Offset]][Axis] - Min[Axis]) * Scale);
+			++Counts[FMath::Min(Bin, SurfaceAreaNumBins - 1)];
+		}
+
+		// The grown extent of the other axes is the same on both sides.
+		const double OtherVolume = GrownVolume / (Extent + GrowBy);
+		int32 NumLeft = 0;
+		for (int32 Boundary = 1; Boundary < SurfaceAreaNumBins; ++Boundary)
+		{
+			NumLeft += Counts[Boundary - 1];
+			const double LeftExtent = Extent * Boundary / SurfaceAreaNumBins;
+			const double Cost =
+				OtherVolume * ((LeftExtent + GrowBy) * NumLeft + (Extent - LeftExtent + GrowBy) * (NumData - NumLeft));
+			if (Cost < BestCost)
+			{
+				BestCost = Cost;
+				Best.Axis = Axis;
+				BestCut = static_cast<ScalarType>(Min[Axis] + LeftExtent);
+			}
+		}
+	}
+
+	// All points coincide, so any split is as good as another.
+	Best.Middle = BestCost < TNumericLimits<double>::Max() ? SplitAtValue(Tree, Indices, NumData, Best.Axis, BestCut)
+														  : SplitAtMedian(Tree, Indices, NumData, Best.Axis);
+	return Best;
+}
+
+// Policies that always split at the median, so the size of every subtree follows from its number of points.
+inline bool IsBalancedSplitPolicy(EKdtreeSplitPolicy Policy)
+{
+	return Policy == EKdtreeSplitPolicy::RoundRobin || Policy == EKdtreeSplitPolicy::MaxSpread;
+}
+
+// Policy for subtrees rebuilt after edits. They are kept balanced, as scapegoat rebalancing relies on bounded depth.
+template <typename TreeType>
+EKdtreeSplitPolicy GetRebuildSplitPolicy(const TreeType& Tree)
+{
+	return Tree.SplitPolicy == EKdtreeSplitPolicy::RoundRobin ? EKdtreeSplitPolicy::RoundRobin : EKdtreeSplitPolicy::MaxSpread;
+}
+
+// Depth from which unbalanced policies split at the median. They can peel off one point per level, e.g. on
+// geometrically spaced points, and the build, nearest searches and validation recurse once per level.
+inline int GetMaxUnbalancedDepth(int NumData)
+{
+	return 2 * static_cast<int>(FMath::CeilLogTwo(static_cast<uint32>(FMath::Max(NumData, 1)))) + 8;
+}
+
+// Picks the split of the node over Indices[0, NumData) at Depth and reorders Indices around it.
+template <typename TreeType>
+FNodeSplit SplitNodePoints(const TreeType& Tree, int* Indices, int NumData, int Depth, EKdtreeSplitPolicy Policy)
+{
+	if (!IsBalancedSplitPolicy(Policy) && Depth >= GetMaxUnbalancedDepth(Tree.Data.Num()))
+	{
+		Policy = EKdtreeSplitPolicy::MaxSpread;
+	}
+	if (Policy == EKdtreeSplitPolicy::RoundRobin)
+	{
+		const int Axis = Depth % TreeType::Dim;
+		return FNodeSplit{Axis, SplitAtMedian(Tree, Indices, NumData, Axis)};
+	}
+
+	typename TreeType::PointType Min = Tree.Data[Indices[0]];
+	typename TreeType::PointType Max = Min;
+	for (int Offset = 1; Offset < NumData; ++Offset)
+	{
+		const typename TreeType::PointType& Point = Tree.Data[Indices[Offset]];
+		ForEachAxis<TreeType::Dim>([&](int32 Axis) {
+			Min[Axis] = FMath::Min(Min[Axis], Point[Axis]);
+			Max[Axis] = FMath::Max(Max[Axis], Point[Axis]);
+		});
+	}
+	int Axis = 0;
+	ForEachAxis<TreeType::Dim>([&](int32 Candidate) {
+		if (Max[Candidate] - Min[Candidate] > Max[Axis] - Min[Axis])
+		{
+			Axis = Candidate;
+		}
+	});
+
+	if (Policy == EKdtreeSplitPolicy::SurfaceAreaHeuristic)
+	{
+		return SplitBySurfaceArea(Tree, Indices, NumData, Min, Max, Axis);
+	}
+	if (Policy == EKdtreeSplitPolicy::SlidingMidpoint && Min[Axis] < Max[Axis])
+	{
+		return FNodeSplit{Axis, SplitAtValue(Tree, Indices, NumData, Axis, Min[Axis] + (Max[Axis] - Min[Axis]) / 2)};
+	}
+	return FNodeSplit{Axis, SplitAtMedian(Tree, Indices, NumData, Axis)};
+}
+
+// Number of leaf slots loaded at once by the SIMD leaf kernel.
+constexpr int32 LeafSimdWidth = 4;
+
+// Points removed from a leaf bucket are taken out of it, so only the points of inner nodes need this check.
+template <typename TreeType>
+bool IsTombstone(const TreeType& Tree, int Index)
+{
+	return Tree.NumTombstones > 0 && Tree.RemovedPoints[Index];
+}
+
+template <int32 Dim, typename PointType>
+auto GetDistSquared(const PointType& A, const PointType& B)
+{
+	std::decay_t<decltype(A[0])> DistSquared = 0;
+	ForEachAxis<Dim>([&](int32 Axis) { DistSquared += FMath::Square(A[Axis] - B[Axis]); });
+	return DistSquared;
+}
+
+template <typename TreeType>
+void ExpandBounds(TreeType& Tree, const typename TreeType::PointType& Point)
+{
+	ForEachAxis<TreeType::Dim>([&](int32 Axis) {
+		Tree.BoundsMin[Axis] = FMath::Min(Tree.BoundsMin[Axis], Point[Axis]);
+		Tree.BoundsMax[Axis] = FMath::Max(Tree.BoundsMax[Axis], Point[Axis]);
+	});
+}
+
+template <typename TreeType>
+void ResetBounds(TreeType& Tree)
+{
+	Tree.BoundsMin = TreeType::MakeUniformPoint(TNumericLimits<typename TreeType::ScalarType>::Max());
+	Tree.BoundsMax = TreeType::MakeUniformPoint(TNumericLimits<typename TreeType::ScalarType>::Lowest());
+}
+
+template <int32 Dim, typename PointType>
+FString PointToString(const PointType& Point)
+{
+	FString Result;
+	for (int32 Axis = 0; Axis < Dim; ++Axis)
+	{
+		Result += FString::Printf(Axis == 0 ? TEXT("%f") : TEXT(", %f"), static_cast<double>(Point[Axis]));
+	}
+	return Result;
+}
+
+struct FSubtreeSize
+{
+	int32 NumNodes = 0;
+	int32 NumLeafPoints = 0;
+};
+
+// Number of nodes and leaf bucket slots BuildNode produces for NumData points.
+inline FSubtreeSize GetSubtreeSize(int NumData, int LeafSize)
+{
+	if (NumData <= 0)
+	{
+		return FSubtreeSize();
+	}
+	if (NumData <= LeafSize)
+	{
+		return FSubtreeSize{1, NumData};
+	}
+	if (LeafSize <= 0)
+	{
+		return FSubtreeSize{NumData, 0};
+	}
+
+	const int Middle = (NumData - 1) / 2;
+	const FSubtreeSize Left = GetSubtreeSize(Middle, LeafSize);
+	const FSubtreeSize Right = GetSubtreeSize(NumData - Middle - 1, LeafSize);
+	return FSubtreeSize{1 + Left.NumNodes + Right.NumNodes, Left.NumLeafPoints + Right.NumLeafPoints};
+}
+
+// Nodes and leaf slots to reserve for a subtree over NumData points. Unbalanced policies split at positions that are
+// not known in advance, but every node holds at least one point, so NumData of each is enough.
+inline FSubtreeSize GetSubtreeCapacity(int NumData, int LeafSize, EKdtreeSplitPolicy Policy)
+{
+	if (IsBalancedSplitPolicy(Policy) || NumData <= LeafSize)
+	{
+		return GetSubtreeSize(NumData, LeafSize);
+	}
+	return FSubtreeSize{NumData, LeafSize > 0 ? NumData : 0};
+}
+
+template <typename TreeType>
+void SetLeafSlot(TreeType& Tree, int32 Slot, int Index)
+{
+	const typename TreeType::PointType& Point = Tree.Data[Index];
+	Tree.LeafIndices[Slot] = Index;
+	ForEachAxis<TreeType::Dim>([&](int32 Axis) { Tree.LeafCoords[Axis][Slot] = Point[Axis]; });
+}
+
+template <typename TreeType>
+void BuildLeaf(TreeType& Tree, FKdtreeNode& Node, const int* Indices, int NumData, int32 FirstSlot)
+{
+	Node.SetLeaf(FirstSlot, NumData, NumData);
+	for (int Offset = 0; Offset < NumData; ++Offset)
+	{
+		SetLeafSlot(Tree, FirstSlot + Offset, Indices[Offset]);
+	}
+}
+
+// Builds the subtree over Indices[0, NumData) in pre-order starting at Nodes[NextNode]: the left subtree directly
+// follows its parent and the right subtree follows the left one. Leaf buckets are filled starting at NextLeafSlot.
+// Both counters are advanced past the subtree.
+template <typename TreeType>
+void BuildNode(TreeType& Tree, int* Indices, int NumData, int Depth, EKdtreeSplitPolicy Policy, uint32& NextNode,
+	int32& NextLeafSlot)
+{
+	FKdtreeNode& Node = Tree.Nodes[NextNode++];
+	if (NumData <= Tree.LeafSize)
+	{
+		BuildLeaf(Tree, Node, Indices, NumData, NextLeafSlot);
+		NextLeafSlot += NumData;
+		return;
+	}
+
+	const FNodeSplit Split = SplitNodePoints(Tree, Indices, NumData, Depth, Policy);
+	const int Axis = Split.Axis;
+	const int Middle = Split.Middle;
+	const int NumRight = NumData - Middle - 1;
+
+	Node.Index = Indices[Middle];
+	Node.ChildLeft = FKdtreeNode::NoChild;
+	uint32 ChildRight = FKdtreeNode::NoChild;
+	if (Middle > 0)
+	{
+		Node.ChildLeft = NextNode;
+		BuildNode(Tree, Indices, Middle, Depth + 1, Policy, NextNode, NextLeafSlot);
+	}
+	if (NumRight > 0)
+	{
+		ChildRight = NextNode;
+		BuildNode(Tree, Indices + Middle + 1, NumRight, Depth + 1, Policy, NextNode, NextLeafSlot);
+	}
+	Node.SetChildRightAndAxis(ChildRight, Axis);
+}
+
+// Same split as BuildNode, but the left subtree is handed to the task graph while this thread descends into
+// the right one. Both subtrees write to disjoint node and leaf slot ranges that are known up front, and subtrees
+// below ParallelBuildMinPoints are built serially, so the resulting tree is identical to the one BuildNode produces.
+// With unbalanced policies the ranges are only upper bounds, which leaves unused nodes and slots between subtrees.
+template <typename TreeType>
+void BuildNodeParallel(TreeType& Tree, int* Indices, int NumData, int Depth, EKdtreeSplitPolicy Policy, uint32 NodeIndex,
+	int32 LeafSlot)
+{
+	if (NumData < ParallelBuildMinPoints || NumData <= Tree.LeafSize)
+	{
+		BuildNode(Tree, Indices, NumData, Depth, Policy, NodeIndex, LeafSlot);
+		return;
+	}
+
+	const FNodeSplit Split = SplitNodePoints(Tree, Indices, NumData, Depth, Policy);
+	const int Axis = Split.Axis;
+	const int Middle = Split.Middle;
+	const int NumRight = NumData - Middle - 1;
+	const FSubtreeSize LeftSize = GetSubtreeCapacity(Middle, Tree.LeafSize, Policy);
+	// Unbalanced policies can leave one side empty.
+	const uint32 ChildLeft = Middle > 0 ? NodeIndex + 1 : FKdtreeNode::NoChild;
+	const uint32 ChildRight = NumRight > 0 ? NodeIndex + 1 + LeftSize.NumNodes : FKdtreeNode::NoChild;
+
+	FKdtreeNode& Node = Tree.Nodes[NodeIndex];
+	Node.Index = Indices[Middle];
+	Node.ChildLeft = ChildLeft;
+	Node.SetChildRightAndAxis(ChildRight, Axis);
+
+	UE::Tasks::FTask LeftTask;
+	if (Middle > 0)
+	{
+		LeftTask = UE::Tasks::Launch(UE_SOURCE_LOCATION, [&Tree, Indices, Middle, Depth, Policy, ChildLeft, LeafSlot]()
+			{ BuildNodeParallel(Tree, Indices, Middle, Depth + 1, Policy, ChildLeft, LeafSlot); });
+	}
+	if (NumRight > 0)
+	{
+		BuildNodeParallel(Tree, Indices + Middle + 1, NumRight, Depth + 1, Policy, ChildRight, LeafSlot + LeftSize.NumLeafPoints);
+	}
+	LeftTask.Wait();
+}
+
+template <typename TreeType>
+void ValidateLeaf(const TreeType& Tree, const FKdtreeNode& Parent, const FKdtreeNode& Leaf, bool bIsLeftChild)
+{
+	const int Axis = Parent.GetAxis();
+	const double Split = Tree.Data[Parent.Index][Axis];
+	for (int32 Slot = Leaf.GetLeafFirstSlot(); Slot < Leaf.GetLeafFirstSlot() + Leaf.GetLeafNumPoints(); ++Slot)
+	{
+		const int Index = Tree.LeafIndices[Slot];
+		const double Value = Tree.Data[Index][Axis];
+		if (bIsLeftChild && Split < Value)
+		{
+			UE_LOG(LogTemp, Error, TEXT("Kdtree is invalid: tree.Data[%d][%d](%f) < tree.Data[%d][%d](%f)"), Parent.Index, Axis,
+				Split, Index, Axis, Value);
+		}
+		if (!bIsLeftChild && Split > Value)
+		{
+			UE_LOG(LogTemp, Error, TEXT("Kdtree is invalid: tree.Data[%d][%d](%f) > tree.Data[%d][%d](%f)"), Parent.Index, Axis,
+				Split, Index, Axis, Value);
+		}
+		if (Tree.RemovedPoints[Index])
+		{
+			UE_LOG(LogTemp, Error, TEXT("Kdtree is invalid: removed point tree.Data[%d] is still in leaf slot %d"), Index, Slot);
+		}
+		bool bMatches = true;
+		ForEachAxis<TreeType::Dim>([&](int32 CoordAxis) { bMatches &= Tree.LeafCoords[CoordAxis][Slot] == Tree.Data[Index][CoordAxis]; });
+		if (!bMatches)
+		{
+			UE_LOG(LogTemp, Error, TEXT("Kdtree is invalid: leaf slot %d does not match tree.Data[%d]"), Slot, Index);
+		}
+	}
+}
+
+template <typename TreeType>
+void ValidateKdtree(const TreeType& Tree, uint32 NodeIndex, int Depth)
+{
+	const FKdtreeNode& Node = Tree.Nodes[NodeIndex];
+	if (Node.IsLeaf())
+	{
+		return;
+	}
+
+	const int Axis = Node.GetAxis();
+	const uint32 ChildLeft = Node.ChildLeft;
+	const uint32 ChildRight = Node.GetChildRight();
+	const double Split = Tree.Data[Node.Index][Axis];
+	if (ChildLeft != FKdtreeNode::NoChild)
+	{
+		const FKdtreeNode& NodeLeft = Tree.Nodes[ChildLeft];
+		if (NodeLeft.IsLeaf())
+		{
+			ValidateLeaf(Tree, Node, NodeLeft, true);
+		}
+		else if (Split < Tree.Data[NodeLeft.Index][Axis])
+		{
+			UE_LOG(LogTemp, Error, TEXT("Kdtree is invalid: tree.Data[%d][%d](%f) < tree.Data[%d][%d](%f)"), Node.Index, Axis,
+				Split, NodeLeft.Index, Axis, static_cast<double>(Tree.Data[NodeLeft.Index][Axis]));
+		}
+	}
+	if (ChildRight != FKdtreeNode::NoChild)
+	{
+		const FKdtreeNode& NodeRight = Tree.Nodes[ChildRight];
+		if (NodeRight.IsLeaf())
+		{
+			ValidateLeaf(Tree, Node, NodeRight, false);
+		}
+		else if (Split > Tree.Data[NodeRight.Index][Axis])
+		{
+			UE_LOG(LogTemp, Error, TEXT("Kdtree is invalid: tree.Data[%d][%d](%f) > tree.Data[%d][%d](%f)"), Node.Index, Axis,
+				Split, NodeRight.Index, Axis, static_cast<double>(Tree.Data[NodeRight.Index][Axis]));
+		}
+	}
+
+	if (ChildLeft != FKdtreeNode::NoChild)
+	{
+		ValidateKdtree(Tree, ChildLeft, Depth + 1);
+	}
+	if (ChildRight != FKdtreeNode::NoChild)
+	{
+		ValidateKdtree(Tree, ChildRight, Depth + 1);
+	}
+}
+
+template <typename TreeType>
+void DumpNode(const TreeType& Tree, const FKdtreeNode& Node)
+{
+	if (Node.IsLeaf())
+	{
+		for (int32 Slot = Node.GetLeafFirstSlot(); Slot < Node.GetLeafFirstSlot() + Node.GetLeafNumPoints(); ++Slot)
+		{
+			const int Index = Tree.LeafIndices[Slot];
+			UE_LOG(LogTemp, Display, TEXT("[%d] value=(%s), leaf"), Index, *PointToString<TreeType::Dim>(Tree.Data[Index]));
+		}
+		return;
+	}
+
+	FString Left = "null";
+	FString Right = "null";
+
+	if (Node.ChildLeft != FKdtreeNode::NoChild)
+	{
+		Left = Tree.Nodes[Node.ChildLeft].IsLeaf() ? FString("leaf") : FString::FromInt(Tree.Nodes[Node.ChildLeft].Index);
+	}
+	if (Node.GetChildRight() != FKdtreeNode::NoChild)
+	{
+		const FKdtreeNode& NodeRight = Tree.Nodes[Node.GetChildRight()];
+		Right = NodeRight.IsLeaf() ? FString("leaf") : FString::FromInt(NodeRight.Index);
+	}
+
+	UE_LOG(LogTemp, Display, TEXT("[%d] value=(%s), axis=%d, child_left=%s, child_right=%s%s"), Node.Index,
+		*PointToString<TreeType::Dim>(Tree.Data[Node.Index]), Node.GetAxis(), *Left, *Right,
+		IsTombstone(Tree, Node.Index) ? TEXT(", removed") : TEXT(""));
+}
+
+template <typename TreeType>
+void DumpKdTree(const TreeType& Tree, uint32 NodeIndex)
+{
+	const FKdtreeNode& Node = Tree.Nodes[NodeIndex];
+
+	DumpNode(Tree, Node);
+	if (Node.IsLeaf())
+	{
+		return;
+	}
+
+	if (Node.ChildLeft != FKdtreeNode::NoChild)
+	{
+		DumpKdTree(Tree, Node.ChildLeft);
+	}
+	if (Node.GetChildRight() != FKdtreeNode::NoChild)
+	{
+		DumpKdTree(Tree, Node.GetChildRight());
+	}
+}
+
+// Calls Visitor(Index, DistSquared) for every point of a leaf bucket closer to Center than sqrt(RadiusSquared),
+// testing LeafSimdWidth points per iteration. Stops and returns false as soon as Visitor returns false.
+template <typename TreeType, typename VisitorType>
+bool ForEachLeafPointWithin(const TreeType& Tree, const FKdtreeNode& Leaf, const typename TreeType::PointType& Center,
+	typename TreeType::ScalarType RadiusSquared, const VisitorType& Visitor)
+{
+	using ScalarType = typename TreeType::ScalarType;
+	constexpr int32 Dim = TreeType::Dim;
+
+	const int32 FirstSlot = Leaf.GetLeafFirstSlot();
+	const int32 NumPoints = Leaf.GetLeafNumPoints();
+	const ScalarType* Coords[Dim];
+	ForEachAxis<Dim>([&](int32 Axis) { Coords[Axis] = Tree.LeafCoords[Axis].GetData() + FirstSlot; });
+	const int32* Indices = Tree.LeafIndices.GetData() + FirstSlot;
+
+#if PLATFORM_ENABLE_VECTORINTRINSICS
+	// VectorRegister4Float or VectorRegister4Double, matching the coordinate type.
+	using RegisterType = decltype(VectorLoad(static_cast<const ScalarType*>(nullptr)));
+	RegisterType CenterV[Dim];
+	ForEachAxis<Dim>([&](int32 Axis) { CenterV[Axis] = VectorSetFloat1(Center[Axis]); });
+	const RegisterType RadiusSquaredV = VectorSetFloat1(RadiusSquared);
+	for (int32 Offset = 0; Offset < NumPoints; Offset += LeafSimdWidth)
+	{
+		const RegisterType Diff = VectorSubtract(VectorLoad(Coords[0] + Offset), CenterV[0]);
+		RegisterType DistSquared = VectorMultiply(Diff, Diff);
+		ForEachAxis<Dim - 1>([&](int32 Axis) {
+			const RegisterType AxisDiff = VectorSubtract(VectorLoad(Coords[Axis + 1] + Offset), CenterV[Axis + 1]);
+			DistSquared = VectorMultiplyAdd(AxisDiff, AxisDiff, DistSquared);
+		});
+
+		// Lanes past the end of the bucket read neighbouring slots or padding and are masked out.
+		const uint32 ValidLanes = (1u << FMath::Min(NumPoints - Offset, LeafSimdWidth)) - 1;
+		uint32 HitMask = static_cast<uint32>(VectorMaskBits(VectorCompareLT(DistSquared, RadiusSquaredV))) & ValidLanes;
+		if (HitMask != 0)
+		{
+			alignas(32) ScalarType Distances[LeafSimdWidth];
+			VectorStoreAligned(DistSquared, Distances);
+			do
+			{
+				const uint32 Lane = FMath::CountTrailingZeros(HitMask);
+				if (!Visitor(Indices[Offset + Lane], Distances[Lane]))
+				{
+					return false;
+				}
+				HitMask &= HitMask - 1;
+			} while (HitMask != 0);
+		}
+	}
+#else
+	for (int32 Offset = 0; Offset < NumPoints; ++Offset)
+	{
+		ScalarType DistSquared = 0;
+		ForEachAxis<Dim>([&](int32 Axis) { DistSquared += FMath::Square(Coords[Axis][Offset] - Center[Axis]); });
+		if (DistSquared < RadiusSquared && !Visitor(Indices[Offset], DistSquared))
+		{
+			return false;
+		}
+	}
+#endif
+	return true;
+}
+
+// Squared distance along one axis from C to the nearest point of [Min, Max].
+template <typename ScalarType>
+ScalarType GetAxisMinDistSquared(ScalarType C, ScalarType Min, ScalarType Max)
+{
+	return C < Min ? FMath::Square(Min - C) : (C > Max ? FMath::Square(C - Max) : ScalarType(0));
+}
+
+// Squared distance along one axis from C to the farthest point of [Min, Max].
+template <typename ScalarType>
+ScalarType GetAxisMaxDistSquared(ScalarType C, ScalarType Min, ScalarType Max)
+{
+	return FMath::Square(FMath::Max(C - Min, Max - C));
+}
+
+// A node waiting to be visited along with the box of its region and the squared distances from the query center
+// to the nearest and farthest points of that box.
+template <typename TreeType>
+struct TBoxTraversalEntry
+{
+	uint32 NodeIndex;
+	typename TreeType::ScalarType MinDistSquared;
+	typename TreeType::ScalarType MaxDistSquared;
+	typename TreeType::PointType BoxMin;
+	typename TreeType::PointType BoxMax;
+};
+
+// Work done by one query, added to the STATGROUP_Kdtree counters when it goes out of scope. Counting is compiled out
+// in builds without stats.
+struct FScopedQueryCounters
+{
+#if STATS
+	int32 NumNodesVisited = 0;
+	int32 NumPointsTested = 0;
+	int32 NumResults = 0;
+
+	~FScopedQueryCounters()
+	{
+		INC_DWORD_STAT(STAT_KdtreeQueries);
+		INC_DWORD_STAT_BY(STAT_KdtreeNodesVisited, NumNodesVisited);
+		INC_DWORD_STAT_BY(STAT_KdtreePointsTested, NumPointsTested);
+		INC_DWORD_STAT_BY(STAT_KdtreeResultsReturned, NumResults);
+	}
+
+	void AddNode()
+	{
+		++NumNodesVisited;
+	}
+
+	void AddPointsTested(int32 Num)
+	{
+		NumPointsTested += Num;
+	}
+
+	void AddResults(int32 Num)
+	{
+		NumResults += Num;
+	}
+#else
+	void AddNode()
+	{
+	}
+
+	void AddPointsTested(int32)
+	{
+	}
+
+	void AddResults(int32)
+	{
+	}
+#endif
+};
+
+// Sinks receive the points found by a query: VisitPoint(Index) for single points and VisitLeaf(Indices, Num) for all
+// points of a leaf bucket at once, which lets a sink take them without looking at every point. Both return false to
+// stop the query.
+
+// Appends the points to an array.
+template <typename AllocatorType>
+struct TCollectSink
+{
+	bool VisitPoint(int Index)
+	{
+		Result.Add(Index);
+		return true;
+	}
+
+	bool VisitLeaf(const int32* Indices, int32 Num)
+	{
+		Result.Append(Indices, Num);
+		return true;
+	}
+
+	TArray<int, AllocatorType>& Result;
+};
+
+// Writes the points to a fixed-size buffer and stops once it is full.
+struct FBufferSink
+{
+	bool VisitPoint(int Index)
+	{
+		Buffer[Num++] = Index;
+		return Num < Buffer.Num();
+	}
+
+	bool VisitLeaf(const int32* Indices, int32 NumIndices)
+	{
+		const int32 NumCopied = FMath::Min(NumIndices, Buffer.Num() - Num);
+		FMemory::Memcpy(Buffer.GetData() + Num, Indices, NumCopied * sizeof(int32));
+		Num += NumCopied;
+		return Num < Buffer.Num();
+	}
+
+	TArrayView<int> Buffer;
+	int32 Num = 0;
+};
+
+struct FCountSink
+{
+	bool VisitPoint(int)
+	{
+		++Num;
+		return true;
+	}
+
+	bool VisitLeaf(const int32*, int32 NumIndices)
+	{
+		Num += NumIndices;
+		return true;
+	}
+
+	int32 Num = 0;
+};
+
+// Stops at the first point. Leaf buckets are only handed over when they hold points.
+struct FAnySink
+{
+	bool VisitPoint(int)
+	{
+		return false;
+	}
+
+	bool VisitLeaf(const int32*, int32)
+	{
+		return false;
+	}
+};
+
+// Hands the points to a visitor that returns either nothing or whether to go on.
+template <typename VisitorType>
+struct TVisitorSink
+{
+	bool VisitPoint(int Index)
+	{
+		if constexpr (std::is_void_v<decltype(Visitor(Index))>)
+		{
+			Visitor(Index);
+			return true;
+		}
+		else
+		{
+			return static_cast<bool>(Visitor(Index));
+		}
+	}
+
+	bool VisitLeaf(const int32* Indices, int32 Num)
+	{
+		for (int32 Offset = 0; Offset < Num; ++Offset)
+		{
+			if (!VisitPoint(Indices[Offset]))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	const VisitorType& Visitor;
+};
+
+// Filters decide which points a query may return: SkipsSubtree(NodeIndex) prunes whole subtrees before they are
+// visited and Accepts(Index) tests single points. Queries without a filter use FAcceptAllFilter, which compiles away.
+struct FAcceptAllFilter
+{
+	static constexpr bool bFiltersPoints = false;
+
+	bool SkipsSubtree(uint32) const
+	{
+		return false;
+	}
+
+	bool Accepts(int) const
+	{
+		return true;
+	}
+
+	bool MatchesNothing() const
+	{
+		return false;
+	}
+};
+
+// Passes the points whose mask matches an FKdtreeMaskFilter. Subtrees are skipped when none of their points has any of
+// the included bits.
+template <typename TreeType>
+struct TMaskFilter
+{
+	static constexpr bool bFiltersPoints = true;
+
+	bool SkipsSubtree(uint32 NodeIndex) const
+	{
+		return (Tree.SubtreeMasks[NodeIndex] & static_cast<uint64>(Filter.IncludeMask)) == 0;
+	}
+
+	bool Accepts(int Index) const
+	{
+		return Filter.Matches(Tree.PointMasks[Index]);
+	}
+
+	// A tree without masks has no bits set on any point.
+	bool MatchesNothing() const
+	{
+		return Tree.PointMasks.Num() == 0 || Filter.IncludeMask == 0;
+	}
+
+	const TreeType& Tree;
+	const FKdtreeMaskFilter& Filter;
+};
+
+// Passes the points for which Predicate(Index) returns true. Nothing is known about subtrees, so none is skipped.
+template <typename PredicateType>
+struct TPredicateFilter
+{
+	static constexpr bool bFiltersPoints = true;
+
+	bool SkipsSubtree(uint32) const
+	{
+		return false;
+	}
+
+	bool Accepts(int Index) const
+	{
+		return static_cast<bool>(Predicate(Index));
+	}
+
+	bool MatchesNothing() const
+	{
+		return false;
+	}
+
+	const PredicateType& Predicate;
+};
+
+template <typename TreeType>
+TMaskFilter<TreeType> MakePointFilter(const TreeType& Tree, const FKdtreeMaskFilter& Filter)
+{
+	return TMaskFilter<TreeType>{Tree, Filter};
+}
+
+template <typename TreeType, typename PredicateType>
+TPredicateFilter<PredicateType> MakePointFilter(const TreeType&, const PredicateType& Predicate)
+{
+	return TPredicateFilter<PredicateType>{Predicate};
+}
+
+// Hands every live point of the subtree that passes Filter to Sink without distance tests. Every node visited takes
+// one from *NodesLeft if given. Returns false if the sink stopped the query or the node budget ran out.
+template <typename TreeType, typename SinkType, typename FilterType = FAcceptAllFilter>
+bool VisitSubtree(const TreeType& Tree, uint32 NodeIndex, SinkType& Sink, FScopedQueryCounters& Counters,
+	const FilterType& Filter = FilterType(), int32* NodesLeft = nullptr)
+{
+	TArray<uint32, TInlineAllocator<64>> Stack;
+	Stack.Add(NodeIndex);
+	while (Stack.Num() > 0)
+	{
+		const uint32 CurrentIndex = Stack.Pop();
+		if (Filter.SkipsSubtree(CurrentIndex))
+		{
+			continue;
+		}
+		if (NodesLeft != nullptr && (*NodesLeft)-- == 0)
+		{
+			return false;
+		}
+		const FKdtreeNode& Node = Tree.Nodes[CurrentIndex];
+		Counters.AddNode();
+		if (Node.IsLeaf())
+		{
+			const int32* Indices = Tree.LeafIndices.GetData() + Node.GetLeafFirstSlot();
+			if constexpr (FilterType::bFiltersPoints)
+			{
+				Counters.AddPointsTested(Node.GetLeafNumPoints());
+				for (int32 Offset = 0; Offset < Node.GetLeafNumPoints(); ++Offset)
+				{
+					if (Filter.Accepts(Indices[Offset]) && !Sink.VisitPoint(Indices[Offset]))
+					{
+						return false;
+					}
+				}
+			}
+			else if (Node.GetLeafNumPoints() > 0 && !Sink.VisitLeaf(Indices, Node.GetLeafNumPoints()))
+			{
+				return false;
+			}
+			continue;
+		}
+
+		if (!IsTombstone(Tree, Node.Index) && Filter.Accepts(Node.Index) && !Sink.VisitPoint(Node.Index))
+		{
+			return false;
+		}
+		if (Node.GetChildRight() != FKdtreeNode::NoChild)
+		{
+			Stack.Add(Node.GetChildRight());
+		}
+		if (Node.ChildLeft != FKdtreeNode::NoChild)
+		{
+			Stack.Add(Node.ChildLeft);
+		}
+	}
+	return true;
+}
+
+// Sets the distances of Entry from the nearest and farthest points of its box to Center.
+template <typename TreeType>
+void SetBoxDistances(TBoxTraversalEntry<TreeType>& Entry, const typename TreeType::PointType& Center)
+{
+	Entry.MinDistSquared = 0;
+	Entry.MaxDistSquared = 0;
+	ForEachAxis<TreeType::Dim>([&](int32 Axis) {
+		Entry.MinDistSquared += GetAxisMinDistSquared(Center[Axis], Entry.BoxMin[Axis], Entry.BoxMax[Axis]);
+		Entry.MaxDistSquared += GetAxisMaxDistSquared(Center[Axis], Entry.BoxMin[Axis], Entry.BoxMax[Axis]);
+	});
+}
+
+// Narrows Entry's box to the child on one side of the split plane. The distances are summed again over all axes
+// instead of updating the split axis term: far from the query the squared distances are large enough that subtracting
+// the old term loses more than the whole radius, and boxes would be taken for inside the sphere.
+template <typename TreeType, typename ScalarType>
+void NarrowToChild(TBoxTraversalEntry<TreeType>& Entry, uint32 ChildIndex, int Axis, ScalarType Split, bool bIsLeftChild,
+	const typename TreeType::PointType& Center)
+{
+	if (bIsLeftChild)
+	{
+		Entry.BoxMax[Axis] = Split;
+	}
+	else
+	{
+		Entry.BoxMin[Axis] = Split;
+	}
+	Entry.NodeIndex = ChildIndex;
+	SetBoxDistances(Entry, Center);
+}
+
+// The root with the bounds of the tree as its box.
+template <typename TreeType>
+TBoxTraversalEntry<TreeType> MakeRootTraversalEntry(const TreeType& Tree, const typename TreeType::PointType& Center)
+{
+	TBoxTraversalEntry<TreeType> Entry;
+	Entry.NodeIndex = 0;
+	Entry.BoxMin = Tree.BoundsMin;
+	Entry.BoxMax = Tree.BoundsMax;
+	SetBoxDistances(Entry, Center);
+	return Entry;
+}
+
+// Hands every point closer to Center than sqrt(RadiusSquared) that passes Filter to Sink. Returns false if the sink
+// stopped the query.
+template <typename TreeType, typename SinkType, typename FilterType = FAcceptAllFilter>
+bool TraverseWithinRadius(const TreeType& Tree, const typename TreeType::PointType& Center,
+	typename TreeType::ScalarType RadiusSquared, SinkType& Sink, FScopedQueryCounters& Counters,
+	const FilterType& Filter = FilterType())
+{
+	using ScalarType = typename TreeType::ScalarType;
+
+	TBoxTraversalEntry<TreeType> Entry = MakeRootTraversalEntry(Tree, Center);
+	if (Entry.MinDistSquared >= RadiusSquared)
+	{
+		return true;
+	}
+
+	// Descends into the near child in place and defers far children whose box reaches into the sphere.
+	TArray<TBoxTraversalEntry<TreeType>, TInlineAllocator<64>> Stack;
+	while (true)
+	{
+		const FKdtreeNode& Node = Tree.Nodes[Entry.NodeIndex];
+		bool bDescend = false;
+		if (Filter.SkipsSubtree(Entry.NodeIndex))
+		{
+			// No point below passes the filter.
+		}
+		else if (Entry.MaxDistSquared < RadiusSquared)
+		{
+			// The whole box lies inside the sphere.
+			if (!VisitSubtree(Tree, Entry.NodeIndex, Sink, Counters, Filter))
+			{
+				return false;
+			}
+		}
+		else if (Node.IsLeaf())
+		{
+			Counters.AddNode();
+			Counters.AddPointsTested(Node.GetLeafNumPoints());
+			if (!ForEachLeafPointWithin(Tree, Node, Center, RadiusSquared,
+					[&Sink, &Filter](int Index, ScalarType) { return !Filter.Accepts(Index) || Sink.VisitPoint(Index); }))
+			{
+				return false;
+			}
+		}
+		else
+		{
+			Counters.AddNode();
+			Counters.AddPointsTested(1);
+			const typename TreeType::PointType& Current = Tree.Data[Node.Index];
+			if (GetDistSquared<TreeType::Dim>(Center, Current) < RadiusSquared && !IsTombstone(Tree, Node.Index) &&
+				Filter.Accepts(Node.Index) && !Sink.VisitPoint(Node.Index))
+			{
+				return false;
+			}
+
+			const int Axis = Node.GetAxis();
+			const ScalarType Split = Current[Axis];
+			const bool bCenterOnLeft = Center[Axis] < Split;
+			const uint32 NearChild = bCenterOnLeft ? Node.ChildLeft : Node.GetChildRight();
+			const uint32 FarChild = bCenterOnLeft ? Node.GetChildRight() : Node.ChildLeft;
+			if (FarChild != FKdtreeNode::NoChild && FMath::Square(Center[Axis] - Split) < RadiusSquared)
+			{
+				TBoxTraversalEntry<TreeType> Far = Entry;
+				NarrowToChild(Far, FarChild, Axis, Split, !bCenterOnLeft, Center);
+				if (Far.MinDistSquared < RadiusSquared)
+				{
+					Stack.Add(Far);
+				}
+			}
+			if (NearChild != FKdtreeNode::NoChild)
+			{
+				NarrowToChild(Entry, NearChild, Axis, Split, bCenterOnLeft, Center);
+				bDescend = true;
+			}
+		}
+
+		if (!bDescend)
+		{
+			if (Stack.Num() == 0)
+			{
+				return true;
+			}
+			Entry = Stack.Pop();
+		}
+	}
+}
+
+// Runs a radius query into Sink. Returns false if the sink stopped it.
+template <typename TreeType, typename SinkType, typename FilterType = FAcceptAllFilter>
+bool VisitWithinRadius(const TreeType& Tree, const typename TreeType::PointType& Center, float Radius, SinkType& Sink,
+	FScopedQueryCounters& Counters, const FilterType& Filter = FilterType())
+{
+	if (Tree.Nodes.Num() == 0 || Radius <= 0.0f || Filter.MatchesNothing())
+	{
+		return true;
+	}
+	return TraverseWithinRadius(
+		Tree, Center, FMath::Square(static_cast<typename TreeType::ScalarType>(Radius)), Sink, Counters, Filter);
+}
+
+// Orders the entries of a best-first traversal by the distance of their box to the query.
+template <typename TreeType>
+struct TCloserBoxFirst
+{
+	bool operator()(const TBoxTraversalEntry<TreeType>& Lhs, const TBoxTraversalEntry<TreeType>& Rhs) const
+	{
+		return Lhs.MinDistSquared < Rhs.MinDistSquared;
+	}
+};
+
+inline int32 GetNodeBudget(const FKdtreeApproximation& Approximation)
+{
+	return Approximation.MaxVisitedNodes > 0 ? Approximation.MaxVisitedNodes : MAX_int32;
+}
+
+// (1 + Epsilon)^2, the factor between squared exact and squared approximate distances.
+template <typename ScalarType>
+ScalarType GetApproximationFactor(const FKdtreeApproximation& Approximation)
+{
+	return FMath::Square(1 + static_cast<ScalarType>(FMath::Max(Approximation.Epsilon, 0.0f)));
+}
+
+// TraverseWithinRadius within the limits of Approximation. Nodes whose box is no closer than the radius divided by
+// 1 + Epsilon are skipped, so only the points up to that distance are sure to be found, but no point farther than the
+// radius is handed to Sink. Nodes are visited in order of the distance of their box to Center, so a query stopped by
+// the node budget has found the points nearest to Center. Returns false if the budget ran out or the sink stopped the
+// query.
+template <typename TreeType, typename SinkType>
+bool TraverseWithinRadiusApproximate(const TreeType& Tree, const typename TreeType::PointType& Center,
+	typename TreeType::ScalarType RadiusSquared, const FKdtreeApproximation& Approximation, SinkType& Sink,
+	FScopedQueryCounters& Counters)
+{
+	using ScalarType = typename TreeType::ScalarType;
+
+	const ScalarType InnerRadiusSquared = RadiusSquared / GetApproximationFactor<ScalarType>(Approximation);
+	int32 NodesLeft = GetNodeBudget(Approximation);
+	TArray<TBoxTraversalEntry<TreeType>, TInlineAllocator<64>> Queue;
+	Queue.Add(MakeRootTraversalEntry(Tree, Center));
+	while (Queue.Num() > 0)
+	{
+		TBoxTraversalEntry<TreeType> Entry;
+		Queue.HeapPop(Entry, TCloserBoxFirst<TreeType>(), EAllowShrinking::No);
+		if (Entry.MinDistSquared >= InnerRadiusSquared)
+		{
+			// The remaining boxes are at least as far.
+			return true;
+		}
+
+		// Descends along the near children and queues the far children reaching into the sphere.
+		while (true)
+		{
+			if (Entry.MaxDistSquared < RadiusSquared)
+			{
+				// Charged per node like the rest of the traversal, so a large radius cannot walk the whole tree.
+				if (!VisitSubtree(Tree, Entry.NodeIndex, Sink, Counters, FAcceptAllFilter(), &NodesLeft))
+				{
+					return false;
+				}
+				break;
+			}
+			if (NodesLeft-- == 0)
+			{
+				return false;
+			}
+
+			const FKdtreeNode& Node = Tree.Nodes[Entry.NodeIndex];
+			Counters.AddNode();
+			if (Node.IsLeaf())
+			{
+				Counters.AddPointsTested(Node.GetLeafNumPoints());
+				if (!ForEachLeafPointWithin(
+						Tree, Node, Center, RadiusSquared, [&Sink](int Index, ScalarType) { return Sink.VisitPoint(Index); }))
+				{
+					return false;
+				}
+				break;
+			}
+
+			Counters.AddPointsTested(1);
+			const typename TreeType::PointType& Current = Tree.Data[Node.Index];
+			if (GetDistSquared<TreeType::Dim>(Center, Current) < RadiusSquared && !IsTombstone(Tree, Node.Index) &&
+				!Sink.VisitPoint(Node.Index))
+			{
+				return false;
+			}
+
+			const int Axis = Node.GetAxis();
+			const ScalarType Split = Current[Axis];
+			const bool bCenterOnLeft = Center[Axis] < Split;
+			const uint32 NearChild = bCenterOnLeft ? Node.ChildLeft : Node.GetChildRight();
+			const uint32 FarChild = bCenterOnLeft ? Node.GetChildRight() : Node.ChildLeft;
+			if (FarChild != FKdtreeNode::NoChild && FMath::Square(Center[Axis] - Split) < RadiusSquared)
+			{
+				TBoxTraversalEntry<TreeType> Far = Entry;
+				NarrowToChild(Far, FarChild, Axis, Split, !bCenterOnLeft, Center);
+				if (Far.MinDistSquared < InnerRadiusSquared)
+				{
+					Queue.HeapPush(Far, TCloserBoxFirst<TreeType>());
+				}
+			}
+			if (NearChild == FKdtreeNode::NoChild)
+			{
+				break;
+			}
+			NarrowToChild(Entry, NearChild, Axis, Split, bCenterOnLeft, Center);
+			if (Entry.MinDistSquared >= InnerRadiusSquared)
+			{
+				break;
+			}
+		}
+	}
+	return true;
+}
+
+// Hands every point inside Shape to Sink, using Shape.Classify to skip nodes outside of it and to take nodes inside it
+// without testing their points. Returns false if the sink stopped the query.
+template <typename TreeType, typename ShapeType, typename SinkType>
+bool TraverseShape(const TreeType& Tree, const ShapeType& Shape, SinkType& Sink, FScopedQueryCounters& Counters)
+{
+	using PointType = typename TreeType::PointType;
+
+	struct FEntry
+	{
+		uint32 NodeIndex;
+		EShapeOverlap Overlap;
+		PointType BoxMin;
+		PointType BoxMax;
+	};
+
+	if (Tree.Nodes.Num() == 0)
+	{
+		return true;
+	}
+	const EShapeOverlap RootOverlap = Shape.Classify(Tree.BoundsMin, Tree.BoundsMax);
+	if (RootOverlap == EShapeOverlap::Outside)
+	{
+		return true;
+	}
+
+	TArray<FEntry, TInlineAllocator<64>> Stack;
+	Stack.Add(FEntry{0, RootOverlap, Tree.BoundsMin, Tree.BoundsMax});
+	while (Stack.Num() > 0)
+	{
+		const FEntry Entry = Stack.Pop();
+		if (Entry.Overlap == EShapeOverlap::Inside)
+		{
+			if (!VisitSubtree(Tree, Entry.NodeIndex, Sink, Counters))
+			{
+				return false;
+			}
+			continue;
+		}
+
+		const FKdtreeNode& Node = Tree.Nodes[Entry.NodeIndex];
+		Counters.AddNode();
+		if (Node.IsLeaf())
+		{
+			Counters.AddPointsTested(Node.GetLeafNumPoints());
+			for (int32 Slot = Node.GetLeafFirstSlot(); Slot < Node.GetLeafFirstSlot() + Node.GetLeafNumPoints(); ++Slot)
+			{
+				PointType Point;
+				ForEachAxis<TreeType::Dim>([&](int32 Axis) { Point[Axis] = Tree.LeafCoords[Axis][Slot]; });
+				if (Shape.Contains(Point) && !Sink.VisitPoint(Tree.LeafIndices[Slot]))
+				{
+					return false;
+				}
+			}
+			continue;
+		}
+
+		const PointType& Current = Tree.Data[Node.Index];
+		if (!IsTombstone(Tree, Node.Index))
+		{
+			Counters.AddPointsTested(1);
+			if (Shape.Contains(Current) && !Sink.VisitPoint(Node.Index))
+			{
+				return false;
+			}
+		}
+
+		const int Axis = Node.GetAxis();
+		if (Node.GetChildRight() != FKdtreeNode::NoChild)
+		{
+			FEntry Right{Node.GetChildRight(), EShapeOverlap::Intersects, Entry.BoxMin, Entry.BoxMax};
+			Right.BoxMin[Axis] = Current[Axis];
+			Right.Overlap = Shape.Classify(Right.BoxMin, Right.BoxMax);
+			if (Right.Overlap != EShapeOverlap::Outside)
+			{
+				Stack.Add(Right);
+			}
+		}
+		if (Node.ChildLeft != FKdtreeNode::NoChild)
+		{
+			FEntry Left{Node.ChildLeft, EShapeOverlap::Intersects, Entry.BoxMin, Entry.BoxMax};
+			Left.BoxMax[Axis] = Current[Axis];
+			Left.Overlap = Shape.Classify(Left.BoxMin, Left.BoxMax);
+			if (Left.Overlap != EShapeOverlap::Outside)
+			{
+				Stack.Add(Left);
+			}
+		}
+	}
+	return true;
+}
+
+// First point along the segment from Start to Start + Direction that is closer to it than Radius. Points are ordered
+// by the position along the segment of their closest point on it, the time in [0, 1], and then by their distance.
+template <typename TreeType>
+struct TSegmentHitQuery
+{
+	using ScalarType = typename TreeType::ScalarType;
+	using PointType = typename TreeType::PointType;
+
+	TSegmentHitQuery(const PointType& InStart, const PointType& InEnd, ScalarType InRadius)
+		: Start(InStart), Direction(InEnd - InStart), LengthSquared(Direction.SizeSquared()), Radius(InRadius)
+	{
+		InvLengthSquared = LengthSquared > 0 ? 1 / LengthSquared : 0;
+		ForEachAxis<TreeType::Dim>([&](int32 Axis) { InvDirection[Axis] = Direction[Axis] != 0 ? 1 / Direction[Axis] : 0; });
+	}
+
+	void Offer(int Index, const PointType& Point)
+	{
+		const PointType Offset = Point - Start;
+		const ScalarType Time = FMath::Clamp((Offset | Direction) * InvLengthSquared, ScalarType(0), ScalarType(1));
+		const ScalarType DistSquared = (Offset - Direction * Time).SizeSquared();
+		if (DistSquared < FMath::Square(Radius))
+		{
+			OfferHit(Index, Time, DistSquared);
+		}
+	}
+
+	void OfferHit(int Index, ScalarType Time, ScalarType DistSquared)
+	{
+		if (Time < HitTime || (Time == HitTime && DistSquared < HitDistSquared))
+		{
+			HitIndex = Index;
+			HitTime = Time;
+			HitDistSquared = DistSquared;
+		}
+	}
+
+	// Offers every point of a leaf bucket, testing LeafSimdWidth points per iteration like ForEachLeafPointWithin.
+	void OfferLeaf(const TreeType& Tree, const FKdtreeNode& Leaf)
+	{
+		constexpr int32 Dim = TreeType::Dim;
+
+		const int32 FirstSlot = Leaf.GetLeafFirstSlot();
+		const int32 NumPoints = Leaf.GetLeafNumPoints();
+		const ScalarType* Coords[Dim];
+		ForEachAxis<Dim>([&](int32 Axis) { Coords[Axis] = Tree.LeafCoords[Axis].GetData() + FirstSlot; });
+		const int32* Indices = Tree.LeafIndices.GetData() + FirstSlot;
+
+#if PLATFORM_ENABLE_VECTORINTRINSICS
+		using RegisterType = decltype(VectorLoad(static_cast<const ScalarType*>(nullptr)));
+		RegisterType StartV[Dim];
+		RegisterType DirectionV[Dim];
+		ForEachAxis<Dim>([&](int32 Axis) {
+			StartV[Axis] = VectorSetFloat1(Start[Axis]);
+			DirectionV[Axis] = VectorSetFloat1(Direction[Axis]);
+		});
+		const RegisterType ZeroV = VectorSetFloat1(ScalarType(0));
+		const RegisterType OneV = VectorSetFloat1(ScalarType(1));
+		const RegisterType InvLengthSquaredV = VectorSetFloat1(InvLengthSquared);
+		const RegisterType RadiusSquaredV = VectorSetFloat1(FMath::Square(Radius));
+		for (int32 Offset = 0; Offset < NumPoints; Offset += LeafSimdWidth)
+		{
+			RegisterType Offsets[Dim];
+			ForEachAxis<Dim>([&](int32 Axis) { Offsets[Axis] = VectorSubtract(VectorLoad(Coords[Axis] + Offset), StartV[Axis]); });
+			RegisterType Dot = VectorMultiply(Offsets[0], DirectionV[0]);
+			ForEachAxis<Dim - 1>([&](int32 Axis) { Dot = VectorMultiplyAdd(Offsets[Axis + 1], DirectionV[Axis + 1], Dot); });
+			const RegisterType Time = VectorMin(VectorMax(VectorMultiply(Dot, InvLengthSquaredV), ZeroV), OneV);
+			RegisterType DistSquared = ZeroV;
+			ForEachAxis<Dim>([&](int32 Axis) {
+				const RegisterType AxisDiff = VectorSubtract(Offsets[Axis], VectorMultiply(DirectionV[Axis], Time));
+				DistSquared = VectorMultiplyAdd(AxisDiff, AxisDiff, DistSquared);
+			});
+
+			// Lanes past the end of the bucket read neighbouring slots or padding and are masked out.
+			const uint32 ValidLanes = (1u << FMath::Min(NumPoints - Offset, LeafSimdWidth)) - 1;
+			uint32 HitMask = static_cast<uint32>(VectorMaskBits(VectorCompareLT(DistSquared, RadiusSquaredV))) & ValidLanes;
+			if (HitMask != 0)
+			{
+				alignas(32) ScalarType Times[LeafSimdWidth];
+				alignas(32) ScalarType Distances[LeafSimdWidth];
+				VectorStoreAligned(Time, Times);
+				VectorStoreAligned(DistSquared, Distances);
+				do
+				{
+					const uint32 Lane = FMath::CountTrailingZeros(HitMask);
+					OfferHit(Indices[Offset + Lane], Times[Lane], Distances[Lane]);
+					HitMask &= HitMask - 1;
+				} while (HitMask != 0);
+			}
+		}
+#else
+		for (int32 Offset = 0; Offset < NumPoints; ++Offset)
+		{
+			PointType Point;
+			ForEachAxis<Dim>([&](int32 Axis) { Point[Axis] = Coords[Axis][Offset]; });
+			Offer(Indices[Offset], Point);
+		}
+#endif
+	}
+
+	// Narrows [EnterTime, ExitTime] to the part of the segment where coordinate Axis is at most Bound, or at least
+	// Bound if bAbove is set. Returns false if nothing is left.
+	bool ClipToHalfSpace(int32 Axis, ScalarType Bound, bool bAbove, ScalarType& EnterTime, ScalarType& ExitTime) const
+	{
+		if (Direction[Axis] == 0)
+		{
+			return bAbove ? Start[Axis] >= Bound : Start[Axis] <= Bound;
+		}
+		const ScalarType CrossTime = (Bound - Start[Axis]) * InvDirection[Axis];
+		// Moving up an axis leaves the space below a bound and enters the space above it.
+		if ((Direction[Axis] > 0) == bAbove)
+		{
+			EnterTime = FMath::Max(EnterTime, CrossTime);
+		}
+		else
+		{
+			ExitTime = FMath::Min(ExitTime, CrossTime);
+		}
+		return EnterTime <= ExitTime;
+	}
+
+	PointType Start;
+	PointType Direction;
+	PointType InvDirection;
+	ScalarType LengthSquared;
+	ScalarType InvLengthSquared;
+	ScalarType Radius;
+	int HitIndex = INDEX_NONE;
+	ScalarType HitTime = TNumericLimits<ScalarType>::Max();
+	ScalarType HitDistSquared = TNumericLimits<ScalarType>::Max();
+};
+
+// Walks the nodes front to back along the segment, entering the child the segment reaches first before the other one,
+// and skips every node the segment enters after the current hit. A point closer than Radius to the segment has its
+// closest point on the segment within Radius of the node holding it, so every node only needs the times during which
+// the segment is within Radius of its region. These come from the times of its parent, clipped at the split plane
+// moved out by Radius, so the boxes of the nodes are never built.
+template <typename TreeType>
+void TraverseSegment(const TreeType& Tree, TSegmentHitQuery<TreeType>& Query, FScopedQueryCounters& Counters)
+{
+	using ScalarType = typename TreeType::ScalarType;
+	using PointType = typename TreeType::PointType;
+
+	struct FEntry
+	{
+		uint32 NodeIndex;
+		ScalarType EnterTime;
+		ScalarType ExitTime;
+	};
+
+	FEntry Root{0, 0, 1};
+	for (int32 Axis = 0; Axis < TreeType::Dim; ++Axis)
+	{
+		if (!Query.ClipToHalfSpace(Axis, Tree.BoundsMin[Axis] - Query.Radius, true, Root.EnterTime, Root.ExitTime) ||
+			!Query.ClipToHalfSpace(Axis, Tree.BoundsMax[Axis] + Query.Radius, false, Root.EnterTime, Root.ExitTime))
+		{
+			return;
+		}
+	}
+
+	// Descends into the child entered first in place and defers the other one.
+	TArray<FEntry, TInlineAllocator<64>> Stack;
+	FEntry Entry = Root;
+	while (true)
+	{
+		const FKdtreeNode& Node = Tree.Nodes[Entry.NodeIndex];
+		Counters.AddNode();
+		bool bDescend = false;
+		if (Node.IsLeaf())
+		{
+			Counters.AddPointsTested(Node.GetLeafNumPoints());
+			Query.OfferLeaf(Tree, Node);
+		}
+		else
+		{
+			const PointType& Current = Tree.Data[Node.Index];
+			if (!IsTombstone(Tree, Node.Index))
+			{
+				Counters.AddPointsTested(1);
+				Query.Offer(Node.Index, Current);
+			}
+
+			const int Axis = Node.GetAxis();
+			FEntry Left = Entry;
+			FEntry Right = Entry;
+			Left.NodeIndex = Node.ChildLeft;
+			Right.NodeIndex = Node.GetChildRight();
+			const bool bHasLeft = Left.NodeIndex != FKdtreeNode::NoChild &&
+								  Query.ClipToHalfSpace(Axis, Current[Axis] + Query.Radius, false, Left.EnterTime, Left.ExitTime) &&
+								  Left.EnterTime <= Query.HitTime;
+			const bool bHasRight = Right.NodeIndex != FKdtreeNode::NoChild &&
+								   Query.ClipToHalfSpace(Axis, Current[Axis] - Query.Radius, true, Right.EnterTime, Right.ExitTime) &&
+								   Right.EnterTime <= Query.HitTime;
+			if (bHasLeft && bHasRight)
+			{
+				const bool bLeftFirst = Left.EnterTime <= Right.EnterTime;
+				Stack.Add(bLeftFirst ? Right : Left);
+				Entry = bLeftFirst ? Left : Right;
+				bDescend = true;
+			}
+			else if (bHasLeft || bHasRight)
+			{
+				Entry = bHasLeft ? Left : Right;
+				bDescend = true;
+			}
+		}
+
+		if (!bDescend)
+		{
+			// Deferred nodes entered after a hit found since cannot hold an earlier one.
+			do
+			{
+				if (Stack.Num() == 0)
+				{
+					return;
+				}
+				Entry = Stack.Pop();
+			} while (Entry.EnterTime > Query.HitTime);
+		}
+	}
+}
+
+// Runs the segment queries along Path one segment after the other and stops at the first segment with a hit, since
+// every point found on a later segment lies farther along the path.
+template <typename TreeType>
+int FindFirstAlongPath(const TreeType& Tree, TArrayView<const typename TreeType::PointType> Path, float Radius,
+	typename TreeType::ScalarType* OutDistance)
+{
+	using ScalarType = typename TreeType::ScalarType;
+
+	if (Tree.Nodes.Num() == 0 || Radius <= 0.0f)
+	{
+		return INDEX_NONE;
+	}
+
+	FScopedQueryCounters Counters;
+	ScalarType PathLength = 0;
+	for (int32 Segment = 0; Segment + 1 < Path.Num(); ++Segment)
+	{
+		TSegmentHitQuery<TreeType> Query(Path[Segment], Path[Segment + 1], static_cast<ScalarType>(Radius));
+		TraverseSegment(Tree, Query, Counters);
+		const ScalarType Length = FMath::Sqrt(Query.LengthSquared);
+		if (Query.HitIndex != INDEX_NONE)
+		{
+			Counters.AddResults(1);
+			if (OutDistance != nullptr)
+			{
+				*OutDistance = PathLength + Query.HitTime * Length;
+			}
+			return Query.HitIndex;
+		}
+		PathLength += Length;
+	}
+	return INDEX_NONE;
+}
+
+template <typename ScalarType>
+struct TNeighbor
+{
+	ScalarType DistSquared;
+	int Index;
+};
+
+// Keeps the K closest points offered so far in a max-heap, so the current K-th distance is always at the top.
+template <typename ScalarType>
+struct TKNearestCollector
+{
+	// K is not reserved up front, as it may be far larger than the number of points found.
+	TKNearestCollector(int InK, ScalarType MaxDistSquared) : K(InK), BoundSquared(MaxDistSquared)
+	{
+	}
+
+	struct FFartherFirst
+	{
+		bool operator()(const TNeighbor<ScalarType>& Lhs, const TNeighbor<ScalarType>& Rhs) const
+		{
+			return Lhs.DistSquared > Rhs.DistSquared;
+		}
+	};
+
+	void Offer(int Index, ScalarType DistSquared)
+	{
+		if (DistSquared >= BoundSquared)
+		{
+			return;
+		}
+		if (Heap.Num() == K)
+		{
+			Heap.HeapPopDiscard(FFartherFirst());
+		}
+		Heap.HeapPush(TNeighbor<ScalarType>{DistSquared, Index}, FFartherFirst());
+		if (Heap.Num() == K)
+		{
+			BoundSquared = Heap.HeapTop().DistSquared;
+		}
+	}
+
+	// Starts over for another query, keeping the memory of the heap.
+	void Reset(ScalarType MaxDistSquared)
+	{
+		Heap.Reset();
+		BoundSquared = MaxDistSquared;
+	}
+
+	// Appends the indices of the collected points to Result, nearest first.
+	void AppendNearestFirst(TArray<int>* Result)
+	{
+		Heap.Sort([](const TNeighbor<ScalarType>& Lhs, const TNeighbor<ScalarType>& Rhs)
+			{ return Lhs.DistSquared < Rhs.DistSquared; });
+		Result->Reserve(Result->Num() + Heap.Num());
+		for (const TNeighbor<ScalarType>& Neighbor : Heap)
+		{
+			Result->Add(Neighbor.Index);
+		}
+	}
+
+	int K;
+	// Squared distance a point must beat to be offered: the K-th distance once K points were found.
+	ScalarType BoundSquared;
+	TArray<TNeighbor<ScalarType>> Heap;
+};
+
+template <typename ScalarType>
+struct TNearestCollector
+{
+	explicit TNearestCollector(ScalarType MaxDistSquared) : BoundSquared(MaxDistSquared)
+	{
+	}
+
+	void Offer(int InIndex, ScalarType DistSquared)
+	{
+		if (DistSquared < BoundSquared)
+		{
+			BoundSquared = DistSquared;
+			Index = InIndex;
+		}
+	}
+
+	ScalarType BoundSquared;
+	int Index = INDEX_NONE;
+};
+
+// Depth-first nearest-neighbor search: descends into the child on the side of Center first and only visits the
+// other child if the splitting plane is closer than the collector's current bound. Only points passing Filter are offered.
+template <typename TreeType, typename CollectorType, typename FilterType = FAcceptAllFilter>
+void SearchNearest(const TreeType& Tree, uint32 NodeIndex, const typename TreeType::PointType& Center, CollectorType& Collector,
+	FScopedQueryCounters& Counters, const FilterType& Filter = FilterType())
+{
+	if (Filter.SkipsSubtree(NodeIndex))
+	{
+		return;
+	}
+	const FKdtreeNode& Node = Tree.Nodes[NodeIndex];
+	Counters.AddNode();
+	if (Node.IsLeaf())
+	{
+		Counters.AddPointsTested(Node.GetLeafNumPoints());
+		ForEachLeafPointWithin(Tree, Node, Center, Collector.BoundSquared,
+			[&Collector, &Filter](int Index, typename TreeType::ScalarType DistSquared) {
+				if (Filter.Accepts(Index))
+				{
+					Collector.Offer(Index, DistSquared);
+				}
+				return true;
+			});
+		return;
+	}
+
+	const typename TreeType::PointType& Current = Tree.Data[Node.Index];
+	if (!IsTombstone(Tree, Node.Index) && Filter.Accepts(Node.Index))
+	{
+		Counters.AddPointsTested(1);
+		Collector.Offer(Node.Index, GetDistSquared<TreeType::Dim>(Center, Current));
+	}
+
+	const int Axis = Node.GetAxis();
+	const uint32 NearChild = Center[Axis] < Current[Axis] ? Node.ChildLeft : Node.GetChildRight();
+	const uint32 FarChild = Center[Axis] < Current[Axis] ? Node.GetChildRight() : Node.ChildLeft;
+	if (NearChild != FKdtreeNode::NoChild)
+	{
+		SearchNearest(Tree, NearChild, Center, Collector, Counters, Filter);
+	}
+	if (FarChild != FKdtreeNode::NoChild && FMath::Square(Center[Axis] - Current[Axis]) < Collector.BoundSquared)
+	{
+		SearchNearest(Tree, FarChild, Center, Collector, Counters, Filter);
+	}
+}
+
+// Best-first nearest-neighbor search (Arya & Mount): visits nodes in order of the distance of their box to Center and
+// stops once the nearest remaining box is farther than the collector's bound divided by 1 + Epsilon, which keeps every
+// result within 1 + Epsilon times the distance of the exact one. Returns false if the node budget ran out first.
+template <typename TreeType, typename CollectorType>
+bool SearchNearestApproximate(const TreeType& Tree, const typename TreeType::PointType& Center, CollectorType& Collector,
+	const FKdtreeApproximation& Approximation, FScopedQueryCounters& Counters)
+{
+	using ScalarType = typename TreeType::ScalarType;
+
+	const ScalarType Factor = GetApproximationFactor<ScalarType>(Approximation);
+	int32 NodesLeft = GetNodeBudget(Approximation);
+	TArray<TBoxTraversalEntry<TreeType>, TInlineAllocator<64>> Queue;
+	Queue.Add(MakeRootTraversalEntry(Tree, Center));
+	while (Queue.Num() > 0)
+	{
+		TBoxTraversalEntry<TreeType> Entry;
+		Queue.HeapPop(Entry, TCloserBoxFirst<TreeType>(), EAllowShrinking::No);
+		if (Entry.MinDistSquared * Factor >= Collector.BoundSquared)
+		{
+			// The remaining boxes are at least as far.
+			return true;
+		}
+
+		// Descends along the near children to a leaf and queues the far children on the way.
+		while (Entry.MinDistSquared * Factor < Collector.BoundSquared)
+		{
+			if (NodesLeft-- == 0)
+			{
+				return false;
+			}
+
+			const FKdtreeNode& Node = Tree.Nodes[Entry.NodeIndex];
+			Counters.AddNode();
+			if (Node.IsLeaf())
+			{
+				Counters.AddPointsTested(Node.GetLeafNumPoints());
+				ForEachLeafPointWithin(Tree, Node, Center, Collector.BoundSquared,
+					[&Collector](int Index, ScalarType DistSquared) {
+						Collector.Offer(Index, DistSquared);
+						return true;
+					});
+				break;
+			}
+
+			const typename TreeType::PointType& Current = Tree.Data[Node.Index];
+			if (!IsTombstone(Tree, Node.Index))
+			{
+				Counters.AddPointsTested(1);
+				Collector.Offer(Node.Index, GetDistSquared<TreeType::Dim>(Center, Current));
+			}
+
+			const int Axis = Node.GetAxis();
+			const ScalarType Split = Current[Axis];
+			const bool bCenterOnLeft = Center[Axis] < Split;
+			const uint32 NearChild = bCenterOnLeft ? Node.ChildLeft : Node.GetChildRight();
+			const uint32 FarChild = bCenterOnLeft ? Node.GetChildRight() : Node.ChildLeft;
+			if (FarChild != FKdtreeNode::NoChild)
+			{
+				TBoxTraversalEntry<TreeType> Far = Entry;
+				NarrowToChild(Far, FarChild, Axis, Split, !bCenterOnLeft, Center);
+				if (Far.MinDistSquared * Factor < Collector.BoundSquared)
+				{
+					Queue.HeapPush(Far, TCloserBoxFirst<TreeType>());
+				}
+			}
+			if (NearChild == FKdtreeNode::NoChild)
+			{
+				break;
+			}
+			NarrowToChild(Entry, NearChild, Axis, Split, bCenterOnLeft, Center);
+		}
+	}
+	return true;
+}
+
+template <typename ScalarType>
+ScalarType GetMaxDistSquared(float MaxDistance)
+{
+	return MaxDistance > 0.0f ? FMath::Square(static_cast<ScalarType>(MaxDistance)) : TNumericLimits<ScalarType>::Max();
+}
+
+// Runs CollectQuery(Query, Indices) for every query across worker threads, each appending the hits of one query to
+// Indices, and gathers the hits of query i in ResultIndices[ResultOffsets[i], ResultOffsets[i + 1]).
+template <typename CollectQueryType>
+void RunCollectBatch(int NumQueries, const CollectQueryType& CollectQuery, TArray<int>* ResultIndices, TArray<int>* ResultOffsets)
+{
+	ResultIndices->Reset();
+	ResultOffsets->SetNumUninitialized(NumQueries + 1);
+	(*ResultOffsets)[0] = 0;
+	if (NumQueries == 0)
+	{
+		return;
+	}
+
+	// Each chunk of consecutive queries appends to its own buffer, so the whole batch allocates one buffer per chunk
+	// instead of one per query. A few chunks per worker keep the load balanced when query costs differ.
+	const int NumChunks = FMath::Min(NumQueries, FMath::Max(1, FTaskGraphInterface::Get().GetNumWorkerThreads() * 4));
+	TArray<TArray<int>> ChunkIndices;
+	ChunkIndices.SetNum(NumChunks);
+	int* Counts = ResultOffsets->GetData() + 1;
+	ParallelFor(
+		NumChunks,
+		[&](int Chunk) {
+			const int FirstQuery = static_cast<int>(static_cast<int64>(NumQueries) * Chunk / NumChunks);
+			const int LastQuery = static_cast<int>(static_cast<int64>(NumQueries) * (Chunk + 1) / NumChunks);
+			TArray<int>& Indices = ChunkIndices[Chunk];
+			for (int Query = FirstQuery; Query < LastQuery; ++Query)
+			{
+				const int NumBefore = Indices.Num();
+				CollectQuery(Query, Indices);
+				Counts[Query] = Indices.Num() - NumBefore;
+			}
+		},
+		EParallelForFlags::Unbalanced);
+
+	for (int Query = 0; Query < NumQueries; ++Query)
+	{
+		Counts[Query] += (*ResultOffsets)[Query];
+	}
+	ResultIndices->SetNumUninitialized(Counts[NumQueries - 1]);
+	ParallelFor(NumChunks, [&](int Chunk) {
+		const int FirstQuery = static_cast<int>(static_cast<int64>(NumQueries) * Chunk / NumChunks);
+		const TArray<int>& Indices = ChunkIndices[Chunk];
+		FMemory::Memcpy(ResultIndices->GetData() + (*ResultOffsets)[FirstQuery], Indices.GetData(), Indices.Num() * sizeof(int));
+	});
+}
+
+// Work items of a self-join: the leaf buckets and the live points held by inner nodes, in tree order.
+struct FJoinWork
+{
+	TArray<uint32> Leaves;
+	TArray<int> NodePoints;
+
+	int32 Num() const
+	{
+		return Leaves.Num() + NodePoints.Num();
+	}
+};
+
+template <typename TreeType>
+FJoinWork GetJoinWork(const TreeType& Tree)
+{
+	FJoinWork Work;
+	TArray<uint32, TInlineAllocator<64>> Stack;
+	Stack.Add(0);
+	while (Stack.Num() > 0)
+	{
+		const FKdtreeNode& Node = Tree.Nodes[Stack.Pop()];
+		if (Node.IsLeaf())
+		{
+			if (Node.GetLeafNumPoints() > 0)
+			{
+				Work.Leaves.Add(static_cast<uint32>(&Node - Tree.Nodes.GetData()));
+			}
+			continue;
+		}
+
+		if (!IsTombstone(Tree, Node.Index))
+		{
+			Work.NodePoints.Add(Node.Index);
+		}
+		if (Node.GetChildRight() != FKdtreeNode::NoChild)
+		{
+			Stack.Add(Node.GetChildRight());
+		}
+		if (Node.ChildLeft != FKdtreeNode::NoChild)
+		{
+			Stack.Add(Node.ChildLeft);
+		}
+	}
+	return Work;
+}
+
+struct FJoinRow
+{
+	int Index;
+	int32 NumNeighbors;
+};
+
+// Neighbors found by one chunk of work items, one row per point in the order the chunk visited them.
+struct FJoinChunk
+{
+	TArray<int> Neighbors;
+	TArray<FJoinRow> Rows;
+};
+
+// Splits the work items into chunks joined in parallel by JoinChunk(Work, FirstItem, LastItem, Chunk), then lays out
+// the rows of all chunks by point index. As in CollectFromKdtreeBatch, each chunk appends to its own buffers, so the
+// whole join allocates per chunk instead of per point.
+template <typename TreeType, typename ChunkJoinType>
+void RunSelfJoin(const TreeType& Tree, FKdtreeNeighborGraph& Graph, const ChunkJoinType& JoinChunk)
+{
+	Graph.Neighbors.Reset();
+	Graph.Offsets.Reset();
+	Graph.Offsets.SetNumZeroed(Tree.Data.Num() + 1);
+	if (Tree.Nodes.Num() == 0)
+	{
+		return;
+	}
+
+	const FJoinWork Work = GetJoinWork(Tree);
+	const int32 NumItems = Work.Num();
+	const int32 NumChunks = FMath::Min(NumItems, FMath::Max(1, FTaskGraphInterface::Get().GetNumWorkerThreads() * 8));
+	TArray<FJoinChunk> Chunks;
+	Chunks.SetNum(NumChunks);
+	ParallelFor(
+		NumChunks,
+		[&](int32 Chunk) {
+			const int32 FirstItem = static_cast<int32>(static_cast<int64>(NumItems) * Chunk / NumChunks);
+			const int32 LastItem = static_cast<int32>(static_cast<int64>(NumItems) * (Chunk + 1) / NumChunks);
+			JoinChunk(Work, FirstItem, LastItem, Chunks[Chunk]);
+		},
+		EParallelForFlags::Unbalanced);
+
+	int32* Counts = Graph.Offsets.GetData() + 1;
+	for (const FJoinChunk& Chunk : Chunks)
+	{
+		for (const FJoinRow& Row : Chunk.Rows)
+		{
+			Counts[Row.Index] = Row.NumNeighbors;
+		}
+	}
+	for (int32 Index = 1; Index < Graph.Offsets.Num(); ++Index)
+	{
+		Graph.Offsets[Index] += Graph.Offsets[Index - 1];
+	}
+	Graph.Neighbors.SetNumUninitialized(Graph.Offsets.Last());
+	ParallelFor(NumChunks, [&](int32 Chunk) {
+		const int* Source = Chunks[Chunk].Neighbors.GetData();
+		for (const FJoinRow& Row : Chunks[Chunk].Rows)
+		{
+			FMemory::Memcpy(Graph.Neighbors.GetData() + Graph.Offsets[Row.Index], Source, Row.NumNeighbors * sizeof(int));
+			Source += Row.NumNeighbors;
+		}
+	});
+}
+
+// Finds the neighbors of all points of a leaf bucket at once: a single box query around the bucket gathers every
+// point that can be closer than Radius to one of them, and the points of the bucket are then tested against these
+// candidates only. Their coordinates are copied to one array per axis first, so the inner loop reads them in order.
+template <typename TreeType>
+void JoinLeafWithinRadius(const TreeType& Tree, const FKdtreeNode& Leaf, typename TreeType::ScalarType Radius, FJoinChunk& Chunk,
+	TArray<int>& Candidates, TArray<typename TreeType::ScalarType> (&CandidateCoords)[TreeType::Dim], FScopedQueryCounters& Counters)
+{
+	using ScalarType = typename TreeType::ScalarType;
+	constexpr int32 Dim = TreeType::Dim;
+
+	const int32 FirstSlot = Leaf.GetLeafFirstSlot();
+	const int32 LastSlot = FirstSlot + Leaf.GetLeafNumPoints();
+	TBoxShape<TreeType> Box;
+	ForEachAxis<Dim>([&](int32 Axis) {
+		const ScalarType* Coords = Tree.LeafCoords[Axis].GetData();
+		ScalarType Min = Coords[FirstSlot];
+		ScalarType Max = Coords[FirstSlot];
+		for (int32 Slot = FirstSlot + 1; Slot < LastSlot; ++Slot)
+		{
+			Min = FMath::Min(Min, Coords[Slot]);
+			Max = FMath::Max(Max, Coords[Slot]);
+		}
+		Box.Min[Axis] = Min - Radius;
+		Box.Max[Axis] = Max + Radius;
+	});
+
+	Candidates.Reset();
+	TCollectSink<FDefaultAllocator> Sink{Candidates};
+	TraverseShape(Tree, Box, Sink, Counters);
+
+	// Points in the corners of the grown box are farther than Radius from the bucket and are dropped right away.
+	const ScalarType RadiusSquared = FMath::Square(Radius);
+	int32 NumCandidates = 0;
+	ForEachAxis<Dim>([&](int32 Axis) { CandidateCoords[Axis].SetNumUninitialized(Candidates.Num(), EAllowShrinking::No); });
+	for (const int Candidate : Candidates)
+	{
+		const typename TreeType::PointType& Point = Tree.Data[Candidate];
+		ScalarType DistSquared = 0;
+		ForEachAxis<Dim>([&](int32 Axis) {
+			DistSquared += GetAxisMinDistSquared(Point[Axis], Box.Min[Axis] + Radius, Box.Max[Axis] - Radius);
+		});
+		if (DistSquared < RadiusSquared)
+		{
+			ForEachAxis<Dim>([&](int32 Axis) { CandidateCoords[Axis][NumCandidates] = Point[Axis]; });
+			Candidates[NumCandidates++] = Candidate;
+		}
+	}
+
+	for (int32 Slot = FirstSlot; Slot < LastSlot; ++Slot)
+	{
+		const int Index = Tree.LeafIndices[Slot];
+		ScalarType Point[Dim];
+		const ScalarType* Coords[Dim];
+		ForEachAxis<Dim>([&](int32 Axis) {
+			Point[Axis] = Tree.LeafCoords[Axis][Slot];
+			Coords[Axis] = CandidateCoords[Axis].GetData();
+		});
+
+		const int32 NumBefore = Chunk.Neighbors.Num();
+		for (int32 Candidate = 0; Candidate < NumCandidates; ++Candidate)
+		{
+			ScalarType DistSquared = 0;
+			ForEachAxis<Dim>([&](int32 Axis) { DistSquared += FMath::Square(Coords[Axis][Candidate] - Point[Axis]); });
+			if (DistSquared < RadiusSquared && Candidates[Candidate] != Index)
+			{
+				Chunk.Neighbors.Add(Candidates[Candidate]);
+			}
+		}
+		Chunk.Rows.Add(FJoinRow{Index, Chunk.Neighbors.Num() - NumBefore});
+	}
+	Counters.AddPointsTested(NumCandidates * (LastSlot - FirstSlot));
+}
+
+// Appends the K nearest other points of the point at Index to Chunk, nearest first. Collector collects K + 1 points,
+// as the point finds itself; with duplicates of it the heap may hold those instead. It is reset here, so one collector
+// serves every point of a chunk.
+template <typename TreeType>
+void JoinPointKNearest(const TreeType& Tree, int Index, int K, typename TreeType::ScalarType MaxDistSquared,
+	TKNearestCollector<typename TreeType::ScalarType>& Collector, FJoinChunk& Chunk, FScopedQueryCounters& Counters)
+{
+	using ScalarType = typename TreeType::ScalarType;
+
+	Collector.Reset(MaxDistSquared);
+	SearchNearest(Tree, 0, Tree.Data[Index], Collector, Counters);
+	Collector.Heap.Sort([](const TNeighbor<ScalarType>& Lhs, const TNeighbor<ScalarType>& Rhs) { return Lhs.DistSquared < Rhs.DistSquared; });
+
+	int32 NumNeighbors = 0;
+	for (const TNeighbor<ScalarType>& Neighbor : Collector.Heap)
+	{
+		if (Neighbor.Index != Index && NumNeighbors < K)
+		{
+			Chunk.Neighbors.Add(Neighbor.Index);
+			++NumNeighbors;
+		}
+	}
+	Chunk.Rows.Add(FJoinRow{Index, NumNeighbors});
+}
+
+// A subtree is rebuilt once one of its children holds more than this fraction of its points.
+constexpr double ScapegoatAlpha = 0.7;
+
+using FNodePath = TArray<uint32, TInlineAllocator<64>>;
+
+template <typename TreeType>
+int32 GetNumLivePoints(const TreeType& Tree)
+{
+	// Every removed index is either free or still held by a tombstone.
+	return Tree.Data.Num() - Tree.FreeIndices.Num() - Tree.NumTombstones;
+}
+
+// Appends NumSlots leaf slots, keeping the coordinate arrays padded, and returns the first one.
+template <typename TreeType>
+int32 AddLeafSlots(TreeType& Tree, int32 NumSlots)
+{
+	const int32 FirstSlot = Tree.LeafIndices.AddUninitialized(NumSlots);
+	for (auto& Coords : Tree.LeafCoords)
+	{
+		Coords.SetNumZeroed(Tree.LeafIndices.Num() + LeafSimdWidth - 1);
+	}
+	return FirstSlot;
+}
+
+template <typename TreeType>
+bool HasPointMasks(const TreeType& Tree)
+{
+	return Tree.PointMasks.Num() > 0;
+}
+
+// Gives every point a mask, 0 for the points that had none, and every node a subtree mask.
+template <typename TreeType>
+void EnablePointMasks(TreeType& Tree)
+{
+	Tree.PointMasks.SetNumZeroed(Tree.Data.Num());
+	Tree.SubtreeMasks.SetNumZeroed(Tree.Nodes.Num());
+}
+
+// Sets the subtree masks below NodeIndex to the OR of the masks of their live points and returns the one of NodeIndex.
+template <typename TreeType>
+uint64 UpdateSubtreeMasks(TreeType& Tree, uint32 NodeIndex)
+{
+	const FKdtreeNode& Node = Tree.Nodes[NodeIndex];
+	uint64 Mask = 0;
+	if (Node.IsLeaf())
+	{
+		for (int32 Slot = Node.GetLeafFirstSlot(); Slot < Node.GetLeafFirstSlot() + Node.GetLeafNumPoints(); ++Slot)
+		{
+			Mask |= Tree.PointMasks[Tree.LeafIndices[Slot]];
+		}
+	}
+	else
+	{
+		Mask = IsTombstone(Tree, Node.Index) ? 0 : Tree.PointMasks[Node.Index];
+		if (Node.ChildLeft != FKdtreeNode::NoChild)
+		{
+			Mask |= UpdateSubtreeMasks(Tree, Node.ChildLeft);
+		}
+		if (Node.GetChildRight() != FKdtreeNode::NoChild)
+		{
+			Mask |= UpdateSubtreeMasks(Tree, Node.GetChildRight());
+		}
+	}
+	Tree.SubtreeMasks[NodeIndex] = Mask;
+	return Mask;
+}
+
+// Recomputes all subtree masks, dropping the bits left behind by edits.
+template <typename TreeType>
+void RebuildSubtreeMasks(TreeType& Tree)
+{
+	Tree.SubtreeMasks.Reset();
+	if (HasPointMasks(Tree) && Tree.Nodes.Num() > 0)
+	{
+		Tree.SubtreeMasks.SetNumZeroed(Tree.Nodes.Num());
+		UpdateSubtreeMasks(Tree, 0);
+	}
+}
+
+// Adds the mask of the point at Index to the subtree masks along Path, which leads from the root to the node holding it.
+template <typename TreeType>
+void AddToSubtreeMasks(TreeType& Tree, const FNodePath& Path, int Index)
+{
+	Tree.SubtreeMasks.SetNumZeroed(Tree.Nodes.Num());
+	for (const uint32 NodeIndex : Path)
+	{
+		Tree.SubtreeMasks[NodeIndex] |= Tree.PointMasks[Index];
+	}
+}
+
+// Copies the nodes reachable from the root and their leaf slots to new arrays in the order BuildNode lays them out,
+// dropping the nodes and slots reserved for subtrees that turned out smaller.
+template <typename TreeType>
+void CompactNodes(TreeType& Tree)
+{
+	TArray<FKdtreeNode> Nodes;
+	Nodes.Reserve(Tree.Nodes.Num());
+	TArray<int32> LeafIndices;
+	LeafIndices.Reserve(Tree.LeafIndices.Num());
+
+	struct FEntry
+	{
+		uint32 NodeIndex;
+		// Position of the copied parent, and which of its children the node is.
+		uint32 Parent;
+		bool bIsRightChild;
+	};
+	TArray<FEntry, TInlineAllocator<64>> Stack;
+	Stack.Add(FEntry{0, 0, false});
+	while (Stack.Num() > 0)
+	{
+		const FEntry Entry = Stack.Pop();
+		const uint32 NewIndex = Nodes.Add(Tree.Nodes[Entry.NodeIndex]);
+		if (NewIndex > 0)
+		{
+			FKdtreeNode& Parent = Nodes[Entry.Parent];
+			if (Entry.bIsRightChild)
+			{
+				Parent.SetChildRightAndAxis(NewIndex, Parent.GetAxis());
+			}
+			else
+			{
+				Parent.ChildLeft = NewIndex;
+			}
+		}
+
+		FKdtreeNode& Node = Nodes[NewIndex];
+		if (Node.IsLeaf())
+		{
+			const int32 FirstSlot = LeafIndices.Num();
+			LeafIndices.Append(Tree.LeafIndices.GetData() + Node.GetLeafFirstSlot(), Node.GetLeafNumPoints());
+			Node.SetLeaf(FirstSlot, Node.GetLeafNumPoints(), Node.GetLeafNumPoints());
+			continue;
+		}
+
+		// Pushed right first, so the left subtree is copied directly after its parent.
+		if (Node.GetChildRight() != FKdtreeNode::NoChild)
+		{
+			Stack.Add(FEntry{Node.GetChildRight(), NewIndex, true});
+		}
+		if (Node.ChildLeft != FKdtreeNode::NoChild)
+		{
+			Stack.Add(FEntry{Node.ChildLeft, NewIndex, false});
+		}
+	}
+
+	Tree.Nodes = MoveTemp(Nodes);
+	Tree.LeafIndices = MoveTemp(LeafIndices);
+	for (auto& Coords : Tree.LeafCoords)
+	{
+		Coords.Reset();
+		if (Tree.LeafIndices.Num() > 0)
+		{
+			Coords.SetNumZeroed(Tree.LeafIndices.Num() + LeafSimdWidth - 1);
+		}
+	}
+	for (int32 Slot = 0; Slot < Tree.LeafIndices.Num(); ++Slot)
+	{
+		SetLeafSlot(Tree, Slot, Tree.LeafIndices[Slot]);
+	}
+}
+
+// Builds Nodes and the leaf buckets from scratch over the points in Indices, which is reordered.
+template <typename TreeType>
+void BuildNodes(TreeType& Tree, TArray<int>& Indices)
+{
+	// The size of every subtree is bounded before it is built, so the whole tree fits in a single allocation.
+	const FSubtreeSize Size = GetSubtreeCapacity(Indices.Num(), Tree.LeafSize, Tree.SplitPolicy);
+	Tree.Nodes.SetNumUninitialized(Size.NumNodes);
+	if (Size.NumLeafPoints > 0)
+	{
+		Tree.LeafIndices.SetNumUninitialized(Size.NumLeafPoints);
+		for (auto& Coords : Tree.LeafCoords)
+		{
+			Coords.SetNumZeroed(Size.NumLeafPoints + LeafSimdWidth - 1);
+		}
+	}
+
+	if (Indices.Num() >= ParallelBuildMinPoints && FApp::ShouldUseThreadingForPerformance())
+	{
+		BuildNodeParallel(Tree, Indices.GetData(), Indices.Num(), 0, Tree.SplitPolicy, 0, 0);
+	}
+	else
+	{
+		uint32 NextNode = 0;
+		int32 NextLeafSlot = 0;
+		BuildNode(Tree, Indices.GetData(), Indices.Num(), 0, Tree.SplitPolicy, NextNode, NextLeafSlot);
+	}
+	if (!IsBalancedSplitPolicy(Tree.SplitPolicy))
+	{
+		CompactNodes(Tree);
+	}
+	RebuildSubtreeMasks(Tree);
+	Tree.MaxNumPoints = Indices.Num();
+}
+
+// Moves the points into the order a depth-first walk of the tree visits them, so the points of every subtree are stored
+// together and next to the points of the nodes above. Must run right after the build, while Data is in input order.
+template <typename TreeType>
+void StorePointsInTreeOrder(TreeType& Tree)
+{
+	if (Tree.Nodes.Num() == 0)
+	{
+		return;
+	}
+
+	// Position in the input of every point in the new order.
+	TArray<int32> Order;
+	Order.Reserve(Tree.Data.Num());
+	TArray<uint32, TInlineAllocator<64>> Stack;
+	Stack.Add(0);
+	while (Stack.Num() > 0)
+	{
+		FKdtreeNode& Node = Tree.Nodes[Stack.Pop()];
+		if (Node.IsLeaf())
+		{
+			for (int32 Slot = Node.GetLeafFirstSlot(); Slot < Node.GetLeafFirstSlot() + Node.GetLeafNumPoints(); ++Slot)
+			{
+				Tree.LeafIndices[Slot] = Order.Add(Tree.LeafIndices[Slot]);
+			}
+			continue;
+		}
+
+		Node.Index = Order.Add(Node.Index);
+		if (Node.GetChildRight() != FKdtreeNode::NoChild)
+		{
+			Stack.Add(Node.GetChildRight());
+		}
+		if (Node.ChildLeft != FKdtreeNode::NoChild)
+		{
+			Stack.Add(Node.ChildLeft);
+		}
+	}
+	check(Order.Num() == Tree.Data.Num());
+
+	TArray<typename TreeType::PointType> Points;
+	Points.SetNumUninitialized(Order.Num());
+	for (int32 Index = 0; Index < Order.Num(); ++Index)
+	{
+		Points[Index] = Tree.Data[Order[Index]];
+	}
+	Tree.Data = MoveTemp(Points);
+	Tree.InputIndices = MoveTemp(Order);
+}
+
+// Values given per input point, rearranged to be indexed like Data.
+template <typename TreeType, typename ValueType>
+TArray<ValueType> ToDataOrder(const TreeType& Tree, const TArray<ValueType>& Values)
+{
+	if (Tree.InputIndices.Num() == 0)
+	{
+		return Values;
+	}
+
+	TArray<ValueType> Result;
+	Result.Reserve(Values.Num());
+	for (const int32 InputIndex : Tree.InputIndices)
+	{
+		Result.Add(Values[InputIndex]);
+	}
+	return Result;
+}
+
+// Rebuilds the whole tree over its remaining points, dropping tombstones and unreachable nodes and leaf slots.
+template <typename TreeType>
+void RebuildKdtree(TreeType& Tree)
+{
+	TArray<int> Indices;
+	Indices.Reserve(GetNumLivePoints(Tree));
+	Tree.FreeIndices.Reset();
+	ResetBounds(Tree);
+	for (int Index = 0; Index < Tree.Data.Num(); ++Index)
+	{
+		if (Tree.RemovedPoints[Index])
+		{
+			Tree.FreeIndices.Add(Index);
+		}
+		else
+		{
+			Indices.Add(Index);
+			ExpandBounds(Tree, Tree.Data[Index]);
+		}
+	}
+
+	Tree.Nodes.Reset();
+	Tree.SubtreeMasks.Reset();
+	Tree.LeafIndices.Reset();
+	for (auto& Coords : Tree.LeafCoords)
+	{
+		Coords.Reset();
+	}
+	Tree.NumTombstones = 0;
+	Tree.NumGarbageNodes = 0;
+	Tree.NumGarbageLeafSlots = 0;
+	Tree.MaxNumPoints = 0;
+	if (Indices.Num() > 0)
+	{
+		BuildNodes(Tree, Indices);
+	}
+}
+
+template <typename TreeType>
+bool ShouldRebuildKdtree(const TreeType& Tree)
+{
+	return GetNumLivePoints(Tree) * 2 < Tree.MaxNumPoints || (Tree.NumGarbageNodes + Tree.NumTombstones) * 2 > Tree.Nodes.Num() ||
+		   Tree.NumGarbageLeafSlots * 2 > Tree.LeafIndices.Num();
+}
+
+// Number of points in the subtree, counting tombstones.
+template <typename TreeType>
+int32 CountSubtreePoints(const TreeType& Tree, uint32 NodeIndex)
+{
+	int32 NumPoints = 0;
+	TArray<uint32, TInlineAllocator<64>> Stack;
+	Stack.Add(NodeIndex);
+	while (Stack.Num() > 0)
+	{
+		const FKdtreeNode& Node = Tree.Nodes[Stack.Pop()];
+		if (Node.IsLeaf())
+		{
+			NumPoints += Node.GetLeafNumPoints();
+			continue;
+		}
+
+		++NumPoints;
+		if (Node.GetChildRight() != FKdtreeNode::NoChild)
+		{
+			Stack.Add(Node.GetChildRight());
+		}
+		if (Node.ChildLeft != FKdtreeNode::NoChild)
+		{
+			Stack.Add(Node.ChildLeft);
+		}
+	}
+	return NumPoints;
+}
+
+// Appends the live points of the subtree to Indices and retires its nodes and leaf slots. The indices held by its
+// tombstones become free.
+template <typename TreeType>
+void TakeSubtreePoints(TreeType& Tree, uint32 NodeIndex, TArray<int>& Indices)
+{
+	TArray<uint32, TInlineAllocator<64>> Stack;
+	Stack.Add(NodeIndex);
+	while (Stack.Num() > 0)
+	{
+		const FKdtreeNode& Node = Tree.Nodes[Stack.Pop()];
+		++Tree.NumGarbageNodes;
+		if (Node.IsLeaf())
+		{
+			Indices.Append(Tree.LeafIndices.GetData() + Node.GetLeafFirstSlot(), Node.GetLeafNumPoints());
+			Tree.NumGarbageLeafSlots += Node.GetLeafCapacity();
+			continue;
+		}
+
+		if (IsTombstone(Tree, Node.Index))
+		{
+			Tree.FreeIndices.Add(Node.Index);
+			--Tree.NumTombstones;
+		}
+		else
+		{
+			Indices.Add(Node.Index);
+		}
+		if (Node.GetChildRight() != FKdtreeNode::NoChild)
+		{
+			Stack.Add(Node.GetChildRight());
+		}
+		if (Node.ChildLeft != FKdtreeNode::NoChild)
+		{
+			Stack.Add(Node.ChildLeft);
+		}
+	}
+}
+
+// Replaces the subtree taken at NodeIndex, which sits at Depth, by a balanced one over Indices. The new subtree is
+// built at the end of the arrays and its root is copied over the old one, so the link from the parent stays valid.
+template <typename TreeType>
+void RebuildSubtree(TreeType& Tree, uint32 NodeIndex, int Depth, TArray<int>& Indices)
+{
+	const FSubtreeSize Size = GetSubtreeSize(Indices.Num(), Tree.LeafSize);
+	uint32 NextNode = Tree.Nodes.AddUninitialized(Size.NumNodes);
+	int32 NextLeafSlot = Size.NumLeafPoints > 0 ? AddLeafSlots(Tree, Size.NumLeafPoints) : Tree.LeafIndices.Num();
+	const uint32 Root = NextNode;
+	BuildNode(Tree, Indices.GetData(), Indices.Num(), Depth, GetRebuildSplitPolicy(Tree), NextNode, NextLeafSlot);
+
+	// The old root was counted as garbage when the subtree was taken. Its slot is reused, leaving the copied one unreachable.
+	Tree.Nodes[NodeIndex] = Tree.Nodes[Root];
+	if (HasPointMasks(Tree))
+	{
+		Tree.SubtreeMasks.SetNumZeroed(Tree.Nodes.Num());
+		UpdateSubtreeMasks(Tree, NodeIndex);
+	}
+}
+
+// Appends a node holding only the point at Index: a leaf bucket with room for LeafSize points, or an inner node.
+template <typename TreeType>
+uint32 AddSinglePointNode(TreeType& Tree, int Index, int Depth)
+{
+	const uint32 NodeIndex = Tree.Nodes.AddDefaulted();
+	FKdtreeNode& Node = Tree.Nodes[NodeIndex];
+	if (Tree.LeafSize > 0)
+	{
+		const int32 FirstSlot = AddLeafSlots(Tree, Tree.LeafSize);
+		SetLeafSlot(Tree, FirstSlot, Index);
+		Node.SetLeaf(FirstSlot, 1, Tree.LeafSize);
+	}
+	else
+	{
+		Node.Index = Index;
+		Node.ChildLeft = FKdtreeNode::NoChild;
+		Node.SetChildRightAndAxis(FKdtreeNode::NoChild, Depth % TreeType::Dim);
+	}
+	return NodeIndex;
+}
+
+// Returns whether the bucket was full and had to be rebuilt as a subtree.
+template <typename TreeType>
+bool InsertIntoLeaf(TreeType& Tree, uint32 NodeIndex, int Depth, int Index)
+{
+	FKdtreeNode& Leaf = Tree.Nodes[NodeIndex];
+	const int32 NumPoints = Leaf.GetLeafNumPoints();
+	if (NumPoints < Leaf.GetLeafCapacity())
+	{
+		SetLeafSlot(Tree, Leaf.GetLeafFirstSlot() + NumPoints, Index);
+		Leaf.SetLeafNumPoints(NumPoints + 1);
+		return false;
+	}
+	if (NumPoints < Tree.LeafSize)
+	{
+		// Buckets made by a build are packed, so the bucket moves to the end of the slots with room to grow.
+		const int32 FirstSlot = AddLeafSlots(Tree, Tree.LeafSize);
+		for (int32 Offset = 0; Offset < NumPoints; ++Offset)
+		{
+			SetLeafSlot(Tree, FirstSlot + Offset, Tree.LeafIndices[Leaf.GetLeafFirstSlot() + Offset]);
+		}
+		SetLeafSlot(Tree, FirstSlot + NumPoints, Index);
+		Tree.NumGarbageLeafSlots += Leaf.GetLeafCapacity();
+		Leaf.SetLeaf(FirstSlot, NumPoints + 1, Tree.LeafSize);
+		return false;
+	}
+
+	TArray<int> Indices;
+	Indices.Reserve(NumPoints + 1);
+	TakeSubtreePoints(Tree, NodeIndex, Indices);
+	Indices.Add(Index);
+	RebuildSubtree(Tree, NodeIndex, Depth, Indices);
+	return true;
+}
+
+// Scapegoat rebalancing: an insertion deeper than log_{1/alpha} of the number of points has an ancestor with a child
+// holding more than alpha of its points. Rebuilding the lowest such ancestor keeps the depth logarithmic at an
+// amortized O(log n) cost per insertion. Returns whether a subtree was rebuilt.
+template <typename TreeType>
+bool RebalanceAfterInsert(TreeType& Tree, const FNodePath& Path)
+{
+	const int32 NumPoints = GetNumLivePoints(Tree) + Tree.NumTombstones;
+	const int MaxDepth = FMath::FloorToInt32(FMath::Loge(static_cast<double>(NumPoints)) / FMath::Loge(1.0 / ScapegoatAlpha));
+	if (Path.Num() - 1 <= MaxDepth)
+	{
+		return false;
+	}
+
+	int32 ChildSize = CountSubtreePoints(Tree, Path.Last());
+	for (int Depth = Path.Num() - 2; Depth >= 0; --Depth)
+	{
+		const FKdtreeNode& Node = Tree.Nodes[Path[Depth]];
+		const uint32 Sibling = Node.ChildLeft == Path[Depth + 1] ? Node.GetChildRight() : Node.ChildLeft;
+		const int32 Size = 1 + ChildSize + (Sibling != FKdtreeNode::NoChild ? CountSubtreePoints(Tree, Sibling) : 0);
+		if (ChildSize > ScapegoatAlpha * Size)
+		{
+			TArray<int> Indices;
+			Indices.Reserve(Size);
+			TakeSubtreePoints(Tree, Path[Depth], Indices);
+			RebuildSubtree(Tree, Path[Depth], Depth, Indices);
+			return true;
+		}
+		ChildSize = Size;
+	}
+	return false;
+}
+
+// Finds the node holding Index by following the splits towards its position. Points equal to a split value can be
+// on either side, so both children are searched then. OutSlot is the leaf slot, or INDEX_NONE for an inner node.
+// OutPath receives the nodes from the root down to the found one.
+template <typename TreeType>
+bool FindPointNode(const TreeType& Tree, int Index, uint32& OutNodeIndex, int32& OutSlot, FNodePath& OutPath)
+{
+	struct FEntry
+	{
+		uint32 NodeIndex;
+		int32 Depth;
+	};
+
+	const typename TreeType::PointType& Point = Tree.Data[Index];
+	TArray<FEntry, TInlineAllocator<64>> Stack;
+	Stack.Add(FEntry{0, 0});
+	while (Stack.Num() > 0)
+	{
+		const FEntry Entry = Stack.Pop();
+		const uint32 NodeIndex = Entry.NodeIndex;
+		const FKdtreeNode& Node = Tree.Nodes[NodeIndex];
+		// Entries are visited depth first, so the path above an entry is still intact when it is popped.
+		OutPath.SetNum(Entry.Depth);
+		OutPath.Add(NodeIndex);
+		if (Node.IsLeaf())
+		{
+			for (int32 Slot = Node.GetLeafFirstSlot(); Slot < Node.GetLeafFirstSlot() + Node.GetLeafNumPoints(); ++Slot)
+			{
+				if (Tree.LeafIndices[Slot] == Index)
+				{
+					OutNodeIndex = NodeIndex;
+					OutSlot = Slot;
+					return true;
+				}
+			}
+			continue;
+		}
+
+		if (Node.Index == Index)
+		{
+			OutNodeIndex = NodeIndex;
+			OutSlot = INDEX_NONE;
+			return true;
+		}
+		const int Axis = Node.GetAxis();
+		const typename TreeType::ScalarType Split = Tree.Data[Node.Index][Axis];
+		if (Point[Axis] <= Split && Node.ChildLeft != FKdtreeNode::NoChild)
+		{
+			Stack.Add(FEntry{Node.ChildLeft, Entry.Depth + 1});
+		}
+		if (Point[Axis] >= Split && Node.GetChildRight() != FKdtreeNode::NoChild)
+		{
+			Stack.Add(FEntry{Node.GetChildRight(), Entry.Depth + 1});
+		}
+	}
+	return false;
+}
+
+// Whether Point lies on the same side of every split along Path as the last node of the path.
+template <typename TreeType>
+bool IsWithinPath(const TreeType& Tree, const FNodePath& Path, const typename TreeType::PointType& Point)
+{
+	for (int Depth = 0; Depth + 1 < Path.Num(); ++Depth)
+	{
+		const FKdtreeNode& Node = Tree.Nodes[Path[Depth]];
+		const int Axis = Node.GetAxis();
+		const typename TreeType::ScalarType Split = Tree.Data[Node.Index][Axis];
+		if (Node.ChildLeft == Path[Depth + 1] ? Point[Axis] > Split : Point[Axis] < Split)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Spreads the lower 21 bits of X so that two zero bits separate neighbouring bits.
+inline uint64 SpreadBits3(uint64 X)
+{
+	X &= 0x1fffff;
+	X = (X | X << 32) & 0x1f00000000ffff;
+	X = (X | X << 16) & 0x1f0000ff0000ff;
+	X = (X | X << 8) & 0x100f00f00f00f00f;
+	X = (X | X << 4) & 0x10c30c30c30c30c3;
+	X = (X | X << 2) & 0x1249249249249249;
+	return X;
+}
+
+// Position of Point along a Z-order curve through the bounds of the tree.
+template <typename TreeType>
+uint64 GetMortonCode(const TreeType& Tree, const typename TreeType::PointType& Point)
+{
+	constexpr int32 Dim = TreeType::Dim;
+	constexpr int32 BitsPerAxis = 63 / Dim;
+	constexpr double MaxCell = static_cast<double>((uint64(1) << BitsPerAxis) - 1);
+
+	uint64 Cells[Dim];
+	ForEachAxis<Dim>([&](int32 Axis) {
+		const double Extent = static_cast<double>(Tree.BoundsMax[Axis]) - Tree.BoundsMin[Axis];
+		const double Cell = Extent > 0.0 ? (Point[Axis] - Tree.BoundsMin[Axis]) / Extent * MaxCell : 0.0;
+		Cells[Axis] = static_cast<uint64>(FMath::Clamp(Cell, 0.0, MaxCell));
+	});
+
+	if constexpr (Dim == 3)
+	{
+		return SpreadBits3(Cells[0]) | SpreadBits3(Cells[1]) << 1 | SpreadBits3(Cells[2]) << 2;
+	}
+	else
+	{
+		uint64 Code = 0;
+		for (int32 Bit = BitsPerAxis - 1; Bit >= 0; --Bit)
+		{
+			ForEachAxis<Dim>([&](int32 Axis) { Code = Code << 1 | ((Cells[Axis] >> Bit) & 1); });
+		}
+		return Code;
+	}
+}
+
+// Stores Point at a free index, or at a new one if there is none.
+template <typename TreeType>
+int AllocateIndex(TreeType& Tree, const typename TreeType::PointType& Point)
+{
+	if (Tree.FreeIndices.Num() > 0)
+	{
+		const int Index = Tree.FreeIndices.Pop();
+		Tree.Data[Index] = Point;
+		Tree.RemovedPoints[Index] = false;
+		if (HasPointMasks(Tree))
+		{
+			Tree.PointMasks[Index] = 0;
+		}
+		if (Tree.InputIndices.Num() > 0)
+		{
+			Tree.InputIndices[Index] = INDEX_NONE;
+		}
+		if constexpr (!std::is_void_v<typename TreeType::PayloadType>)
+		{
+			Tree.Payloads[Index] = typename TreeType::PayloadType();
+		}
+		return Index;
+	}
+
+	Tree.RemovedPoints.Add(false);
+	if (HasPointMasks(Tree))
+	{
+		Tree.PointMasks.Add(0);
+	}
+	if (Tree.InputIndices.Num() > 0)
+	{
+		Tree.InputIndices.Add(INDEX_NONE);
+	}
+	if constexpr (!std::is_void_v<typename TreeType::PayloadType>)
+	{
+		Tree.Payloads.AddDefaulted();
+	}
+	return Tree.Data.Add(Point);
+}
+
+template <typename TreeType>
+void RemoveFromLeaf(TreeType& Tree, uint32 NodeIndex, int32 Slot)
+{
+	FKdtreeNode& Leaf = Tree.Nodes[NodeIndex];
+	const int32 LastSlot = Leaf.GetLeafFirstSlot() + Leaf.GetLeafNumPoints() - 1;
+	SetLeafSlot(Tree, Slot, Tree.LeafIndices[LastSlot]);
+	Leaf.SetLeafNumPoints(Leaf.GetLeafNumPoints() - 1);
+}
+
+// Places the point at Index, whose position is already in Data, below a leaf bucket or a missing child reached by
+// following the splits. Returns the number of subtrees rebuilt on the way.
+template <typename TreeType>
+int32 InsertIndex(TreeType& Tree, int Index)
+{
+	if (Tree.Nodes.Num() == 0)
+	{
+		const uint32 Root = AddSinglePointNode(Tree, Index, 0);
+		if (HasPointMasks(Tree))
+		{
+			Tree.SubtreeMasks.SetNumZeroed(Tree.Nodes.Num());
+			Tree.SubtreeMasks[Root] = Tree.PointMasks[Index];
+		}
+		return 0;
+	}
+
+	const typename TreeType::PointType Point = Tree.Data[Index];
+	int32 NumSubtreesRebuilt = 0;
+	FNodePath Path;
+	uint32 NodeIndex = 0;
+	while (true)
+	{
+		Path.Add(NodeIndex);
+		const FKdtreeNode& Node = Tree.Nodes[NodeIndex];
+		if (Node.IsLeaf())
+		{
+			NumSubtreesRebuilt += InsertIntoLeaf(Tree, NodeIndex, Path.Num() - 1, Index) ? 1 : 0;
+			break;
+		}
+
+		const int Axis = Node.GetAxis();
+		const bool bIsLeft = Point[Axis] < Tree.Data[Node.Index][Axis];
+		const uint32 Child = bIsLeft ? Node.ChildLeft : Node.GetChildRight();
+		if (Child == FKdtreeNode::NoChild)
+		{
+			const uint32 NewNode = AddSinglePointNode(Tree, Index, Path.Num());
+			FKdtreeNode& Parent = Tree.Nodes[NodeIndex];
+			if (bIsLeft)
+			{
+				Parent.ChildLeft = NewNode;
+			}
+			else
+			{
+				Parent.SetChildRightAndAxis(NewNode, Axis);
+			}
+			Path.Add(NewNode);
+			break;
+		}
+		NodeIndex = Child;
+	}
+
+	if (HasPointMasks(Tree))
+	{
+		AddToSubtreeMasks(Tree, Path, Index);
+	}
+	NumSubtreesRebuilt += RebalanceAfterInsert(Tree, Path) ? 1 : 0;
+	return NumSubtreesRebuilt;
+}
+
+// Adds Point with Mask to the tree and returns its index. Masks are only stored once a point has one.
+template <typename TreeType>
+int InsertNewPoint(TreeType& Tree, const typename TreeType::PointType& Point, uint64 Mask)
+{
+	const int Index = AllocateIndex(Tree, Point);
+	if (Mask != 0 || HasPointMasks(Tree))
+	{
+		EnablePointMasks(Tree);
+		Tree.PointMasks[Index] = Mask;
+	}
+	ExpandBounds(Tree, Point);
+	Tree.MaxNumPoints = FMath::Max(Tree.MaxNumPoints, GetNumLivePoints(Tree));
+
+	InsertIndex(Tree, Index);
+	if (ShouldRebuildKdtree(Tree))
+	{
+		RebuildKdtree(Tree);
+	}
+	return Index;
+}
+
+// Logs an error for every subtree mask missing bits of a live point below it. Returns the OR of those points' masks.
+template <typename TreeType>
+uint64 ValidateSubtreeMasks(const TreeType& Tree, uint32 NodeIndex)
+{
+	const FKdtreeNode& Node = Tree.Nodes[NodeIndex];
+	uint64 Mask = 0;
+	if (Node.IsLeaf())
+	{
+		for (int32 Slot = Node.GetLeafFirstSlot(); Slot < Node.GetLeafFirstSlot() + Node.GetLeafNumPoints(); ++Slot)
+		{
+			Mask |= Tree.PointMasks[Tree.LeafIndices[Slot]];
+		}
+	}
+	else
+	{
+		Mask = IsTombstone(Tree, Node.Index) ? 0 : Tree.PointMasks[Node.Index];
+		if (Node.ChildLeft != FKdtreeNode::NoChild)
+		{
+			Mask |= ValidateSubtreeMasks(Tree, Node.ChildLeft);
+		}
+		if (Node.GetChildRight() != FKdtreeNode::NoChild)
+		{
+			Mask |= ValidateSubtreeMasks(Tree, Node.GetChildRight());
+		}
+	}
+	if ((Tree.SubtreeMasks[NodeIndex] & Mask) != Mask)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Kdtree is invalid: subtree mask %llx of node %u misses bits of %llx"),
+			Tree.SubtreeMasks[NodeIndex], NodeIndex, Mask);
+	}
+	return Mask;
+}
+}	 // namespace Private
+
+template <typename TreeType>
+void ClearKdtree(TreeType* Tree);
+
+// Builds the tree over Data, taking ownership of the points instead of copying them.
+template <typename TreeType>
+void BuildKdtree(TreeType* Tree, TArray<typename TreeType::PointType>&& Data,
+	const FKdtreeBuildSettings& Settings = FKdtreeBuildSettings())
+{
+	KDTREE_SCOPE_CYCLE_COUNTER(STAT_KdtreeBuild);
+
+	// Taken before clearing, as Data may be the tree's own array.
+	TArray<typename TreeType::PointType> Points = MoveTemp(Data);
+	ClearKdtree(Tree);
+
+	Tree->Data = MoveTemp(Points);
+	Tree->LeafSize = FMath::Max(Settings.LeafSize, 0);
+	Tree->SplitPolicy = Settings.SplitPolicy;
+	Tree->SplitQueryRadius = FMath::Max(Settings.ExpectedQueryRadius, 0.0f);
+	Tree->RemovedPoints.Init(false, Tree->Data.Num());
+	if (Tree->Data.Num() == 0)
+	{
+		return;
+	}
+
+	TArray<int> Indices;
+	Indices.SetNumUninitialized(Tree->Data.Num());
+	for (int Index = 0; Index < Tree->Data.Num(); ++Index)
+	{
+		Indices[Index] = Index;
+		Private::ExpandBounds(*Tree, Tree->Data[Index]);
+	}
+	Private::BuildNodes(*Tree, Indices);
+	if (Settings.bReorderPoints)
+	{
+		Private::StorePointsInTreeOrder(*Tree);
+	}
+}
+
+template <typename TreeType>
+void BuildKdtree(TreeType* Tree, const TArray<typename TreeType::PointType>& Data,
+	const FKdtreeBuildSettings& Settings = FKdtreeBuildSettings())
+{
+	BuildKdtree(Tree, TArray<typename TreeType::PointType>(Data), Settings);
+}
+
+// Settings that build a tree like Tree was built.
+template <typename TreeType>
+FKdtreeBuildSettings GetBuildSettings(const TreeType& Tree)
+{
+	FKdtreeBuildSettings Settings;
+	Settings.LeafSize = Tree.LeafSize;
+	Settings.SplitPolicy = Tree.SplitPolicy;
+	Settings.ExpectedQueryRadius = Tree.SplitQueryRadius;
+	Settings.bReorderPoints = Tree.InputIndices.Num() > 0;
+	return Settings;
+}
+
+// Builds the tree over Data with Payloads[i] attached to Data[i].
+template <typename TreeType>
+void BuildKdtreeWithPayloads(TreeType* Tree, const TArray<typename TreeType::PointType>& Data,
+	const TArray<typename TreeType::PayloadType>& Payloads, const FKdtreeBuildSettings& Settings = FKdtreeBuildSettings())
+{
+	check(Payloads.Num() == Data.Num());
+	BuildKdtree(Tree, Data, Settings);
+	Tree->Payloads = Private::ToDataOrder(*Tree, Payloads);
+}
+
+// Position of the point at Index in the array the tree was built from: Index itself unless the build reordered the
+// points, and INDEX_NONE for points inserted into a reordered tree since.
+template <typename TreeType>
+int GetInputIndex(const TreeType& Tree, int Index)
+{
+	return Tree.InputIndices.Num() > 0 ? Tree.InputIndices[Index] : Index;
+}
+
+// Builds the tree over Data with the user bits Masks[i] assigned to Data[i].
+template <typename TreeType>
+void BuildKdtreeWithMasks(TreeType* Tree, const TArray<typename TreeType::PointType>& Data, const TArray<uint64>& Masks,
+	const FKdtreeBuildSettings& Settings = FKdtreeBuildSettings())
+{
+	check(Masks.Num() == Data.Num());
+	BuildKdtree(Tree, Data, Settings);
+	Tree->PointMasks = Private::ToDataOrder(*Tree, Masks);
+	Private::RebuildSubtreeMasks(*Tree);
+}
+
+// Assigns the user bits in Mask to the point at Index. Returns false if there is no such point.
+template <typename TreeType>
+bool SetPointMask(TreeType* Tree, int Index, uint64 Mask)
+{
+	KDTREE_SCOPE_CYCLE_COUNTER(STAT_KdtreeEdit);
+
+	if (!Tree->Data.IsValidIndex(Index) || Tree->RemovedPoints[Index])
+	{
+		return false;
+	}
+
+	uint32 NodeIndex;
+	int32 Slot;
+	Private::FNodePath Path;
+	if (!Private::FindPointNode(*Tree, Index, NodeIndex, Slot, Path))
+	{
+		UE_LOG(LogTemp, Error, TEXT("Kdtree is invalid: tree.Data[%d] is not reachable from the root"), Index);
+		return false;
+	}
+
+	// Bits the point loses stay in the subtree masks until the next rebuild.
+	Private::EnablePointMasks(*Tree);
+	Tree->PointMasks[Index] = Mask;
+	Private::AddToSubtreeMasks(*Tree, Path, Index);
+	return true;
+}
+
+// The user bits of the point at Index, 0 if it has none.
+template <typename TreeType>
+uint64 GetPointMask(const TreeType& Tree, int Index)
+{
+	return Tree.PointMasks.IsValidIndex(Index) ? Tree.PointMasks[Index] : 0;
+}
+
+// The leaf size and split policy are kept, so points inserted after clearing are stored like the ones of the last build.
+template <typename TreeType>
+void ClearKdtree(TreeType* Tree)
+{
+	Tree->Nodes.Empty();
+	Tree->Data.Empty();
+	Private::ResetBounds(*Tree);
+	Tree->LeafIndices.Empty();
+	for (auto& Coords : Tree->LeafCoords)
+	{
+		Coords.Empty();
+	}
+	Tree->RemovedPoints.Empty();
+	Tree->FreeIndices.Empty();
+	Tree->NumTombstones = 0;
+	Tree->NumGarbageNodes = 0;
+	Tree->NumGarbageLeafSlots = 0;
+	Tree->MaxNumPoints = 0;
+	Tree->PointMasks.Empty();
+	Tree->SubtreeMasks.Empty();
+	Tree->InputIndices.Empty();
+	if constexpr (!std::is_void_v<typename TreeType::PayloadType>)
+	{
+		Tree->Payloads.Empty();
+	}
+}
+
+// Adds Point to the tree and returns its index into Data. Indices of removed points are reused.
+template <typename TreeType>
+int InsertPoint(TreeType* Tree, const typename TreeType::PointType& Point)
+{
+	KDTREE_SCOPE_CYCLE_COUNTER(STAT_KdtreeEdit);
+
+	return Private::InsertNewPoint(*Tree, Point, 0);
+}
+
+// Adds Point with the user bits in Mask, which filtered queries select points by.
+template <typename TreeType>
+int InsertPointWithMask(TreeType* Tree, const typename TreeType::PointType& Point, uint64 Mask)
+{
+	KDTREE_SCOPE_CYCLE_COUNTER(STAT_KdtreeEdit);
+
+	return Private::InsertNewPoint(*Tree, Point, Mask);
+}
+
+template <typename TreeType>
+int InsertPointWithPayload(TreeType* Tree, const typename TreeType::PointType& Point, const typename TreeType::PayloadType& Payload)
+{
+	const int Index = InsertPoint(Tree, Point);
+	Tree->Payloads[Index] = Payload;
+	return Index;
+}
+
+// Removes the point at Index. The indices of all other points stay valid. Returns false if there is no such point.
+template <typename TreeType>
+bool RemovePoint(TreeType* Tree, int Index)
+{
+	KDTREE_SCOPE_CYCLE_COUNTER(STAT_KdtreeEdit);
+
+	if (!Tree->Data.IsValidIndex(Index) || Tree->RemovedPoints[Index])
+	{
+		return false;
+	}
+
+	uint32 NodeIndex;
+	int32 Slot;
+	Private::FNodePath Path;
+	if (!Private::FindPointNode(*Tree, Index, NodeIndex, Slot, Path))
+	{
+		UE_LOG(LogTemp, Error, TEXT("Kdtree is invalid: tree.Data[%d] is not reachable from the root"), Index);
+		return false;
+	}
+
+	Tree->RemovedPoints[Index] = true;
+	if (Slot == INDEX_NONE)
+	{
+		// The point still splits space for its subtree, so it stays in place as a tombstone.
+		++Tree->NumTombstones;
+	}
+	else
+	{
+		Private::RemoveFromLeaf(*Tree, NodeIndex, Slot);
+		Tree->FreeIndices.Add(Index);
+	}
+
+	if (Private::ShouldRebuildKdtree(*Tree))
+	{
+		Private::RebuildKdtree(*Tree);
+	}
+	return true;
+}
+
+// Moves the points at Indices to Positions. Points that stay inside the region of their node are updated in place and
+// the others are reinserted, so only the subtrees they unbalance are rebuilt. Stats is optional.
+template <typename TreeType>
+void UpdatePositions(TreeType* Tree, const TArray<int>& Indices, const TArray<typename TreeType::PointType>& Positions,
+	FKdtreeUpdateStats* Stats = nullptr)
+{
+	KDTREE_SCOPE_CYCLE_COUNTER(STAT_KdtreeEdit);
+
+	using PointType = typename TreeType::PointType;
+
+	FKdtreeUpdateStats LocalStats;
+	if (Stats == nullptr)
+	{
+		Stats = &LocalStats;
+	}
+	*Stats = FKdtreeUpdateStats();
+
+	// Points are looked up in Z-order of their old positions, so consecutive lookups share most of their path through
+	// the tree and find it in cache. The sort is stable to keep repeated updates of one point in order.
+	struct FUpdate
+	{
+		uint64 MortonCode;
+		int Offset;
+	};
+	TArray<FUpdate> Updates;
+	Updates.Reserve(FMath::Min(Indices.Num(), Positions.Num()));
+	for (int Offset = 0; Offset < FMath::Min(Indices.Num(), Positions.Num()); ++Offset)
+	{
+		if (Tree->Data.IsValidIndex(Indices[Offset]) && !Tree->RemovedPoints[Indices[Offset]])
+		{
+			Updates.Add(FUpdate{Private::GetMortonCode(*Tree, Tree->Data[Indices[Offset]]), Offset});
+		}
+	}
+	Updates.StableSort([](const FUpdate& Lhs, const FUpdate& Rhs) { return Lhs.MortonCode < Rhs.MortonCode; });
+
+	Private::FNodePath Path;
+	for (const FUpdate& Update : Updates)
+	{
+		const int Index = Indices[Update.Offset];
+		const PointType& Position = Positions[Update.Offset];
+
+		uint32 NodeIndex;
+		int32 Slot;
+		Path.Reset();
+		if (!Private::FindPointNode(*Tree, Index, NodeIndex, Slot, Path))
+		{
+			UE_LOG(LogTemp, Error, TEXT("Kdtree is invalid: tree.Data[%d] is not reachable from the root"), Index);
+			continue;
+		}
+
+		Private::ExpandBounds(*Tree, Position);
+		if (Slot != INDEX_NONE)
+		{
+			if (Private::IsWithinPath(*Tree, Path, Position))
+			{
+				Tree->Data[Index] = Position;
+				Private::SetLeafSlot(*Tree, Slot, Index);
+				++Stats->NumMovedInPlace;
+				continue;
+			}
+			Private::RemoveFromLeaf(*Tree, NodeIndex, Slot);
+		}
+		else
+		{
+			const int Axis = Tree->Nodes[NodeIndex].GetAxis();
+			if (Position[Axis] == Tree->Data[Index][Axis] && Private::IsWithinPath(*Tree, Path, Position))
+			{
+				// The split value is unchanged, e.g. for a point moving on a plane split along its normal.
+				Tree->Data[Index] = Position;
+				++Stats->NumMovedInPlace;
+				continue;
+			}
+
+			// The node keeps splitting space at the old position through a removed copy of the point.
+			const PointType OldPosition = Tree->Data[Index];
+			const int Ghost = Private::AllocateIndex(*Tree, OldPosition);
+			Tree->RemovedPoints[Ghost] = true;
+			Tree->Nodes[NodeIndex].Index = Ghost;
+			++Tree->NumTombstones;
+		}
+
+		Tree->Data[Index] = Position;
+		Stats->NumSubtreesRebuilt += Private::InsertIndex(*Tree, Index);
+		++Stats->NumReinserted;
+	}
+
+	if (Private::ShouldRebuildKdtree(*Tree))
+	{
+		Private::RebuildKdtree(*Tree);
+		Stats->bRebuiltAll = true;
+	}
+}
+
+// Appends the indices of the points closer to Center than Radius. Result can use any allocator, so a reused array or
+// one with an inline allocator makes the query free of heap allocations.
+template <typename TreeType, typename AllocatorType>
+void CollectFromKdtree(
+	const TreeType& Tree, const typename TreeType::PointType& Center, float Radius, TArray<int, AllocatorType>* Result)
+{
+	KDTREE_SCOPE_CYCLE_COUNTER(STAT_KdtreeCollect);
+
+	Private::FScopedQueryCounters Counters;
+	Private::TCollectSink<AllocatorType> Sink{*Result};
+	const int NumBefore = Result->Num();
+	Private::VisitWithinRadius(Tree, Center, Radius, Sink, Counters);
+	Counters.AddResults(Result->Num() - NumBefore);
+}
+
+// Appends the indices of the points closer to Center than Radius that pass Filter: an FKdtreeMaskFilter tested against
+// the masks of the points, or a predicate called with the index of every point in range. Subtrees whose points have
+// none of the bits a mask filter includes are skipped without being visited.
+template <typename TreeType, typename FilterType, typename AllocatorType>
+void CollectFromKdtreeFiltered(const TreeType& Tree, const typename TreeType::PointType& Center, float Radius,
+	const FilterType& Filter, TArray<int, AllocatorType>* Result)
+{
+	KDTREE_SCOPE_CYCLE_COUNTER(STAT_KdtreeCollect);
+
+	Private::FScopedQueryCounters Counters;
+	Private::TCollectSink<AllocatorType> Sink{*Result};
+	const int NumBefore = Result->Num();
+	Private::VisitWithinRadius(Tree, Center, Radius, Sink, Counters, Private::MakePointFilter(Tree, Filter));
+	Counters.AddResults(Result->Num() - NumBefore);
+}
+
+// CollectFromKdtree within the limits of Approximation. Only points closer than Radius are appended, and all points
+// closer than Radius / (1 + Epsilon) are among them as long as the query stays within MaxVisitedNodes; otherwise only
+// the points found in the nodes nearest to Center are. Returns false in that case.
+template <typename TreeType, typename AllocatorType>
+bool CollectFromKdtreeApproximate(const TreeType& Tree, const typename TreeType::PointType& Center, float Radius,
+	const FKdtreeApproximation& Approximation, TArray<int, AllocatorType>* Result)
+{
+	KDTREE_SCOPE_CYCLE_COUNTER(STAT_KdtreeCollect);
+
+	if (Tree.Nodes.Num() == 0 || Radius <= 0.0f)
+	{
+		return true;
+	}
+
+	Private::FScopedQueryCounters Counters;
+	Private::TCollectSink<AllocatorType> Sink{*Result};
+	const int NumBefore = Result->Num();
+	const bool bCompleted = Private::TraverseWithinRadiusApproximate(
+		Tree, Center, FMath::Square(static_cast<typename TreeType::ScalarType>(Radius)), Approximation, Sink, Counters);
+	Counters.AddResults(Result->Num() - NumBefore);
+	return bCompleted;
+}
+
+// Writes the indices of the points closer to Center than Radius to Buffer and returns how many were written. The
+// query stops once Buffer is full, so a result of Buffer.Num() can mean that points were left out.
+template <typename TreeType>
+int32 CollectFromKdtreeToBuffer(const TreeType& Tree, const typename TreeType::PointType& Center, float Radius, TArrayView<int> Buffer)
+{
+	KDTREE_SCOPE_CYCLE_COUNTER(STAT_KdtreeCollect);
+
+	if (Buffer.Num() == 0)
+	{
+		return 0;
+	}
+
+	Private::FScopedQueryCounters Counters;
+	Private::FBufferSink Sink{Buffer};
+	Private::VisitWithinRadius(Tree, Center, Radius, Sink, Counters);
+	Counters.AddResults(Sink.Num);
+	return Sink.Num;
+}
+
+// Calls Visitor(Index) for every point closer to Center than Radius, in no particular order. Visitor may return a
+// bool, in which case returning false ends the query. Returns false if the visitor ended it.
+template <typename TreeType, typename VisitorType>
+bool ForEachInRadius(const TreeType& Tree, const typename TreeType::PointType& Center, float Radius, const VisitorType& Visitor)
+{
+	KDTREE_SCOPE_CYCLE_COUNTER(STAT_KdtreeCollect);
+
+	Private::FScopedQueryCounters Counters;
+	Private::TVisitorSink<VisitorType> Sink{Visitor};
+	return Private::VisitWithinRadius(Tree, Center, Radius, Sink, Counters);
+}
+
+// Number of points closer to Center than Radius. Subtrees inside the sphere are counted per leaf bucket without
+// looking at their points.
+template <typename TreeType>
+int32 CountInRadius(const TreeType& Tree, const typename TreeType::PointType& Center, float Radius)
+{
+	KDTREE_SCOPE_CYCLE_COUNTER(STAT_KdtreeCollect);
+
+	Private::FScopedQueryCounters Counters;
+	Private::FCountSink Sink;
+	Private::VisitWithinRadius(Tree, Center, Radius, Sink, Counters);
+	Counters.AddResults(Sink.Num);
+	return Sink.Num;
+}
+
+// Whether any point is closer to Center than Radius. Stops at the first one found.
+template <typename TreeType>
+bool AnyInRadius(const TreeType& Tree, const typename TreeType::PointType& Center, float Radius)
+{
+	KDTREE_SCOPE_CYCLE_COUNTER(STAT_KdtreeCollect);
+
+	Private::FScopedQueryCounters Counters;
+	Private::FAnySink Sink;
+	const bool bFound = !Private::VisitWithinRadius(Tree, Center, Radius, Sink, Counters);
+	Counters.AddResults(bFound ? 1 : 0);
+	return bFound;
+}
+
+// Appends the indices of the points inside Shape, one of the shapes in KdtreeShapes.h or any type with the same
+// Contains and Classify functions.
+template <typename TreeType, typename ShapeType, typename AllocatorType>
+void CollectInShape(const TreeType& Tree, const ShapeType& Shape, TArray<int, AllocatorType>* Result)
+{
+	KDTREE_SCOPE_CYCLE_COUNTER(STAT_KdtreeCollectInShape);
+
+	Private::FScopedQueryCounters Counters;
+	Private::TCollectSink<AllocatorType> Sink{*Result};
+	const int NumBefore = Result->Num();
+	Private::TraverseShape(Tree, Shape, Sink, Counters);
+	Counters.AddResults(Result->Num() - NumBefore);
+}
+
+// Calls Visitor(Index) for every point inside Shape, in no particular order. Visitor may return a bool, in which case
+// returning false ends the query. Returns false if the visitor ended it.
+template <typename TreeType, typename ShapeType, typename VisitorType>
+bool ForEachInShape(const TreeType& Tree, const ShapeType& Shape, const VisitorType& Visitor)
+{
+	KDTREE_SCOPE_CYCLE_COUNTER(STAT_KdtreeCollectInShape);
+
+	Private::FScopedQueryCounters Counters;
+	Private::TVisitorSink<VisitorType> Sink{Visitor};
+	return Private::TraverseShape(Tree, Shape, Sink, Counters);
+}
+
+template <typename TreeType, typename ShapeType>
+int32 CountInShape(const TreeType& Tree, const ShapeType& Shape)
+{
+	KDTREE_SCOPE_CYCLE_COUNTER(STAT_KdtreeCollectInShape);
+
+	Private::FScopedQueryCounters Counters;
+	Private::FCountSink Sink;
+	Private::TraverseShape(Tree, Shape, Sink, Counters);
+	Counters.AddResults(Sink.Num);
+	return Sink.Num;
+}
+
+template <typename TreeType, typename ShapeType>
+bool AnyInShape(const TreeType& Tree, const ShapeType& Shape)
+{
+	KDTREE_SCOPE_CYCLE_COUNTER(STAT_KdtreeCollectInShape);
+
+	Private::FScopedQueryCounters Counters;
+	Private::FAnySink Sink;
+	const bool bFound = !Private::TraverseShape(Tree, Shape, Sink, Counters);
+	Counters.AddResults(bFound ? 1 : 0);
+	return bFound;
+}
+
+// Returns the first point closer than Radius to the segment from Start to End, or INDEX_NONE if there is none. Points
+// are ordered by where along the segment they come closest to it. OutDistance receives the distance from Start to
+// that position.
+template <typename TreeType>
+int FindFirstAlongSegment(const TreeType& Tree, const typename TreeType::PointType& Start, const typename TreeType::PointType& End,
+	float Radius, typename TreeType::ScalarType* OutDistance = nullptr)
+{
+	KDTREE_SCOPE_CYCLE_COUNTER(STAT_KdtreeFindAlongPath);
+
+	const typename TreeType::PointType Path[] = {Start, End};
+	return Private::FindFirstAlongPath(Tree, MakeArrayView(Path), Radius, OutDistance);
+}
+
+// Same as FindFirstAlongSegment for the ray from Origin along Direction, which need not be normalized. The ray ends
+// after MaxDistance, or past the tree if MaxDistance is 0 or less.
+template <typename TreeType>
+int FindFirstAlongRay(const TreeType& Tree, const typename TreeType::PointType& Origin, const typename TreeType::PointType& Direction,
+	float MaxDistance, float Radius, typename TreeType::ScalarType* OutDistance = nullptr)
+{
+	KDTREE_SCOPE_CYCLE_COUNTER(STAT_KdtreeFindAlongPath);
+
+	using ScalarType = typename TreeType::ScalarType;
+
+	const typename TreeType::PointType UnitDirection = Direction.GetSafeNormal();
+	if (Tree.Nodes.Num() == 0 || UnitDirection.IsZero())
+	{
+		return INDEX_NONE;
+	}
+
+	ScalarType Length = static_cast<ScalarType>(MaxDistance);
+	if (MaxDistance <= 0.0f)
+	{
+		// No point beyond the farthest corner of the bounds can be hit.
+		ScalarType MaxDistSquared = 0;
+		ForEachAxis<TreeType::Dim>([&](int32 Axis) {
+			MaxDistSquared += Private::GetAxisMaxDistSquared(Origin[Axis], Tree.BoundsMin[Axis], Tree.BoundsMax[Axis]);
+		});
+		Length = FMath::Sqrt(MaxDistSquared) + static_cast<ScalarType>(Radius);
+	}
+	const typename TreeType::PointType Path[] = {Origin, Origin + UnitDirection * Length};
+	return Private::FindFirstAlongPath(Tree, MakeArrayView(Path), Radius, OutDistance);
+}
+
+// Same as FindFirstAlongSegment for the polyline through the points of Path, e.g. the samples of a predicted
+// projectile path. OutDistance receives the distance along the polyline from its first point.
+template <typename TreeType>
+int FindFirstAlongPath(const TreeType& Tree, TArrayView<const typename TreeType::PointType> Path, float Radius,
+	typename TreeType::ScalarType* OutDistance = nullptr)
+{
+	KDTREE_SCOPE_CYCLE_COUNTER(STAT_KdtreeFindAlongPath);
+
+	return Private::FindFirstAlongPath(Tree, Path, Radius, OutDistance);
+}
+
+// Runs one radius query per center across worker threads. Radii holds either one radius per center or a single
+// radius shared by all of them. The hits of query i end up in ResultIndices[ResultOffsets[i], ResultOffsets[i + 1]).
+template <typename TreeType>
+void CollectFromKdtreeBatch(const TreeType& Tree, const TArray<typename TreeType::PointType>& Centers, const TArray<float>& Radii,
+	TArray<int>* ResultIndices, TArray<int>* ResultOffsets)
+{
+	KDTREE_SCOPE_CYCLE_COUNTER(STAT_KdtreeCollectBatch);
+
+	check(Radii.Num() == 1 || Radii.Num() == Centers.Num());
+
+	Private::RunCollectBatch(
+		Centers.Num(),
+		[&](int Query, TArray<int>& Indices) {
+			CollectFromKdtree(Tree, Centers[Query], Radii.Num() == 1 ? Radii[0] : Radii[Query], &Indices);
+		},
+		ResultIndices, ResultOffsets);
+}
+
+// Finds the points closer than Radius to each point, other than the point itself, in parallel. Every pair shows up in
+// the rows of both of its points; keeping the neighbors j > i of each point i lists every pair once. Neighbors are in
+// no particular order.
+template <typename TreeType>
+void BuildRadiusNeighborGraph(const TreeType& Tree, float Radius, FKdtreeNeighborGraph* Graph)
+{
+	KDTREE_SCOPE_CYCLE_COUNTER(STAT_KdtreeNeighborGraph);
+
+	using ScalarType = typename TreeType::ScalarType;
+
+	const ScalarType RadiusScalar = static_cast<ScalarType>(FMath::Max(Radius, 0.0f));
+	Private::RunSelfJoin(Tree, *Graph, [&Tree, RadiusScalar](const Private::FJoinWork& Work, int32 FirstItem, int32 LastItem,
+											  Private::FJoinChunk& Chunk) {
+		Private::FScopedQueryCounters Counters;
+		TArray<int> Candidates;
+		TArray<ScalarType> CandidateCoords[TreeType::Dim];
+		for (int32 Item = FirstItem; Item < LastItem; ++Item)
+		{
+			if (Item < Work.Leaves.Num())
+			{
+				Private::JoinLeafWithinRadius(Tree, Tree.Nodes[Work.Leaves[Item]], RadiusScalar, Chunk, Candidates, CandidateCoords, Counters);
+				continue;
+			}
+
+			const int Index = Work.NodePoints[Item - Work.Leaves.Num()];
+			const int32 NumBefore = Chunk.Neighbors.Num();
+			Private::TCollectSink<FDefaultAllocator> Sink{Chunk.Neighbors};
+			if (RadiusScalar > 0)
+			{
+				Private::TraverseWithinRadius(Tree, Tree.Data[Index], FMath::Square(RadiusScalar), Sink, Counters);
+			}
+			for (int32 Offset = NumBefore; Offset < Chunk.Neighbors.Num(); ++Offset)
+			{
+				if (Chunk.Neighbors[Offset] == Index)
+				{
+					Chunk.Neighbors.RemoveAtSwap(Offset, 1, EAllowShrinking::No);
+					break;
+				}
+			}
+			Chunk.Rows.Add(Private::FJoinRow{Index, Chunk.Neighbors.Num() - NumBefore});
+		}
+		Counters.AddResults(Chunk.Neighbors.Num());
+	});
+}
+
+// Finds the K nearest other points of each point in parallel, nearest first. Only points closer than MaxDistance are
+// considered; a MaxDistance of 0 or less means no limit.
+template <typename TreeType>
+void BuildKNearestNeighborGraph(const TreeType& Tree, int K, float MaxDistance, FKdtreeNeighborGraph* Graph)
+{
+	KDTREE_SCOPE_CYCLE_COUNTER(STAT_KdtreeNeighborGraph);
+
+	using ScalarType = typename TreeType::ScalarType;
+
+	// No point has more neighbors than the other live points, which also keeps K + 1 below from overflowing.
+	K = FMath::Min(K, Private::GetNumLivePoints(Tree) - 1);
+	const ScalarType MaxDistSquared = Private::GetMaxDistSquared<ScalarType>(MaxDistance);
+	Private::RunSelfJoin(Tree, *Graph, [&Tree, K, MaxDistSquared](const Private::FJoinWork& Work, int32 FirstItem, int32 LastItem,
+											  Private::FJoinChunk& Chunk) {
+		if (K <= 0)
+		{
+			return;
+		}
+
+		// Points of the same leaf bucket are searched one after the other, which keeps their paths through the tree
+		// in cache.
+		Private::FScopedQueryCounters Counters;
+		Private::TKNearestCollector<ScalarType> Collector(K + 1, MaxDistSquared);
+		for (int32 Item = FirstItem; Item < LastItem; ++Item)
+		{
+			if (Item < Work.Leaves.Num())
+			{
+				const FKdtreeNode& Leaf = Tree.Nodes[Work.Leaves[Item]];
+				for (int32 Slot = Leaf.GetLeafFirstSlot(); Slot < Leaf.GetLeafFirstSlot() + Leaf.GetLeafNumPoints(); ++Slot)
+				{
+					Private::JoinPointKNearest(Tree, Tree.LeafIndices[Slot], K, MaxDistSquared, Collector, Chunk, Counters);
+				}
+			}
+			else
+			{
+				Private::JoinPointKNearest(
+					Tree, Work.NodePoints[Item - Work.Leaves.Num()], K, MaxDistSquared, Collector, Chunk, Counters);
+			}
+		}
+		Counters.AddResults(Chunk.Neighbors.Num());
+	});
+}
+
+// Appends the indices of the K points closest to Center, nearest first. Only points closer than MaxDistance are
+// considered; a MaxDistance of 0 or less means no limit.
+template <typename TreeType>
+void FindKNearest(const TreeType& Tree, const typename TreeType::PointType& Center, int K, float MaxDistance, TArray<int>* Result)
+{
+	KDTREE_SCOPE_CYCLE_COUNTER(STAT_KdtreeFindKNearest);
+
+	using ScalarType = typename TreeType::ScalarType;
+
+	// K comes straight from Blueprint, so it is bounded by what the tree can return.
+	K = FMath::Min(K, Private::GetNumLivePoints(Tree));
+	if (Tree.Nodes.Num() == 0 || K <= 0)
+	{
+		return;
+	}
+
+	Private::FScopedQueryCounters Counters;
+	Private::TKNearestCollector<ScalarType> Collector(K, Private::GetMaxDistSquared<ScalarType>(MaxDistance));
+	Private::SearchNearest(Tree, 0, Center, Collector, Counters);
+	Counters.AddResults(Collector.Heap.Num());
+	Collector.AppendNearestFirst(Result);
+}
+
+// FindKNearest among the points passing Filter, which is either an FKdtreeMaskFilter or a predicate as in
+// CollectFromKdtreeFiltered.
+template <typename TreeType, typename FilterType>
+void FindKNearestFiltered(const TreeType& Tree, const typename TreeType::PointType& Center, int K, float MaxDistance,
+	const FilterType& Filter, TArray<int>* Result)
+{
+	KDTREE_SCOPE_CYCLE_COUNTER(STAT_KdtreeFindKNearest);
+
+	using ScalarType = typename TreeType::ScalarType;
+
+	const auto PointFilter = Private::MakePointFilter(Tree, Filter);
+	K = FMath::Min(K, Private::GetNumLivePoints(Tree));
+	if (Tree.Nodes.Num() == 0 || K <= 0 || PointFilter.MatchesNothing())
+	{
+		return;
+	}
+
+	Private::FScopedQueryCounters Counters;
+	Private::TKNearestCollector<ScalarType> Collector(K, Private::GetMaxDistSquared<ScalarType>(MaxDistance));
+	Private::SearchNearest(Tree, 0, Center, Collector, Counters, PointFilter);
+	Counters.AddResults(Collector.Heap.Num());
+	Collector.AppendNearestFirst(Result);
+}
+
+// FindKNearest within the limits of Approximation, for lookups that must fit a fixed time. The i-th result is at most
+// 1 + Epsilon times farther from Center than the exact i-th nearest point, as long as the query stays within
+// MaxVisitedNodes; otherwise it returns the nearest points found before the budget ran out. Returns false in that case.
+template <typename TreeType>
+bool FindKNearestApproximate(const TreeType& Tree, const typename TreeType::PointType& Center, int K, float MaxDistance,
+	const FKdtreeApproximation& Approximation, TArray<int>* Result)
+{
+	KDTREE_SCOPE_CYCLE_COUNTER(STAT_KdtreeFindKNearest);
+
+	using ScalarType = typename TreeType::ScalarType;
+
+	K = FMath::Min(K, Private::GetNumLivePoints(Tree));
+	if (Tree.Nodes.Num() == 0 || K <= 0)
+	{
+		return true;
+	}
+
+	Private::FScopedQueryCounters Counters;
+	Private::TKNearestCollector<ScalarType> Collector(K, Private::GetMaxDistSquared<ScalarType>(MaxDistance));
+	const bool bCompleted = Private::SearchNearestApproximate(Tree, Center, Collector, Approximation, Counters);
+	Counters.AddResults(Collector.Heap.Num());
+	Collector.AppendNearestFirst(Result);
+	return bCompleted;
+}
+
+// Returns the index of the point closest to Center and closer than MaxDistance (no limit if 0 or less), or
+// INDEX_NONE if there is none.
+template <typename TreeType>
+int FindNearest(const TreeType& Tree, const typename TreeType::PointType& Center, float MaxDistance)
+{
+	KDTREE_SCOPE_CYCLE_COUNTER(STAT_KdtreeFindNearest);
+
+	using ScalarType = typename TreeType::ScalarType;
+
+	if (Tree.Nodes.Num() == 0)
+	{
+		return INDEX_NONE;
+	}
+
+	Private::FScopedQueryCounters Counters;
+	Private::TNearestCollector<ScalarType> Collector(Private::GetMaxDistSquared<ScalarType>(MaxDistance));
+	Private::SearchNearest(Tree, 0, Center, Collector, Counters);
+	Counters.AddResults(Collector.Index != INDEX_NONE ? 1 : 0);
+	return Collector.Index;
+}
+
+// FindNearest within the limits of Approximation, as FindKNearestApproximate with K = 1. bOutCompleted, if given, is set
+// to false if the node budget ran out.
+template <typename TreeType>
+int FindNearestApproximate(const TreeType& Tree, const typename TreeType::PointType& Center, float MaxDistance,
+	const FKdtreeApproximation& Approximation, bool* bOutCompleted = nullptr)
+{
+	KDTREE_SCOPE_CYCLE_COUNTER(STAT_KdtreeFindNearest);
+
+	using ScalarType = typename TreeType::ScalarType;
+
+	bool bCompleted = true;
+	Private::TNearestCollector<ScalarType> Collector(Private::GetMaxDistSquared<ScalarType>(MaxDistance));
+	if (Tree.Nodes.Num() > 0)
+	{
+		Private::FScopedQueryCounters Counters;
+		bCompleted = Private::SearchNearestApproximate(Tree, Center, Collector, Approximation, Counters);
+		Counters.AddResults(Collector.Index != INDEX_NONE ? 1 : 0);
+	}
+	if (bOutCompleted != nullptr)
+	{
+		*bOutCompleted = bCompleted;
+	}
+	return Collector.Index;
+}
+
+// FindNearest among the points passing Filter, which is either an FKdtreeMaskFilter or a predicate as in
+// CollectFromKdtreeFiltered.
+template <typename TreeType, typename FilterType>
+int FindNearestFiltered(const TreeType& Tree, const typename TreeType::PointType& Center, float MaxDistance, const FilterType& Filter)
+{
+	KDTREE_SCOPE_CYCLE_COUNTER(STAT_KdtreeFindNearest);
+
+	using ScalarType = typename TreeType::ScalarType;
+
+	const auto PointFilter = Private::MakePointFilter(Tree, Filter);
+	if (Tree.Nodes.Num() == 0 || PointFilter.MatchesNothing())
+	{
+		return INDEX_NONE;
+	}
+
+	Private::FScopedQueryCounters Counters;
+	Private::TNearestCollector<ScalarType> Collector(Private::GetMaxDistSquared<ScalarType>(MaxDistance));
+	Private::SearchNearest(Tree, 0, Center, Collector, Counters, PointFilter);
+	Counters.AddResults(Collector.Index != INDEX_NONE ? 1 : 0);
+	return Collector.Index;
+}
+
+// Layouts written by SerializeKdtree. Archives holding trees store the version they were written with and pass it
+// back when loading.
+enum class EKdtreeSerializeVersion : int32
+{
+	Initial = 1,
+	SplitPolicy,
+	PointMasks,
+	InputIndices,
+
+	Latest = InputIndices,
+};
+
+// Saves or loads the tree as a sequence of flat arrays. Nodes refer to each other and to the points by position, so a
+// loaded tree is ready for queries without rebuilding or fixing up anything.
+template <typename TreeType>
+void SerializeKdtree(FArchive& Ar, TreeType& Tree, EKdtreeSerializeVersion Version = EKdtreeSerializeVersion::Latest)
+{
+	KDTREE_SCOPE_CYCLE_COUNTER(STAT_KdtreeSerialize);
+
+	Tree.Data.BulkSerialize(Ar);
+	Tree.Nodes.BulkSerialize(Ar);
+	Ar << Tree.BoundsMin << Tree.BoundsMax;
+	Ar << Tree.LeafSize;
+	if (Version >= EKdtreeSerializeVersion::SplitPolicy)
+	{
+		Ar << Tree.SplitPolicy << Tree.SplitQueryRadius;
+	}
+	Tree.LeafIndices.BulkSerialize(Ar);
+	for (auto& Coords : Tree.LeafCoords)
+	{
+		Coords.BulkSerialize(Ar);
+	}
+	Ar << Tree.RemovedPoints;
+	Tree.FreeIndices.BulkSerialize(Ar);
+	Ar << Tree.NumTombstones << Tree.NumGarbageNodes << Tree.NumGarbageLeafSlots << Tree.MaxNumPoints;
+	if (Version >= EKdtreeSerializeVersion::PointMasks)
+	{
+		Tree.PointMasks.BulkSerialize(Ar);
+		Tree.SubtreeMasks.BulkSerialize(Ar);
+	}
+	if (Version >= EKdtreeSerializeVersion::InputIndices)
+	{
+		Tree.InputIndices.BulkSerialize(Ar);
+	}
+	if constexpr (!std::is_void_v<typename TreeType::PayloadType>)
+	{
+		Ar << Tree.Payloads;
+	}
+}
+
+template <typename TreeType>
+void ValidateKdtree(const TreeType& Tree)
+{
+	if (Tree.Nodes.Num() > 0)
+	{
+		Private::ValidateKdtree(Tree, 0, 0);
+		if (Private::HasPointMasks(Tree))
+		{
+			Private::ValidateSubtreeMasks(Tree, 0);
+		}
+	}
+	if (Tree.InputIndices.Num() > 0 && Tree.InputIndices.Num() != Tree.Data.Num())
+	{
+		UE_LOG(LogTemp, Error, TEXT("Kdtree is invalid: %d input indices for %d points"), Tree.InputIndices.Num(), Tree.Data.Num());
+	}
+}
+
+template <typename TreeType>
+FKdtreeSummary GetKdtreeSummary(const TreeType& Tree)
+{
+	FKdtreeSummary Summary;
+	Summary.NumPoints = Private::GetNumLivePoints(Tree);
+	Summary.NumTombstones = Tree.NumTombstones;
+	Summary.AllocatedBytes = static_cast<int64>(sizeof(TreeType) + Tree.GetAllocatedSize());
+	Summary.SplitPolicy = Tree.SplitPolicy;
+	if (Tree.Nodes.Num() == 0)
+	{
+		return Summary;
+	}
+
+	TArray<TPair<uint32, int32>, TInlineAllocator<64>> Stack;
+	Stack.Emplace(0, 0);
+	while (Stack.Num() > 0)
+	{
+		const TPair<uint32, int32> Entry = Stack.Pop();
+		const FKdtreeNode& Node = Tree.Nodes[Entry.Key];
+		const int32 Depth = Entry.Value;
+		if (Summary.NodesPerDepth.Num() <= Depth)
+		{
+			Summary.NodesPerDepth.SetNumZeroed(Depth + 1);
+		}
+		++Summary.NodesPerDepth[Depth];
+		++Summary.NumNodes;
+		if (Node.IsLeaf())
+		{
+			++Summary.NumLeafBuckets;
+			continue;
+		}
+
+		if (Node.ChildLeft != FKdtreeNode::NoChild)
+		{
+			Stack.Emplace(Node.ChildLeft, Depth + 1);
+		}
+		if (Node.GetChildRight() != FKdtreeNode::NoChild)
+		{
+			Stack.Emplace(Node.GetChildRight(), Depth + 1);
+		}
+	}
+
+	// A perfectly balanced tree of N nodes has floor(log2(N)) + 1 levels.
+	const int32 BalancedDepth = static_cast<int32>(FMath::FloorLog2(static_cast<uint32>(Summary.NumNodes))) + 1;
+	Summary.BalanceFactor = static_cast<float>(Summary.NodesPerDepth.Num()) / BalancedDepth;
+	return Summary;
+}
+
+// Logs every node, which takes long for large trees. GetKdtreeSummary gives an overview in one line.
+template <typename TreeType>
+void DumpKdTree(const TreeType& Tree)
+{
+	UE_LOG(LogTemp, Display, TEXT("========== DUMP FKdtree =========="));
+	if (Tree.Nodes.Num() > 0)
+	{
+		Private::DumpKdTree(Tree, 0);
+	}
+	UE_LOG(LogTemp, Display, TEXT("=================================="));
+}
+}	 // namespace KdtreeInternal
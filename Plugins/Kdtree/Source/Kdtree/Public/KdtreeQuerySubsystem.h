@@ -0,0 +1,129 @@
+/*!
+ * Kdtree
+ *
+ * Copyright (c) 2019-2023 nutti
+ *
+ * This software is released under the MIT License.
+ * https://opensource.org/licenses/MIT
+ */
+
+#pragma once
+
+#include "KdtreeCommon.h"
+#include "KdtreeShapes.h"
+#include "Misc/TVariant.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Tasks/Task.h"
+
+#include "KdtreeQuerySubsystem.generated.h"
+
+// Identifies a submitted query for CancelQuery. Native only: the latent Blueprint nodes cancel their query when the
+// latent action is destroyed.
+struct FKdtreeQueryHandle
+{
+	int64 Id = 0;
+
+	bool IsValid() const
+	{
+		return Id != 0;
+	}
+};
+
+// Points found by an async query. Nearest and path queries find at most one point.
+struct FKdtreeQueryResult
+{
+	TArray<int> Indices;
+	TArray<FVector> Data;
+	// Distance along the path to the point found by a path query.
+	float Distance = 0.0f;
+};
+
+DECLARE_DELEGATE_OneParam(FOnKdtreeQueryDone, const FKdtreeQueryResult&);
+
+// Shape of an async shape query.
+using FKdtreeQueryShape = TVariant<FKdtreeBoxShape, FKdtreeOrientedBoxShape, FKdtreeCapsuleShape, FKdtreeConvexShape>;
+
+// Runs the async kd-tree and spatial hash queries of a world. Queries submitted during a frame are run together as one
+// parallel batch on worker threads, and their results are handed to the callbacks on the game thread, spread over as
+// many frames as the delivery budget requires. Result buffers are pooled, so a steady stream of queries does not
+// allocate.
+UCLASS(Config = Game)
+class KDTREE_API UKdtreeQuerySubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	// Game thread time per frame spent handing results to callbacks. At least one result is delivered every frame.
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = "SpacialDataStructure|kd-tree", meta = (ClampMin = "0"))
+	float DeliveryBudgetMs = 1.0f;
+
+	// The queries run on the tree Tree holds now, even if it is rebuilt before the query runs.
+	FKdtreeQueryHandle CollectFromKdtree(const FKdtree& Tree, const FVector& Center, float Radius, FOnKdtreeQueryDone OnDone);
+	FKdtreeQueryHandle FindKNearestFromKdtree(
+		const FKdtree& Tree, const FVector& Center, int K, float MaxDistance, FOnKdtreeQueryDone OnDone);
+	FKdtreeQueryHandle FindNearestFromKdtree(const FKdtree& Tree, const FVector& Center, float MaxDistance, FOnKdtreeQueryDone OnDone);
+	FKdtreeQueryHandle CollectInShapeFromKdtree(const FKdtree& Tree, FKdtreeQueryShape Shape, FOnKdtreeQueryDone OnDone);
+	// Finds the first point closer than Radius to the polyline through Path. A segment is a path of two points.
+	FKdtreeQueryHandle FindFirstAlongPathFromKdtree(const FKdtree& Tree, TArray<FVector> Path, float Radius, FOnKdtreeQueryDone OnDone);
+
+	// The same queries on the grid Hash holds now.
+	FKdtreeQueryHandle CollectFromSpatialHash(const FSpatialHash& Hash, const FVector& Center, float Radius, FOnKdtreeQueryDone OnDone);
+	FKdtreeQueryHandle FindKNearestFromSpatialHash(
+		const FSpatialHash& Hash, const FVector& Center, int K, float MaxDistance, FOnKdtreeQueryDone OnDone);
+	FKdtreeQueryHandle FindNearestFromSpatialHash(
+		const FSpatialHash& Hash, const FVector& Center, float MaxDistance, FOnKdtreeQueryDone OnDone);
+
+	// Drops the query so its callback is never called. Returns false if it was already delivered or cancelled.
+	bool CancelQuery(FKdtreeQueryHandle Handle);
+
+	virtual void Deinitialize() override;
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+private:
+	enum class EQueryType : uint8
+	{
+		Collect,
+		KNearest,
+		Nearest,
+		Shape,
+		Path,
+	};
+
+	struct FQuery
+	{
+		int64 Id;
+		EQueryType Type;
+		bool bCancelled;
+		// Exactly one of Tree and SpatialHash is set until the query ran.
+		TSharedPtr<const FKdtreeInternal, ESPMode::ThreadSafe> Tree;
+		TSharedPtr<const FSpatialHashInternal, ESPMode::ThreadSafe> SpatialHash;
+		FVector Center;
+		float Radius;
+		int K;
+		FKdtreeQueryShape Shape;
+		TArray<FVector> Path;
+		FOnKdtreeQueryDone OnDone;
+		FKdtreeQueryResult* Result;
+	};
+
+	// Adds a pending query with a pooled result buffer. The caller fills in the parameters of its type.
+	FQuery& Submit(const FKdtree& Tree, EQueryType Type, FOnKdtreeQueryDone&& OnDone);
+	FQuery& Submit(const FSpatialHash& Hash, EQueryType Type, FOnKdtreeQueryDone&& OnDone);
+	FQuery& AddPendingQuery(EQueryType Type, FOnKdtreeQueryDone&& OnDone);
+	static void RunQuery(FQuery& Query);
+	static void RunSpatialHashQuery(FQuery& Query);
+	void FinishBatch();
+	void DeliverResults();
+
+	int64 NextId = 1;
+	// Submitted since the last batch was launched.
+	TArray<FQuery> PendingQueries;
+	// Read by the running batch. Left alone by the game thread until the batch finished.
+	TArray<FQuery> BatchQueries;
+	UE::Tasks::FTask BatchTask;
+	// Run and waiting to be delivered, oldest first.
+	TArray<FQuery> CompletedQueries;
+	TArray<TUniquePtr<FKdtreeQueryResult>> ResultPool;
+	TArray<FKdtreeQueryResult*> FreeResults;
+};
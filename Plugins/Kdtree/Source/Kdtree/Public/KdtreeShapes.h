@@ -0,0 +1,259 @@
+/*!
+ * Kdtree
+ *
+ * Copyright (c) 2019-2023 nutti
+ *
+ * This software is released under the MIT License.
+ * https://opensource.org/licenses/MIT
+ */
+
+#pragma once
+
+#include "KdtreeCommon.h"
+#include "Math/Plane.h"
+#include "Math/Quat.h"
+
+// Query shapes for CollectInShape and the other shape queries in KdtreeOperations.h. A shape tells whether it contains
+// a point and how it overlaps the box of a node, which lets queries skip nodes outside the shape and take nodes inside
+// it without testing their points. Any type with the same two functions can be used as a shape.
+namespace KdtreeInternal
+{
+enum class EShapeOverlap : uint8
+{
+	Outside,
+	Intersects,
+	Inside,
+};
+
+// Axis-aligned box. Points on its faces are inside.
+template <typename TreeType>
+struct TBoxShape
+{
+	using PointType = typename TreeType::PointType;
+
+	PointType Min = TreeType::MakeUniformPoint(0);
+	PointType Max = TreeType::MakeUniformPoint(0);
+
+	bool Contains(const PointType& Point) const
+	{
+		bool bInside = true;
+		ForEachAxis<TreeType::Dim>([&](int32 Axis) { bInside &= Point[Axis] >= Min[Axis] && Point[Axis] <= Max[Axis]; });
+		return bInside;
+	}
+
+	EShapeOverlap Classify(const PointType& BoxMin, const PointType& BoxMax) const
+	{
+		bool bDisjoint = false;
+		bool bInside = true;
+		ForEachAxis<TreeType::Dim>([&](int32 Axis) {
+			bDisjoint |= BoxMax[Axis] < Min[Axis] || BoxMin[Axis] > Max[Axis];
+			bInside &= BoxMin[Axis] >= Min[Axis] && BoxMax[Axis] <= Max[Axis];
+		});
+		return bDisjoint ? EShapeOverlap::Outside : (bInside ? EShapeOverlap::Inside : EShapeOverlap::Intersects);
+	}
+};
+
+// Box rotated by Rotation around its center, reaching Extent from the center along each of its axes. 3D only.
+template <typename TreeType>
+struct TOrientedBoxShape
+{
+	static_assert(TreeType::Dim == 3, "Oriented boxes need a 3D tree");
+	using ScalarType = typename TreeType::ScalarType;
+	using PointType = typename TreeType::PointType;
+
+	PointType Center = PointType::ZeroVector;
+	PointType Axes[3] = {PointType::XAxisVector, PointType::YAxisVector, PointType::ZAxisVector};
+	PointType Extent = PointType::ZeroVector;
+	// How far the box reaches along each world axis.
+	PointType WorldExtent = PointType::ZeroVector;
+
+	TOrientedBoxShape() = default;
+
+	TOrientedBoxShape(const PointType& InCenter, const UE::Math::TQuat<ScalarType>& Rotation, const PointType& InExtent)
+		: Center(InCenter), Axes{Rotation.GetAxisX(), Rotation.GetAxisY(), Rotation.GetAxisZ()}, Extent(InExtent)
+	{
+		WorldExtent = Axes[0].GetAbs() * Extent[0] + Axes[1].GetAbs() * Extent[1] + Axes[2].GetAbs() * Extent[2];
+	}
+
+	bool Contains(const PointType& Point) const
+	{
+		const PointType Offset = Point - Center;
+		return FMath::Abs(Offset | Axes[0]) <= Extent[0] && FMath::Abs(Offset | Axes[1]) <= Extent[1] &&
+			   FMath::Abs(Offset | Axes[2]) <= Extent[2];
+	}
+
+	// Separating axis test on the axes of both boxes. The nine edge cross products are left out, so a few boxes
+	// just outside a corner count as intersecting and have their points tested.
+	EShapeOverlap Classify(const PointType& BoxMin, const PointType& BoxMax) const
+	{
+		const PointType BoxCenter = (BoxMin + BoxMax) * ScalarType(0.5);
+		const PointType BoxExtent = (BoxMax - BoxMin) * ScalarType(0.5);
+		const PointType Offset = BoxCenter - Center;
+
+		for (int32 WorldAxis = 0; WorldAxis < 3; ++WorldAxis)
+		{
+			if (FMath::Abs(Offset[WorldAxis]) > BoxExtent[WorldAxis] + WorldExtent[WorldAxis])
+			{
+				return EShapeOverlap::Outside;
+			}
+		}
+
+		bool bInside = true;
+		for (int32 Axis = 0; Axis < 3; ++Axis)
+		{
+			const ScalarType BoxReach = FMath::Abs(Axes[Axis].X) * BoxExtent.X + FMath::Abs(Axes[Axis].Y) * BoxExtent.Y +
+										FMath::Abs(Axes[Axis].Z) * BoxExtent.Z;
+			const ScalarType Distance = FMath::Abs(Offset | Axes[Axis]);
+			if (Distance > Extent[Axis] + BoxReach)
+			{
+				return EShapeOverlap::Outside;
+			}
+			bInside &= Distance + BoxReach <= Extent[Axis];
+		}
+		return bInside ? EShapeOverlap::Inside : EShapeOverlap::Intersects;
+	}
+};
+
+// Points closer than Radius to the segment from Start to End. 3D only.
+template <typename TreeType>
+struct TCapsuleShape
+{
+	static_assert(TreeType::Dim == 3, "Capsules need a 3D tree");
+	using ScalarType = typename TreeType::ScalarType;
+	using PointType = typename TreeType::PointType;
+
+	PointType Start = PointType::ZeroVector;
+	PointType End = PointType::ZeroVector;
+	ScalarType Radius = 0;
+
+	bool Contains(const PointType& Point) const
+	{
+		return GetDistSquaredToSegment(Point) < FMath::Square(Radius);
+	}
+
+	EShapeOverlap Classify(const PointType& BoxMin, const PointType& BoxMax) const
+	{
+		// Clips the segment against the box grown by Radius, which holds every point closer than Radius to the box.
+		const PointType Direction = End - Start;
+		ScalarType EnterTime = 0;
+		ScalarType ExitTime = 1;
+		for (int32 Axis = 0; Axis < 3; ++Axis)
+		{
+			const ScalarType SlabMin = BoxMin[Axis] - Radius;
+			const ScalarType SlabMax = BoxMax[Axis] + Radius;
+			if (Direction[Axis] == 0)
+			{
+				if (Start[Axis] < SlabMin || Start[Axis] > SlabMax)
+				{
+					return EShapeOverlap::Outside;
+				}
+				continue;
+			}
+			const ScalarType T0 = (SlabMin - Start[Axis]) / Direction[Axis];
+			const ScalarType T1 = (SlabMax - Start[Axis]) / Direction[Axis];
+			EnterTime = FMath::Max(EnterTime, FMath::Min(T0, T1));
+			ExitTime = FMath::Min(ExitTime, FMath::Max(T0, T1));
+			if (EnterTime > ExitTime)
+			{
+				return EShapeOverlap::Outside;
+			}
+		}
+
+		// The capsule is convex, so the box is inside once all its corners are. A box with a diagonal longer than the
+		// capsule is wide cannot be.
+		if ((BoxMax - BoxMin).SizeSquared() >= FMath::Square(2 * Radius))
+		{
+			return EShapeOverlap::Intersects;
+		}
+		for (int32 Corner = 0; Corner < 8; ++Corner)
+		{
+			const PointType Point(Corner & 1 ? BoxMax.X : BoxMin.X, Corner & 2 ? BoxMax.Y : BoxMin.Y, Corner & 4 ? BoxMax.Z : BoxMin.Z);
+			if (!Contains(Point))
+			{
+				return EShapeOverlap::Intersects;
+			}
+		}
+		return EShapeOverlap::Inside;
+	}
+
+	ScalarType GetDistSquaredToSegment(const PointType& Point) const
+	{
+		const PointType Direction = End - Start;
+		const ScalarType LengthSquared = Direction.SizeSquared();
+		const ScalarType Time = LengthSquared > 0 ? FMath::Clamp(((Point - Start) | Direction) / LengthSquared, ScalarType(0), ScalarType(1)) : 0;
+		return (Start + Direction * Time - Point).SizeSquared();
+	}
+};
+
+// Intersection of the half-spaces behind Planes, whose normals point outwards as in FConvexVolume. Points on a plane
+// are inside. 3D only.
+template <typename TreeType>
+struct TConvexShape
+{
+	static_assert(TreeType::Dim == 3, "Convex volumes need a 3D tree");
+	using ScalarType = typename TreeType::ScalarType;
+	using PointType = typename TreeType::PointType;
+	using PlaneType = UE::Math::TPlane<ScalarType>;
+
+	TArray<PlaneType, TInlineAllocator<6>> Planes;
+
+	// Perspective view frustum looking from Origin along the X axis of Rotation. HalfFov is the horizontal half angle in radians and
+	// AspectRatio the width divided by the height of the view.
+	static TConvexShape MakeFrustum(const PointType& Origin, const UE::Math::TQuat<ScalarType>& Rotation, ScalarType HalfFov,
+		ScalarType AspectRatio, ScalarType NearDistance, ScalarType FarDistance)
+	{
+		const PointType Forward = Rotation.GetAxisX();
+		const PointType Right = Rotation.GetAxisY();
+		const PointType Up = Rotation.GetAxisZ();
+		const ScalarType TanHorizontal = FMath::Tan(HalfFov);
+		const ScalarType TanVertical = TanHorizontal / FMath::Max(AspectRatio, static_cast<ScalarType>(UE_KINDA_SMALL_NUMBER));
+
+		TConvexShape Frustum;
+		Frustum.Planes.Add(PlaneType(Origin + Forward * NearDistance, -Forward));
+		Frustum.Planes.Add(PlaneType(Origin + Forward * FarDistance, Forward));
+		Frustum.Planes.Add(PlaneType(Origin, (Right - Forward * TanHorizontal).GetSafeNormal()));
+		Frustum.Planes.Add(PlaneType(Origin, (-Right - Forward * TanHorizontal).GetSafeNormal()));
+		Frustum.Planes.Add(PlaneType(Origin, (Up - Forward * TanVertical).GetSafeNormal()));
+		Frustum.Planes.Add(PlaneType(Origin, (-Up - Forward * TanVertical).GetSafeNormal()));
+		return Frustum;
+	}
+
+	bool Contains(const PointType& Point) const
+	{
+		for (const PlaneType& Plane : Planes)
+		{
+			if (Plane.PlaneDot(Point) > 0)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Tests the box against each plane at the corner farthest along and against the normal. Boxes outside the volume
+	// but not behind a single plane, near its edges, count as intersecting.
+	EShapeOverlap Classify(const PointType& BoxMin, const PointType& BoxMax) const
+	{
+		const PointType BoxCenter = (BoxMin + BoxMax) * ScalarType(0.5);
+		const PointType BoxExtent = (BoxMax - BoxMin) * ScalarType(0.5);
+		bool bInside = true;
+		for (const PlaneType& Plane : Planes)
+		{
+			const ScalarType Distance = Plane.PlaneDot(BoxCenter);
+			const ScalarType Reach =
+				FMath::Abs(Plane.X) * BoxExtent.X + FMath::Abs(Plane.Y) * BoxExtent.Y + FMath::Abs(Plane.Z) * BoxExtent.Z;
+			if (Distance - Reach > 0)
+			{
+				return EShapeOverlap::Outside;
+			}
+			bInside &= Distance + Reach <= 0;
+		}
+		return bInside ? EShapeOverlap::Inside : EShapeOverlap::Intersects;
+	}
+};
+}	 // namespace KdtreeInternal
+
+using FKdtreeBoxShape = KdtreeInternal::TBoxShape<FKdtreeInternal>;
+using FKdtreeOrientedBoxShape = KdtreeInternal::TOrientedBoxShape<FKdtreeInternal>;
+using FKdtreeCapsuleShape = KdtreeInternal::TCapsuleShape<FKdtreeInternal>;
+using FKdtreeConvexShape = KdtreeInternal::TConvexShape<FKdtreeInternal>;
@@ -0,0 +1,46 @@
+/*!
+ * Kdtree
+ *
+ * Copyright (c) 2019-2023 nutti
+ *
+ * This software is released under the MIT License.
+ * https://opensource.org/licenses/MIT
+ */
+
+#pragma once
+
+#include "ProfilingDebugging/CpuProfilerTrace.h"
+#include "Stats/Stats.h"
+
+// Shown with "stat Kdtree". The counters add up the work of all queries run during a frame, on any thread.
+DECLARE_STATS_GROUP(TEXT("Kdtree"), STATGROUP_Kdtree, STATCAT_Advanced);
+
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Build"), STAT_KdtreeBuild, STATGROUP_Kdtree, KDTREE_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Edit"), STAT_KdtreeEdit, STATGROUP_Kdtree, KDTREE_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Serialize"), STAT_KdtreeSerialize, STATGROUP_Kdtree, KDTREE_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Collect"), STAT_KdtreeCollect, STATGROUP_Kdtree, KDTREE_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Collect Batch"), STAT_KdtreeCollectBatch, STATGROUP_Kdtree, KDTREE_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Collect In Shape"), STAT_KdtreeCollectInShape, STATGROUP_Kdtree, KDTREE_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Find K Nearest"), STAT_KdtreeFindKNearest, STATGROUP_Kdtree, KDTREE_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Find Nearest"), STAT_KdtreeFindNearest, STATGROUP_Kdtree, KDTREE_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Find Along Path"), STAT_KdtreeFindAlongPath, STATGROUP_Kdtree, KDTREE_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Neighbor Graph"), STAT_KdtreeNeighborGraph, STATGROUP_Kdtree, KDTREE_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Spatial Hash Build"), STAT_SpatialHashBuild, STATGROUP_Kdtree, KDTREE_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Spatial Hash Edit"), STAT_SpatialHashEdit, STATGROUP_Kdtree, KDTREE_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Spatial Hash Collect"), STAT_SpatialHashCollect, STATGROUP_Kdtree, KDTREE_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Spatial Hash Collect Batch"), STAT_SpatialHashCollectBatch, STATGROUP_Kdtree, KDTREE_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Spatial Hash Find K Nearest"), STAT_SpatialHashFindKNearest, STATGROUP_Kdtree, KDTREE_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Spatial Hash Find Nearest"), STAT_SpatialHashFindNearest, STATGROUP_Kdtree, KDTREE_API);
+
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Queries"), STAT_KdtreeQueries, STATGROUP_Kdtree, KDTREE_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Nodes Visited"), STAT_KdtreeNodesVisited, STATGROUP_Kdtree, KDTREE_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Points Tested"), STAT_KdtreePointsTested, STATGROUP_Kdtree, KDTREE_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Results Returned"), STAT_KdtreeResultsReturned, STATGROUP_Kdtree, KDTREE_API);
+
+// Times the enclosing scope under Stat. Cycle stats are traced to Unreal Insights as well, so builds without stats
+// fall back to a plain trace scope of the same name.
+#if STATS
+#define KDTREE_SCOPE_CYCLE_COUNTER(Stat) SCOPE_CYCLE_COUNTER(Stat)
+#else
+#define KDTREE_SCOPE_CYCLE_COUNTER(Stat) TRACE_CPUPROFILER_EVENT_SCOPE(Stat)
+#endif
@@ -0,0 +1,88 @@
+/*!
+ * Kdtree
+ *
+ * Copyright (c) 2019-2023 nutti
+ *
+ * This software is released under the MIT License.
+ * https://opensource.org/licenses/MIT
+ */
+
+#pragma once
+
+#include "KdtreeCore.h"
+
+// Uniform grid over points with Dim coordinates of type ScalarType, the alternative to TKdtree for points that move
+// every frame. Space is cut into cubic cells of CellSize and the cells are hashed into buckets, so memory depends on
+// the number of points rather than on the extent of the grid. The operations working on it live in
+// SpatialHashOperations.h. FSpatialHashInternal, the grid behind the Blueprint-facing FSpatialHash, is the 3D double
+// precision instantiation.
+template <int32 InDim, typename InScalarType>
+struct TSpatialHash
+{
+	static_assert(InDim >= 1, "Unsupported number of dimensions");
+	static_assert(std::is_floating_point_v<InScalarType>, "Coordinates must be float or double");
+
+	static constexpr int32 Dim = InDim;
+	using ScalarType = InScalarType;
+	using PointType = typename KdtreeInternal::TKdtreePoint<Dim, ScalarType>::Type;
+	using CellType = TStaticArray<int32, Dim>;
+
+	static PointType MakeUniformPoint(ScalarType Value)
+	{
+		return TKdtree<Dim, ScalarType>::MakeUniformPoint(Value);
+	}
+
+	TArray<PointType> Data;
+	// Box all points lie in. Grown by edits and shrunk again by the next rebuild. Empty while BoundsMin lies above
+	// BoundsMax.
+	PointType BoundsMin = MakeUniformPoint(TNumericLimits<ScalarType>::Max());
+	PointType BoundsMax = MakeUniformPoint(TNumericLimits<ScalarType>::Lowest());
+
+	// Cell size requested by the build settings, 0 to derive it from the density of the points at every rebuild.
+	float RequestedCellSize = 0.0f;
+	// Edge length of the cells in use and its inverse, 0 until the first build.
+	ScalarType CellSize = 0;
+	ScalarType InvCellSize = 0;
+	// The number of buckets is 1 << BucketBits. A cell goes to the bucket given by the upper bits of its hash.
+	int32 BucketBits = 0;
+
+	// Points grouped by bucket with a counting sort: the slots of bucket b are BucketStart[b] to BucketStart[b + 1] - 1,
+	// of which the first BucketCount[b] are in use. The spare slots take points moving into the bucket without shifting
+	// any other bucket. Each slot holds the index into Data and a copy of the position, so scanning a bucket reads one
+	// contiguous range of memory.
+	TArray<int32> BucketStart;
+	TArray<int32> BucketCount;
+	TArray<int32> SlotIndices;
+	TArray<PointType> SlotPoints;
+	// Points that moved into a bucket without spare slots, in one doubly linked list per bucket through OverflowNext
+	// and OverflowPrev, which are indexed like Data. They are moved back into slots by the next rebuild.
+	TArray<int32> OverflowHeads;
+	TArray<int32> OverflowNext;
+	TArray<int32> OverflowPrev;
+	int32 NumOverflow = 0;
+
+	// Bucket and slot of every point, indexed like Data. The slot is INDEX_NONE for points in an overflow list, and both
+	// are INDEX_NONE for removed points.
+	TArray<int32> PointBuckets;
+	TArray<int32> PointSlots;
+
+	// Set for every index into Data that holds no point. Indices of live points never change, and insertions reuse the
+	// removed indices in FreeIndices before growing Data.
+	TBitArray<> RemovedPoints;
+	TArray<int32> FreeIndices;
+	int32 NumPoints = 0;
+
+	int32 GetNumBuckets() const
+	{
+		return BucketCount.Num();
+	}
+
+	// Heap memory held by the arrays of the grid, not counting the grid itself.
+	SIZE_T GetAllocatedSize() const
+	{
+		return Data.GetAllocatedSize() + BucketStart.GetAllocatedSize() + BucketCount.GetAllocatedSize() +
+			   SlotIndices.GetAllocatedSize() + SlotPoints.GetAllocatedSize() + OverflowHeads.GetAllocatedSize() +
+			   OverflowNext.GetAllocatedSize() + OverflowPrev.GetAllocatedSize() + PointBuckets.GetAllocatedSize() +
+			   PointSlots.GetAllocatedSize() + RemovedPoints.GetAllocatedSize() + FreeIndices.GetAllocatedSize();
+	}
+};
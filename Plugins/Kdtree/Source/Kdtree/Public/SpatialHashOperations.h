@@ -0,0 +1,831 @@
+/*!
+ * Kdtree
+ *
+ * Copyright (c) 2019-2023 nutti
+ *
+ * This software is released under the MIT License.
+ * https://opensource.org/licenses/MIT
+ */
+
+#pragma once
+
+#include "KdtreeOperations.h"
+
+namespace KdtreeInternal
+{
+namespace Private
+{
+// Average number of points per cell the cell size is derived for when the build settings leave it at 0.
+constexpr double SpatialHashPointsPerCell = 2.0;
+
+// A grid is rebuilt once more than this fraction of its points sit in overflow lists.
+constexpr int32 SpatialHashOverflowDivisor = 8;
+
+// Cell coordinate of a position already divided by the cell size. Positions beyond the range of int32 are clamped,
+// which only crowds them into the outermost cells.
+template <typename ScalarType>
+int32 ToCellCoord(ScalarType Scaled)
+{
+	constexpr ScalarType Limit = static_cast<ScalarType>(1 << 30);
+	return FMath::FloorToInt32(FMath::Clamp(Scaled, -Limit, Limit));
+}
+
+template <typename HashType>
+typename HashType::CellType GetCell(const HashType& Hash, const typename HashType::PointType& Point)
+{
+	typename HashType::CellType Cell;
+	ForEachAxis<HashType::Dim>([&](int32 Axis) { Cell[Axis] = ToCellCoord(Point[Axis] * Hash.InvCellSize); });
+	return Cell;
+}
+
+template <int32 Dim>
+bool IsSameCell(const TStaticArray<int32, Dim>& A, const TStaticArray<int32, Dim>& B)
+{
+	bool bSame = true;
+	ForEachAxis<Dim>([&](int32 Axis) { bSame &= A[Axis] == B[Axis]; });
+	return bSame;
+}
+
+// Bucket of a cell: the coordinates are multiplied by large odd constants, the first three from Teschner et al.,
+// combined and spread over all bits by a Fibonacci hash, whose upper bits pick the bucket.
+template <int32 Dim>
+int32 GetCellBucket(const TStaticArray<int32, Dim>& Cell, int32 BucketBits)
+{
+	static constexpr uint32 Multipliers[] = {73856093u, 19349663u, 83492791u, 2654435761u, 805459861u, 3674653429u};
+	uint32 Key = 0;
+	ForEachAxis<Dim>([&](int32 Axis) { Key ^= static_cast<uint32>(Cell[Axis]) * Multipliers[Axis % UE_ARRAY_COUNT(Multipliers)]; });
+	return BucketBits > 0 ? static_cast<int32>((Key * 2654435769u) >> (32 - BucketBits)) : 0;
+}
+
+template <typename HashType>
+int32 GetPointBucket(const HashType& Hash, const typename HashType::PointType& Point)
+{
+	return GetCellBucket<HashType::Dim>(GetCell(Hash, Point), Hash.BucketBits);
+}
+
+// Squared distance from Center to the box of Cell. The box is grown by a few units in the last place of its
+// coordinates, so that rounding in GetCell never places a point outside the box of its cell.
+template <typename HashType>
+typename HashType::ScalarType GetCellMinDistSquared(
+	const HashType& Hash, const typename HashType::CellType& Cell, const typename HashType::PointType& Center)
+{
+	using ScalarType = typename HashType::ScalarType;
+
+	ScalarType DistSquared = 0;
+	ForEachAxis<HashType::Dim>([&](int32 Axis) {
+		const ScalarType Min = Cell[Axis] * Hash.CellSize;
+		const ScalarType Slack = (FMath::Abs(Min) + Hash.CellSize) * 4 * std::numeric_limits<ScalarType>::epsilon();
+		DistSquared += GetAxisMinDistSquared(Center[Axis], Min - Slack, Min + Hash.CellSize + Slack);
+	});
+	return DistSquared;
+}
+
+// Calls Visitor(Index, Point) for every point hashed into Bucket, which holds the points of all cells sharing it.
+template <typename HashType, typename VisitorType>
+void ForEachPointInBucket(const HashType& Hash, int32 Bucket, FScopedQueryCounters& Counters, const VisitorType& Visitor)
+{
+	Counters.AddNode();
+	const int32 FirstSlot = Hash.BucketStart[Bucket];
+	const int32 EndSlot = FirstSlot + Hash.BucketCount[Bucket];
+	Counters.AddPointsTested(EndSlot - FirstSlot);
+	for (int32 Slot = FirstSlot; Slot < EndSlot; ++Slot)
+	{
+		Visitor(Hash.SlotIndices[Slot], Hash.SlotPoints[Slot]);
+	}
+	for (int32 Index = Hash.OverflowHeads[Bucket]; Index != INDEX_NONE; Index = Hash.OverflowNext[Index])
+	{
+		Counters.AddPointsTested(1);
+		Visitor(Index, Hash.Data[Index]);
+	}
+}
+
+// Calls Visitor(Cell) for every cell from Min to Max, both included.
+template <int32 Dim, typename VisitorType>
+void ForEachCellInBox(const TStaticArray<int32, Dim>& Min, const TStaticArray<int32, Dim>& Max, const VisitorType& Visitor)
+{
+	TStaticArray<int32, Dim> Cell = Min;
+	while (true)
+	{
+		Visitor(Cell);
+		int32 Axis = 0;
+		for (; Axis < Dim && Cell[Axis] == Max[Axis]; ++Axis)
+		{
+			Cell[Axis] = Min[Axis];
+		}
+		if (Axis == Dim)
+		{
+			return;
+		}
+		++Cell[Axis];
+	}
+}
+
+// Calls Visitor(Cell) for every cell from Min to Max whose largest distance in cells from Center along any axis is
+// exactly Ring, i.e. the cells on the surface of the cube of cells around Center.
+template <int32 Dim, typename VisitorType>
+void ForEachCellOnRing(const TStaticArray<int32, Dim>& Center, int32 Ring, const TStaticArray<int32, Dim>& Min,
+	const TStaticArray<int32, Dim>& Max, const VisitorType& Visitor)
+{
+	TStaticArray<int32, Dim> Lo;
+	TStaticArray<int32, Dim> Hi;
+	bool bEmpty = false;
+	ForEachAxis<Dim>([&](int32 Axis) {
+		Lo[Axis] = FMath::Max(Center[Axis] - Ring, Min[Axis]);
+		Hi[Axis] = FMath::Min(Center[Axis] + Ring, Max[Axis]);
+		bEmpty |= Lo[Axis] > Hi[Axis];
+	});
+	if (bEmpty)
+	{
+		return;
+	}
+
+	TStaticArray<int32, Dim> Cell = Lo;
+	while (true)
+	{
+		// While all other axes are inside the ring, only the two ends of the first axis lie on it.
+		bool bOthersInside = Ring > 0;
+		for (int32 Axis = 1; Axis < Dim; ++Axis)
+		{
+			bOthersInside &= FMath::Abs(Cell[Axis] - Center[Axis]) < Ring;
+		}
+		if (bOthersInside)
+		{
+			for (const int32 End : {Center[0] - Ring, Center[0] + Ring})
+			{
+				if (End >= Lo[0] && End <= Hi[0])
+				{
+					Cell[0] = End;
+					Visitor(Cell);
+				}
+			}
+		}
+		else
+		{
+			for (Cell[0] = Lo[0]; Cell[0] <= Hi[0]; ++Cell[0])
+			{
+				Visitor(Cell);
+			}
+		}
+		Cell[0] = Lo[0];
+
+		int32 Axis = 1;
+		for (; Axis < Dim && Cell[Axis] == Hi[Axis]; ++Axis)
+		{
+			Cell[Axis] = Lo[Axis];
+		}
+		if (Axis == Dim)
+		{
+			return;
+		}
+		++Cell[Axis];
+	}
+}
+
+// Number of cells from Min to Max, both included, saturating instead of overflowing.
+template <int32 Dim>
+int64 GetNumCellsInBox(const TStaticArray<int32, Dim>& Min, const TStaticArray<int32, Dim>& Max)
+{
+	int64 NumCells = 1;
+	ForEachAxis<Dim>([&](int32 Axis) {
+		const int64 Extent = FMath::Max<int64>(static_cast<int64>(Max[Axis]) - Min[Axis] + 1, 0);
+		NumCells = FMath::Min<int64>(NumCells * Extent, MAX_int32);
+	});
+	return NumCells;
+}
+
+// Cell size giving SpatialHashPointsPerCell points per cell if the points filled their bounding box evenly. Axes along
+// which the box is thinner than a cell are left out, so points on a plane get the same density per cell as points in a
+// volume.
+template <typename HashType>
+typename HashType::ScalarType ChooseCellSize(const HashType& Hash)
+{
+	using ScalarType = typename HashType::ScalarType;
+
+	if (Hash.RequestedCellSize > 0.0f)
+	{
+		return static_cast<ScalarType>(Hash.RequestedCellSize);
+	}
+
+	ScalarType CellSize = 0;
+	for (int32 Pass = 0; Pass < 2; ++Pass)
+	{
+		double Volume = 1.0;
+		int32 NumAxes = 0;
+		for (int32 Axis = 0; Axis < HashType::Dim; ++Axis)
+		{
+			const double Extent = static_cast<double>(Hash.BoundsMax[Axis]) - static_cast<double>(Hash.BoundsMin[Axis]);
+			if (Extent > 0.0 && Extent >= CellSize)
+			{
+				Volume *= Extent;
+				++NumAxes;
+			}
+		}
+		if (NumAxes == 0)
+		{
+			break;
+		}
+		CellSize = static_cast<ScalarType>(FMath::Pow(Volume * SpatialHashPointsPerCell / Hash.NumPoints, 1.0 / NumAxes));
+	}
+	// A single point or points all at one position: any size works until the next rebuild.
+	return CellSize > 0 ? CellSize : ScalarType(1);
+}
+
+// Adds the point at Index to the slots of Bucket, or to its overflow list if no slot is spare.
+template <typename HashType>
+void LinkPoint(HashType& Hash, int Index, int32 Bucket)
+{
+	Hash.PointBuckets[Index] = Bucket;
+	const int32 Slot = Hash.BucketStart[Bucket] + Hash.BucketCount[Bucket];
+	if (Slot < Hash.BucketStart[Bucket + 1])
+	{
+		++Hash.BucketCount[Bucket];
+		Hash.SlotIndices[Slot] = Index;
+		Hash.SlotPoints[Slot] = Hash.Data[Index];
+		Hash.PointSlots[Index] = Slot;
+		return;
+	}
+
+	const int32 Head = Hash.OverflowHeads[Bucket];
+	Hash.PointSlots[Index] = INDEX_NONE;
+	Hash.OverflowPrev[Index] = INDEX_NONE;
+	Hash.OverflowNext[Index] = Head;
+	if (Head != INDEX_NONE)
+	{
+		Hash.OverflowPrev[Head] = Index;
+	}
+	Hash.OverflowHeads[Bucket] = Index;
+	++Hash.NumOverflow;
+}
+
+// Takes the point at Index out of its bucket. The last point of the bucket fills its slot.
+template <typename HashType>
+void UnlinkPoint(HashType& Hash, int Index)
+{
+	const int32 Bucket = Hash.PointBuckets[Index];
+	const int32 Slot = Hash.PointSlots[Index];
+	if (Slot != INDEX_NONE)
+	{
+		const int32 LastSlot = Hash.BucketStart[Bucket] + --Hash.BucketCount[Bucket];
+		if (Slot != LastSlot)
+		{
+			Hash.SlotIndices[Slot] = Hash.SlotIndices[LastSlot];
+			Hash.SlotPoints[Slot] = Hash.SlotPoints[LastSlot];
+			Hash.PointSlots[Hash.SlotIndices[Slot]] = Slot;
+		}
+	}
+	else
+	{
+		const int32 Next = Hash.OverflowNext[Index];
+		const int32 Prev = Hash.OverflowPrev[Index];
+		(Prev != INDEX_NONE ? Hash.OverflowNext[Prev] : Hash.OverflowHeads[Bucket]) = Next;
+		if (Next != INDEX_NONE)
+		{
+			Hash.OverflowPrev[Next] = Prev;
+		}
+		--Hash.NumOverflow;
+	}
+	Hash.PointBuckets[Index] = INDEX_NONE;
+	Hash.PointSlots[Index] = INDEX_NONE;
+}
+
+// Sorts the live points into buckets from scratch with a counting sort: one pass counts the points per bucket, a
+// prefix sum over the counts plus spare slots places the buckets, and a second pass scatters the points into them.
+// The cell size is derived anew unless the build settings fixed it, and the number of buckets follows the number of
+// points.
+template <typename HashType>
+void RebuildSpatialHash(HashType& Hash)
+{
+	KDTREE_SCOPE_CYCLE_COUNTER(STAT_SpatialHashBuild);
+
+	const int NumData = Hash.Data.Num();
+	ResetBounds(Hash);
+	for (int Index = 0; Index < NumData; ++Index)
+	{
+		if (!Hash.RemovedPoints[Index])
+		{
+			ExpandBounds(Hash, Hash.Data[Index]);
+		}
+	}
+	Hash.CellSize = ChooseCellSize(Hash);
+	Hash.InvCellSize = 1 / Hash.CellSize;
+	// About two points per bucket: cells hold a few points each, and bucket collisions only cost a longer scan.
+	Hash.BucketBits = FMath::CeilLogTwo(static_cast<uint32>(FMath::Max(Hash.NumPoints / 2, 1)));
+	const int32 NumBuckets = 1 << Hash.BucketBits;
+
+	Hash.PointBuckets.SetNumUninitialized(NumData);
+	ParallelFor(
+		NumData,
+		[&Hash](int Index) {
+			Hash.PointBuckets[Index] = Hash.RemovedPoints[Index] ? INDEX_NONE : GetPointBucket(Hash, Hash.Data[Index]);
+		},
+		NumData >= ParallelBuildMinPoints && FApp::ShouldUseThreadingForPerformance() ? EParallelForFlags::None
+																					  : EParallelForFlags::ForceSingleThread);
+
+	Hash.BucketCount.Init(0, NumBuckets);
+	for (const int32 Bucket : Hash.PointBuckets)
+	{
+		if (Bucket != INDEX_NONE)
+		{
+			++Hash.BucketCount[Bucket];
+		}
+	}
+
+	// A quarter of the points of a bucket plus one as spare slots, so that most moves into it find room.
+	Hash.BucketStart.SetNumUninitialized(NumBuckets + 1);
+	int32 NumSlots = 0;
+	for (int32 Bucket = 0; Bucket < NumBuckets; ++Bucket)
+	{
+		Hash.BucketStart[Bucket] = NumSlots;
+		NumSlots += Hash.BucketCount[Bucket] + Hash.BucketCount[Bucket] / 4 + 1;
+		Hash.BucketCount[Bucket] = 0;
+	}
+	Hash.BucketStart[NumBuckets] = NumSlots;
+
+	Hash.SlotIndices.SetNumUninitialized(NumSlots);
+	Hash.SlotPoints.SetNumUninitialized(NumSlots);
+	Hash.PointSlots.SetNumUninitialized(NumData);
+	for (int Index = 0; Index < NumData; ++Index)
+	{
+		const int32 Bucket = Hash.PointBuckets[Index];
+		if (Bucket == INDEX_NONE)
+		{
+			Hash.PointSlots[Index] = INDEX_NONE;
+			continue;
+		}
+		const int32 Slot = Hash.BucketStart[Bucket] + Hash.BucketCount[Bucket]++;
+		Hash.SlotIndices[Slot] = Index;
+		Hash.SlotPoints[Slot] = Hash.Data[Index];
+		Hash.PointSlots[Index] = Slot;
+	}
+
+	Hash.OverflowHeads.Init(INDEX_NONE, NumBuckets);
+	Hash.OverflowNext.Init(INDEX_NONE, NumData);
+	Hash.OverflowPrev.Init(INDEX_NONE, NumData);
+	Hash.NumOverflow = 0;
+}
+
+// Whether edits left the grid in need of a rebuild: too many points in overflow lists or too many points per bucket.
+template <typename HashType>
+bool ShouldRebuildSpatialHash(const HashType& Hash)
+{
+	return Hash.GetNumBuckets() == 0 || Hash.NumOverflow > Hash.NumPoints / SpatialHashOverflowDivisor + 16 ||
+		   Hash.NumPoints > 4 * Hash.GetNumBuckets();
+}
+
+// Offers the points of the cells around Center to Collector, ring by ring outwards from the cell of Center, until the
+// next ring lies farther away than the collector's bound. Once a ring would take more cells than a scan of all points,
+// the points outside the rings visited so far are scanned instead.
+template <typename HashType, typename CollectorType>
+void SearchNearestInSpatialHash(
+	const HashType& Hash, const typename HashType::PointType& Center, CollectorType& Collector, FScopedQueryCounters& Counters)
+{
+	using ScalarType = typename HashType::ScalarType;
+	using CellType = typename HashType::CellType;
+	constexpr int32 Dim = HashType::Dim;
+
+	const CellType CenterCell = GetCell(Hash, Center);
+	// Cells outside the bounds hold no points.
+	const CellType BoundsCellMin = GetCell(Hash, Hash.BoundsMin);
+	const CellType BoundsCellMax = GetCell(Hash, Hash.BoundsMax);
+	int32 MaxRing = 0;
+	ForEachAxis<Dim>([&](int32 Axis) {
+		MaxRing = FMath::Max(MaxRing, FMath::Max(CenterCell[Axis] - BoundsCellMin[Axis], BoundsCellMax[Axis] - CenterCell[Axis]));
+	});
+	const int64 MaxCellsToVisit = FMath::Max<int64>(Hash.NumPoints, 64);
+
+	const auto VisitCell = [&](const CellType& Cell) {
+		if (GetCellMinDistSquared(Hash, Cell, Center) >= Collector.BoundSquared)
+		{
+			return;
+		}
+		ForEachPointInBucket(Hash, GetCellBucket<Dim>(Cell, Hash.BucketBits), Counters,
+			[&](int Index, const typename HashType::PointType& Point) {
+				const ScalarType DistSquared = GetDistSquared<Dim>(Point, Center);
+				if (DistSquared < Collector.BoundSquared && IsSameCell<Dim>(GetCell(Hash, Point), Cell))
+				{
+					Collector.Offer(Index, DistSquared);
+				}
+			});
+	};
+
+	for (int32 Ring = 0; Ring <= MaxRing; ++Ring)
+	{
+		CellType RingMin;
+		CellType RingMax;
+		ForEachAxis<Dim>([&](int32 Axis) {
+			RingMin[Axis] = FMath::Max(CenterCell[Axis] - Ring, BoundsCellMin[Axis]);
+			RingMax[Axis] = FMath::Min(CenterCell[Axis] + Ring, BoundsCellMax[Axis]);
+		});
+		if (GetNumCellsInBox<Dim>(RingMin, RingMax) > MaxCellsToVisit)
+		{
+			for (int Index = 0; Index < Hash.Data.Num(); ++Index)
+			{
+				if (Hash.RemovedPoints[Index])
+				{
+					continue;
+				}
+				const ScalarType DistSquared = GetDistSquared<Dim>(Hash.Data[Index], Center);
+				if (DistSquared >= Collector.BoundSquared)
+				{
+					continue;
+				}
+				const CellType Cell = GetCell(Hash, Hash.Data[Index]);
+				int32 CellRing = 0;
+				ForEachAxis<Dim>([&](int32 Axis) { CellRing = FMath::Max(CellRing, FMath::Abs(Cell[Axis] - CenterCell[Axis])); });
+				if (CellRing >= Ring)
+				{
+					Collector.Offer(Index, DistSquared);
+				}
+			}
+			Counters.AddPointsTested(Hash.Data.Num());
+			return;
+		}
+
+		ForEachCellOnRing<Dim>(CenterCell, Ring, BoundsCellMin, BoundsCellMax, VisitCell);
+
+		// Points on later rings are at least as far as the nearest face of the cube of cells visited so far, less the
+		// same rounding slack as in GetCellMinDistSquared.
+		ScalarType RingDist = TNumericLimits<ScalarType>::Max();
+		ForEachAxis<Dim>([&](int32 Axis) {
+			const ScalarType Below = Center[Axis] - (CenterCell[Axis] - Ring) * Hash.CellSize;
+			const ScalarType Above = (CenterCell[Axis] + Ring + 1) * Hash.CellSize - Center[Axis];
+			const ScalarType Slack =
+				(FMath::Abs(Center[Axis]) + Hash.CellSize * (Ring + 1)) * 4 * std::numeric_limits<ScalarType>::epsilon();
+			RingDist = FMath::Min(RingDist, FMath::Min(Below, Above) - Slack);
+		});
+		if (RingDist > 0 && FMath::Square(RingDist) >= Collector.BoundSquared)
+		{
+			return;
+		}
+	}
+}
+}	 // namespace Private
+
+template <typename HashType>
+void ClearSpatialHash(HashType* Hash);
+
+// Builds the grid over Data, taking ownership of the points instead of copying them.
+template <typename HashType>
+void BuildSpatialHash(HashType* Hash, TArray<typename HashType::PointType>&& Data,
+	const FSpatialHashBuildSettings& Settings = FSpatialHashBuildSettings())
+{
+	// Taken before clearing, as Data may be the grid's own array.
+	TArray<typename HashType::PointType> Points = MoveTemp(Data);
+	ClearSpatialHash(Hash);
+
+	Hash->Data = MoveTemp(Points);
+	Hash->RequestedCellSize = FMath::Max(Settings.CellSize, 0.0f);
+	Hash->RemovedPoints.Init(false, Hash->Data.Num());
+	Hash->NumPoints = Hash->Data.Num();
+	Private::RebuildSpatialHash(*Hash);
+}
+
+template <typename HashType>
+void BuildSpatialHash(HashType* Hash, const TArray<typename HashType::PointType>& Data,
+	const FSpatialHashBuildSettings& Settings = FSpatialHashBuildSettings())
+{
+	BuildSpatialHash(Hash, TArray<typename HashType::PointType>(Data), Settings);
+}
+
+// The requested cell size is kept, so points inserted after clearing are stored like the ones of the last build.
+template <typename HashType>
+void ClearSpatialHash(HashType* Hash)
+{
+	Hash->Data.Empty();
+	Private::ResetBounds(*Hash);
+	Hash->CellSize = 0;
+	Hash->InvCellSize = 0;
+	Hash->BucketBits = 0;
+	Hash->BucketStart.Empty();
+	Hash->BucketCount.Empty();
+	Hash->SlotIndices.Empty();
+	Hash->SlotPoints.Empty();
+	Hash->OverflowHeads.Empty();
+	Hash->OverflowNext.Empty();
+	Hash->OverflowPrev.Empty();
+	Hash->NumOverflow = 0;
+	Hash->PointBuckets.Empty();
+	Hash->PointSlots.Empty();
+	Hash->RemovedPoints.Empty();
+	Hash->FreeIndices.Empty();
+	Hash->NumPoints = 0;
+}
+
+// Adds Point to the grid and returns its index into Data. Indices of removed points are reused.
+template <typename HashType>
+int InsertIntoSpatialHash(HashType* Hash, const typename HashType::PointType& Point)
+{
+	KDTREE_SCOPE_CYCLE_COUNTER(STAT_SpatialHashEdit);
+
+	int Index;
+	if (Hash->FreeIndices.Num() > 0)
+	{
+		Index = Hash->FreeIndices.Pop(EAllowShrinking::No);
+		Hash->Data[Index] = Point;
+		Hash->RemovedPoints[Index] = false;
+	}
+	else
+	{
+		Index = Hash->Data.Add(Point);
+		Hash->RemovedPoints.Add(false);
+		Hash->PointBuckets.Add(INDEX_NONE);
+		Hash->PointSlots.Add(INDEX_NONE);
+		Hash->OverflowNext.Add(INDEX_NONE);
+		Hash->OverflowPrev.Add(INDEX_NONE);
+	}
+	++Hash->NumPoints;
+	Private::ExpandBounds(*Hash, Point);
+
+	if (Hash->GetNumBuckets() > 0)
+	{
+		Private::LinkPoint(*Hash, Index, Private::GetPointBucket(*Hash, Point));
+	}
+	if (Private::ShouldRebuildSpatialHash(*Hash))
+	{
+		Private::RebuildSpatialHash(*Hash);
+	}
+	return Index;
+}
+
+// Removes the point at Index. The indices of all other points stay valid. Returns false if there is no such point.
+template <typename HashType>
+bool RemoveFromSpatialHash(HashType* Hash, int Index)
+{
+	KDTREE_SCOPE_CYCLE_COUNTER(STAT_SpatialHashEdit);
+
+	if (!Hash->Data.IsValidIndex(Index) || Hash->RemovedPoints[Index])
+	{
+		return false;
+	}
+
+	Private::UnlinkPoint(*Hash, Index);
+	Hash->RemovedPoints[Index] = true;
+	Hash->FreeIndices.Add(Index);
+	--Hash->NumPoints;
+	return true;
+}
+
+// Moves the points at Indices to Positions. A point that stays in its bucket is updated in place, and any other is
+// taken out of its bucket and added to the new one, so every move costs the same few array writes. The grid is
+// rebuilt once too many moves found their bucket full. This holds for the grid edited here; FSpatialHash::Edit copies
+// the whole grid first while async queries hold a snapshot of it.
+template <typename HashType>
+void UpdateSpatialHashPositions(HashType* Hash, const TArray<int>& Indices, const TArray<typename HashType::PointType>& Positions)
+{
+	KDTREE_SCOPE_CYCLE_COUNTER(STAT_SpatialHashEdit);
+
+	for (int Offset = 0; Offset < FMath::Min(Indices.Num(), Positions.Num()); ++Offset)
+	{
+		const int Index = Indices[Offset];
+		if (!Hash->Data.IsValidIndex(Index) || Hash->RemovedPoints[Index])
+		{
+			continue;
+		}
+
+		const typename HashType::PointType& Position = Positions[Offset];
+		Hash->Data[Index] = Position;
+		Private::ExpandBounds(*Hash, Position);
+		const int32 Bucket = Private::GetPointBucket(*Hash, Position);
+		if (Bucket == Hash->PointBuckets[Index])
+		{
+			if (Hash->PointSlots[Index] != INDEX_NONE)
+			{
+				Hash->SlotPoints[Hash->PointSlots[Index]] = Position;
+			}
+			continue;
+		}
+		Private::UnlinkPoint(*Hash, Index);
+		Private::LinkPoint(*Hash, Index, Bucket);
+	}
+
+	if (Private::ShouldRebuildSpatialHash(*Hash))
+	{
+		Private::RebuildSpatialHash(*Hash);
+	}
+}
+
+// Appends the indices of the points closer to Center than Radius. Result can use any allocator, as for
+// CollectFromKdtree.
+template <typename HashType, typename AllocatorType>
+void CollectFromSpatialHash(
+	const HashType& Hash, const typename HashType::PointType& Center, float Radius, TArray<int, AllocatorType>* Result)
+{
+	KDTREE_SCOPE_CYCLE_COUNTER(STAT_SpatialHashCollect);
+
+	using ScalarType = typename HashType::ScalarType;
+	using CellType = typename HashType::CellType;
+	constexpr int32 Dim = HashType::Dim;
+
+	if (Hash.NumPoints == 0 || Radius <= 0.0f)
+	{
+		return;
+	}
+
+	Private::FScopedQueryCounters Counters;
+	const int NumBefore = Result->Num();
+	const ScalarType RadiusSquared = FMath::Square(static_cast<ScalarType>(Radius));
+	CellType CellMin;
+	CellType CellMax;
+	ForEachAxis<Dim>([&](int32 Axis) {
+		const ScalarType Min = FMath::Max(Center[Axis] - Radius, Hash.BoundsMin[Axis]);
+		const ScalarType Max = FMath::Min(Center[Axis] + Radius, Hash.BoundsMax[Axis]);
+		CellMin[Axis] = Private::ToCellCoord(Min * Hash.InvCellSize);
+		CellMax[Axis] = Private::ToCellCoord(Max * Hash.InvCellSize);
+	});
+
+	const int64 NumCells = Private::GetNumCellsInBox<Dim>(CellMin, CellMax);
+	if (NumCells == 0)
+	{
+		// The sphere misses the bounds of the points.
+	}
+	else if (NumCells > Hash.GetNumBuckets())
+	{
+		// Visiting the cells would take longer than testing every point.
+		for (int Index = 0; Index < Hash.Data.Num(); ++Index)
+		{
+			if (!Hash.RemovedPoints[Index] && Private::GetDistSquared<Dim>(Hash.Data[Index], Center) < RadiusSquared)
+			{
+				Result->Add(Index);
+			}
+		}
+		Counters.AddPointsTested(Hash.Data.Num());
+	}
+	else
+	{
+		Private::ForEachCellInBox<Dim>(CellMin, CellMax, [&](const CellType& Cell) {
+			if (Private::GetCellMinDistSquared(Hash, Cell, Center) >= RadiusSquared)
+			{
+				return;
+			}
+			// Other cells sharing the bucket are skipped by the cell test, which only runs for points in range.
+			Private::ForEachPointInBucket(Hash, Private::GetCellBucket<Dim>(Cell, Hash.BucketBits), Counters,
+				[&](int Index, const typename HashType::PointType& Point) {
+					if (Private::GetDistSquared<Dim>(Point, Center) < RadiusSquared &&
+						Private::IsSameCell<Dim>(Private::GetCell(Hash, Point), Cell))
+					{
+						Result->Add(Index);
+					}
+				});
+		});
+	}
+	Counters.AddResults(Result->Num() - NumBefore);
+}
+
+// Runs one radius query per center across worker threads, as CollectFromKdtreeBatch.
+template <typename HashType>
+void CollectFromSpatialHashBatch(const HashType& Hash, const TArray<typename HashType::PointType>& Centers,
+	const TArray<float>& Radii, TArray<int>* ResultIndices, TArray<int>* ResultOffsets)
+{
+	KDTREE_SCOPE_CYCLE_COUNTER(STAT_SpatialHashCollectBatch);
+
+	check(Radii.Num() == 1 || Radii.Num() == Centers.Num());
+
+	Private::RunCollectBatch(
+		Centers.Num(),
+		[&](int Query, TArray<int>& Indices) {
+			CollectFromSpatialHash(Hash, Centers[Query], Radii.Num() == 1 ? Radii[0] : Radii[Query], &Indices);
+		},
+		ResultIndices, ResultOffsets);
+}
+
+// Appends the indices of the K points closest to Center, nearest first. Only points closer than MaxDistance are
+// considered; a MaxDistance of 0 or less means no limit.
+template <typename HashType>
+void FindKNearestInSpatialHash(
+	const HashType& Hash, const typename HashType::PointType& Center, int K, float MaxDistance, TArray<int>* Result)
+{
+	KDTREE_SCOPE_CYCLE_COUNTER(STAT_SpatialHashFindKNearest);
+
+	using ScalarType = typename HashType::ScalarType;
+
+	// K comes straight from Blueprint, so it is bounded by what the grid can return.
+	K = FMath::Min(K, Hash.NumPoints);
+	if (Hash.NumPoints == 0 || K <= 0)
+	{
+		return;
+	}
+
+	Private::FScopedQueryCounters Counters;
+	Private::TKNearestCollector<ScalarType> Collector(K, Private::GetMaxDistSquared<ScalarType>(MaxDistance));
+	Private::SearchNearestInSpatialHash(Hash, Center, Collector, Counters);
+	Counters.AddResults(Collector.Heap.Num());
+	Collector.AppendNearestFirst(Result);
+}
+
+// Returns the index of the point closest to Center and closer than MaxDistance (no limit if 0 or less), or
+// INDEX_NONE if there is none.
+template <typename HashType>
+int FindNearestInSpatialHash(const HashType& Hash, const typename HashType::PointType& Center, float MaxDistance)
+{
+	KDTREE_SCOPE_CYCLE_COUNTER(STAT_SpatialHashFindNearest);
+
+	using ScalarType = typename HashType::ScalarType;
+
+	if (Hash.NumPoints == 0)
+	{
+		return INDEX_NONE;
+	}
+
+	Private::FScopedQueryCounters Counters;
+	Private::TNearestCollector<ScalarType> Collector(Private::GetMaxDistSquared<ScalarType>(MaxDistance));
+	Private::SearchNearestInSpatialHash(Hash, Center, Collector, Counters);
+	Counters.AddResults(Collector.Index != INDEX_NONE ? 1 : 0);
+	return Collector.Index;
+}
+
+template <typename HashType>
+void ValidateSpatialHash(const HashType& Hash)
+{
+	int32 NumLive = 0;
+	for (int Index = 0; Index < Hash.Data.Num(); ++Index)
+	{
+		if (Hash.RemovedPoints[Index])
+		{
+			continue;
+		}
+		++NumLive;
+		const int32 Bucket = Private::GetPointBucket(Hash, Hash.Data[Index]);
+		if (Hash.PointBuckets[Index] != Bucket)
+		{
+			UE_LOG(LogTemp, Error, TEXT("Spatial hash is invalid: point %d is in bucket %d instead of %d"), Index,
+				Hash.PointBuckets[Index], Bucket);
+			continue;
+		}
+		const int32 Slot = Hash.PointSlots[Index];
+		if (Slot != INDEX_NONE &&
+			(Slot < Hash.BucketStart[Bucket] || Slot >= Hash.BucketStart[Bucket] + Hash.BucketCount[Bucket] ||
+				Hash.SlotIndices[Slot] != Index ||
+				Private::GetDistSquared<HashType::Dim>(Hash.SlotPoints[Slot], Hash.Data[Index]) != 0))
+		{
+			UE_LOG(LogTemp, Error, TEXT("Spatial hash is invalid: slot %d does not hold point %d"), Slot, Index);
+		}
+	}
+	if (NumLive != Hash.NumPoints)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Spatial hash is invalid: %d live points, expected %d"), NumLive, Hash.NumPoints);
+	}
+
+	int32 NumOverflow = 0;
+	for (int32 Bucket = 0; Bucket < Hash.GetNumBuckets(); ++Bucket)
+	{
+		if (Hash.BucketStart[Bucket] + Hash.BucketCount[Bucket] > Hash.BucketStart[Bucket + 1])
+		{
+			UE_LOG(LogTemp, Error, TEXT("Spatial hash is invalid: bucket %d holds more points than slots"), Bucket);
+		}
+		for (int32 Index = Hash.OverflowHeads[Bucket]; Index != INDEX_NONE; Index = Hash.OverflowNext[Index])
+		{
+			++NumOverflow;
+			if (Hash.PointBuckets[Index] != Bucket || Hash.PointSlots[Index] != INDEX_NONE)
+			{
+				UE_LOG(LogTemp, Error, TEXT("Spatial hash is invalid: overflow list of bucket %d holds point %d"), Bucket, Index);
+			}
+		}
+	}
+	if (NumOverflow != Hash.NumOverflow)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Spatial hash is invalid: %d points in overflow lists, expected %d"), NumOverflow,
+			Hash.NumOverflow);
+	}
+}
+
+namespace Private
+{
+// Costs behind EstimateSpatialBackendCost in nanoseconds, per moved point and per radius or 8-nearest query of about 30
+// hits, fitted to uniform points from 1k to 100k: kd-trees with leaves of 16 points, and the grid with cells of the
+// query radius. The kd-tree terms scale with its depth, which also covers the cache misses of larger trees.
+constexpr double KdtreeMoveNsPerLevel = 65.0;
+constexpr double KdtreeQueryNsPerLevel = 260.0;
+constexpr double SpatialHashMoveNs = 60.0;
+constexpr double SpatialHashQueryNs = 5000.0;
+}	 // namespace Private
+
+// Estimated cost per frame, in nanoseconds, of keeping NumPoints points in the structure of Backend while
+// NumMovedPerFrame of them move and NumQueriesPerFrame radius or nearest queries run. The constants are fitted to the
+// results of the Plugins.Kdtree.Benchmark automation test.
+inline double EstimateSpatialBackendCost(
+	EKdtreeSpatialBackend Backend, int32 NumPoints, int32 NumMovedPerFrame, int32 NumQueriesPerFrame)
+{
+	const double Depth = FMath::Log2(static_cast<double>(FMath::Max(NumPoints, 2)));
+	switch (Backend)
+	{
+		case EKdtreeSpatialBackend::Kdtree:
+			return (NumMovedPerFrame * Private::KdtreeMoveNsPerLevel + NumQueriesPerFrame * Private::KdtreeQueryNsPerLevel) * Depth;
+		case EKdtreeSpatialBackend::SpatialHash:
+			return NumMovedPerFrame * Private::SpatialHashMoveNs + NumQueriesPerFrame * Private::SpatialHashQueryNs;
+	}
+	return 0.0;
+}
+
+// The backend with the lower EstimateSpatialBackendCost. Ties go to the kd-tree, which copes with any distribution of
+// points, while the estimate for the grid assumes points spread evenly enough for its cells to hold a few each. The
+// estimate also assumes the moves happen while no async query holds a snapshot: FSpatialHash::Edit copies a shared
+// grid whole, which costs more than the moves themselves, so a grid queried asynchronously every frame loses its edge.
+inline EKdtreeSpatialBackend RecommendSpatialBackend(int32 NumPoints, int32 NumMovedPerFrame, int32 NumQueriesPerFrame)
+{
+	const double KdtreeCost =
+		EstimateSpatialBackendCost(EKdtreeSpatialBackend::Kdtree, NumPoints, NumMovedPerFrame, NumQueriesPerFrame);
+	const double SpatialHashCost =
+		EstimateSpatialBackendCost(EKdtreeSpatialBackend::SpatialHash, NumPoints, NumMovedPerFrame, NumQueriesPerFrame);
+	return SpatialHashCost < KdtreeCost ? EKdtreeSpatialBackend::SpatialHash : EKdtreeSpatialBackend::Kdtree;
+}
+}	 // namespace KdtreeInternal